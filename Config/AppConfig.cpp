@@ -1,6 +1,8 @@
 #include "Config/AppConfig.h"
 #include <QDataStream>
 #include <QFile>
+#include <QSettings>
+#include <QUuid>
 
 AppConfig* AppConfig::s_pSingleton = nullptr;
 
@@ -23,6 +25,18 @@ void AppConfig::Load(const QString& sAppDir)
 {
   m_MusicSources.clear();
 
+  {
+    // stored per user on this computer, a synchronized profile directory or a copied application directory must not share it
+    QSettings s;
+    m_sDeviceId = s.value("DeviceId").toString();
+
+    if (m_sDeviceId.isEmpty())
+    {
+      m_sDeviceId = QString::fromLatin1(QUuid::createUuid().toRfc4122().toHex());
+      s.setValue("DeviceId", m_sDeviceId);
+    }
+  }
+
   m_sProfileDirectory = sAppDir + "/Profile";
   const QString sFile = sAppDir + "/Form1.cfg";
 
@@ -35,7 +49,7 @@ void AppConfig::Load(const QString& sAppDir)
   int version = 0;
   stream >> version;
 
-  if (version != 1 && version != 2)
+  if (version < 1 || version > 3)
     return;
 
   stream >> m_sProfileDirectory;
@@ -54,6 +68,22 @@ void AppConfig::Load(const QString& sAppDir)
   {
     stream >> m_bShowRateSongPopup;
   }
+
+  if (version >= 3)
+  {
+    stream >> m_ImportPipelineConfig.m_iFilterThreads;
+    stream >> m_ImportPipelineConfig.m_iHashThreads;
+    stream >> m_ImportPipelineConfig.m_iTagThreads;
+    stream >> m_ImportPipelineConfig.m_iQueueCapacity;
+    stream >> m_ImportPipelineConfig.m_iSongsPerTransaction;
+
+    // a capacity of 0 would block the pipeline forever, and a stage without threads would never drain its queue
+    m_ImportPipelineConfig.m_iFilterThreads = Max(m_ImportPipelineConfig.m_iFilterThreads, 1);
+    m_ImportPipelineConfig.m_iHashThreads = Max(m_ImportPipelineConfig.m_iHashThreads, 1);
+    m_ImportPipelineConfig.m_iTagThreads = Max(m_ImportPipelineConfig.m_iTagThreads, 1);
+    m_ImportPipelineConfig.m_iQueueCapacity = Max(m_ImportPipelineConfig.m_iQueueCapacity, 1);
+    m_ImportPipelineConfig.m_iSongsPerTransaction = Max(m_ImportPipelineConfig.m_iSongsPerTransaction, 1);
+  }
 }
 
 void AppConfig::Save(const QString& sAppDir)
@@ -66,7 +96,7 @@ void AppConfig::Save(const QString& sAppDir)
 
   QDataStream stream(&file);
 
-  int version = 2;
+  int version = 3;
   stream << version;
 
   stream << m_sProfileDirectory;
@@ -80,6 +110,12 @@ void AppConfig::Save(const QString& sAppDir)
   }
 
   stream << m_bShowRateSongPopup;
+
+  stream << m_ImportPipelineConfig.m_iFilterThreads;
+  stream << m_ImportPipelineConfig.m_iHashThreads;
+  stream << m_ImportPipelineConfig.m_iTagThreads;
+  stream << m_ImportPipelineConfig.m_iQueueCapacity;
+  stream << m_ImportPipelineConfig.m_iSongsPerTransaction;
 }
 
 void AppConfig::RemoveMusicSource(int index)
@@ -3,6 +3,18 @@
 #include "Misc/Common.h"
 #include <QObject.h>
 
+/// \brief Settings for ImportPipeline: how many threads each stage uses and how much work may be queued up between stages.
+struct ImportPipelineConfig
+{
+  int m_iFilterThreads = 1;
+  int m_iHashThreads = 2;
+  int m_iTagThreads = 2;
+  int m_iQueueCapacity = 256;
+
+  /// \brief How many songs the database writer adds per transaction. The UI is refreshed after each transaction.
+  int m_iSongsPerTransaction = 50;
+};
+
 class AppConfig : public QObject
 {
   Q_OBJECT
@@ -24,9 +36,15 @@ public:
   void SetProfileDirectory(const QString& sDirectory);
   const QString& GetProfileDirectory() const { return m_sProfileDirectory; }
 
+  /// \brief A random ID of this computer, which separates its files from those of other computers that share the profile directory.
+  const QString& GetDeviceId() const { return m_sDeviceId; }
+
   void SetShowRateSongPopup(bool show) { m_bShowRateSongPopup = show; }
   bool GetShowRateSongPopup() const { return m_bShowRateSongPopup; }
 
+  void SetImportPipelineConfig(const ImportPipelineConfig& config) { m_ImportPipelineConfig = config; }
+  const ImportPipelineConfig& GetImportPipelineConfig() const { return m_ImportPipelineConfig; }
+
 signals:
   void MusicSourceAdded(const QString& path);
   void MusicSourcesChanged();
@@ -34,8 +52,10 @@ signals:
 
 private:
   QString m_sProfileDirectory;
+  QString m_sDeviceId;
   std::vector<QString> m_MusicSources;
   bool m_bShowRateSongPopup = false;
+  ImportPipelineConfig m_ImportPipelineConfig;
 
   static AppConfig* s_pSingleton;
 };
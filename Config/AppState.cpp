@@ -1,5 +1,7 @@
 #include "Config/AppState.h"
 #include "Config/AppConfig.h"
+#include "Misc/JobScheduler.h"
+#include "Misc/ModificationRecorder.h"
 #include "MusicLibrary/MusicSourceFolder.h"
 #include "Playlists/AllSongs/AllSongsPlaylist.h"
 #include "Playlists/Radio/RadioPlaylist.h"
@@ -10,6 +12,7 @@
 #include <QDir>
 #include <QDirIterator>
 #include <QFile>
+#include <QHash>
 #include <QSettings>
 
 AppState* AppState::s_Singleton = nullptr;
@@ -24,6 +27,9 @@ AppState::AppState()
   connect(SoundDevice::GetSingleton(), &SoundDevice::MediaPositionChanged, this, &AppState::onMediaPositionChanged);
   connect(AppConfig::GetSingleton(), &AppConfig::MusicSourceAdded, this, &AppState::onMusicSourceAdded);
   connect(AppConfig::GetSingleton(), &AppConfig::ProfileDirectoryChanged, this, &AppState::onProfileDirectoryChanged);
+  connect(JobScheduler::GetSingleton(), &JobScheduler::BusyChanged, this, &AppState::BusyWorkActive);
+  connect(this, &AppState::PlayingStateChanged, this, &AppState::onPlayingStateChanged);
+  connect(&m_PlaylistWatchTimer, &QTimer::timeout, this, &AppState::onPlaylistWatchTimer);
 
   m_AllPlaylists.push_back(make_unique<AllSongsPlaylist>());
   m_pActivePlaylist = nullptr;
@@ -43,6 +49,7 @@ void AppState::Startup()
   }
 
   LoadAllPlaylists();
+  StartPlaylistWatch();
   SetActivePlaylist(m_AllPlaylists[0].get());
 
   LoadUserState();
@@ -519,7 +526,10 @@ void AppState::onProfileDirectoryChanged()
     m_AllPlaylists[i]->ClearFilesToDeleteOnSave();
   }
 
+  m_MergedPlaylistFiles.clear();
+
   SaveAllPlaylists(true);
+  StartPlaylistWatch();
 }
 
 Playlist* AppState::GetActivePlaylist() const
@@ -578,25 +588,15 @@ void AppState::AddMusicSource(unique_ptr<MusicSource>&& musicSource)
   m_MusicSources.back()->Startup();
 }
 
-void AppState::BeginBusyWork()
+bool AppState::IsBusyWorkActive() const
 {
-  if (m_BusyWorkCounter++ == 0)
-  {
-    emit BusyWorkActive(true);
-  }
+  return JobScheduler::GetSingleton()->IsBusy();
 }
 
-void AppState::EndBusyWork()
+void AppState::onPlayingStateChanged()
 {
-  if (--m_BusyWorkCounter == 0)
-  {
-    emit BusyWorkActive(false);
-  }
-}
-
-bool AppState::IsBusyWorkActive() const
-{
-  return m_BusyWorkCounter > 0;
+  // imports continue, since new songs should show up right away, but maintenance must not cause stutters during playback
+  JobScheduler::GetSingleton()->SetPaused(m_PlayingState == PlayingState::Playing);
 }
 
 void AppState::SongsHaveBeenImported()
@@ -646,6 +646,21 @@ void AppState::LoadAllPlaylists()
   const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/playlists/";
   QDir().mkpath(sDir);
 
+  std::vector<QString> playlistFiles;
+  FindPlaylistFiles(playlistFiles);
+
+  LoadPlaylistFiles(playlistFiles);
+
+  for (size_t i = 0; i < m_AllPlaylists.size(); ++i)
+  {
+    m_AllPlaylists[i]->Refresh(PlaylistRefreshReason::PlaylistLoaded);
+  }
+}
+
+void AppState::FindPlaylistFiles(std::vector<QString>& out_Files) const
+{
+  const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/playlists/";
+
   QDirIterator dirIt(sDir, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
 
   while (dirIt.hasNext())
@@ -659,33 +674,166 @@ void AppState::LoadAllPlaylists()
 
     const QString sPlaylist = fileInfo.absoluteFilePath();
 
-    //dirIt.filePath();
+    if (!JournalFile::IsPlaylistJournal(sPlaylist))
+      continue;
+
+    out_Files.push_back(sPlaylist);
+  }
+}
+
+std::vector<Playlist*> AppState::LoadPlaylistFiles(const std::vector<QString>& files)
+{
+  struct PlaylistFiles
+  {
+    QString m_sFactory;
+    QString m_sTitle;
+    std::vector<QString> m_Files;
+    std::vector<QDataStream*> m_Journals;
+  };
+
+  // all files stay mapped until every playlist has been loaded
+  std::vector<std::unique_ptr<JournalFile>> journalFiles;
+
+  // there may be multiple files for the same playlist, their journals are decoded in parallel and merged
+  std::vector<QString> playlistGuids;
+  QHash<QString, PlaylistFiles> playlistFiles;
 
-    if (!sPlaylist.endsWith(".f1pl", Qt::CaseInsensitive))
+  for (const QString& sFile : files)
+  {
+    const QFileInfo fileInfo(sFile);
+
+    if (!fileInfo.exists())
       continue;
 
-    LoadPlaylist(sPlaylist);
+    const QString sPlaylist = QDir::cleanPath(fileInfo.absoluteFilePath());
+
+    // the modification time is the high-water mark of every file, a file is only loaded again, if it has been rewritten since
+    auto itMerged = m_MergedPlaylistFiles.find(sPlaylist);
+    if (itMerged != m_MergedPlaylistFiles.end() && itMerged.value() == fileInfo.lastModified())
+      continue;
+
+    std::unique_ptr<JournalFile> pFile = std::make_unique<JournalFile>();
+
+    if (!pFile->Open(sPlaylist))
+      continue;
+
+    m_MergedPlaylistFiles[sPlaylist] = fileInfo.lastModified();
+
+    QDataStream& stream = pFile->GetStream();
+
+    QString sGuid, sFactory, sTitle;
+    stream >> sGuid;
+    stream >> sFactory;
+    stream >> sTitle;
+
+    if (!playlistFiles.contains(sGuid))
+    {
+      playlistGuids.push_back(sGuid);
+      playlistFiles[sGuid].m_sFactory = sFactory;
+      playlistFiles[sGuid].m_sTitle = sTitle;
+    }
+
+    PlaylistFiles& playlist = playlistFiles[sGuid];
+    playlist.m_Files.push_back(sPlaylist);
+    playlist.m_Journals.push_back(&stream);
+
+    journalFiles.push_back(std::move(pFile));
   }
 
-  for (size_t i = 0; i < m_AllPlaylists.size(); ++i)
+  std::vector<Playlist*> loaded;
+
+  for (const QString& sGuid : playlistGuids)
   {
-    m_AllPlaylists[i]->Refresh(PlaylistRefreshReason::PlaylistLoaded);
+    const PlaylistFiles& playlist = playlistFiles[sGuid];
+
+    Playlist* pPlaylist = LoadPlaylist(sGuid, playlist.m_sFactory, playlist.m_sTitle, playlist.m_Files, playlist.m_Journals);
+
+    if (pPlaylist != nullptr)
+    {
+      loaded.push_back(pPlaylist);
+    }
   }
+
+  return loaded;
 }
 
-void AppState::LoadPlaylist(const QString& sPath)
+void AppState::StartPlaylistWatch()
 {
-  QFile file(sPath);
-  if (!file.open(QIODevice::OpenModeFlag::ReadOnly))
-    return;
+  m_PlaylistWatchTimer.stop();
+  m_PlaylistWatcher.CloseDirectory();
+  m_PendingPlaylistFiles.clear();
+
+  const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/playlists/";
+  QDir().mkpath(sDir);
+
+  if (m_PlaylistWatcher.OpenDirectory(sDir, ezDirectoryWatcher::Writes | ezDirectoryWatcher::Creates | ezDirectoryWatcher::Renames | ezDirectoryWatcher::Subdirectories))
+  {
+    m_PlaylistWatchTimer.start(1000);
+  }
+}
+
+void AppState::onPlaylistWatchTimer()
+{
+  const qint64 now = QDateTime::currentMSecsSinceEpoch();
+  const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/playlists/";
+
+  bool bEventsLost = false;
+
+  m_PlaylistWatcher.EnumerateChanges([this, now, &sDir, &bEventsLost](const QString& filename, ezDirectoryWatcherAction action) {
+    if (action == ezDirectoryWatcherAction::EventsLost)
+      bEventsLost = true;
+
+    if (action == ezDirectoryWatcherAction::Removed || action == ezDirectoryWatcherAction::RenamedOldName || action == ezDirectoryWatcherAction::EventsLost)
+      return;
+
+    if (!JournalFile::IsPlaylistJournal(filename))
+      return;
+
+    m_PendingPlaylistFiles[QDir::cleanPath(sDir + QDir::fromNativeSeparators(filename))] = now;
+  });
+
+  if (bEventsLost)
+  {
+    // any file may have changed, those that didn't are skipped by their modification time
+    std::vector<QString> files;
+    FindPlaylistFiles(files);
+
+    for (const QString& sFile : files)
+    {
+      m_PendingPlaylistFiles[QDir::cleanPath(sFile)] = now;
+    }
+  }
 
-  QDataStream stream(&file);
+  // sync clients often write a file in several steps, wait until it settles down
+  const qint64 settleTime = 2000;
 
-  QString sGuid, sFactory, sTitle;
-  stream >> sGuid;
-  stream >> sFactory;
-  stream >> sTitle;
+  std::vector<QString> files;
 
+  for (auto it = m_PendingPlaylistFiles.begin(); it != m_PendingPlaylistFiles.end();)
+  {
+    if (now - it.value() >= settleTime)
+    {
+      files.push_back(it.key());
+      it = m_PendingPlaylistFiles.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  if (files.empty())
+    return;
+
+  // playlists are small, they are merged right away
+  for (Playlist* pPlaylist : LoadPlaylistFiles(files))
+  {
+    pPlaylist->Refresh(PlaylistRefreshReason::PlaylistLoaded);
+  }
+}
+
+Playlist* AppState::LoadPlaylist(const QString& sGuid, const QString& sFactory, const QString& sTitle, const std::vector<QString>& files, const std::vector<QDataStream*>& journals)
+{
   Playlist* pPlaylist = nullptr;
 
   for (size_t i = 0; i < m_AllPlaylists.size(); ++i)
@@ -694,7 +842,7 @@ void AppState::LoadPlaylist(const QString& sPath)
     {
       pPlaylist = m_AllPlaylists[i].get();
 
-      // if there are two or more files for this playlist, mark it as modified, to coalesce all files at shutdown
+      // the playlist has been loaded before, mark it as modified, to coalesce all files at shutdown
       pPlaylist->SetModified();
       break;
     }
@@ -725,12 +873,22 @@ void AppState::LoadPlaylist(const QString& sPath)
     else
     {
       assert(false && "Not implemented");
-      return;
+      return nullptr;
     }
   }
 
-  pPlaylist->Load(stream);
-  pPlaylist->AddFileToDeleteOnSave(sPath);
+  if (files.size() > 1)
+  {
+    // if there are two or more files for this playlist, mark it as modified, to coalesce all files at shutdown
+    pPlaylist->SetModified();
+  }
+
+  pPlaylist->Load(journals);
+
+  for (const QString& sPath : files)
+  {
+    pPlaylist->AddFileToDeleteOnSave(sPath);
+  }
 
   {
     QSettings s;
@@ -745,6 +903,8 @@ void AppState::LoadPlaylist(const QString& sPath)
 
     s.endGroup();
   }
+
+  return pPlaylist;
 }
 
 void AppState::SaveAllPlaylists(bool bForce)
@@ -770,9 +930,16 @@ void AppState::SaveAllPlaylists(bool bForce)
     if (!m_AllPlaylists[i]->CanSerialize())
       continue;
 
-    const QString sPath = sBaseFile + m_AllPlaylists[i]->GetTitle() + ".f1pl";
+    const QString sPath = QDir::cleanPath(sBaseFile + m_AllPlaylists[i]->GetTitle() + JournalFile::GetPlaylistExtension());
 
     m_AllPlaylists[i]->SaveToFile(sPath, bForce);
+
+    // the watcher must not merge the own file back into the playlist
+    const QFileInfo fileInfo(sPath);
+    if (fileInfo.exists())
+    {
+      m_MergedPlaylistFiles[sPath] = fileInfo.lastModified();
+    }
   }
 
   s.endGroup();
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "Misc/Common.h"
+#include "Misc/FileSystemWatcher.h"
 #include "MusicLibrary/MusicLibrary.h"
 #include "MusicLibrary/MusicSource.h"
+#include <QDateTime>
+#include <QHash>
+#include <QTimer>
 
 class AppState : public QObject
 {
@@ -68,8 +72,7 @@ public:
   void AddMusicSource(unique_ptr<MusicSource>&& musicSource);
   const vector<unique_ptr<MusicSource>>& GetAllMusicSources() const { return m_MusicSources; }
 
-  void BeginBusyWork();
-  void EndBusyWork();
+  /// \brief Whether music folders are currently being imported. See JobScheduler::IsBusy().
   bool IsBusyWorkActive() const;
   void SongsHaveBeenImported();
 
@@ -103,10 +106,17 @@ private slots:
   void onMediaError();
   void onMediaPositionChanged();
   void onProfileDirectoryChanged();
+  void onPlaylistWatchTimer();
+  void onPlayingStateChanged();
 
 private:
   void ShutdownMusicSources();
-  void LoadPlaylist(const QString& sPath);
+  /// \brief Appends all playlist files in the profile directory.
+  void FindPlaylistFiles(std::vector<QString>& out_Files) const;
+  /// \brief Loads the given playlist files, or merges them into the playlists that exist already. Files that have been loaded before and didn't change since are skipped.
+  std::vector<Playlist*> LoadPlaylistFiles(const std::vector<QString>& files);
+  void StartPlaylistWatch();
+  Playlist* LoadPlaylist(const QString& sGuid, const QString& sFactory, const QString& sTitle, const std::vector<QString>& files, const std::vector<QDataStream*>& journals);
   void SetFinalVolume();
 
   static AppState* s_Singleton;
@@ -124,5 +134,10 @@ private:
   vector<QString> m_SongHistory;
 
   SongInfo m_ActiveSong;
-  QAtomicInt m_BusyWorkCounter;
+
+  // playlist files from other computers are picked up by the watcher and merged into the playlists
+  QHash<QString, QDateTime> m_MergedPlaylistFiles; // path -> modification time when it was loaded
+  ezDirectoryWatcher m_PlaylistWatcher;
+  QTimer m_PlaylistWatchTimer;
+  QHash<QString, qint64> m_PendingPlaylistFiles; // path -> time of the last change
 };
@@ -77,12 +77,13 @@ void SettingsDlg::FillMusicFoldersList()
   const auto& sources = AppConfig::GetSingleton()->GetAllMusicSources();
 
   MusicDirsList->clear();
-  MusicDirsList->setColumnCount(2);
+  MusicDirsList->setColumnCount(3);
   MusicDirsList->setRowCount((int)sources.size());
   MusicDirsList->horizontalHeader()->hide();
   MusicDirsList->verticalHeader()->hide();
   MusicDirsList->horizontalHeader()->setSectionResizeMode(0, QHeaderView::ResizeMode::Stretch);
   MusicDirsList->horizontalHeader()->setSectionResizeMode(1, QHeaderView::ResizeMode::ResizeToContents);
+  MusicDirsList->horizontalHeader()->setSectionResizeMode(2, QHeaderView::ResizeMode::ResizeToContents);
 
   for (int row = 0; row < (int)sources.size(); ++row)
   {
@@ -93,8 +94,15 @@ void SettingsDlg::FillMusicFoldersList()
 
     pButton->setProperty("dir", source);
 
+    QPushButton* pVerifyButton = new QPushButton("Verify", MusicDirsList);
+    pVerifyButton->setToolTip("Checks every file in this folder for changes, instead of only the files in modified directories.");
+    connect(pVerifyButton, &QPushButton::clicked, this, &SettingsDlg::onVerifyDirClicked);
+
+    pVerifyButton->setProperty("dir", source);
+
     MusicDirsList->setItem(row, 0, new QTableWidgetItem(source));
     MusicDirsList->setCellWidget(row, 1, pButton);
+    MusicDirsList->setCellWidget(row, 2, pVerifyButton);
   }
 }
 
@@ -109,3 +117,13 @@ void SettingsDlg::onSortDirClicked()
     ptr->Sort(sDir);
   }
 }
+
+void SettingsDlg::onVerifyDirClicked()
+{
+  QString sDir = sender()->property("dir").toString();
+
+  for (const unique_ptr<MusicSource>& ptr : AppState::GetSingleton()->GetAllMusicSources())
+  {
+    ptr->Verify(sDir);
+  }
+}
@@ -18,6 +18,7 @@ private slots:
   void on_AddMusicDirButton_clicked();
   void on_MusicDirsList_itemSelectionChanged();
   void onSortDirClicked();
+  void onVerifyDirClicked();
 
 private:
   void FillMusicFoldersList();
@@ -801,12 +801,16 @@ void Form1::onRateSongs()
   else if (title == "1 Star")
     iRating = 1;
 
+  MusicLibrary::GetSingleton()->BeginTransaction();
+
   for (auto idx : selection)
   {
     QString sGuid = m_pSelectedPlaylist->GetSongGuid(idx.row());
 
     MusicLibrary::GetSingleton()->UpdateSongRating(sGuid, iRating, true);
   }
+
+  MusicLibrary::GetSingleton()->EndTransaction();
 }
 
 void Form1::onRateSong(QString guid, int rating, bool skipAfterRating)
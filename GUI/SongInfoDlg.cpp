@@ -215,6 +215,9 @@ void SongInfoDlg::on_ButtonBox_clicked(QAbstractButton* button)
       }
     }
 
+    // all songs are updated in one go and reported as one change
+    MusicLibrary::GetSingleton()->BeginTransaction();
+
     for (const QString& guid : m_SelectedSongs)
     {
       if ((partMask & SongInfo::Part::Title) != 0)
@@ -248,6 +251,8 @@ void SongInfoDlg::on_ButtonBox_clicked(QAbstractButton* button)
         MusicLibrary::GetSingleton()->UpdateSongEndOffset(guid, si.m_iEndOffset, true);
     }
 
+    MusicLibrary::GetSingleton()->EndTransaction();
+
     accept();
     return;
   }
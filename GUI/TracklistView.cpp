@@ -1,5 +1,6 @@
 #include "TrackListView.h"
 #include "MusicLibrary/MusicLibrary.h"
+#include "Playlists/Playlist.h"
 #include <QDrag>
 #include <QKeyEvent>
 #include <QMouseEvent>
@@ -37,6 +38,22 @@ void TrackListView::keyPressEvent(QKeyEvent* e)
   QTreeView::keyPressEvent(e);
 }
 
+void TrackListView::paintEvent(QPaintEvent* e)
+{
+  Playlist* pPlaylist = qobject_cast<Playlist*>(model());
+  const QModelIndex firstVisible = indexAt(QPoint(0, 0));
+
+  if (pPlaylist != nullptr && firstVisible.isValid())
+  {
+    const int iRowHeight = Max(rowHeight(firstVisible), 1);
+    const int iNumVisibleRows = viewport()->height() / iRowHeight + 1;
+
+    pPlaylist->PrefetchRows(firstVisible.row(), firstVisible.row() + iNumVisibleRows);
+  }
+
+  QTreeView::paintEvent(e);
+}
+
 void TrackListView::startDrag(Qt::DropActions supportedActions)
 {
   //Q_D(QAbstractItemView);
@@ -20,6 +20,9 @@ protected:
 
   virtual void startDrag(Qt::DropActions supportedActions) override;
 
+  /// \brief Lets the playlist fetch all visible rows at once, before the cells are painted one by one.
+  virtual void paintEvent(QPaintEvent* e) override;
+
 };
 
 class RatingItemDelegate : public QItemDelegate
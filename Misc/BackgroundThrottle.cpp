@@ -0,0 +1,58 @@
+#include "Misc/BackgroundThrottle.h"
+#include <chrono>
+#include <thread>
+
+#ifdef _WIN32
+#  include <windows.h>
+#endif
+
+BackgroundThrottle::BackgroundThrottle(int iSliceMS)
+    : m_iSliceMS(iSliceMS)
+{
+  GetSystemCpuLoad();
+  m_SliceTimer.start();
+}
+
+void BackgroundThrottle::Step()
+{
+  const qint64 elapsed = m_SliceTimer.elapsed();
+
+  if (elapsed < m_iSliceMS)
+    return;
+
+  const int load = GetSystemCpuLoad();
+
+  // pause for 10% of the slice on an idle system, up to 400% when the system is fully loaded
+  const qint64 pause = elapsed * (10 + (load * load * 390) / (100 * 100)) / 100;
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(pause));
+
+  m_SliceTimer.restart();
+}
+
+int BackgroundThrottle::GetSystemCpuLoad()
+{
+#ifdef _WIN32
+  FILETIME idleTime, kernelTime, userTime;
+  if (!GetSystemTimes(&idleTime, &kernelTime, &userTime))
+    return 0;
+
+  auto toUInt64 = [](const FILETIME& ft) -> quint64 { return ((quint64)ft.dwHighDateTime << 32) | ft.dwLowDateTime; };
+
+  const quint64 idle = toUInt64(idleTime);
+  const quint64 total = toUInt64(kernelTime) + toUInt64(userTime); // kernel time includes the idle time
+
+  const quint64 idleDiff = idle - m_uiLastIdleTime;
+  const quint64 totalDiff = total - m_uiLastTotalTime;
+
+  m_uiLastIdleTime = idle;
+  m_uiLastTotalTime = total;
+
+  if (totalDiff == 0)
+    return 0;
+
+  return (int)(100 - (idleDiff * 100) / totalDiff);
+#else
+  return 0;
+#endif
+}
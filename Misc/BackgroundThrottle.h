@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QElapsedTimer>
+
+/// \brief Slows down background work, so that it doesn't compete with the UI and with playback.
+///
+/// Call Step() after every unit of work. The work runs in slices of a few milliseconds,
+/// and after every slice the throttle pauses for a fraction of the time that the slice took.
+/// The fraction depends on the CPU usage of the whole system: on an idle machine the pause is short,
+/// on a busy machine it is up to four times as long as the slice.
+/// Since the slice is measured in wall clock time, time spent waiting for the disk counts as work as well,
+/// so slow I/O (e.g. a network drive) is throttled just like heavy computations.
+class BackgroundThrottle
+{
+public:
+  explicit BackgroundThrottle(int iSliceMS = 20);
+
+  void Step();
+
+private:
+  /// \brief Returns the CPU usage of the whole system since the previous call, in percent.
+  int GetSystemCpuLoad();
+
+  int m_iSliceMS;
+  QElapsedTimer m_SliceTimer;
+
+  quint64 m_uiLastIdleTime = 0;
+  quint64 m_uiLastTotalTime = 0;
+};
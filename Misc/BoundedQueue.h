@@ -0,0 +1,69 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/// \brief A thread-safe FIFO queue with a fixed capacity, to pass work between producer and consumer threads.
+///
+/// Push() blocks while the queue is full, Pop() blocks while it is empty.
+/// Once the producers are done, they call Close(). Consumers then receive the remaining items,
+/// after which Pop() returns false.
+template <typename T>
+class BoundedQueue
+{
+public:
+  explicit BoundedQueue(size_t capacity = 256)
+      : m_Capacity(capacity)
+  {
+  }
+
+  /// \brief Adds an item, waits for free space if necessary. Returns false (and drops the item), if the queue has been closed.
+  bool Push(T&& item)
+  {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+
+    m_NotFull.wait(lock, [this]() { return m_bClosed || m_Items.size() < m_Capacity; });
+
+    if (m_bClosed)
+      return false;
+
+    m_Items.push_back(std::move(item));
+    m_NotEmpty.notify_one();
+    return true;
+  }
+
+  /// \brief Takes the oldest item, waits for one if necessary. Returns false, once the queue is closed and empty.
+  bool Pop(T& out_Item)
+  {
+    std::unique_lock<std::mutex> lock(m_Mutex);
+
+    m_NotEmpty.wait(lock, [this]() { return m_bClosed || !m_Items.empty(); });
+
+    if (m_Items.empty())
+      return false;
+
+    out_Item = std::move(m_Items.front());
+    m_Items.pop_front();
+    m_NotFull.notify_one();
+    return true;
+  }
+
+  /// \brief Signals that no more items will be pushed. Wakes up all waiting threads.
+  void Close()
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    m_bClosed = true;
+    m_NotEmpty.notify_all();
+    m_NotFull.notify_all();
+  }
+
+private:
+  size_t m_Capacity;
+  bool m_bClosed = false;
+  std::deque<T> m_Items;
+  std::mutex m_Mutex;
+  std::condition_variable m_NotEmpty;
+  std::condition_variable m_NotFull;
+};
@@ -1,5 +1,7 @@
 #include "FileSystemWatcher.h"
 
+#ifdef _WIN32
+
 #include <windows.h>
 #include <vector>
 
@@ -95,7 +97,9 @@ void ezDirectoryWatcher::EnumerateChanges(std::function<void(const QString& file
   {
     if (numberOfBytes <= 0)
     {
+      // the buffer overflowed, the changes in it are lost
       m_pImpl->DoRead();
+      func(QString(), ezDirectoryWatcherAction::EventsLost);
       continue;
     }
     //Copy the buffer
@@ -145,3 +149,237 @@ void ezDirectoryWatcher::EnumerateChanges(std::function<void(const QString& file
     }
   }
 }
+
+#else
+
+#include <QDir>
+#include <QHash>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <vector>
+
+using ezDirectoryWatcherChanges = std::vector<std::pair<QString, ezDirectoryWatcherAction>>;
+
+struct ezDirectoryWatcherImpl
+{
+  void AddWatch(const QString& relativePath, ezDirectoryWatcherChanges* pReportContent);
+  void RemoveWatches(const QString& relativePath);
+
+  int m_inotifyFd = -1;
+  bool m_watchSubdirs = false;
+  uint32_t m_watchMask = 0;  // what inotify reports
+  uint32_t m_reportMask = 0; // what the user asked for
+  QString m_sRoot;
+  QHash<int, QString> m_watchToPath; // watch descriptor -> directory path relative to the root
+  std::vector<uint8_t> m_buffer;
+};
+
+ezDirectoryWatcher::ezDirectoryWatcher()
+    : m_pImpl(new ezDirectoryWatcherImpl)
+{
+  m_pImpl->m_buffer.resize(64 * 1024);
+}
+
+bool ezDirectoryWatcher::OpenDirectory(const QString& absolutePath, uint32_t whatToWatch)
+{
+  CloseDirectory();
+
+  m_pImpl->m_watchSubdirs = (whatToWatch & Watch::Subdirectories) != 0;
+  m_pImpl->m_reportMask = 0;
+  if ((whatToWatch & Watch::Reads) != 0)
+    m_pImpl->m_reportMask |= IN_ACCESS;
+  if ((whatToWatch & Watch::Writes) != 0)
+    m_pImpl->m_reportMask |= IN_CLOSE_WRITE; // only once per write session, instead of IN_MODIFY for every single write
+  if ((whatToWatch & Watch::Creates) != 0)
+    m_pImpl->m_reportMask |= IN_CREATE;
+  if ((whatToWatch & Watch::Renames) != 0)
+    m_pImpl->m_reportMask |= IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE;
+
+  m_pImpl->m_watchMask = m_pImpl->m_reportMask | IN_ONLYDIR;
+
+  // new subdirectories need to be watched as well, and those that are moved away not anymore
+  if (m_pImpl->m_watchSubdirs)
+    m_pImpl->m_watchMask |= IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM;
+
+  m_pImpl->m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_pImpl->m_inotifyFd < 0)
+  {
+    return false;
+  }
+
+  m_pImpl->m_sRoot = QDir::cleanPath(absolutePath);
+  m_pImpl->AddWatch(QString(), nullptr);
+
+  if (m_pImpl->m_watchToPath.isEmpty())
+  {
+    CloseDirectory();
+    return false;
+  }
+
+  m_sDirectoryPath = absolutePath;
+
+  return true;
+}
+
+void ezDirectoryWatcher::CloseDirectory()
+{
+  if (m_pImpl->m_inotifyFd >= 0)
+  {
+    // closing the descriptor also removes all watches
+    close(m_pImpl->m_inotifyFd);
+    m_pImpl->m_inotifyFd = -1;
+  }
+
+  m_pImpl->m_watchToPath.clear();
+  m_sDirectoryPath.clear();
+}
+
+ezDirectoryWatcher::~ezDirectoryWatcher()
+{
+  CloseDirectory();
+  delete m_pImpl;
+}
+
+void ezDirectoryWatcherImpl::AddWatch(const QString& relativePath, ezDirectoryWatcherChanges* pReportContent)
+{
+  // inotify is not recursive, every directory needs its own watch
+  const QString absolutePath = relativePath.isEmpty() ? m_sRoot : m_sRoot + "/" + relativePath;
+
+  const int wd = inotify_add_watch(m_inotifyFd, QFile::encodeName(absolutePath).constData(), m_watchMask);
+  if (wd < 0)
+    return;
+
+  m_watchToPath[wd] = relativePath;
+
+  if (!m_watchSubdirs && pReportContent == nullptr)
+    return;
+
+  const QFileInfoList entries = QDir(absolutePath).entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+
+  for (const QFileInfo& entry : entries)
+  {
+    const QString entryPath = relativePath.isEmpty() ? entry.fileName() : relativePath + "/" + entry.fileName();
+
+    if (pReportContent != nullptr)
+    {
+      pReportContent->push_back({entryPath, ezDirectoryWatcherAction::Added});
+    }
+
+    if (m_watchSubdirs && entry.isDir() && !entry.isSymLink())
+    {
+      AddWatch(entryPath, pReportContent);
+    }
+  }
+}
+
+void ezDirectoryWatcherImpl::RemoveWatches(const QString& relativePath)
+{
+  const QString prefix = relativePath + "/";
+
+  for (auto it = m_watchToPath.begin(); it != m_watchToPath.end();)
+  {
+    if (it.value() == relativePath || it.value().startsWith(prefix))
+    {
+      inotify_rm_watch(m_inotifyFd, it.key());
+      it = m_watchToPath.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+void ezDirectoryWatcher::EnumerateChanges(std::function<void(const QString& filename, ezDirectoryWatcherAction action)> func)
+{
+  if (m_pImpl->m_inotifyFd < 0)
+    return;
+
+  ezDirectoryWatcherChanges changes;
+
+  // directories that were moved away, by the cookie that connects IN_MOVED_FROM with IN_MOVED_TO
+  QHash<uint32_t, QString> movedDirs;
+
+  while (true)
+  {
+    const ssize_t numBytes = read(m_pImpl->m_inotifyFd, m_pImpl->m_buffer.data(), m_pImpl->m_buffer.size());
+
+    // EAGAIN: no more events queued up
+    if (numBytes <= 0)
+      break;
+
+    for (ssize_t offset = 0; offset < numBytes;)
+    {
+      const inotify_event* info = (const inotify_event*)(m_pImpl->m_buffer.data() + offset);
+      offset += sizeof(inotify_event) + info->len;
+
+      if ((info->mask & IN_IGNORED) != 0)
+      {
+        // the watched directory was deleted or moved away
+        m_pImpl->m_watchToPath.remove(info->wd);
+        continue;
+      }
+
+      if ((info->mask & IN_Q_OVERFLOW) != 0)
+      {
+        changes.push_back({QString(), ezDirectoryWatcherAction::EventsLost});
+        continue;
+      }
+
+      if (info->len == 0 || !m_pImpl->m_watchToPath.contains(info->wd))
+        continue;
+
+      const QString& dirPath = m_pImpl->m_watchToPath[info->wd];
+      const QString name = QFile::decodeName(info->name);
+      const QString filename = dirPath.isEmpty() ? name : dirPath + "/" + name;
+
+      ezDirectoryWatcherAction action = ezDirectoryWatcherAction::None;
+
+      if ((info->mask & IN_CREATE) != 0)
+        action = ezDirectoryWatcherAction::Added;
+      else if ((info->mask & IN_DELETE) != 0)
+        action = ezDirectoryWatcherAction::Removed;
+      else if ((info->mask & (IN_CLOSE_WRITE | IN_ACCESS)) != 0)
+        action = ezDirectoryWatcherAction::Modified;
+      else if ((info->mask & IN_MOVED_FROM) != 0)
+        action = ezDirectoryWatcherAction::RenamedOldName;
+      else if ((info->mask & IN_MOVED_TO) != 0)
+        action = ezDirectoryWatcherAction::RenamedNewName;
+
+      // some events are only watched to keep track of new subdirectories
+      const bool bReport = (info->mask & m_pImpl->m_reportMask) != 0;
+
+      // coalesce repeated events for the same file
+      if (bReport && (changes.empty() || changes.back().first != filename || changes.back().second != action))
+      {
+        changes.push_back({filename, action});
+      }
+
+      if ((info->mask & IN_ISDIR) != 0 && m_pImpl->m_watchSubdirs && (action == ezDirectoryWatcherAction::Added || action == ezDirectoryWatcherAction::RenamedNewName))
+      {
+        // a new directory may already have content by the time the watch is added
+        // for a directory that was moved within the tree, this only updates the paths of the existing watches
+        m_pImpl->AddWatch(filename, (action == ezDirectoryWatcherAction::Added && bReport) ? &changes : nullptr);
+        movedDirs.remove(info->cookie);
+      }
+
+      if ((info->mask & IN_ISDIR) != 0 && m_pImpl->m_watchSubdirs && action == ezDirectoryWatcherAction::RenamedOldName)
+      {
+        movedDirs[info->cookie] = filename;
+      }
+    }
+  }
+
+  // the watches follow a directory that was moved out of the tree, which would report its changes under the old path
+  for (auto it = movedDirs.begin(); it != movedDirs.end(); ++it)
+  {
+    m_pImpl->RemoveWatches(it.value());
+  }
+
+  for (const auto& change : changes)
+  {
+    func(change.first, change.second);
+  }
+}
+
+#endif
@@ -15,6 +15,7 @@ enum class ezDirectoryWatcherAction
   Modified,
   RenamedOldName,
   RenamedNewName,
+  EventsLost, ///< Too many changes at once, some were dropped by the OS. The filename is empty, the whole directory has to be scanned again.
 };
 
 /// \brief
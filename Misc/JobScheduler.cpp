@@ -0,0 +1,302 @@
+#include "Misc/JobScheduler.h"
+#include <QStorageInfo>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include <stdio.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+#endif
+
+JobScheduler* JobScheduler::s_Singleton = nullptr;
+
+Job::Job(JobScheduler* pScheduler, const QString& sName, JobPriority priority, const QString& sDevice, std::function<void(Job&)> func)
+    : m_pScheduler(pScheduler)
+    , m_sName(sName)
+    , m_Priority(priority)
+    , m_sDevice(sDevice)
+    , m_Func(std::move(func))
+    , m_bCanceled(false)
+    , m_bFinished(false)
+    , m_iProgressDone(0)
+    , m_iProgressTotal(0)
+    , m_iProcessedItems(0)
+    , m_iProcessedBytes(0)
+{
+}
+
+void Job::Cancel()
+{
+  m_bCanceled = true;
+
+  // jobs that did not start yet are simply dropped
+  m_pScheduler->Remove(this);
+}
+
+void Job::Wait()
+{
+  std::unique_lock<std::mutex> lock(m_pScheduler->m_Mutex);
+  m_pScheduler->m_StateChanged.wait(lock, [this]() { return m_bFinished.load(); });
+}
+
+bool Job::Checkpoint()
+{
+  std::unique_lock<std::mutex> lock(m_pScheduler->m_Mutex);
+
+  if (!m_bCanceled && m_pScheduler->IsBlocked(*this))
+  {
+    m_bWaiting = true;
+
+    // a waiting job doesn't use its device, so a job with a higher priority may take its place
+    m_pScheduler->StartJobs();
+
+    m_pScheduler->m_StateChanged.wait(lock, [this]() { return m_bCanceled || !m_pScheduler->IsBlocked(*this); });
+
+    m_bWaiting = false;
+  }
+
+  return !m_bCanceled;
+}
+
+void Job::SetProgress(qint64 done, qint64 total)
+{
+  m_iProgressDone = done;
+  m_iProgressTotal = total;
+}
+
+void Job::AddProcessed(qint64 items, qint64 bytes)
+{
+  m_iProcessedItems += items;
+  m_iProcessedBytes += bytes;
+}
+
+JobScheduler::JobScheduler()
+{
+  s_Singleton = this;
+
+  // most jobs wait for the disk, not for the CPU, and are limited per device anyway
+  m_ThreadPool.setMaxThreadCount(16);
+}
+
+JobScheduler::~JobScheduler()
+{
+  Shutdown();
+
+  s_Singleton = nullptr;
+}
+
+std::shared_ptr<Job> JobScheduler::Schedule(const QString& sName, JobPriority priority, const QString& sDevice, std::function<void(Job&)> func)
+{
+  std::shared_ptr<Job> pJob = std::make_shared<Job>(this, sName, priority, sDevice, std::move(func));
+
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    m_QueuedJobs.push_back(pJob);
+
+    // running jobs with a lower priority may have to halt now
+    m_StateChanged.notify_all();
+    StartJobs();
+  }
+
+  UpdateBusyState();
+  return pJob;
+}
+
+void JobScheduler::Shutdown()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    for (const auto& pJob : m_QueuedJobs)
+    {
+      pJob->m_bCanceled = true;
+      pJob->m_bFinished = true;
+    }
+
+    for (const auto& pJob : m_RunningJobs)
+    {
+      pJob->m_bCanceled = true;
+    }
+
+    m_QueuedJobs.clear();
+    m_StateChanged.notify_all();
+  }
+
+  m_ThreadPool.waitForDone();
+
+  UpdateBusyState();
+}
+
+void JobScheduler::SetPaused(bool bPaused)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  if (m_bPaused == bPaused)
+    return;
+
+  m_bPaused = bPaused;
+
+  m_StateChanged.notify_all();
+  StartJobs();
+}
+
+bool JobScheduler::IsBusy() const
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+  return m_bBusy;
+}
+
+void JobScheduler::SetMaxJobsPerDevice(int iMaxJobs)
+{
+  std::lock_guard<std::mutex> lock(m_Mutex);
+
+  m_iMaxJobsPerDevice = Max(iMaxJobs, 1);
+  StartJobs();
+}
+
+QString JobScheduler::GetDeviceOfPath(const QString& sPath)
+{
+  return QStorageInfo(sPath).rootPath();
+}
+
+bool JobScheduler::IsBlocked(const Job& job) const
+{
+  if (m_bPaused && job.m_Priority < JobPriority::Import)
+    return true;
+
+  auto isHigher = [&job](const std::shared_ptr<Job>& pOther) { return pOther->m_Priority > job.m_Priority; };
+
+  return std::any_of(m_QueuedJobs.begin(), m_QueuedJobs.end(), isHigher) || std::any_of(m_RunningJobs.begin(), m_RunningJobs.end(), isHigher);
+}
+
+bool JobScheduler::CanStart(const Job& job) const
+{
+  if (IsBlocked(job))
+    return false;
+
+  int iJobsOnDevice = 0;
+
+  for (const auto& pRunning : m_RunningJobs)
+  {
+    if (pRunning->m_bWaiting)
+      continue;
+
+    // jobs of different priorities never run at the same time, a job with a lower priority has to reach its next checkpoint first
+    if (pRunning->m_Priority < job.m_Priority)
+      return false;
+
+    if (pRunning->m_sDevice == job.m_sDevice)
+    {
+      ++iJobsOnDevice;
+    }
+  }
+
+  return job.m_sDevice.isEmpty() || iJobsOnDevice < m_iMaxJobsPerDevice;
+}
+
+void JobScheduler::StartJobs()
+{
+  // the mutex is locked by the caller
+
+  // higher priorities first, otherwise first come, first served
+  std::stable_sort(m_QueuedJobs.begin(), m_QueuedJobs.end(), [](const std::shared_ptr<Job>& lhs, const std::shared_ptr<Job>& rhs) { return lhs->m_Priority > rhs->m_Priority; });
+
+  for (auto it = m_QueuedJobs.begin(); it != m_QueuedJobs.end();)
+  {
+    std::shared_ptr<Job> pJob = *it;
+
+    // the job itself doesn't block its own start
+    it = m_QueuedJobs.erase(it);
+
+    if (!CanStart(*pJob))
+    {
+      it = m_QueuedJobs.insert(it, pJob);
+      ++it;
+      continue;
+    }
+
+    m_RunningJobs.push_back(pJob);
+    pJob->m_Timer.start();
+
+    QtConcurrent::run(&m_ThreadPool, this, &JobScheduler::RunJob, pJob);
+  }
+}
+
+void JobScheduler::RunJob(std::shared_ptr<Job> pJob)
+{
+  pJob->m_Func(*pJob);
+
+  ReportJob(*pJob);
+
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    m_RunningJobs.erase(std::find(m_RunningJobs.begin(), m_RunningJobs.end(), pJob));
+    pJob->m_bFinished = true;
+
+    // jobs with a lower priority may continue now
+    m_StateChanged.notify_all();
+    StartJobs();
+  }
+
+  UpdateBusyState();
+}
+
+void JobScheduler::Remove(Job* pJob)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto it = std::find_if(m_QueuedJobs.begin(), m_QueuedJobs.end(), [pJob](const std::shared_ptr<Job>& pQueued) { return pQueued.get() == pJob; });
+
+    if (it != m_QueuedJobs.end())
+    {
+      m_QueuedJobs.erase(it);
+      pJob->m_bFinished = true;
+    }
+
+    // wakes up the job, if it is waiting in Checkpoint(), and the jobs that it may have blocked
+    m_StateChanged.notify_all();
+    StartJobs();
+  }
+
+  UpdateBusyState();
+}
+
+void JobScheduler::UpdateBusyState()
+{
+  // keeps the notifications from different threads in order, recursive because receivers may schedule jobs
+  std::lock_guard<std::recursive_mutex> busyLock(m_BusyMutex);
+
+  bool bBusy = false;
+
+  {
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    auto isImport = [](const std::shared_ptr<Job>& pJob) { return pJob->m_Priority == JobPriority::Import; };
+    bBusy = std::any_of(m_QueuedJobs.begin(), m_QueuedJobs.end(), isImport) || std::any_of(m_RunningJobs.begin(), m_RunningJobs.end(), isImport);
+
+    if (m_bBusy == bBusy)
+      return;
+
+    m_bBusy = bBusy;
+  }
+
+  emit BusyChanged(bBusy);
+}
+
+void JobScheduler::ReportJob(const Job& job) const
+{
+  const double seconds = Max((int)job.m_Timer.elapsed(), 1) / 1000.0;
+  const double megaBytes = job.m_iProcessedBytes / (1024.0 * 1024.0);
+
+  char msg[512];
+  snprintf(msg, 512, "Job '%s' %s after %.1f seconds: %i items (%.1f/sec), %.1f MB (%.1f MB/sec)\n", job.m_sName.toUtf8().data(), job.m_bCanceled ? "canceled" : "finished", seconds, (int)job.m_iProcessedItems, job.m_iProcessedItems / seconds, megaBytes, megaBytes / seconds);
+
+#ifdef _WIN32
+  OutputDebugStringA(msg);
+#else
+  fputs(msg, stderr);
+#endif
+}
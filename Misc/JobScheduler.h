@@ -0,0 +1,142 @@
+#pragma once
+
+#include "Misc/Common.h"
+#include <QElapsedTimer>
+#include <QObject>
+#include <QThreadPool>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+class JobScheduler;
+
+/// \brief Decides which background job runs first. Jobs with a lower priority wait while any job with a higher priority is scheduled.
+enum class JobPriority
+{
+  JournalRestore, ///< writing database state back into the journal
+  Cleanup,        ///< removing stale database entries and similar maintenance
+  Import,         ///< scanning music folders, the user waits for the result of these
+  JournalMerge,   ///< loading and applying the library journal, also files that arrived from other computers; never paused and doesn't count as busy work
+};
+
+/// \brief A unit of background work, executed by the JobScheduler.
+///
+/// The job function receives the Job object, to check for cancellation and to report progress.
+/// It should call Checkpoint() regularly between units of work, outside of any locks and database transactions.
+class Job
+{
+public:
+  Job(JobScheduler* pScheduler, const QString& sName, JobPriority priority, const QString& sDevice, std::function<void(Job&)> func);
+
+  const QString& GetName() const { return m_sName; }
+  JobPriority GetPriority() const { return m_Priority; }
+  const QString& GetDevice() const { return m_sDevice; }
+
+  /// \brief Asks the job to stop. Jobs that did not start yet are removed from the queue.
+  void Cancel();
+  bool IsCanceled() const { return m_bCanceled; }
+
+  bool IsFinished() const { return m_bFinished; }
+
+  /// \brief Blocks until the job has finished or, if it got canceled before it started, has been removed from the queue.
+  void Wait();
+
+  /// \brief Blocks while the job is paused or preempted by jobs with a higher priority. Returns false, if the job has been canceled.
+  bool Checkpoint();
+
+  /// \brief Reports how much of the job is done. \a total may be 0, if it is unknown.
+  void SetProgress(qint64 done, qint64 total);
+  qint64 GetProgressDone() const { return m_iProgressDone; }
+  qint64 GetProgressTotal() const { return m_iProgressTotal; }
+
+  /// \brief Adds to the number of processed items and bytes, from which the throughput is computed.
+  void AddProcessed(qint64 items, qint64 bytes);
+
+private:
+  friend class JobScheduler;
+
+  JobScheduler* m_pScheduler;
+  QString m_sName;
+  JobPriority m_Priority;
+  QString m_sDevice;
+  std::function<void(Job&)> m_Func;
+
+  std::atomic<bool> m_bCanceled;
+  std::atomic<bool> m_bFinished;
+  bool m_bWaiting = false; // inside Checkpoint(), protected by the scheduler mutex
+
+  std::atomic<qint64> m_iProgressDone;
+  std::atomic<qint64> m_iProgressTotal;
+  std::atomic<qint64> m_iProcessedItems;
+  std::atomic<qint64> m_iProcessedBytes;
+  QElapsedTimer m_Timer;
+};
+
+/// \brief Runs all background work of the application.
+///
+/// - Jobs with a higher JobPriority run first. Jobs with a lower priority don't start and are halted in Job::Checkpoint()
+///   while a job with a higher priority is queued or running. Jobs of different priorities never run at the same time,
+///   so a job with a higher priority only starts once the running jobs have reached a checkpoint.
+/// - Jobs below JobPriority::Import are paused while music is playing.
+/// - Jobs that access the same device (e.g. the same hard drive) are limited to a fixed number at a time,
+///   because parallel reads from one disk only slow each other down.
+/// - The throughput of each job is written to the debug output when it finishes.
+class JobScheduler : public QObject
+{
+  Q_OBJECT
+
+public:
+  JobScheduler();
+  ~JobScheduler();
+
+  static JobScheduler* GetSingleton() { return s_Singleton; }
+
+  /// \brief Queues a job. \a sDevice identifies the device that the job mostly reads from, see GetDeviceOfPath(). It may be empty.
+  std::shared_ptr<Job> Schedule(const QString& sName, JobPriority priority, const QString& sDevice, std::function<void(Job&)> func);
+
+  /// \brief Cancels all jobs and waits for them to finish.
+  void Shutdown();
+
+  /// \brief Pauses all jobs below JobPriority::Import, e.g. while music is playing.
+  void SetPaused(bool bPaused);
+
+  /// \brief Whether any job with JobPriority::Import is queued or running.
+  bool IsBusy() const;
+
+  /// \brief Returns the number of jobs that may access the same device at the same time.
+  int GetMaxJobsPerDevice() const { return m_iMaxJobsPerDevice; }
+  void SetMaxJobsPerDevice(int iMaxJobs);
+
+  /// \brief Returns an identifier for the device (drive, network share) that the given path is on.
+  static QString GetDeviceOfPath(const QString& sPath);
+
+signals:
+  /// \brief Emitted whenever IsBusy() changes.
+  void BusyChanged(bool bBusy);
+
+private:
+  friend class Job;
+
+  bool IsBlocked(const Job& job) const;
+  bool CanStart(const Job& job) const;
+  void StartJobs();
+  void RunJob(std::shared_ptr<Job> pJob);
+  void Remove(Job* pJob);
+  void UpdateBusyState();
+  void ReportJob(const Job& job) const;
+
+  static JobScheduler* s_Singleton;
+
+  mutable std::mutex m_Mutex;
+  std::condition_variable m_StateChanged;
+  std::deque<std::shared_ptr<Job>> m_QueuedJobs;
+  std::vector<std::shared_ptr<Job>> m_RunningJobs;
+  bool m_bPaused = false;
+  bool m_bBusy = false;
+  std::recursive_mutex m_BusyMutex;
+  int m_iMaxJobsPerDevice = 1;
+
+  QThreadPool m_ThreadPool;
+};
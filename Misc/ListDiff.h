@@ -0,0 +1,199 @@
+#pragma once
+
+#include <QHash>
+#include <algorithm>
+#include <vector>
+
+/// \brief Finds the longest sequence of items that two lists have in common, in the same order (patience diff).
+///
+/// Everything in the old list that is not part of that sequence has been removed (or moved), everything in the new list
+/// that is not part of it has been inserted (or moved). LIST is a random access container (std::vector, std::deque),
+/// its items are compared by value and need operator== and qHash().
+///
+/// Common prefixes and suffixes are stripped first. In between, items that occur exactly once in both lists serve as anchors,
+/// the longest increasing sequence of anchors is kept and the ranges between them are diffed recursively.
+/// Only ranges without any unique items fall back to the quadratic LCS, and only if they are small.
+template <typename LIST>
+class ListDiff
+{
+public:
+  typedef typename LIST::value_type T;
+
+  /// \brief An item that is in both lists.
+  struct Match
+  {
+    int m_iOldIndex;
+    int m_iNewIndex;
+  };
+
+  /// \brief Returns all items that are kept, ordered by both indices.
+  static std::vector<Match> FindMatches(const LIST& oldList, const LIST& newList)
+  {
+    std::vector<Match> matches;
+    Diff(oldList, 0, (int)oldList.size(), newList, 0, (int)newList.size(), matches);
+    return matches;
+  }
+
+private:
+  /// \brief Ranges whose LCS table would be larger than this are treated as completely different.
+  static const qint64 s_iMaxLcsCells = 1024 * 1024;
+
+  static void Diff(const LIST& a, int a0, int a1, const LIST& b, int b0, int b1, std::vector<Match>& out_Matches)
+  {
+    while (a0 < a1 && b0 < b1 && a[a0] == b[b0])
+    {
+      out_Matches.push_back({a0++, b0++});
+    }
+
+    int suffix = 0;
+    while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1])
+    {
+      --a1;
+      --b1;
+      ++suffix;
+    }
+
+    if (a0 < a1 && b0 < b1)
+    {
+      const std::vector<Match> anchors = FindAnchors(a, a0, a1, b, b0, b1);
+
+      if (anchors.empty())
+      {
+        Lcs(a, a0, a1, b, b0, b1, out_Matches);
+      }
+      else
+      {
+        for (const Match& anchor : anchors)
+        {
+          Diff(a, a0, anchor.m_iOldIndex, b, b0, anchor.m_iNewIndex, out_Matches);
+          out_Matches.push_back(anchor);
+
+          a0 = anchor.m_iOldIndex + 1;
+          b0 = anchor.m_iNewIndex + 1;
+        }
+
+        Diff(a, a0, a1, b, b0, b1, out_Matches);
+      }
+    }
+
+    for (int i = 0; i < suffix; ++i)
+    {
+      out_Matches.push_back({a1 + i, b1 + i});
+    }
+  }
+
+  /// \brief Pairs up the items that are unique in both ranges and returns the longest sequence of pairs that is increasing in both lists.
+  static std::vector<Match> FindAnchors(const LIST& a, int a0, int a1, const LIST& b, int b0, int b1)
+  {
+    // index of the item in b, or -1 if it occurs more than once
+    QHash<T, int> inB;
+    inB.reserve(b1 - b0);
+
+    for (int i = b0; i < b1; ++i)
+    {
+      auto it = inB.find(b[i]);
+      if (it == inB.end())
+        inB.insert(b[i], i);
+      else
+        it.value() = -1;
+    }
+
+    QHash<T, int> inA;
+    inA.reserve(a1 - a0);
+
+    for (int i = a0; i < a1; ++i)
+    {
+      auto it = inA.find(a[i]);
+      if (it == inA.end())
+        inA.insert(a[i], i);
+      else
+        it.value() = -1;
+    }
+
+    std::vector<Match> unique;
+
+    for (int i = a0; i < a1; ++i)
+    {
+      if (inA.value(a[i]) != i)
+        continue;
+
+      const int j = inB.value(a[i], -1);
+      if (j >= 0)
+      {
+        unique.push_back({i, j});
+      }
+    }
+
+    // patience sorting: the piles hold the index of the smallest top element, every element links to the top of the previous pile
+    std::vector<int> piles;
+    std::vector<int> prev(unique.size(), -1);
+
+    for (int i = 0; i < (int)unique.size(); ++i)
+    {
+      auto it = std::lower_bound(piles.begin(), piles.end(), unique[i].m_iNewIndex, [&unique](int pile, int newIndex) { return unique[pile].m_iNewIndex < newIndex; });
+
+      if (it != piles.begin())
+        prev[i] = *(it - 1);
+
+      if (it == piles.end())
+        piles.push_back(i);
+      else
+        *it = i;
+    }
+
+    std::vector<Match> anchors;
+
+    for (int i = piles.empty() ? -1 : piles.back(); i >= 0; i = prev[i])
+    {
+      anchors.push_back(unique[i]);
+    }
+
+    std::reverse(anchors.begin(), anchors.end());
+    return anchors;
+  }
+
+  static void Lcs(const LIST& a, int a0, int a1, const LIST& b, int b0, int b1, std::vector<Match>& out_Matches)
+  {
+    const int n = a1 - a0;
+    const int m = b1 - b0;
+
+    if ((qint64)(n + 1) * (m + 1) > s_iMaxLcsCells)
+      return;
+
+    // length[i][j] = LCS of a[a0 + i ...] and b[b0 + j ...]
+    std::vector<int> length((n + 1) * (m + 1), 0);
+    auto at = [m](int i, int j) { return i * (m + 1) + j; };
+
+    for (int i = n - 1; i >= 0; --i)
+    {
+      for (int j = m - 1; j >= 0; --j)
+      {
+        if (a[a0 + i] == b[b0 + j])
+          length[at(i, j)] = length[at(i + 1, j + 1)] + 1;
+        else
+          length[at(i, j)] = std::max(length[at(i + 1, j)], length[at(i, j + 1)]);
+      }
+    }
+
+    int i = 0;
+    int j = 0;
+
+    while (i < n && j < m)
+    {
+      if (a[a0 + i] == b[b0 + j])
+      {
+        out_Matches.push_back({a0 + i, b0 + j});
+        ++i;
+        ++j;
+      }
+      else if (length[at(i + 1, j)] >= length[at(i, j + 1)])
+      {
+        ++i;
+      }
+      else
+      {
+        ++j;
+      }
+    }
+  }
+};
@@ -1,6 +1,7 @@
 #include "Config/AppConfig.h"
 #include "Config/AppState.h"
 #include "GUI/Form1.h"
+#include "Misc/JobScheduler.h"
 #include <QApplication>
 #include <QDir>
 #include <QLocalServer>
@@ -81,6 +82,7 @@ int main(int argc, char** argv)
     SoundDevice::s_pSingleton->Startup();
 
     AppConfig config;
+    JobScheduler scheduler;
     MusicLibrary library;
     AppState state;
 
@@ -95,6 +97,9 @@ int main(int argc, char** argv)
     result = app.exec();
     delete mainWnd;
 
+    // stop all background work, before the objects that it uses are destroyed
+    scheduler.Shutdown();
+
     config.Save(sAppDir);
 
     SoundDevice::s_pSingleton->Shutdown();
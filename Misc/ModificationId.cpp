@@ -0,0 +1,62 @@
+#include "Misc/ModificationId.h"
+#include <QByteArray>
+#include <QDateTime>
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+
+/// \brief How far the clock of another computer may be ahead, before its IDs are not observed anymore.
+static const qint64 s_iMaxClockDriftMS = 24 * 60 * 60 * 1000;
+
+static std::atomic<quint64> s_uiLastClock(0);
+
+static quint64 GetLocalNode()
+{
+  // only computed once per run, this is the only place that needs the OS random source
+  static const quint64 s_uiNode = ModificationId::FromLegacy(QUuid::createUuid(), 0).m_uiNode;
+  return s_uiNode;
+}
+
+ModificationId ModificationId::Create()
+{
+  const quint64 uiPhysical = (quint64)QDateTime::currentMSecsSinceEpoch() << 16;
+
+  quint64 uiLast = s_uiLastClock.load();
+  quint64 uiNext = 0;
+
+  do
+  {
+    uiNext = std::max(uiPhysical, uiLast + 1);
+  } while (!s_uiLastClock.compare_exchange_weak(uiLast, uiNext));
+
+  ModificationId id;
+  id.m_uiClock = uiNext;
+  id.m_uiNode = GetLocalNode();
+  return id;
+}
+
+void ModificationId::Observe(const ModificationId& id)
+{
+  if (id.GetMilliseconds() > QDateTime::currentMSecsSinceEpoch() + s_iMaxClockDriftMS)
+    return;
+
+  quint64 uiLast = s_uiLastClock.load();
+
+  while (id.m_uiClock > uiLast && !s_uiLastClock.compare_exchange_weak(uiLast, id.m_uiClock))
+  {
+  }
+}
+
+ModificationId ModificationId::FromLegacy(const QUuid& guid, qint64 iMilliseconds)
+{
+  const QByteArray data = guid.toRfc4122();
+
+  quint64 uiHigh = 0, uiLow = 0;
+  memcpy(&uiHigh, data.constData(), 8);
+  memcpy(&uiLow, data.constData() + 8, 8);
+
+  ModificationId id;
+  id.m_uiClock = iMilliseconds > 0 ? (quint64)iMilliseconds << 16 : 0;
+  id.m_uiNode = uiHigh ^ uiLow;
+  return id;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QUuid>
+
+/// \brief Identifies a modification, and orders all modifications in time, across all computers.
+///
+/// The clock is a hybrid logical clock: the upper 48 bits are milliseconds since the epoch (UTC), the lower 16 bits
+/// count the modifications within the same millisecond. It never runs backwards, even if the system clock does,
+/// and it is advanced past all modifications loaded from other computers (see Observe()).
+/// The node is a random number per application run, it separates modifications of different computers with the same clock value.
+///
+/// Comparing, sorting and hashing IDs only needs integer operations, and creating one doesn't need the OS random source.
+struct ModificationId
+{
+  quint64 m_uiClock = 0; // 0 if invalid
+  quint64 m_uiNode = 0;
+
+  bool IsValid() const { return m_uiClock != 0; }
+
+  /// \brief The milliseconds since the epoch (UTC) at which the modification was made.
+  qint64 GetMilliseconds() const { return (qint64)(m_uiClock >> 16); }
+
+  QString ToString() const { return QString("%1-%2").arg(m_uiClock, 16, 16, QChar('0')).arg(m_uiNode, 16, 16, QChar('0')); }
+
+  bool operator==(const ModificationId& rhs) const { return m_uiClock == rhs.m_uiClock && m_uiNode == rhs.m_uiNode; }
+  bool operator!=(const ModificationId& rhs) const { return !(*this == rhs); }
+
+  bool operator<(const ModificationId& rhs) const
+  {
+    if (m_uiClock != rhs.m_uiClock)
+      return m_uiClock < rhs.m_uiClock;
+
+    return m_uiNode < rhs.m_uiNode;
+  }
+
+  /// \brief Returns a new ID, which is greater than all IDs that have been created or observed before.
+  static ModificationId Create();
+
+  /// \brief Advances the local clock past the given ID, e.g. after loading it from another computer's journal.
+  ///
+  /// IDs that are far in the future (a broken clock on another computer) are ignored, so they can't drag the local clock along.
+  static void Observe(const ModificationId& id);
+
+  /// \brief Converts the GUID and timestamp of journal format version 1 and 2 into an ID.
+  static ModificationId FromLegacy(const QUuid& guid, qint64 iMilliseconds);
+};
+
+inline uint qHash(const ModificationId& id, uint seed = 0)
+{
+  return qHash(id.m_uiClock ^ (id.m_uiNode * 0x9E3779B97F4A7C15ull), seed);
+}
@@ -1,22 +1,165 @@
 #pragma once
 
 #include "Misc/Common.h"
+#include "Misc/ModificationId.h"
+#include <QByteArray>
+#include <QDataStream>
 #include <QDateTime>
+#include <QFile>
+#include <QHash>
+#include <QIODevice>
+#include <QSet>
 #include <QUuid>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
 #include <deque>
-#include <set>
+#include <queue>
+#include <vector>
+
+/// \brief Stores every distinct string of a journal only once, the entries refer to them by index.
+///
+/// Song GUIDs appear in many journal entries, interning them makes the files much smaller and faster to load.
+/// Journals of format version 1 store all strings inline, for those the table passes the strings through.
+class JournalStringTable
+{
+public:
+  explicit JournalStringTable(int iFormatVersion = 2)
+      : m_iFormatVersion(iFormatVersion)
+  {
+  }
+
+  void Write(QDataStream& stream, const QString& sString)
+  {
+    auto it = m_Indices.find(sString);
+
+    if (it == m_Indices.end())
+    {
+      it = m_Indices.insert(sString, (quint32)m_Strings.size());
+      m_Strings.push_back(sString);
+    }
+
+    stream << it.value();
+  }
+
+  QString Read(QDataStream& stream) const
+  {
+    if (m_iFormatVersion == 1)
+    {
+      QString sString;
+      stream >> sString;
+      return sString;
+    }
+
+    quint32 index = 0;
+    stream >> index;
+
+    if (index >= m_Strings.size())
+    {
+      stream.setStatus(QDataStream::ReadCorruptData);
+      return QString();
+    }
+
+    return m_Strings[index];
+  }
+
+  void Save(QDataStream& stream) const
+  {
+    stream << (quint32)m_Strings.size();
+
+    for (const QString& sString : m_Strings)
+    {
+      stream << sString;
+    }
+  }
+
+  void Load(QDataStream& stream)
+  {
+    quint32 numStrings = 0;
+    stream >> numStrings;
+
+    m_Strings.clear();
+
+    for (quint32 i = 0; i < numStrings && stream.status() == QDataStream::Ok; ++i)
+    {
+      m_Strings.push_back(QString());
+      stream >> m_Strings.back();
+    }
+  }
+
+private:
+  int m_iFormatVersion;
+  QHash<QString, quint32> m_Indices;
+  std::vector<QString> m_Strings;
+};
+
+/// \brief Read access to a journal file through a memory mapping, which avoids copying the whole file before it is decoded.
+///
+/// Falls back to reading the file into memory, if it can't be mapped. The stream is valid as long as the object exists.
+class JournalFile
+{
+public:
+  bool Open(const QString& sPath)
+  {
+    m_File.setFileName(sPath);
+
+    if (!m_File.open(QIODevice::OpenModeFlag::ReadOnly))
+      return false;
+
+    const qint64 size = m_File.size();
+    uchar* pData = size > 0 ? m_File.map(0, size) : nullptr;
+
+    if (pData != nullptr)
+    {
+      // doesn't copy the data, the mapping is released when the file is closed
+      m_Data = QByteArray::fromRawData(reinterpret_cast<const char*>(pData), (int)size);
+    }
+    else
+    {
+      m_Data = m_File.readAll();
+    }
+
+    m_pStream = std::make_unique<QDataStream>(m_Data);
+    return true;
+  }
+
+  QDataStream& GetStream() { return *m_pStream; }
+
+  /// \brief File extensions under which library journals and playlists are written.
+  ///
+  /// Builds that only understand format version 1 enumerate every .f1l and .f1pl file, schedule it for deletion and only then look
+  /// at its version. Journals in a newer format therefore must never use those extensions, or such a build would delete the data of
+  /// all synchronized computers. Files with the old extensions are still read, but not written anymore.
+  static const char* GetLibraryExtension() { return ".f1j"; }
+  static const char* GetPlaylistExtension() { return ".f1pj"; }
+
+  static bool IsLibraryJournal(const QString& sPath) { return sPath.endsWith(GetLibraryExtension(), Qt::CaseInsensitive) || sPath.endsWith(".f1l", Qt::CaseInsensitive); }
+  static bool IsPlaylistJournal(const QString& sPath) { return sPath.endsWith(GetPlaylistExtension(), Qt::CaseInsensitive) || sPath.endsWith(".f1pl", Qt::CaseInsensitive); }
+
+private:
+  // declaration order matters, the stream has to be destroyed before the data and the mapping
+  QFile m_File;
+  QByteArray m_Data;
+  std::unique_ptr<QDataStream> m_pStream;
+};
 
 struct Modification
 {
   // Template interface:
   //
   // void Apply(context) const;
-  // void Save(QDataStream& stream) const;
-  // void Load(QDataStream& stream);
-  // void Coalesce(ModificationRecorder<Modification>& recorder, size_t passThroughIndex);
+  //
+  // All strings should be written and read through the string table.
+  // void Save(QDataStream& stream, JournalStringTable& strings) const;
+  // void Load(QDataStream& stream, const JournalStringTable& strings);
+  //
+  // Returns false, if the modification has no effect and can be dropped.
+  // bool IsRelevant() const;
+  //
+  // Modifications with the same key replace each other, only the most recent one is kept.
+  // An empty key means the modification is never replaced.
+  // QString GetCoalescingKey() const;
 
-  QDateTime m_ModTimestamp;
-  QString m_sModGuid;
+  ModificationId m_ModId;
 };
 
 template <typename T, typename CONTEXT>
@@ -30,8 +173,8 @@ public:
     m_bRecordedModifcations = true;
 
     m_Modifications.push_back(mod);
-    m_Modifications.back().m_ModTimestamp = QDateTime::currentDateTimeUtc();
-    m_Modifications.back().m_sModGuid = QUuid::createUuid().toString();
+    m_Modifications.back().m_ModId = ModificationId::Create();
+    m_KnownModIds.insert(m_Modifications.back().m_ModId);
 
     mod.Apply(context);
   }
@@ -47,160 +190,339 @@ public:
     m_bRecordedModifcations = true;
 
     m_Modifications.push_back(mod);
-    m_Modifications.back().m_ModTimestamp = QDateTime::currentDateTimeUtc();
-    m_Modifications.back().m_sModGuid = QUuid::createUuid().toString();
+    m_Modifications.back().m_ModId = ModificationId::Create();
+    m_KnownModIds.insert(m_Modifications.back().m_ModId);
 
     // do not apply the modification
   }
 
+  /// \brief Writes all modifications in the current format (version 3).
+  ///
+  /// Version 3 stores the modification IDs as two 64 bit integers, and all strings in one string table in front of the entries.
+  /// Version 2 stored a GUID and a timestamp instead, version 1 stored them as a string and a QDateTime, and the strings inline.
   void Save(QDataStream& stream) const
   {
-    int version = 1;
+    Save(stream, [](const T&) { return true; });
+  }
+
+  /// \brief Writes only the modifications for which \a filter returns true, e.g. those that were not loaded from another computer's journal.
+  template <typename FILTER>
+  void Save(QDataStream& stream, FILTER filter) const
+  {
+    const int version = 3;
     stream << version;
 
-    int numMods = (int)m_Modifications.size();
-    stream << numMods;
+    JournalStringTable strings;
+    QByteArray entries;
+    int numMods = 0;
 
-    for (int i = 0; i < numMods; ++i)
+    // the entries are serialized first, to collect the strings that they use
     {
-      stream << m_Modifications[i].m_sModGuid;
-      stream << m_Modifications[i].m_ModTimestamp;
-      m_Modifications[i].Save(stream);
+      QDataStream entryStream(&entries, QIODevice::WriteOnly);
+      entryStream.setVersion(stream.version());
+
+      for (const T& mod : m_Modifications)
+      {
+        if (!filter(mod))
+          continue;
+
+        ++numMods;
+        entryStream << mod.m_ModId.m_uiClock;
+        entryStream << mod.m_ModId.m_uiNode;
+        mod.Save(entryStream, strings);
+      }
     }
 
+    strings.Save(stream);
+
+    stream << numMods;
+    stream.writeRawData(entries.constData(), entries.size());
+
     m_bRecordedModifcations = false;
   }
 
-  void LoadAdditional(QDataStream& stream)
+  /// \brief Adds the modifications from all streams, skipping those that are already known. Reads format version 1 to 3.
+  void LoadAdditional(const std::vector<QDataStream*>& journals)
+  {
+    std::vector<T> merged;
+    DecodeAndMerge(journals, merged);
+
+    Splice(merged);
+  }
+
+  /// \brief Decodes several journals in parallel and merges them, see MergeJournals().
+  ///
+  /// Doesn't touch any recorder, so a lock is only needed for the final Splice().
+  /// If \a out_pComplete is given, it receives for every journal whether it was decoded completely, see Decode().
+  static void DecodeAndMerge(const std::vector<QDataStream*>& journals, std::vector<T>& out_Merged, std::vector<bool>* out_pComplete = nullptr)
+  {
+    struct DecodedJournal
+    {
+      QDataStream* m_pStream;
+      std::vector<T> m_Modifications;
+      bool m_bComplete = false;
+    };
+
+    std::vector<DecodedJournal> decoded(journals.size());
+
+    for (size_t i = 0; i < journals.size(); ++i)
+    {
+      decoded[i].m_pStream = journals[i];
+    }
+
+    QtConcurrent::blockingMap(decoded, [](DecodedJournal& journal) { journal.m_bComplete = Decode(*journal.m_pStream, journal.m_Modifications); });
+
+    std::vector<std::vector<T>> modifications(decoded.size());
+
+    if (out_pComplete != nullptr)
+    {
+      out_pComplete->resize(decoded.size());
+    }
+
+    for (size_t i = 0; i < decoded.size(); ++i)
+    {
+      modifications[i].swap(decoded[i].m_Modifications);
+
+      if (out_pComplete != nullptr)
+      {
+        (*out_pComplete)[i] = decoded[i].m_bComplete;
+      }
+    }
+
+    MergeJournals(modifications, out_Merged);
+  }
+
+  /// \brief Reads the modifications from the stream, without touching any recorder. Reads format version 1 to 3.
+  ///
+  /// Doesn't need any synchronization, so several journals can be decoded in parallel.
+  /// Returns false, if the version is unknown or the data ends early, e.g. because a sync client is still writing the file.
+  /// The modifications before that point are still added.
+  static bool Decode(QDataStream& stream, std::vector<T>& out_Modifications)
   {
     int version = 0;
     stream >> version;
 
-    if (version != 1)
-      return;
+    if (version < 1 || version > 3)
+      return false;
+
+    JournalStringTable strings(version);
+
+    if (version >= 2)
+    {
+      strings.Load(stream);
+    }
 
     int numMods = 0;
     stream >> numMods;
 
-    std::set<QString> knownGuids;
+    if (numMods < 0)
+      return false;
 
-    // make sure existing modifications are known
-    for (const auto& mod : m_Modifications)
+    // the count comes from the file, a broken one must not reserve gigabytes
+    // every entry takes at least the bytes of its ID: a string and a QDateTime in version 1, a GUID and a timestamp in version 2, two integers in version 3
+    if (stream.device() != nullptr)
     {
-      knownGuids.insert(mod.m_sModGuid);
+      const qint64 minEntrySize = version == 1 ? 17 : (version == 2 ? 24 : 16);
+      const qint64 maxMods = stream.device()->bytesAvailable() / minEntrySize;
+
+      out_Modifications.reserve(out_Modifications.size() + (size_t)std::min<qint64>(numMods, maxMods));
     }
 
     for (int i = 0; i < numMods; ++i)
     {
-      m_Modifications.push_back(T());
-      T& mod = m_Modifications.back();
+      T mod;
 
-      stream >> mod.m_sModGuid;
-      stream >> mod.m_ModTimestamp;
-      mod.Load(stream);
+      if (version == 1)
+      {
+        QString sModGuid;
+        QDateTime timestamp;
+        stream >> sModGuid;
+        stream >> timestamp;
 
-      if (knownGuids.find(mod.m_sModGuid) != knownGuids.end())
+        mod.m_ModId = ModificationId::FromLegacy(QUuid(sModGuid), timestamp.isValid() ? timestamp.toMSecsSinceEpoch() : 0);
+      }
+      else if (version == 2)
       {
-        // remove the new modification, if one with the same GUID already exists
-        m_Modifications.pop_back();
+        char guid[16];
+        qint64 timestamp = 0;
+        stream.readRawData(guid, 16);
+        stream >> timestamp;
+
+        mod.m_ModId = ModificationId::FromLegacy(QUuid::fromRfc4122(QByteArray::fromRawData(guid, 16)), timestamp);
       }
       else
       {
-        knownGuids.insert(mod.m_sModGuid);
+        stream >> mod.m_ModId.m_uiClock;
+        stream >> mod.m_ModId.m_uiNode;
       }
+
+      mod.Load(stream, strings);
+
+      if (stream.status() != QDataStream::Ok)
+        return false;
+
+      out_Modifications.push_back(std::move(mod));
     }
+
+    return stream.status() == QDataStream::Ok;
   }
 
-  void ApplyAll(CONTEXT context)
+  /// \brief Merges several decoded journals into one chronologically sorted list, in which every modification ID appears only once.
+  ///
+  /// Each journal is sorted on its own (files are usually written sorted already), then all are merged with a k-way merge.
+  static void MergeJournals(std::vector<std::vector<T>>& journals, std::vector<T>& out_Merged)
   {
-    sort(m_Modifications.begin(), m_Modifications.end(), [](const T& lhs, const T& rhs) -> bool {
-      return lhs.m_ModTimestamp < rhs.m_ModTimestamp;
-    });
+    struct Head
+    {
+      ModificationId m_Id;
+      size_t m_uiJournal;
+      size_t m_uiIndex;
+    };
 
-    for (const auto& mod : m_Modifications)
+    auto isLater = [](const Head& lhs, const Head& rhs) { return rhs.m_Id < lhs.m_Id; };
+    std::priority_queue<Head, std::vector<Head>, decltype(isLater)> heads(isLater);
+
+    auto isEarlier = [](const T& lhs, const T& rhs) { return lhs.m_ModId < rhs.m_ModId; };
+
+    size_t uiTotal = 0;
+
+    for (size_t j = 0; j < journals.size(); ++j)
     {
-      mod.Apply(context);
-    }
-  }
+      std::vector<T>& journal = journals[j];
 
-  void CoalesceEntries()
-  {
-    if (m_Modifications.empty())
-      return;
+      if (!std::is_sorted(journal.begin(), journal.end(), isEarlier))
+      {
+        std::stable_sort(journal.begin(), journal.end(), isEarlier);
+      }
 
-    sort(m_Modifications.begin(), m_Modifications.end(), [](const T& lhs, const T& rhs) -> bool {
-      return lhs.m_ModTimestamp < rhs.m_ModTimestamp;
-    });
+      if (!journal.empty())
+      {
+        heads.push({journal[0].m_ModId, j, 0});
+      }
 
-    for (size_t i = m_Modifications.size(); i > 0; --i)
+      uiTotal += journal.size();
+    }
+
+    out_Merged.reserve(out_Merged.size() + uiTotal);
+
+    while (!heads.empty())
     {
-      auto& mod = m_Modifications[i - 1];
+      Head head = heads.top();
+      heads.pop();
 
-      if (!mod.m_ModTimestamp.isValid())
-        continue;
+      std::vector<T>& journal = journals[head.m_uiJournal];
+      T& mod = journal[head.m_uiIndex];
 
-      mod.Coalesce(*this, i - 1);
+      // the same modification is stored in several files, when multiple computers share the profile
+      // IDs are totally ordered, so copies of a modification are merged right after each other
+      if (out_Merged.empty() || out_Merged.back().m_ModId != mod.m_ModId)
+      {
+        out_Merged.push_back(std::move(mod));
+      }
+
+      if (++head.m_uiIndex < journal.size())
+      {
+        head.m_Id = journal[head.m_uiIndex].m_ModId;
+        heads.push(head);
+      }
     }
+  }
 
-    sort(m_Modifications.begin(), m_Modifications.end(), [](const T& lhs, const T& rhs) -> bool {
-      if (!lhs.m_ModTimestamp.isValid() && !rhs.m_ModTimestamp.isValid()) // equal
-        return false;
-      if (!lhs.m_ModTimestamp.isValid())
+  /// \brief Adds merged modifications to the recorder, skipping those that are already known.
+  ///
+  /// Afterwards \a modifications only contains the modifications that were added.
+  void Splice(std::vector<T>& modifications)
+  {
+    auto isKnown = [this](const T& mod) {
+      if (m_KnownModIds.contains(mod.m_ModId))
         return true;
-      if (!rhs.m_ModTimestamp.isValid())
-        return false;
 
-      return lhs.m_ModTimestamp < rhs.m_ModTimestamp;
-    });
+      m_KnownModIds.insert(mod.m_ModId);
 
-    while (!m_Modifications.empty())
-    {
-      const auto& mod = m_Modifications.front();
+      // modifications recorded from now on must be newer than everything that is known
+      ModificationId::Observe(mod.m_ModId);
+      return false;
+    };
 
-      if (mod.m_ModTimestamp.isValid())
-        break;
+    modifications.erase(std::remove_if(modifications.begin(), modifications.end(), isKnown), modifications.end());
 
-      m_Modifications.pop_front();
-    }
+    m_Modifications.insert(m_Modifications.end(), modifications.begin(), modifications.end());
+  }
 
-    while (!m_Modifications.empty())
-    {
-      const auto& mod = m_Modifications.back();
+  void ApplyAll(CONTEXT context)
+  {
+    ForEach([context](const T& mod) { mod.Apply(context); });
+  }
 
-      if (mod.m_ModTimestamp.isValid())
-        break;
+  /// \brief Calls \a func for all modifications in chronological order.
+  ///
+  /// Allows to process all modifications at once, e.g. to collapse them to their final result, instead of applying them one by one.
+  template <typename FUNC>
+  void ForEach(FUNC func)
+  {
+    sort(m_Modifications.begin(), m_Modifications.end(), [](const T& lhs, const T& rhs) -> bool {
+      return lhs.m_ModId < rhs.m_ModId;
+    });
 
-      m_Modifications.pop_back();
+    for (const auto& mod : m_Modifications)
+    {
+      func(mod);
     }
   }
 
-  const std::deque<T>& GetAllModifications() const { return m_Modifications; }
+  /// \brief Marks the given modification IDs as known, so that LoadAdditional() and Splice() skip modifications with those IDs.
+  void AddKnownModifications(const QSet<ModificationId>& ids) { m_KnownModIds.unite(ids); }
 
-private:
-  friend T;
+  /// \brief Removes the modifications with the given IDs, e.g. after they have been stored elsewhere. They stay known.
+  void RemoveModifications(const QSet<ModificationId>& ids)
+  {
+    m_Modifications.erase(std::remove_if(m_Modifications.begin(), m_Modifications.end(), [&ids](const T& mod) { return ids.contains(mod.m_ModId); }), m_Modifications.end());
+  }
 
-  template <typename InvalidateIf>
-  void InvalidatePrevious(size_t index, InvalidateIf ii)
+  /// \brief Removes all modifications that are replaced by more recent ones, in one pass over all entries.
+  void CoalesceEntries()
   {
-    for (size_t i = index; i > 0; --i)
+    if (m_Modifications.empty())
+      return;
+
+    std::sort(m_Modifications.begin(), m_Modifications.end(), [](const T& lhs, const T& rhs) -> bool {
+      return lhs.m_ModId < rhs.m_ModId;
+    });
+
+    QSet<QString> seenKeys;
+    seenKeys.reserve((int)m_Modifications.size());
+
+    std::deque<T> kept;
+
+    // walk backwards, so the first modification seen for each key is the one that wins
+    for (size_t i = m_Modifications.size(); i > 0; --i)
     {
-      auto& mod = m_Modifications[i - 1];
+      T& mod = m_Modifications[i - 1];
 
-      if (!mod.m_ModTimestamp.isValid())
+      if (!mod.m_ModId.IsValid() || !mod.IsRelevant())
         continue;
 
-      if (ii((const T&)mod))
+      const QString sKey = mod.GetCoalescingKey();
+
+      if (!sKey.isEmpty())
       {
-        mod.m_ModTimestamp = QDateTime();
+        if (seenKeys.contains(sKey))
+          continue;
+
+        seenKeys.insert(sKey);
       }
+
+      kept.push_front(std::move(mod));
     }
-  }
 
-  void InvalidateThis(size_t index)
-  {
-    auto& mod = m_Modifications[index];
-    mod.m_ModTimestamp = QDateTime();
+    m_Modifications.swap(kept);
   }
 
+  const std::deque<T>& GetAllModifications() const { return m_Modifications; }
+
+private:
   std::deque<T> m_Modifications;
+
+  // the IDs of all modifications that were recorded or loaded, including those that have been coalesced away since
+  QSet<ModificationId> m_KnownModIds;
 };
@@ -17,6 +17,11 @@ public:
     Volume = 1 << 7,
     StartOffset = 1 << 8,
     EndOffset = 1 << 9,
+    Length = 1 << 10,
+    LastPlayed = 1 << 11,
+    DateAdded = 1 << 12,
+    PlayCount = 1 << 13,
+    Existence = 1 << 14, // the song was added to or removed from the library
   };
 
   QString m_sSongGuid;
@@ -38,7 +43,10 @@ public:
   QString m_sDateAdded;
 
   void Clear();
-  bool ReadSongInfo(const QString& sFile);
+  /// \brief Reads the song information from the tags of the given file.
+  ///
+  /// \a fileHead may contain the first bytes of the file, if they have already been read for other purposes.
+  bool ReadSongInfo(const QString& sFile, const QByteArray& fileHead = QByteArray());
 
   static bool ModifyFileTag(const QString& file, const SongInfo& info, unsigned int PartMask);
 };
@@ -0,0 +1,678 @@
+#include "Misc/TagReader.h"
+#include <QFile>
+#include <string.h>
+#include <taglib/fileref.h>
+#include <taglib/tag.h>
+
+namespace
+{
+  /// \brief Reads parts of a file, using the already read file head where possible.
+  class FileReader
+  {
+  public:
+    FileReader(const QString& sFile, const QByteArray& fileHead)
+        : m_File(sFile)
+        , m_FileHead(fileHead)
+    {
+    }
+
+    bool Open()
+    {
+      if (!m_File.open(QIODevice::ReadOnly))
+        return false;
+
+      m_iSize = m_File.size();
+      return true;
+    }
+
+    qint64 GetSize() const { return m_iSize; }
+
+    /// \brief Returns the requested bytes. Returns fewer bytes at the end of the file or if reading fails.
+    QByteArray ReadAt(qint64 offset, qint64 size)
+    {
+      if (offset < 0 || size <= 0)
+        return QByteArray();
+
+      if (offset + size <= m_FileHead.size())
+        return m_FileHead.mid((int)offset, (int)size);
+
+      if (!m_File.seek(offset))
+        return QByteArray();
+
+      return m_File.read(size);
+    }
+
+  private:
+    QFile m_File;
+    const QByteArray& m_FileHead;
+    qint64 m_iSize = 0;
+  };
+
+  enum class TagField
+  {
+    None,
+    Title,
+    Artist,
+    Album,
+    Track,
+    Year,
+  };
+} // namespace
+
+static quint32 ReadBE16(const char* p)
+{
+  return ((quint32)(quint8)p[0] << 8) | (quint32)(quint8)p[1];
+}
+
+static quint32 ReadBE24(const char* p)
+{
+  return ((quint32)(quint8)p[0] << 16) | ((quint32)(quint8)p[1] << 8) | (quint32)(quint8)p[2];
+}
+
+static quint32 ReadBE32(const char* p)
+{
+  return ((quint32)(quint8)p[0] << 24) | ((quint32)(quint8)p[1] << 16) | ((quint32)(quint8)p[2] << 8) | (quint32)(quint8)p[3];
+}
+
+static quint64 ReadBE64(const char* p)
+{
+  return ((quint64)ReadBE32(p) << 32) | ReadBE32(p + 4);
+}
+
+/// \brief ID3v2 sizes use only the lower 7 bits of every byte.
+static quint32 ReadSyncSafe(const char* p)
+{
+  return ((quint32)(p[0] & 0x7F) << 21) | ((quint32)(p[1] & 0x7F) << 14) | ((quint32)(p[2] & 0x7F) << 7) | (quint32)(p[3] & 0x7F);
+}
+
+/// \brief Decodes UTF-16 text, up to the first null character.
+static QString DecodeUtf16(const char* p, int size, bool bLittleEndian)
+{
+  QString result;
+  result.reserve(size / 2);
+
+  for (int i = 0; i + 1 < size; i += 2)
+  {
+    const quint8 b0 = (quint8)p[i];
+    const quint8 b1 = (quint8)p[i + 1];
+    const ushort ch = bLittleEndian ? (ushort)(b0 | (b1 << 8)) : (ushort)((b0 << 8) | b1);
+
+    if (ch == 0)
+      break;
+
+    result.append(QChar(ch));
+  }
+
+  return result;
+}
+
+/// \brief Decodes the value of an ID3v2 text frame. Only the first value is used, if there are several.
+static QString DecodeId3v2Text(const QByteArray& frame)
+{
+  if (frame.size() < 2)
+    return QString();
+
+  const int encoding = frame[0];
+  const char* p = frame.data() + 1;
+  const int size = frame.size() - 1;
+
+  switch (encoding)
+  {
+  case 0: // ISO-8859-1
+    return QString::fromLatin1(p, (int)strnlen(p, size));
+
+  case 1: // UTF-16 with byte order mark
+    if (size >= 2 && (quint8)p[0] == 0xFF && (quint8)p[1] == 0xFE)
+      return DecodeUtf16(p + 2, size - 2, true);
+    if (size >= 2 && (quint8)p[0] == 0xFE && (quint8)p[1] == 0xFF)
+      return DecodeUtf16(p + 2, size - 2, false);
+    return DecodeUtf16(p, size, true);
+
+  case 2: // UTF-16 big endian, without byte order mark
+    return DecodeUtf16(p, size, false);
+
+  case 3: // UTF-8
+    return QString::fromUtf8(p, (int)strnlen(p, size));
+  }
+
+  return QString();
+}
+
+static TagField GetId3v2Field(const QByteArray& id)
+{
+  if (id == "TIT2" || id == "TT2")
+    return TagField::Title;
+  if (id == "TPE1" || id == "TP1")
+    return TagField::Artist;
+  if (id == "TALB" || id == "TAL")
+    return TagField::Album;
+  if (id == "TRCK" || id == "TRK")
+    return TagField::Track;
+  if (id == "TDRC" || id == "TYER" || id == "TYE")
+    return TagField::Year;
+
+  return TagField::None;
+}
+
+/// \brief Stores the value in the tags, unless the field is already set. The first value found wins, like in TagLib.
+static void SetTagField(FileTags& tags, TagField field, const QString& value)
+{
+  switch (field)
+  {
+  case TagField::Title:
+    if (tags.m_sTitle.isEmpty())
+      tags.m_sTitle = value;
+    break;
+  case TagField::Artist:
+    if (tags.m_sArtist.isEmpty())
+      tags.m_sArtist = value;
+    break;
+  case TagField::Album:
+    if (tags.m_sAlbum.isEmpty())
+      tags.m_sAlbum = value;
+    break;
+  case TagField::Track:
+    // "3/12" means track 3 of 12
+    if (tags.m_iTrackNumber == 0)
+      tags.m_iTrackNumber = value.section('/', 0, 0).trimmed().toInt();
+    break;
+  case TagField::Year:
+    // may be a full date, e.g. "2004-05-01"
+    if (tags.m_iYear == 0)
+      tags.m_iYear = value.left(4).toInt();
+    break;
+
+  default:
+    break;
+  }
+}
+
+/// \brief Parses the ID3v2 tag at the start of the file, if there is one. Returns the offset of the audio data behind it.
+static bool ParseId3v2(FileReader& file, FileTags& tags, qint64& out_iAudioStart)
+{
+  out_iAudioStart = 0;
+
+  const QByteArray header = file.ReadAt(0, 10);
+
+  if (header.size() < 10 || !header.startsWith("ID3"))
+    return true;
+
+  const int major = header[3];
+  const quint8 flags = (quint8)header[5];
+  const qint64 tagEnd = 10 + ReadSyncSafe(header.data() + 6);
+
+  // a footer is a copy of the header behind the tag
+  out_iAudioStart = tagEnd + ((flags & 0x10) ? 10 : 0);
+
+  if (major < 2 || major > 4)
+    return false;
+
+  // unsynchronisation changes the data of the entire tag, rarely used nowadays
+  if (flags & 0x80)
+    return false;
+
+  qint64 pos = 10;
+
+  if (flags & 0x40)
+  {
+    // in ID3v2.2 this flag means compression
+    if (major == 2)
+      return false;
+
+    const QByteArray extended = file.ReadAt(pos, 4);
+    if (extended.size() < 4)
+      return false;
+
+    // the extended header size excludes the size field in ID3v2.3, but includes it in ID3v2.4
+    pos += (major == 3) ? 4 + ReadBE32(extended.data()) : ReadSyncSafe(extended.data());
+  }
+
+  const int idSize = (major == 2) ? 3 : 4;
+  const int frameHeaderSize = (major == 2) ? 6 : 10;
+
+  // compression, encryption, grouping and (in ID3v2.4) per-frame unsynchronisation
+  const quint32 unsupportedFlags = (major == 3) ? 0x00E0 : 0x004F;
+
+  while (pos + frameHeaderSize <= tagEnd)
+  {
+    const QByteArray frameHeader = file.ReadAt(pos, frameHeaderSize);
+    if (frameHeader.size() < frameHeaderSize)
+      return false;
+
+    // padding
+    if (frameHeader[0] == 0)
+      break;
+
+    quint32 frameSize = 0;
+    quint32 frameFlags = 0;
+
+    if (major == 2)
+    {
+      frameSize = ReadBE24(frameHeader.data() + 3);
+    }
+    else
+    {
+      frameSize = (major == 3) ? ReadBE32(frameHeader.data() + 4) : ReadSyncSafe(frameHeader.data() + 4);
+      frameFlags = ReadBE16(frameHeader.data() + 8);
+    }
+
+    pos += frameHeaderSize;
+
+    // e.g. ID3v2.4 tags written with ID3v2.3 frame sizes, TagLib has heuristics for that
+    if (pos + frameSize > tagEnd)
+      return false;
+
+    // only the few text frames that we need are read, everything else (e.g. cover art) is skipped
+    const TagField field = GetId3v2Field(frameHeader.left(idSize));
+
+    if (field != TagField::None)
+    {
+      if (frameFlags & unsupportedFlags)
+        return false;
+
+      SetTagField(tags, field, DecodeId3v2Text(file.ReadAt(pos, frameSize)));
+    }
+
+    pos += frameSize;
+  }
+
+  return true;
+}
+
+static QString DecodeId3v1Text(const char* p, int size)
+{
+  return QString::fromLatin1(p, (int)strnlen(p, size)).trimmed();
+}
+
+/// \brief Fills the fields that the ID3v2 tag did not provide from the ID3v1 tag at the end of the file, if there is one.
+static bool ParseId3v1(FileReader& file, FileTags& tags)
+{
+  if (file.GetSize() < 128)
+    return false;
+
+  const QByteArray tag = file.ReadAt(file.GetSize() - 128, 128);
+
+  if (tag.size() != 128 || !tag.startsWith("TAG"))
+    return false;
+
+  const char* p = tag.data();
+
+  SetTagField(tags, TagField::Title, DecodeId3v1Text(p + 3, 30));
+  SetTagField(tags, TagField::Artist, DecodeId3v1Text(p + 33, 30));
+  SetTagField(tags, TagField::Album, DecodeId3v1Text(p + 63, 30));
+  SetTagField(tags, TagField::Year, DecodeId3v1Text(p + 93, 4));
+
+  // ID3v1.1 stores the track number in the last byte of the comment
+  if (p[125] == 0 && tags.m_iTrackNumber == 0)
+  {
+    tags.m_iTrackNumber = (quint8)p[126];
+  }
+
+  return true;
+}
+
+namespace
+{
+  struct MpegHeader
+  {
+    int m_iVersion = 0; // 1, 2 or 25 (for MPEG 2.5)
+    int m_iLayer = 0;
+    int m_iBitrate = 0; // in kbit/s
+    int m_iSampleRate = 0;
+    int m_iSamplesPerFrame = 0;
+    int m_iFrameSize = 0;
+    int m_iSideInfoSize = 0;
+  };
+} // namespace
+
+static bool ParseMpegHeader(const char* p, MpegHeader& out_Header)
+{
+  const quint8 b1 = (quint8)p[1];
+  const quint8 b2 = (quint8)p[2];
+  const quint8 b3 = (quint8)p[3];
+
+  if ((quint8)p[0] != 0xFF || (b1 & 0xE0) != 0xE0)
+    return false;
+
+  static const int versions[4] = {25, 0, 2, 1};
+  static const int layers[4] = {0, 3, 2, 1};
+
+  const int version = versions[(b1 >> 3) & 3];
+  const int layer = layers[(b1 >> 1) & 3];
+  const int bitrateIndex = b2 >> 4;
+  const int sampleRateIndex = (b2 >> 2) & 3;
+  const bool bPadding = (b2 & 0x02) != 0;
+  const bool bMono = (b3 >> 6) == 3;
+
+  // reserved values and 'free' bit rate
+  if (version == 0 || layer == 0 || bitrateIndex == 0 || bitrateIndex == 15 || sampleRateIndex == 3)
+    return false;
+
+  static const int bitrates[5][16] = {
+    {0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0}, // MPEG 1, layer I
+    {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},    // MPEG 1, layer II
+    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},     // MPEG 1, layer III
+    {0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},    // MPEG 2 and 2.5, layer I
+    {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},         // MPEG 2 and 2.5, layer II and III
+  };
+
+  static const int sampleRates[3][3] = {
+    {44100, 48000, 32000}, // MPEG 1
+    {22050, 24000, 16000}, // MPEG 2
+    {11025, 12000, 8000},  // MPEG 2.5
+  };
+
+  const int bitrateTable = (version == 1) ? (layer - 1) : (layer == 1 ? 3 : 4);
+  const int sampleRateTable = (version == 1) ? 0 : (version == 2 ? 1 : 2);
+
+  MpegHeader& h = out_Header;
+  h.m_iVersion = version;
+  h.m_iLayer = layer;
+  h.m_iBitrate = bitrates[bitrateTable][bitrateIndex];
+  h.m_iSampleRate = sampleRates[sampleRateTable][sampleRateIndex];
+
+  if (layer == 1)
+  {
+    h.m_iSamplesPerFrame = 384;
+    h.m_iFrameSize = (12 * h.m_iBitrate * 1000 / h.m_iSampleRate + (bPadding ? 1 : 0)) * 4;
+  }
+  else
+  {
+    h.m_iSamplesPerFrame = (layer == 3 && version != 1) ? 576 : 1152;
+    h.m_iFrameSize = (h.m_iSamplesPerFrame / 8) * h.m_iBitrate * 1000 / h.m_iSampleRate + (bPadding ? 1 : 0);
+  }
+
+  if (version == 1)
+    h.m_iSideInfoSize = bMono ? 17 : 32;
+  else
+    h.m_iSideInfoSize = bMono ? 9 : 17;
+
+  return true;
+}
+
+/// \brief Computes the duration from the first MPEG audio frame.
+static bool ReadMpegDuration(FileReader& file, qint64 audioStart, qint64 audioEnd, int& out_iLengthInMS)
+{
+  // the first frame may be preceded by some garbage or padding
+  const QByteArray data = file.ReadAt(audioStart, 8192);
+  const char* p = data.data();
+
+  for (int i = 0; i + 4 <= data.size(); ++i)
+  {
+    MpegHeader h;
+    if (!ParseMpegHeader(p + i, h))
+      continue;
+
+    // random data may look like a frame header, so also check that the next frame matches
+    const int next = i + h.m_iFrameSize;
+    if (next + 4 <= data.size())
+    {
+      MpegHeader nextHeader;
+      if (!ParseMpegHeader(p + next, nextHeader) || nextHeader.m_iVersion != h.m_iVersion || nextHeader.m_iLayer != h.m_iLayer || nextHeader.m_iSampleRate != h.m_iSampleRate)
+        continue;
+    }
+
+    qint64 numFrames = 0;
+
+    // variable bit rate files written by LAME and others store the number of frames in a Xing (or Info) header
+    const int xing = i + 4 + h.m_iSideInfoSize;
+    if (xing + 12 <= data.size() && (memcmp(p + xing, "Xing", 4) == 0 || memcmp(p + xing, "Info", 4) == 0))
+    {
+      if (ReadBE32(p + xing + 4) & 0x01)
+      {
+        numFrames = ReadBE32(p + xing + 8);
+      }
+    }
+
+    // Fraunhofer's encoder uses a VBRI header instead
+    const int vbri = i + 4 + 32;
+    if (numFrames == 0 && vbri + 18 <= data.size() && memcmp(p + vbri, "VBRI", 4) == 0)
+    {
+      numFrames = ReadBE32(p + vbri + 14);
+    }
+
+    if (numFrames > 0)
+    {
+      out_iLengthInMS = (int)(numFrames * h.m_iSamplesPerFrame * 1000 / h.m_iSampleRate);
+    }
+    else
+    {
+      // constant bit rate
+      out_iLengthInMS = (int)((audioEnd - (audioStart + i)) * 8 / h.m_iBitrate);
+    }
+
+    return true;
+  }
+
+  return false;
+}
+
+static bool ReadMp3(FileReader& file, FileTags& tags)
+{
+  qint64 audioStart = 0;
+
+  if (!ParseId3v2(file, tags, audioStart))
+    return false;
+
+  qint64 audioEnd = file.GetSize();
+
+  if (ParseId3v1(file, tags))
+  {
+    audioEnd -= 128;
+  }
+
+  return ReadMpegDuration(file, audioStart, audioEnd, tags.m_iLengthInMS);
+}
+
+/// \brief Finds the child box with the given type in the content of an MP4 box.
+static bool FindMp4Box(const char* p, qint64 size, const char* szType, const char*& out_pContent, qint64& out_iContentSize)
+{
+  qint64 pos = 0;
+
+  while (pos + 8 <= size)
+  {
+    qint64 boxSize = ReadBE32(p + pos);
+    qint64 headerSize = 8;
+
+    if (boxSize == 1)
+    {
+      if (pos + 16 > size)
+        return false;
+
+      boxSize = (qint64)ReadBE64(p + pos + 8);
+      headerSize = 16;
+    }
+    else if (boxSize == 0)
+    {
+      boxSize = size - pos;
+    }
+
+    if (boxSize < headerSize || pos + boxSize > size)
+      return false;
+
+    if (memcmp(p + pos + 4, szType, 4) == 0)
+    {
+      out_pContent = p + pos + headerSize;
+      out_iContentSize = boxSize - headerSize;
+      return true;
+    }
+
+    pos += boxSize;
+  }
+
+  return false;
+}
+
+/// \brief Returns the value of an item in the ilst box, which is stored in a 'data' box.
+static QByteArray GetMp4ItemData(const char* pList, qint64 listSize, const char* szItem)
+{
+  const char* pItem = nullptr;
+  qint64 itemSize = 0;
+  const char* pData = nullptr;
+  qint64 dataSize = 0;
+
+  if (!FindMp4Box(pList, listSize, szItem, pItem, itemSize) || !FindMp4Box(pItem, itemSize, "data", pData, dataSize))
+    return QByteArray();
+
+  // skip the type and the locale
+  if (dataSize < 8)
+    return QByteArray();
+
+  return QByteArray(pData + 8, (int)(dataSize - 8));
+}
+
+static bool ReadMp4(FileReader& file, FileTags& tags)
+{
+  // the moov box may be in front of or behind the audio data, only the box headers are read to find it
+  QByteArray moov;
+  qint64 pos = 0;
+
+  while (pos + 8 <= file.GetSize())
+  {
+    const QByteArray header = file.ReadAt(pos, 16);
+    if (header.size() < 8)
+      return false;
+
+    qint64 boxSize = ReadBE32(header.data());
+    qint64 headerSize = 8;
+
+    if (boxSize == 1)
+    {
+      if (header.size() < 16)
+        return false;
+
+      boxSize = (qint64)ReadBE64(header.data() + 8);
+      headerSize = 16;
+    }
+    else if (boxSize == 0)
+    {
+      boxSize = file.GetSize() - pos;
+    }
+
+    if (boxSize < headerSize)
+      return false;
+
+    if (memcmp(header.data() + 4, "moov", 4) == 0)
+    {
+      // the metadata should never be this large, something is odd about this file
+      if (boxSize > 64 * 1024 * 1024)
+        return false;
+
+      moov = file.ReadAt(pos + headerSize, boxSize - headerSize);
+
+      if (moov.size() != boxSize - headerSize)
+        return false;
+
+      break;
+    }
+
+    pos += boxSize;
+  }
+
+  const char* pMovieHeader = nullptr;
+  qint64 movieHeaderSize = 0;
+
+  if (!FindMp4Box(moov.data(), moov.size(), "mvhd", pMovieHeader, movieHeaderSize) || movieHeaderSize < 32)
+    return false;
+
+  // version 1 uses 64 bit times and durations
+  const bool bVersion1 = pMovieHeader[0] == 1;
+  const quint32 timeScale = ReadBE32(pMovieHeader + (bVersion1 ? 20 : 12));
+  const quint64 duration = bVersion1 ? ReadBE64(pMovieHeader + 24) : ReadBE32(pMovieHeader + 16);
+
+  if (timeScale == 0)
+    return false;
+
+  tags.m_iLengthInMS = (int)(duration * 1000 / timeScale);
+
+  const char* pUserData = nullptr;
+  qint64 userDataSize = 0;
+  const char* pMeta = nullptr;
+  qint64 metaSize = 0;
+  const char* pList = nullptr;
+  qint64 listSize = 0;
+
+  // files without metadata are fine
+  if (!FindMp4Box(moov.data(), moov.size(), "udta", pUserData, userDataSize) || !FindMp4Box(pUserData, userDataSize, "meta", pMeta, metaSize))
+    return true;
+
+  // 'meta' is usually a full box (with version and flags), but QuickTime writes it without
+  if (metaSize >= 8 && memcmp(pMeta + 4, "hdlr", 4) != 0)
+  {
+    pMeta += 4;
+    metaSize -= 4;
+  }
+
+  if (!FindMp4Box(pMeta, metaSize, "ilst", pList, listSize))
+    return true;
+
+  // item names start with the copyright sign in ISO-8859-1 (octal 251)
+  SetTagField(tags, TagField::Title, QString::fromUtf8(GetMp4ItemData(pList, listSize, "\251nam")));
+  SetTagField(tags, TagField::Artist, QString::fromUtf8(GetMp4ItemData(pList, listSize, "\251ART")));
+  SetTagField(tags, TagField::Album, QString::fromUtf8(GetMp4ItemData(pList, listSize, "\251alb")));
+  SetTagField(tags, TagField::Year, QString::fromUtf8(GetMp4ItemData(pList, listSize, "\251day")));
+
+  // track number and total number of tracks as 16 bit integers, behind 2 reserved bytes
+  const QByteArray track = GetMp4ItemData(pList, listSize, "trkn");
+  if (track.size() >= 4)
+  {
+    tags.m_iTrackNumber = ReadBE16(track.data() + 2);
+  }
+
+  return true;
+}
+
+bool ReadFileTagsNative(const QString& sFile, const QByteArray& fileHead, FileTags& out_Tags)
+{
+  out_Tags = FileTags();
+
+  FileReader file(sFile, fileHead);
+
+  if (!file.Open())
+    return false;
+
+  const QByteArray start = file.ReadAt(0, 12);
+
+  if (start.size() >= 8 && memcmp(start.data() + 4, "ftyp", 4) == 0)
+  {
+    return ReadMp4(file, out_Tags);
+  }
+
+  if (!sFile.endsWith(".mp3", Qt::CaseInsensitive))
+    return false;
+
+  return ReadMp3(file, out_Tags);
+}
+
+bool ReadFileTagsTagLib(const QString& sFile, FileTags& out_Tags)
+{
+  out_Tags = FileTags();
+
+#ifdef Q_OS_WIN32
+  TagLib::FileRef file(sFile.toStdWString().data());
+#else
+  TagLib::FileRef file(sFile.toUtf8().data());
+#endif
+
+  const TagLib::Tag* tag = file.tag();
+
+  if (file.audioProperties() != nullptr)
+    out_Tags.m_iLengthInMS = file.audioProperties()->lengthInMilliseconds();
+
+  if (tag == nullptr)
+    return false;
+
+  if (!tag->title().isNull() && !tag->title().isEmpty())
+    out_Tags.m_sTitle = tag->title().toCString(true);
+
+  if (!tag->artist().isNull() && !tag->artist().isEmpty())
+    out_Tags.m_sArtist = tag->artist().toCString(true);
+
+  if (!tag->album().isNull() && !tag->album().isEmpty())
+    out_Tags.m_sAlbum = tag->album().toCString(true);
+
+  out_Tags.m_iTrackNumber = tag->track();
+  out_Tags.m_iYear = tag->year();
+
+  return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Misc/Common.h"
+#include <QByteArray>
+
+/// \brief The metadata of a music file that is stored in the library.
+struct FileTags
+{
+  QString m_sTitle;
+  QString m_sArtist;
+  QString m_sAlbum;
+  int m_iTrackNumber = 0;
+  int m_iYear = 0;
+  int m_iLengthInMS = 0;
+};
+
+/// \brief Reads the tags and the duration of MP3 and MP4 files directly from the file data, without going through TagLib.
+///
+/// Supports ID3v2.2 - 2.4 and ID3v1 tags, and iTunes style MP4 metadata (moov/udta/meta/ilst).
+/// The duration is taken from the Xing or VBRI header, the mvhd box, or estimated from the bit rate of constant bit rate MP3s.
+/// Only the parts of the file that contain metadata are read. \a fileHead may contain the first bytes of the file,
+/// if they have been read already (e.g. for computing the song GUID), they are not read again.
+///
+/// Returns false, if the file format or a feature used in it is not supported (e.g. unsynchronised or compressed ID3v2 frames).
+/// The caller should fall back to TagLib in that case.
+bool ReadFileTagsNative(const QString& sFile, const QByteArray& fileHead, FileTags& out_Tags);
+
+/// \brief Reads the tags through TagLib, which supports many more formats and special cases than ReadFileTagsNative(), but is much slower.
+bool ReadFileTagsTagLib(const QString& sFile, FileTags& out_Tags);
@@ -1,4 +1,5 @@
 #include "Misc/Song.h"
+#include "Misc/TagReader.h"
 #include <QFileInfo>
 #include <QString>
 #include <taglib/fileref.h>
@@ -74,23 +75,20 @@ void SongInfo::Clear()
   m_iLengthInMS = 0;
 }
 
-bool SongInfo::ReadSongInfo(const QString& sFile)
+bool SongInfo::ReadSongInfo(const QString& sFile, const QByteArray& fileHead)
 {
   Clear();
 
-#ifdef Q_OS_WIN32
-  TagLib::FileRef file(sFile.toStdWString().data());
-#else
-  TagLib::FileRef file(sFile.toUtf8().data());
-#endif
+  FileTags tags;
 
-  const TagLib::Tag* tag = file.tag();
+  // the native reader handles the common files much faster, TagLib is only needed for the unusual ones
+  const bool bHasTags = ReadFileTagsNative(sFile, fileHead, tags) || ReadFileTagsTagLib(sFile, tags);
 
   m_sTitle = QFileInfo(sFile).baseName();
 
-  m_iLengthInMS = file.audioProperties()->lengthInMilliseconds();
+  m_iLengthInMS = tags.m_iLengthInMS;
 
-  if (tag == nullptr)
+  if (!bHasTags)
     return false;
 
   if (m_sTitle[1] == '-')
@@ -101,20 +99,20 @@ bool SongInfo::ReadSongInfo(const QString& sFile)
     m_sTitle.remove(0, 2);
   }
 
-  if (!tag->title().isNull() && !tag->title().isEmpty())
-    m_sTitle = tag->title().toCString(true);
+  if (!tags.m_sTitle.isEmpty())
+    m_sTitle = tags.m_sTitle;
 
-  if (!tag->artist().isNull() && !tag->artist().isEmpty())
-    m_sArtist = tag->artist().toCString(true);
+  if (!tags.m_sArtist.isEmpty())
+    m_sArtist = tags.m_sArtist;
 
-  if (!tag->album().isNull() && !tag->album().isEmpty())
-    m_sAlbum = tag->album().toCString(true);
+  if (!tags.m_sAlbum.isEmpty())
+    m_sAlbum = tags.m_sAlbum;
 
-  if (tag->track() != 0)
-    m_iTrackNumber = tag->track();
+  if (tags.m_iTrackNumber != 0)
+    m_iTrackNumber = tags.m_iTrackNumber;
 
-  if (tag->year() != 0)
-    m_iYear = tag->year();
+  if (tags.m_iYear != 0)
+    m_iYear = tags.m_iYear;
 
   // unfortunately this does not seem to be the way to find additional information
   //if (!tag->properties().isEmpty())
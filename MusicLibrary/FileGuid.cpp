@@ -0,0 +1,353 @@
+#include "MusicLibrary/FileGuid.h"
+#include <QCryptographicHash>
+#include <QFile>
+#include <assert.h>
+#include <string.h>
+
+namespace
+{
+  /// \brief Interface for the hash function of one FileGuidVersion.
+  class FileGuidHasher
+  {
+  public:
+    virtual ~FileGuidHasher() {}
+
+    virtual void AddData(const char* pData, qint64 size) = 0;
+    virtual QString GetResult() = 0;
+  };
+
+  class Md5Hasher : public FileGuidHasher
+  {
+  public:
+    Md5Hasher()
+        : m_Hash(QCryptographicHash::Algorithm::Md5)
+    {
+    }
+
+    virtual void AddData(const char* pData, qint64 size) override { m_Hash.addData(pData, (int)size); }
+    virtual QString GetResult() override { return m_Hash.result().toHex(); }
+
+  private:
+    QCryptographicHash m_Hash;
+  };
+
+  /// \brief Streaming version of MurmurHash3_x64_128 (public domain, by Austin Appleby).
+  ///
+  /// Gives the same result as the reference implementation with seed 0, regardless of how the data is split up.
+  class Murmur3Hasher : public FileGuidHasher
+  {
+  public:
+    virtual void AddData(const char* pData, qint64 size) override
+    {
+      const quint8* pBytes = reinterpret_cast<const quint8*>(pData);
+      m_uiTotalSize += size;
+
+      // complete a block that was started by the previous call
+      if (m_iTailSize > 0)
+      {
+        const int toCopy = (int)std::min<qint64>(16 - m_iTailSize, size);
+        memcpy(m_Tail + m_iTailSize, pBytes, toCopy);
+        m_iTailSize += toCopy;
+        pBytes += toCopy;
+        size -= toCopy;
+
+        if (m_iTailSize < 16)
+          return;
+
+        ProcessBlock(m_Tail);
+        m_iTailSize = 0;
+      }
+
+      while (size >= 16)
+      {
+        ProcessBlock(pBytes);
+        pBytes += 16;
+        size -= 16;
+      }
+
+      memcpy(m_Tail, pBytes, (size_t)size);
+      m_iTailSize = (int)size;
+    }
+
+    virtual QString GetResult() override
+    {
+      quint64 h1 = m_h1;
+      quint64 h2 = m_h2;
+      quint64 k1 = 0;
+      quint64 k2 = 0;
+
+      switch (m_iTailSize)
+      {
+      case 15:
+        k2 ^= (quint64)m_Tail[14] << 48;
+        [[fallthrough]];
+      case 14:
+        k2 ^= (quint64)m_Tail[13] << 40;
+        [[fallthrough]];
+      case 13:
+        k2 ^= (quint64)m_Tail[12] << 32;
+        [[fallthrough]];
+      case 12:
+        k2 ^= (quint64)m_Tail[11] << 24;
+        [[fallthrough]];
+      case 11:
+        k2 ^= (quint64)m_Tail[10] << 16;
+        [[fallthrough]];
+      case 10:
+        k2 ^= (quint64)m_Tail[9] << 8;
+        [[fallthrough]];
+      case 9:
+        k2 ^= (quint64)m_Tail[8];
+        k2 *= c2;
+        k2 = Rotl(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        [[fallthrough]];
+      case 8:
+        k1 ^= (quint64)m_Tail[7] << 56;
+        [[fallthrough]];
+      case 7:
+        k1 ^= (quint64)m_Tail[6] << 48;
+        [[fallthrough]];
+      case 6:
+        k1 ^= (quint64)m_Tail[5] << 40;
+        [[fallthrough]];
+      case 5:
+        k1 ^= (quint64)m_Tail[4] << 32;
+        [[fallthrough]];
+      case 4:
+        k1 ^= (quint64)m_Tail[3] << 24;
+        [[fallthrough]];
+      case 3:
+        k1 ^= (quint64)m_Tail[2] << 16;
+        [[fallthrough]];
+      case 2:
+        k1 ^= (quint64)m_Tail[1] << 8;
+        [[fallthrough]];
+      case 1:
+        k1 ^= (quint64)m_Tail[0];
+        k1 *= c1;
+        k1 = Rotl(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+      }
+
+      h1 ^= m_uiTotalSize;
+      h2 ^= m_uiTotalSize;
+
+      h1 += h2;
+      h2 += h1;
+
+      h1 = FMix(h1);
+      h2 = FMix(h2);
+
+      h1 += h2;
+      h2 += h1;
+
+      // little endian byte order, like the 16 bytes that the reference implementation writes
+      QByteArray result(16, 0);
+      for (int i = 0; i < 8; ++i)
+      {
+        result[i] = (char)(h1 >> (i * 8));
+        result[8 + i] = (char)(h2 >> (i * 8));
+      }
+
+      return result.toHex();
+    }
+
+  private:
+    static const quint64 c1 = 0x87c37b91114253d5ULL;
+    static const quint64 c2 = 0x4cf5ad432745937fULL;
+
+    static quint64 Rotl(quint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    static quint64 FMix(quint64 k)
+    {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdULL;
+      k ^= k >> 33;
+      k *= 0xc4ceb9fe1a85ec53ULL;
+      k ^= k >> 33;
+      return k;
+    }
+
+    static quint64 ReadLittleEndian(const quint8* p)
+    {
+      quint64 value = 0;
+      for (int i = 7; i >= 0; --i)
+      {
+        value = (value << 8) | p[i];
+      }
+      return value;
+    }
+
+    void ProcessBlock(const quint8* pBlock)
+    {
+      quint64 k1 = ReadLittleEndian(pBlock);
+      quint64 k2 = ReadLittleEndian(pBlock + 8);
+
+      k1 *= c1;
+      k1 = Rotl(k1, 31);
+      k1 *= c2;
+      m_h1 ^= k1;
+
+      m_h1 = Rotl(m_h1, 27);
+      m_h1 += m_h2;
+      m_h1 = m_h1 * 5 + 0x52dce729;
+
+      k2 *= c2;
+      k2 = Rotl(k2, 33);
+      k2 *= c1;
+      m_h2 ^= k2;
+
+      m_h2 = Rotl(m_h2, 31);
+      m_h2 += m_h1;
+      m_h2 = m_h2 * 5 + 0x38495ab5;
+    }
+
+    quint64 m_h1 = 0;
+    quint64 m_h2 = 0;
+    quint64 m_uiTotalSize = 0;
+    quint8 m_Tail[16];
+    int m_iTailSize = 0;
+  };
+
+  std::unique_ptr<FileGuidHasher> CreateHasher(FileGuidVersion version)
+  {
+    switch (version)
+    {
+    case FileGuidVersion::Md5:
+      return std::make_unique<Md5Hasher>();
+    case FileGuidVersion::Murmur3:
+      return std::make_unique<Murmur3Hasher>();
+
+    default:
+      assert(false && "Unknown GUID version");
+    }
+
+    return nullptr;
+  }
+} // namespace
+
+static const qint64 s_iFileHeadSize = 64 * 1024;
+
+// Skips ID3 tags only, thus only works for mp3 files!
+static void AdjustRangeID3v2(const QByteArray& fileHead, qint64& rangeStart)
+{
+  if (fileHead.size() < 10)
+    return;
+
+  const char* tag = fileHead.data();
+
+  if (tag[0] != 'I' || tag[1] != 'D' || tag[2] != '3')
+    return;
+
+  const char* data = tag + 3 + 2 + 1;
+
+  // all GUID versions have to use the same range, so this must stay as it is (including the sign extension of 'char')
+  qint32 size = ((qint32)data[0] << (7 * 3)) |
+                ((qint32)data[1] << (7 * 2)) |
+                ((qint32)data[2] << 7) |
+                ((qint32)data[3]);
+
+  rangeStart = 3 + 2 + 1 + 4 + size;
+}
+
+static void AdjustRangeID3v1(QFile& file, qint64& rangeEnd)
+{
+  if (!file.seek(file.size() - 128))
+    return;
+
+  char tag[3];
+  if (file.read(tag, 3) != 3)
+    return;
+
+  if (tag[0] != 'T' || tag[1] != 'A' || tag[2] != 'G')
+    return;
+
+  rangeEnd = file.size() - 128;
+}
+
+QString ComputeFileGuid(const QString& sFilepath, QByteArray* out_pFileHead)
+{
+  std::vector<QString> guids;
+  ComputeFileGuids(sFilepath, {FileGuidVersion::Current}, guids, out_pFileHead);
+  return guids[0];
+}
+
+bool ComputeFileGuids(const QString& sFilepath, const std::vector<FileGuidVersion>& versions, std::vector<QString>& out_Guids, QByteArray* out_pFileHead)
+{
+  out_Guids.clear();
+  out_Guids.resize(versions.size());
+
+  QFile file(sFilepath);
+
+  if (!file.open(QIODevice::ReadOnly))
+    return false;
+
+  // MP3 files can have tags at the end OR the beginning,
+  // which really messes up the GUID computation when you modify metadata and the tag is changed
+  // from being at the end to being at the beginning
+  // therefore always skip the MP3 tag at the beginning, if we find it, because we know the file format for this
+
+  // the head usually contains all the tags, so the tag reader can use it as well
+  const QByteArray fileHead = file.read(s_iFileHeadSize);
+
+  if (out_pFileHead != nullptr)
+  {
+    *out_pFileHead = fileHead;
+  }
+
+  qint64 rangeStart = 0;
+  qint64 rangeEnd = file.size();
+  AdjustRangeID3v2(fileHead, rangeStart);
+  AdjustRangeID3v1(file, rangeEnd);
+
+  const qint64 fileSize = rangeEnd - rangeStart;
+
+  const qint64 blockSize = 4096 * 4;
+  const qint64 readRangeEnd = fileSize - blockSize;               // ignore the last part of the file, depending on the format, this may contain metadata, which can change
+  const qint64 fullBlocks = ((readRangeEnd - 0) / blockSize) - 2; // how much of the file we want to read, -1 because we also want to skip the start of the file, which often contains metadata
+  const qint64 readRangeStart = readRangeEnd - (fullBlocks * blockSize);
+
+  // if the file is too small, we can't properly handle it
+  if (readRangeStart < 0 || readRangeEnd < 0 || fullBlocks <= 0)
+    return false;
+
+  // skip the first n bytes, which potentially contain the song description
+  if (!file.seek(rangeStart + readRangeStart))
+    return false;
+
+  std::vector<std::unique_ptr<FileGuidHasher>> hashers;
+  for (FileGuidVersion version : versions)
+  {
+    hashers.push_back(CreateHasher(version));
+  }
+
+  // read in large chunks, the hashed range is the same as if it was read block by block
+  const qint64 chunkSize = blockSize * 64;
+  std::vector<char> buffer((size_t)chunkSize);
+
+  qint64 remaining = fullBlocks * blockSize;
+  while (remaining > 0)
+  {
+    const qint64 toRead = std::min(remaining, chunkSize);
+
+    if (file.read(buffer.data(), toRead) != toRead)
+      return false;
+
+    for (auto& pHasher : hashers)
+    {
+      pHasher->AddData(buffer.data(), toRead);
+    }
+
+    remaining -= toRead;
+  }
+
+  for (size_t i = 0; i < hashers.size(); ++i)
+  {
+    out_Guids[i] = hashers[i]->GetResult();
+  }
+
+  return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Misc/Common.h"
+#include <QByteArray>
+
+/// \brief The algorithms with which song GUIDs have been computed from file content.
+///
+/// The version of every location is stored in the database, so that GUIDs computed with an older algorithm
+/// can still be verified and mapped to the current algorithm. Never change the result of a released version, add a new one instead.
+enum class FileGuidVersion
+{
+  Md5 = 1,     ///< MD5 of the audio data. Slow, but all libraries created before version 2 use it.
+  Murmur3 = 2, ///< MurmurHash3 (x64, 128 bit) of the same audio data. Not cryptographic, but much faster and just as good for identification.
+
+  Current = Murmur3
+};
+
+/// \brief Computes the GUID of the given file with the current algorithm. Returns an empty string, if the file can't be identified.
+///
+/// If \a out_pFileHead is given, it receives the first bytes of the file, which can be passed to SongInfo::ReadSongInfo(), to not read them twice.
+QString ComputeFileGuid(const QString& sFilepath, QByteArray* out_pFileHead = nullptr);
+
+/// \brief Computes the GUID of the given file with several algorithms at once, reading the file only once.
+///
+/// \a out_Guids receives one GUID per entry in \a versions, in the same order.
+/// Returns false, if the file can't be identified, the GUIDs are empty in that case.
+bool ComputeFileGuids(const QString& sFilepath, const std::vector<FileGuidVersion>& versions, std::vector<QString>& out_Guids, QByteArray* out_pFileHead = nullptr);
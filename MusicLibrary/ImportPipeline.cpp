@@ -0,0 +1,481 @@
+#include "MusicLibrary/ImportPipeline.h"
+#include "Config/AppState.h"
+#include "MusicLibrary/FileGuid.h"
+#include "MusicLibrary/MusicLibrary.h"
+#include <QDateTime>
+#include <QDir>
+#include <QSet>
+#include <windows.h>
+
+ImportPipeline::ImportPipeline(const ImportPipelineConfig& config, Job* pJob)
+    : m_Config(config)
+    , m_pJob(pJob)
+    , m_FilterQueue(config.m_iQueueCapacity)
+    , m_HashQueue(config.m_iQueueCapacity)
+    , m_TagQueue(config.m_iQueueCapacity)
+    , m_WriteQueue(config.m_iQueueCapacity)
+{
+  const char* names[NumStages] = {"walk", "filter", "hash", "tag", "write"};
+
+  for (int i = 0; i < NumStages; ++i)
+  {
+    m_Stats[i].m_szName = names[i];
+    m_Stats[i].m_iNumFiles = 0;
+    m_Stats[i].m_iNumBytes = 0;
+    m_Stats[i].m_iActiveThreads = 0;
+  }
+}
+
+ImportPipeline::~ImportPipeline()
+{
+  for (std::thread& thread : m_Threads)
+  {
+    if (thread.joinable())
+      thread.join();
+  }
+}
+
+void ImportPipeline::Run(const QString& sFolder, bool bFullVerify)
+{
+  m_Timer.start();
+
+  // locations and directories are stored with absolute paths, all lookups have to use the same form
+  const QString sPath = QFileInfo(sFolder).absoluteFilePath();
+
+  // one query for the whole folder, the filter stage only does lookups in memory
+  MusicLibrary::GetSingleton()->GetLocationsInFolder(sPath, m_KnownLocations);
+
+  RunStage(m_Stats[Walking], 1, &m_FilterQueue, [this, sPath, bFullVerify]() { Walk(sPath, bFullVerify); });
+  RunStage(m_Stats[Filtering], m_Config.m_iFilterThreads, &m_HashQueue, [this]() { Filter(); });
+  RunStage(m_Stats[Hashing], m_Config.m_iHashThreads, &m_TagQueue, [this]() { Hash(); });
+  RunStage(m_Stats[Tagging], m_Config.m_iTagThreads, &m_WriteQueue, [this]() { ReadTags(); });
+  RunStage(m_Stats[Writing], 1, nullptr, [this]() { Write(); });
+
+  for (std::thread& thread : m_Threads)
+  {
+    thread.join();
+  }
+
+  m_Threads.clear();
+
+  // only now all files in the scanned directories are in the database
+  if (!IsCanceled())
+  {
+    StoreScanResults(sPath);
+  }
+
+  ReportStats(sPath);
+}
+
+void ImportPipeline::RunStage(StageStats& stats, int iNumThreads, BoundedQueue<ImportItem>* pOutput, std::function<void()> func)
+{
+  iNumThreads = Max(iNumThreads, 1);
+  stats.m_iActiveThreads = iNumThreads;
+
+  for (int i = 0; i < iNumThreads; ++i)
+  {
+    m_Threads.emplace_back([this, &stats, pOutput, func]() {
+      func();
+      FinishStage(stats, pOutput);
+    });
+  }
+}
+
+void ImportPipeline::FinishStage(StageStats& stats, BoundedQueue<ImportItem>* pOutput)
+{
+  // the last thread of a stage tells the next stage that no more work will arrive
+  if (--stats.m_iActiveThreads > 0)
+    return;
+
+  stats.m_iElapsedMS = m_Timer.elapsed();
+
+  if (pOutput != nullptr)
+  {
+    pOutput->Close();
+  }
+}
+
+void ImportPipeline::ReportStats(const QString& sFolder) const
+{
+  char msg[512];
+  sprintf_s(msg, 512, "Import of '%s' finished after %.1f seconds.\n", sFolder.toUtf8().data(), m_Timer.elapsed() / 1000.0);
+  OutputDebugStringA(msg);
+
+  for (int i = 0; i < NumStages; ++i)
+  {
+    const StageStats& stats = m_Stats[i];
+    const double seconds = Max((int)stats.m_iElapsedMS, 1) / 1000.0;
+    const double megaBytes = stats.m_iNumBytes / (1024.0 * 1024.0);
+
+    sprintf_s(msg, 512, "  %-6s: %7i files, %9.1f MB, %8.1f files/sec, %7.1f MB/sec\n", stats.m_szName, (int)stats.m_iNumFiles, megaBytes, stats.m_iNumFiles / seconds, megaBytes / seconds);
+    OutputDebugStringA(msg);
+  }
+
+  sprintf_s(msg, 512, "  %i files skipped in unchanged directories, %i missing files removed\n", m_iNumSkippedFiles, m_iNumMissingFiles);
+  OutputDebugStringA(msg);
+}
+
+void ImportPipeline::Walk(const QString& sFolder, bool bFullVerify)
+{
+  MusicLibrary* ml = MusicLibrary::GetSingleton();
+
+  QHash<QString, KnownDirectory> knownDirs;
+  QHash<QString, QStringList> knownSubDirs;
+
+  {
+    std::vector<KnownDirectory> dirs;
+    ml->FindDirectoriesInLocation(sFolder, dirs);
+
+    for (const KnownDirectory& dir : dirs)
+    {
+      knownDirs.insert(dir.m_sPath, dir);
+      knownSubDirs[QFileInfo(dir.m_sPath).path()].push_back(dir.m_sPath);
+    }
+  }
+
+  QSet<QString> visitedDirs;
+  std::vector<QString> dirsToVisit;
+  dirsToVisit.push_back(sFolder);
+
+  while (!IsCanceled() && !dirsToVisit.empty())
+  {
+    const QString sDir = dirsToVisit.back();
+    dirsToVisit.pop_back();
+
+    // symlinks may lead to the same directory more than once
+    if (visitedDirs.contains(sDir))
+      continue;
+
+    visitedDirs.insert(sDir);
+
+    const QFileInfo dirInfo(sDir);
+
+    if (!dirInfo.isDir())
+      continue;
+
+    const QString sModDate = QString::number(dirInfo.lastModified().toMSecsSinceEpoch());
+
+    auto itKnown = knownDirs.find(sDir);
+    if (!bFullVerify && itKnown != knownDirs.end() && itKnown.value().m_sLastModified == sModDate)
+    {
+      m_iNumSkippedFiles += itKnown.value().m_iNumChildren;
+      m_SkippedDirectories.insert(sDir);
+
+      for (const QString& sSubDir : knownSubDirs.value(sDir))
+      {
+        dirsToVisit.push_back(sSubDir);
+      }
+
+      continue;
+    }
+
+    const QDir dir(sDir);
+    const QFileInfoList entries = dir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+
+    // an empty list is also returned, if the directory can't be read; then nothing in it must be taken as deleted
+    // it keeps its old timestamp in the database, so it is listed again on the next import
+    if (entries.isEmpty() && (!dir.isReadable() || !QFileInfo::exists(sDir)))
+    {
+      m_UnlistedDirectories.push_back(sDir);
+      continue;
+    }
+
+    KnownDirectory scanned;
+    scanned.m_sPath = sDir;
+    scanned.m_sLastModified = sModDate;
+
+    for (const QFileInfo& info : entries)
+    {
+      if (info.isDir())
+      {
+        dirsToVisit.push_back(info.absoluteFilePath());
+        continue;
+      }
+
+      ++scanned.m_iNumChildren;
+
+      ImportItem item;
+      item.m_sLocation = info.absoluteFilePath();
+      m_ListedFiles.insert(item.m_sLocation);
+      item.m_sModDate = info.lastModified().toString("yyyy-MM-dd-hh-mm-ss");
+      item.m_iFileSize = info.size();
+
+      m_Stats[Walking].m_iNumFiles++;
+      m_Stats[Walking].m_iNumBytes += item.m_iFileSize;
+
+      m_FilterQueue.Push(std::move(item));
+    }
+
+    m_ScannedDirectories.push_back(scanned);
+  }
+
+  if (IsCanceled())
+    return;
+
+  for (auto it = knownDirs.begin(); it != knownDirs.end(); ++it)
+  {
+    if (!visitedDirs.contains(it.key()) && !IsInUnlistedDirectory(it.key()))
+    {
+      m_RemovedDirectories.push_back(it.key());
+    }
+  }
+}
+
+void ImportPipeline::StoreScanResults(const QString& sFolder)
+{
+  // when a network drive is offline, its files are not gone
+  const bool bFolderExists = QFileInfo(sFolder).isDir();
+
+  std::vector<QString> missingFiles;
+
+  if (bFolderExists)
+  {
+    for (auto it = m_KnownLocations.begin(); it != m_KnownLocations.end(); ++it)
+    {
+      // files in unchanged directories can't have been deleted, otherwise the directory timestamp would have changed
+      if (m_ListedFiles.contains(it.key()) || m_SkippedDirectories.contains(QFileInfo(it.key()).path()))
+        continue;
+
+      if (IsInUnlistedDirectory(it.key()))
+        continue;
+
+      missingFiles.push_back(it.key());
+    }
+  }
+
+  m_iNumMissingFiles = (int)missingFiles.size();
+
+  if (m_ScannedDirectories.empty() && m_RemovedDirectories.empty() && missingFiles.empty())
+    return;
+
+  MusicLibrary* ml = MusicLibrary::GetSingleton();
+
+  ml->BeginTransaction();
+
+  for (const QString& sLocation : missingFiles)
+  {
+    ml->RemoveSongLocation(sLocation);
+  }
+
+  for (const KnownDirectory& dir : m_ScannedDirectories)
+  {
+    ml->AddDirectory(dir);
+  }
+
+  for (const QString& sDir : m_RemovedDirectories)
+  {
+    ml->RemoveDirectory(sDir);
+  }
+
+  ml->EndTransaction();
+}
+
+bool ImportPipeline::IsInUnlistedDirectory(const QString& sPath) const
+{
+  // usually empty, or a handful of entries
+  for (const QString& sDir : m_UnlistedDirectories)
+  {
+    if (sPath.startsWith(sDir) && sPath.length() > sDir.length() && sPath[sDir.length()] == '/')
+      return true;
+  }
+
+  return false;
+}
+
+bool ImportPipeline::ImportFile(const QString& sLocation)
+{
+  const QFileInfo info(sLocation);
+
+  ImportItem item;
+  item.m_sLocation = info.absoluteFilePath();
+  item.m_sModDate = info.lastModified().toString("yyyy-MM-dd-hh-mm-ss");
+  item.m_iFileSize = info.size();
+
+  if (!NeedsImport(item))
+    return false;
+
+  if (!ComputeGuid(item))
+    return false;
+
+  item.m_Info.ReadSongInfo(item.m_sLocation, item.m_FileHead);
+
+  AddToLibrary(item);
+  return true;
+}
+
+bool ImportPipeline::NeedsImport(const ImportItem& item)
+{
+  MusicLibrary* ml = MusicLibrary::GetSingleton();
+
+  if (!ml->IsSupportedFileExtension(QFileInfo(item.m_sLocation).suffix().toUtf8().data()))
+    return false;
+
+  return ml->IsLocationModified(item.m_sLocation, item.m_sModDate);
+}
+
+bool ImportPipeline::ComputeGuid(ImportItem& item)
+{
+  MusicLibrary* ml = MusicLibrary::GetSingleton();
+
+  QString sPreviousGuid;
+  int iPreviousVersion = 0;
+
+  if (!ml->GetLocationGuid(item.m_sLocation, sPreviousGuid, iPreviousVersion) || iPreviousVersion >= (int)FileGuidVersion::Current)
+  {
+    item.m_Info.m_sSongGuid = ComputeFileGuid(item.m_sLocation, &item.m_FileHead);
+    return !item.m_Info.m_sSongGuid.isEmpty();
+  }
+
+  // the file was imported with an older algorithm, also compute that GUID in the same pass, to detect whether only the tags changed
+  const std::vector<FileGuidVersion> versions = {(FileGuidVersion)iPreviousVersion, FileGuidVersion::Current};
+  std::vector<QString> guids;
+
+  if (!ComputeFileGuids(item.m_sLocation, versions, guids, &item.m_FileHead))
+    return false;
+
+  if (guids[0] == sPreviousGuid)
+  {
+    item.m_sPreviousGuid = sPreviousGuid;
+  }
+
+  item.m_Info.m_sSongGuid = guids[1];
+  return true;
+}
+
+void ImportPipeline::AddToLibrary(const ImportItem& item)
+{
+  MusicLibrary* ml = MusicLibrary::GetSingleton();
+  const SongInfo& songInfo = item.m_Info;
+
+  if (!item.m_sPreviousGuid.isEmpty())
+  {
+    // keep the rating, play count etc. of the song
+    ml->RemapSongGuid(item.m_sPreviousGuid, songInfo.m_sSongGuid);
+  }
+
+  ml->AddSongToLibrary(songInfo.m_sSongGuid, songInfo);
+  ml->AddSongLocation(songInfo.m_sSongGuid, item.m_sLocation, item.m_sModDate, (int)FileGuidVersion::Current);
+
+  if (songInfo.m_iDiscNumber != 0)
+  {
+    // disc number is not stored in the file tag itself, but externally
+    ml->UpdateSongDiscNumber(songInfo.m_sSongGuid, songInfo.m_iDiscNumber, true);
+  }
+}
+
+void ImportPipeline::Filter()
+{
+  ImportItem item;
+  while (m_FilterQueue.Pop(item))
+  {
+    if (IsCanceled())
+      continue;
+
+    m_Stats[Filtering].m_iNumFiles++;
+    m_Stats[Filtering].m_iNumBytes += item.m_iFileSize;
+
+    if (!MusicLibrary::GetSingleton()->IsSupportedFileExtension(QFileInfo(item.m_sLocation).suffix().toUtf8().data()))
+      continue;
+
+    // m_KnownLocations is not modified anymore while the stages run
+    auto itKnown = m_KnownLocations.find(item.m_sLocation);
+    if (itKnown != m_KnownLocations.end() && itKnown.value() == item.m_sModDate)
+      continue;
+
+    m_HashQueue.Push(std::move(item));
+  }
+}
+
+void ImportPipeline::Hash()
+{
+  ImportItem item;
+  while (m_HashQueue.Pop(item))
+  {
+    if (IsCanceled())
+      continue;
+
+    const bool bIdentified = ComputeGuid(item);
+
+    m_Stats[Hashing].m_iNumFiles++;
+    m_Stats[Hashing].m_iNumBytes += item.m_iFileSize;
+
+    if (!bIdentified)
+      continue;
+
+    m_TagQueue.Push(std::move(item));
+  }
+}
+
+void ImportPipeline::ReadTags()
+{
+  ImportItem item;
+  while (m_TagQueue.Pop(item))
+  {
+    if (IsCanceled())
+      continue;
+
+    item.m_Info.ReadSongInfo(item.m_sLocation, item.m_FileHead);
+    item.m_FileHead.clear();
+
+    m_Stats[Tagging].m_iNumFiles++;
+    m_Stats[Tagging].m_iNumBytes += item.m_iFileSize;
+
+    m_WriteQueue.Push(std::move(item));
+  }
+}
+
+void ImportPipeline::Write()
+{
+  std::vector<ImportItem> batch;
+  batch.reserve(m_Config.m_iSongsPerTransaction);
+
+  ImportItem item;
+  while (m_WriteQueue.Pop(item))
+  {
+    if (IsCanceled())
+      continue;
+
+    batch.push_back(std::move(item));
+
+    if ((int)batch.size() >= m_Config.m_iSongsPerTransaction)
+    {
+      WriteBatch(batch);
+
+      // outside of the transaction, jobs with a higher priority may run now, the other stages stall on the full queues meanwhile
+      m_pJob->Checkpoint();
+    }
+  }
+
+  // also write the last partial batch, when the import got canceled
+  WriteBatch(batch);
+}
+
+void ImportPipeline::WriteBatch(std::vector<ImportItem>& batch)
+{
+  if (batch.empty())
+    return;
+
+  MusicLibrary* ml = MusicLibrary::GetSingleton();
+
+  ml->BeginTransaction();
+
+  qint64 iBatchBytes = 0;
+
+  for (const ImportItem& item : batch)
+  {
+    AddToLibrary(item);
+
+    m_Stats[Writing].m_iNumFiles++;
+    m_Stats[Writing].m_iNumBytes += item.m_iFileSize;
+    iBatchBytes += item.m_iFileSize;
+  }
+
+  ml->EndTransaction();
+
+  m_pJob->AddProcessed((qint64)batch.size(), iBatchBytes);
+  m_pJob->SetProgress(m_Stats[Writing].m_iNumFiles, m_Stats[Walking].m_iNumFiles);
+
+  batch.clear();
+
+  AppState::GetSingleton()->SongsHaveBeenImported();
+}
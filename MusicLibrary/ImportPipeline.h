@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Config/AppConfig.h"
+#include "Misc/BoundedQueue.h"
+#include "Misc/Common.h"
+#include "Misc/JobScheduler.h"
+#include "Misc/Song.h"
+#include "MusicLibrary/MusicLibrary.h"
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <atomic>
+#include <functional>
+#include <thread>
+
+/// \brief Imports all music files below a folder into the MusicLibrary, using one thread pool per processing stage.
+///
+/// The stages are:
+///  - walk: enumerates the directory tree, skipping the files of directories that did not change since the last import
+///  - filter: skips unsupported files and files that did not change since the last import
+///  - hash: computes the song GUID from the file content, and keeps the start of the file for the next stage
+///  - tag: reads title, artist, etc. from the file tags, which are mostly in the already read start of the file
+///  - write: adds the songs to the database, in batches
+///
+/// The stages are connected through bounded queues, so that reading files for hashing and parsing tags overlap,
+/// instead of keeping the disk idle while the CPU is busy and vice versa.
+/// Throughput statistics for each stage are written to the debug output once the import has finished.
+/// The pipeline runs inside a Job, which is used for cancellation and receives the number of written files as progress.
+///
+/// The timestamp of every scanned directory is stored in the database. If a directory's timestamp is unchanged on the next import,
+/// no file was added, removed or renamed inside it, so its files are not listed again. Its subdirectories are still checked,
+/// because changes inside them don't affect the timestamp of the parent. Modifying a file in place doesn't update the directory timestamp either,
+/// such changes are only picked up by a full verification.
+///
+/// All known song locations in the folder are loaded once before the import, so that checking files for modifications
+/// doesn't need a database query per file. Known locations that were neither found by the walk nor are inside an unchanged directory,
+/// have been deleted and are removed from the database once the import is finished.
+/// If a directory can't be listed (e.g. a network share that went offline during the import), its contents are unknown and stay as they are.
+class ImportPipeline
+{
+public:
+  ImportPipeline(const ImportPipelineConfig& config, Job* pJob);
+  ~ImportPipeline();
+
+  /// \brief Processes all files below \a sFolder. Blocks until everything has been written to the database or the import was canceled.
+  ///
+  /// With \a bFullVerify all directories are listed and every file's timestamp is checked, regardless of the stored directory timestamps.
+  void Run(const QString& sFolder, bool bFullVerify);
+
+  /// \brief Imports a single file right away on the calling thread. Returns true, if the file was new or modified.
+  static bool ImportFile(const QString& sLocation);
+
+private:
+  struct ImportItem
+  {
+    QString m_sLocation;
+    QString m_sModDate;
+    qint64 m_iFileSize = 0;
+    QString m_sPreviousGuid; // GUID of the location with an older FileGuidVersion, if the audio data is unchanged
+    QByteArray m_FileHead;   // read while hashing, so that the tags can be parsed without reading the file again
+    SongInfo m_Info;
+  };
+
+  static bool NeedsImport(const ImportItem& item);
+  static bool ComputeGuid(ImportItem& item);
+  static void AddToLibrary(const ImportItem& item);
+
+  struct StageStats
+  {
+    const char* m_szName = nullptr;
+    std::atomic<int> m_iNumFiles;
+    std::atomic<qint64> m_iNumBytes;
+    std::atomic<int> m_iActiveThreads;
+    qint64 m_iElapsedMS = 0;
+  };
+
+  void RunStage(StageStats& stats, int iNumThreads, BoundedQueue<ImportItem>* pOutput, std::function<void()> func);
+  void FinishStage(StageStats& stats, BoundedQueue<ImportItem>* pOutput);
+  void ReportStats(const QString& sFolder) const;
+
+  // both expect the absolute path of the folder, as it is stored in the database
+  void Walk(const QString& sFolder, bool bFullVerify);
+  void StoreScanResults(const QString& sFolder);
+  bool IsInUnlistedDirectory(const QString& sPath) const;
+  void Filter();
+  void Hash();
+  void ReadTags();
+  void Write();
+  void WriteBatch(std::vector<ImportItem>& batch);
+
+  bool IsCanceled() const { return m_pJob->IsCanceled(); }
+
+  ImportPipelineConfig m_Config;
+  Job* m_pJob = nullptr;
+  QElapsedTimer m_Timer;
+
+  BoundedQueue<ImportItem> m_FilterQueue;
+  BoundedQueue<ImportItem> m_HashQueue;
+  BoundedQueue<ImportItem> m_TagQueue;
+  BoundedQueue<ImportItem> m_WriteQueue;
+
+  enum Stage
+  {
+    Walking,
+    Filtering,
+    Hashing,
+    Tagging,
+    Writing,
+    NumStages
+  };
+
+  StageStats m_Stats[NumStages];
+  int m_iNumSkippedFiles = 0;
+  int m_iNumMissingFiles = 0;
+  std::vector<KnownDirectory> m_ScannedDirectories;
+  std::vector<QString> m_RemovedDirectories;
+
+  // scan session state: the database state of all files in the folder before the import, and what the walk found on disk
+  QHash<QString, QString> m_KnownLocations; // path -> last modification date
+  QSet<QString> m_ListedFiles;
+  QSet<QString> m_SkippedDirectories;
+  std::vector<QString> m_UnlistedDirectories; // couldn't be read, everything below them is left as it is
+  std::vector<std::thread> m_Threads;
+};
@@ -0,0 +1,304 @@
+#include "MusicLibrary/LibraryCheckpoint.h"
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+void LibraryCheckpoint::Clear()
+{
+  m_Songs.clear();
+  m_FoldedModifications.clear();
+  m_LegacyFoldedModifications.clear();
+  m_FoldedJournalFiles.clear();
+}
+
+bool LibraryCheckpoint::Load(const QString& sFile)
+{
+  Clear();
+
+  QFile file(sFile);
+  if (!file.open(QIODevice::OpenModeFlag::ReadOnly))
+    return false;
+
+  QDataStream stream(&file);
+
+  int version = 0;
+  stream >> version;
+
+  // version 1 stored GUIDs and timestamps instead of modification IDs, version 3 added the folded journal files
+  if (version < 1 || version > 3)
+    return false;
+
+  if (version >= 3)
+  {
+    stream >> m_FoldedJournalFiles;
+  }
+
+  quint32 numFolded = 0;
+  stream >> numFolded;
+
+  m_FoldedModifications.reserve((int)numFolded);
+
+  for (quint32 i = 0; i < numFolded && stream.status() == QDataStream::Ok; ++i)
+  {
+    if (version == 1)
+    {
+      char guid[16];
+      stream.readRawData(guid, 16);
+
+      // the timestamp is unknown, so the full ID is only known once the modification shows up in a journal again
+      m_LegacyFoldedModifications.insert(ModificationId::FromLegacy(QUuid::fromRfc4122(QByteArray::fromRawData(guid, 16)), 0).m_uiNode);
+    }
+    else
+    {
+      ModificationId id;
+      stream >> id.m_uiClock;
+      stream >> id.m_uiNode;
+
+      m_FoldedModifications.insert(id);
+    }
+  }
+
+  if (version >= 2)
+  {
+    quint32 numLegacy = 0;
+    stream >> numLegacy;
+
+    for (quint32 i = 0; i < numLegacy && stream.status() == QDataStream::Ok; ++i)
+    {
+      quint64 node = 0;
+      stream >> node;
+      m_LegacyFoldedModifications.insert(node);
+    }
+  }
+
+  quint32 numSongs = 0;
+  stream >> numSongs;
+
+  m_Songs.reserve((int)numSongs);
+
+  for (quint32 i = 0; i < numSongs && stream.status() == QDataStream::Ok; ++i)
+  {
+    QString sGuid;
+    stream >> sGuid;
+
+    SongState& state = m_Songs[sGuid];
+    stream >> state.m_iPlayCount;
+
+    quint8 numValues = 0;
+    stream >> numValues;
+
+    for (quint8 v = 0; v < numValues; ++v)
+    {
+      quint8 type = 0;
+      Value value;
+      stream >> type;
+      stream >> value.m_iData;
+
+      if (version == 1)
+      {
+        qint64 timestamp = 0;
+        stream >> timestamp;
+        value.m_Id.m_uiClock = timestamp > 0 ? (quint64)timestamp << 16 : 0;
+      }
+      else
+      {
+        stream >> value.m_Id.m_uiClock;
+        stream >> value.m_Id.m_uiNode;
+      }
+
+      if (type < (int)LibraryModification::Type::ENUM_COUNT)
+      {
+        state.m_Values[type] = value;
+      }
+    }
+  }
+
+  if (stream.status() != QDataStream::Ok)
+  {
+    Clear();
+    return false;
+  }
+
+  return true;
+}
+
+bool LibraryCheckpoint::Save(const QString& sFile) const
+{
+  // writes to a temporary file and renames it on commit
+  QSaveFile file(sFile);
+  if (!file.open(QIODevice::OpenModeFlag::WriteOnly))
+    return false;
+
+  QDataStream stream(&file);
+
+  const int version = 3;
+  stream << version;
+
+  stream << m_FoldedJournalFiles;
+
+  stream << (quint32)m_FoldedModifications.size();
+
+  for (const ModificationId& id : m_FoldedModifications)
+  {
+    stream << id.m_uiClock;
+    stream << id.m_uiNode;
+  }
+
+  stream << (quint32)m_LegacyFoldedModifications.size();
+
+  for (quint64 node : m_LegacyFoldedModifications)
+  {
+    stream << node;
+  }
+
+  stream << (quint32)m_Songs.size();
+
+  for (auto it = m_Songs.begin(); it != m_Songs.end(); ++it)
+  {
+    const SongState& state = it.value();
+
+    stream << it.key();
+    stream << state.m_iPlayCount;
+
+    quint8 numValues = 0;
+    for (const Value& value : state.m_Values)
+    {
+      if (value.m_Id.IsValid())
+        ++numValues;
+    }
+
+    stream << numValues;
+
+    for (int type = 0; type < (int)LibraryModification::Type::ENUM_COUNT; ++type)
+    {
+      const Value& value = state.m_Values[type];
+
+      if (!value.m_Id.IsValid())
+        continue;
+
+      stream << (quint8)type;
+      stream << value.m_iData;
+      stream << value.m_Id.m_uiClock;
+      stream << value.m_Id.m_uiNode;
+    }
+  }
+
+  if (stream.status() != QDataStream::Ok)
+  {
+    file.cancelWriting();
+    return false;
+  }
+
+  return file.commit();
+}
+
+void LibraryCheckpoint::Fold(const LibraryModification& mod, const QString& sSongGuid)
+{
+  if (mod.m_Type == LibraryModification::Type::None || m_FoldedModifications.contains(mod.m_ModId))
+    return;
+
+  m_FoldedModifications.insert(mod.m_ModId);
+
+  SongState& state = m_Songs[sSongGuid];
+
+  if (mod.m_Type == LibraryModification::Type::AddPlayDate)
+  {
+    ++state.m_iPlayCount;
+  }
+
+  Value& value = state.m_Values[(int)mod.m_Type];
+
+  if (value.m_Id < mod.m_ModId)
+  {
+    value.m_iData = mod.m_iData;
+    value.m_Id = mod.m_ModId;
+  }
+}
+
+void LibraryCheckpoint::Merge(const LibraryCheckpoint& other)
+{
+  m_FoldedModifications.unite(other.m_FoldedModifications);
+  m_LegacyFoldedModifications.unite(other.m_LegacyFoldedModifications);
+
+  for (auto it = other.m_Songs.begin(); it != other.m_Songs.end(); ++it)
+  {
+    MergeState(m_Songs[it.key()], it.value());
+  }
+}
+
+void LibraryCheckpoint::MergeState(SongState& inout_State, const SongState& other)
+{
+  inout_State.m_iPlayCount += other.m_iPlayCount;
+
+  for (int type = 0; type < (int)LibraryModification::Type::ENUM_COUNT; ++type)
+  {
+    const Value& value = other.m_Values[type];
+
+    if (inout_State.m_Values[type].m_Id < value.m_Id)
+    {
+      inout_State.m_Values[type] = value;
+    }
+  }
+}
+
+void LibraryCheckpoint::ResolveSongGuids(const std::function<QString(const QString&)>& resolve)
+{
+  QHash<QString, SongState> songs;
+  songs.reserve(m_Songs.size());
+
+  for (auto it = m_Songs.begin(); it != m_Songs.end(); ++it)
+  {
+    MergeState(songs[resolve(it.key())], it.value());
+  }
+
+  m_Songs = std::move(songs);
+}
+
+void LibraryCheckpoint::RemapSong(const QString& sOldGuid, const QString& sNewGuid)
+{
+  auto it = m_Songs.find(sOldGuid);
+
+  if (it == m_Songs.end() || sOldGuid == sNewGuid)
+    return;
+
+  const SongState state = it.value();
+  m_Songs.erase(it);
+
+  MergeState(m_Songs[sNewGuid], state);
+}
+
+void LibraryCheckpoint::ForgetFoldedModifications()
+{
+  m_FoldedModifications.clear();
+  m_LegacyFoldedModifications.clear();
+  m_FoldedJournalFiles.clear();
+}
+
+bool LibraryCheckpoint::IsOutdated(const LibraryModification& mod, const QString& sSongGuid) const
+{
+  auto it = m_Songs.find(sSongGuid);
+
+  if (it == m_Songs.end())
+    return false;
+
+  return mod.m_ModId < it.value().m_Values[(int)mod.m_Type].m_Id;
+}
+
+bool LibraryCheckpoint::HasValue(const QString& sSongGuid, LibraryModification::Type type) const
+{
+  auto it = m_Songs.find(sSongGuid);
+
+  if (it == m_Songs.end())
+    return false;
+
+  return it.value().m_Values[(int)type].m_Id.IsValid();
+}
+
+bool LibraryCheckpoint::ResolveLegacyModification(const ModificationId& modId)
+{
+  if (!m_LegacyFoldedModifications.contains(modId.m_uiNode))
+    return false;
+
+  m_FoldedModifications.insert(modId);
+  return true;
+}
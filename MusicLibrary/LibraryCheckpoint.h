@@ -0,0 +1,94 @@
+#pragma once
+
+#include "MusicLibrary/MusicLibrary.h"
+#include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <functional>
+
+/// \brief The coalesced state of all journal entries up to some point in time.
+///
+/// Without a checkpoint every startup has to replay the whole listening history. The checkpoint stores,
+/// for every song, the latest value of each property together with the ID of the modification that set it, and the number of plays.
+/// Journal entries that have been folded into it are removed from the journal, so only the entries written since have to be replayed.
+///
+/// The IDs of all folded entries are kept as well. Journal files may still contain copies of them
+/// (e.g. synced from another computer, or when the application exits before the journal was rewritten),
+/// those must neither override newer values nor be counted twice. Once the journal files that held them are gone,
+/// the IDs are not needed anymore, see ForgetFoldedModifications().
+///
+/// Every computer that shares the profile directory writes its own checkpoint, which only contains its own modifications.
+/// The checkpoints of all computers are disjoint, so they can be combined with Merge().
+///
+/// Songs are keyed by their current GUID (see MusicLibrary::ResolveSongGuid()), so that entries from before and after
+/// a GUID remap end up in the same state. Checkpoints written before a remap are brought up to date with ResolveSongGuids().
+class LibraryCheckpoint
+{
+public:
+  struct Value
+  {
+    int m_iData = 0;
+    ModificationId m_Id; // invalid if the value was never set
+  };
+
+  struct SongState
+  {
+    Value m_Values[(int)LibraryModification::Type::ENUM_COUNT]; // AddPlayDate holds the last play date
+    int m_iPlayCount = 0;
+  };
+
+  void Clear();
+
+  /// \brief Reads the checkpoint from disk. Returns false and leaves the checkpoint empty, if the file doesn't exist or is broken.
+  bool Load(const QString& sFile);
+
+  /// \brief Writes the checkpoint to disk. The file is replaced atomically, so it is never left half written.
+  bool Save(const QString& sFile) const;
+
+  /// \brief Merges the modification into the state of the song with the current GUID \a sSongGuid. Does nothing, if it has been folded before.
+  void Fold(const LibraryModification& mod, const QString& sSongGuid);
+
+  /// \brief Adds the state of another computer's checkpoint. Play counts are summed up, for every value the newer one wins.
+  void Merge(const LibraryCheckpoint& other);
+
+  /// \brief Moves the state of every song to the GUID that \a resolve returns for it, combining states that end up at the same GUID.
+  void ResolveSongGuids(const std::function<QString(const QString&)>& resolve);
+
+  /// \brief Moves the state of a song to its new GUID, after MusicLibrary::RemapSongGuid().
+  void RemapSong(const QString& sOldGuid, const QString& sNewGuid);
+
+  /// \brief Drops the IDs of all folded modifications, but keeps the state. Only allowed once no journal file contains them anymore.
+  void ForgetFoldedModifications();
+
+  /// \brief The journal files (relative to the library directory) that still contained folded modifications, when the checkpoint was written.
+  const QStringList& GetFoldedJournalFiles() const { return m_FoldedJournalFiles; }
+  void SetFoldedJournalFiles(const QStringList& files) { m_FoldedJournalFiles = files; }
+
+  /// \brief Whether the modification has been folded into the checkpoint.
+  bool Contains(const ModificationId& modId) const { return m_FoldedModifications.contains(modId); }
+
+  /// \brief Whether the checkpoint holds a newer value for the same property of the song with the current GUID \a sSongGuid, so the modification must not be applied.
+  bool IsOutdated(const LibraryModification& mod, const QString& sSongGuid) const;
+
+  /// \brief Whether the checkpoint holds any value for the given property of the song with the current GUID \a sSongGuid.
+  bool HasValue(const QString& sSongGuid, LibraryModification::Type type) const;
+
+  const QHash<QString, SongState>& GetSongs() const { return m_Songs; }
+  const QSet<ModificationId>& GetFoldedModifications() const { return m_FoldedModifications; }
+
+  /// \brief Whether the checkpoint was written before modification IDs existed, and still has folded modifications that are only known by their GUID.
+  bool HasLegacyModifications() const { return !m_LegacyFoldedModifications.isEmpty(); }
+
+  /// \brief Checks whether the modification was folded into a checkpoint of version 1. If so, its ID is added to the folded modifications.
+  ///
+  /// Version 1 only stored the GUIDs, but the ID of a modification from an old journal is derived from its GUID (see ModificationId::FromLegacy()).
+  bool ResolveLegacyModification(const ModificationId& modId);
+
+private:
+  static void MergeState(SongState& inout_State, const SongState& other);
+
+  QHash<QString, SongState> m_Songs;
+  QSet<ModificationId> m_FoldedModifications;
+  QSet<quint64> m_LegacyFoldedModifications; // the node part of the legacy IDs
+  QStringList m_FoldedJournalFiles;
+};
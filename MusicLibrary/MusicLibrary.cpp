@@ -1,18 +1,61 @@
 #include "MusicLibrary/MusicLibrary.h"
 #include "Config/AppConfig.h"
 #include "Config/AppState.h"
+#include "Misc/BackgroundThrottle.h"
+#include "Misc/JobScheduler.h"
+#include "MusicLibrary/FileGuid.h"
+#include "MusicLibrary/LibraryCheckpoint.h"
+#include "Playlists/Smart/SmartPlaylistProgram.h"
 #include <QDataStream>
 #include <QDirIterator>
-#include <QtConcurrent/QtConcurrentRun>
+#include <QElapsedTimer>
+#include <QMessageBox>
+#include <QSet>
+#include <QTimer>
+#include <QtConcurrent/QtConcurrentMap>
+#include <algorithm>
 #include <assert.h>
 #include <windows.h>
 
 MusicLibrary* MusicLibrary::s_Singleton = nullptr;
 
+/// \brief The number of journal entries from which on they are folded into the checkpoint.
+static const int s_iCheckpointThreshold = 1000;
+
+/// \brief The song properties that journal entries change, in the order of the columns of the journal_staging table.
+static const int s_iNumJournalColumns = 6;
+static const std::pair<LibraryModification::Type, SongColumn> s_JournalColumns[s_iNumJournalColumns] = {
+  {LibraryModification::Type::SetRating, SongColumn::Rating},
+  {LibraryModification::Type::SetVolume, SongColumn::Volume},
+  {LibraryModification::Type::SetStartOffset, SongColumn::StartOffset},
+  {LibraryModification::Type::SetEndOffset, SongColumn::EndOffset},
+  {LibraryModification::Type::SetDiscNumber, SongColumn::DiscNumber},
+  {LibraryModification::Type::AddPlayDate, SongColumn::LastPlayed},
+};
+
+/// \brief The number of open transactions of the calling thread. Decides when the thread sends SongsChanged(), see FlushSongChanges().
+static thread_local int s_iThreadTransactionDepth = 0;
+
+static int GetJournalColumnIndex(LibraryModification::Type type)
+{
+  for (int idx = 0; idx < s_iNumJournalColumns; ++idx)
+  {
+    if (s_JournalColumns[idx].first == type)
+      return idx;
+  }
+
+  return -1;
+}
+
 MusicLibrary::MusicLibrary()
 {
   s_Singleton = this;
 
+  m_pCheckpoint = std::make_unique<LibraryCheckpoint>();
+  m_pOwnCheckpoint = std::make_unique<LibraryCheckpoint>();
+
+  connect(&m_JournalWatchTimer, &QTimer::timeout, this, &MusicLibrary::onJournalWatchTimer);
+
   AddSupportedFileExtension("mp3");
   AddSupportedFileExtension("mp4");
   AddSupportedFileExtension("m4a");
@@ -25,6 +68,7 @@ MusicLibrary::~MusicLibrary()
   s_Singleton = nullptr;
 }
 
+/// \brief Replaces SQLite's UPPER, which only converts ASCII characters.
 static void SqliteToUpper(sqlite3_context* context, int argc, sqlite3_value** argv)
 {
   if (argc == 1)
@@ -55,32 +99,81 @@ void MusicLibrary::Startup(const QString& sAppDir)
     (void)i;
   }
 
-  if (!CreateTable())
+  sqlite3_create_function(m_pSongDatabase, "UPPER", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, SqliteToUpper, nullptr, nullptr);
+
+  m_Statements.Startup(m_pSongDatabase);
+
+  const SchemaResult schema = CreateTable();
+
+  if (schema == SchemaResult::Incompatible)
   {
-    // version changed
+    // the database is too old (or too new) to be upgraded
     Shutdown();
 
     if (QFile::remove(sDatabase))
     {
       Startup(sAppDir);
+      return;
     }
+
+    OutputDebugStringA("The incompatible library database could not be removed.\n");
   }
+  else if (schema == SchemaResult::UpgradeFailed)
+  {
+    // never delete the library because of an upgrade failure, it may work with another build (e.g. one with FTS5)
+    Shutdown();
 
-  connect(AppState::GetSingleton(), &AppState::BusyWorkActive, this, &MusicLibrary::onBusyWorkChanged);
-  connect(AppConfig::GetSingleton(), &AppConfig::ProfileDirectoryChanged, this, &MusicLibrary::onProfileDirectoryChanged);
+    QMessageBox::warning(nullptr, "Form1", QString("The music library '%1' could not be upgraded.\nIt is left untouched, but can't be used by this version.").arg(QDir::toNativeSeparators(sDatabase)));
+    return;
+  }
 
-  sqlite3_create_function(m_pSongDatabase, "UPPER", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr, SqliteToUpper, nullptr, nullptr);
+  if (m_pSongDatabase != nullptr)
+  {
+    // only lives as long as the connection, it is used to apply the journal in bulk
+    SqlQuery(m_Statements, "CREATE TEMP TABLE IF NOT EXISTS journal_staging (id TEXT NOT NULL, rating INTEGER, volume INTEGER, start INTEGER, end INTEGER, disc INTEGER, lastplayed INTEGER, PRIMARY KEY(id))").Execute();
+  }
+
+  connect(JobScheduler::GetSingleton(), &JobScheduler::BusyChanged, this, &MusicLibrary::onBusyWorkChanged, Qt::UniqueConnection);
+  connect(AppConfig::GetSingleton(), &AppConfig::ProfileDirectoryChanged, this, &MusicLibrary::onProfileDirectoryChanged, Qt::UniqueConnection);
+
+  LoadGuidRemaps();
+  LoadSongStore();
+  StartJournalWatch();
+
+  // the journal has to be applied once per session, but only after the music sources have queued their scans,
+  // so that it is applied to the imported songs
+  m_bMaintenanceNeeded = true;
+  QTimer::singleShot(0, this, &MusicLibrary::ScheduleMaintenance);
 }
 
 void MusicLibrary::Shutdown()
 {
+  m_JournalWatchTimer.stop();
+  m_JournalWatcher.CloseDirectory();
+  m_PendingJournalFiles.clear();
+
   SaveUserState();
 
-  m_bWorkersActive = false;
+  for (std::shared_ptr<Job>* ppJob : {&m_pMaintenanceJob, &m_pRestoreJob, &m_pJournalMergeJob})
+  {
+    if (*ppJob)
+    {
+      (*ppJob)->Cancel();
+      (*ppJob)->Wait();
+      ppJob->reset();
+    }
+  }
+
+  m_Statements.Shutdown();
+
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+    m_SongStore.Clear();
+  }
 
-  if (m_WorkerTask.isRunning())
   {
-    m_WorkerTask.waitForFinished();
+    std::lock_guard<std::mutex> lock(m_GuidRemapMutex);
+    m_GuidRemap.clear();
   }
 
   if (m_pSongDatabase != nullptr)
@@ -98,11 +191,11 @@ void MusicLibrary::SaveUserState()
   if (!m_Recorder.m_bRecordedModifcations)
     return;
 
-  {
-    const QString dt = QDateTime::currentDateTimeUtc().toString("yyyy-MM-dd-hh-mm-ss");
-    const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/library/";
-    const QString sLibFile = sDir + dt + ".f1l";
+  const QString dt = QDateTime::currentDateTimeUtc().toString("yyyy-MM-dd-hh-mm-ss");
+  const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/library/";
+  const QString sLibFile = QDir::cleanPath(sDir + dt + "-" + AppConfig::GetSingleton()->GetDeviceId() + JournalFile::GetLibraryExtension());
 
+  {
     QDir().mkdir(sDir);
 
     QFile file(sLibFile);
@@ -112,444 +205,1193 @@ void MusicLibrary::SaveUserState()
     QDataStream stream(&file);
 
     m_Recorder.CoalesceEntries();
-    m_Recorder.Save(stream);
+    m_Recorder.Save(stream, [this](const LibraryModification& mod) { return !m_ForeignModifications.contains(mod.m_ModId); });
   }
 
   for (const QString& s : m_LibFilesToDeleteOnSave)
   {
+    // saving twice within one second writes to the same file
+    if (s == sLibFile)
+      continue;
+
     QFile::remove(s);
+    m_MergedJournalFiles.remove(s);
   }
 
   m_LibFilesToDeleteOnSave.clear();
+
+  // the file contains everything that is known now, so it must not be merged again, and the next save replaces it
+  m_MergedJournalFiles[sLibFile] = QFileInfo(sLibFile).lastModified();
+  m_LibFilesToDeleteOnSave.push_back(sLibFile);
 }
 
-void MusicLibrary::LoadUserState()
+void MusicLibrary::LoadUserState(Job& job)
 {
   const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/library/";
   QDir().mkpath(sDir);
 
-  QDirIterator dirIt(sDir, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
-
-  bool bMoreThanOneFile = false;
-  while (dirIt.hasNext())
-  {
-    if (!m_bWorkersActive)
-      return;
-
-    dirIt.next();
-
-    const QFileInfo fileInfo = dirIt.fileInfo();
+  // must be loaded first, so that journal entries that are already part of it are skipped
+  LoadCheckpoint();
 
-    if (fileInfo.isDir())
-      continue;
+  std::vector<QString> libraryFiles;
+  FindJournalFiles(libraryFiles);
 
-    const QString sLibraryFile = fileInfo.absoluteFilePath();
+  if (!job.Checkpoint())
+    return;
 
-    if (!sLibraryFile.endsWith(".f1l", Qt::CaseInsensitive))
-      continue;
+  std::vector<LibraryModification> added;
+  MergeJournalFiles(libraryFiles, added);
 
-    LoadLibraryFile(sLibraryFile);
+  if (!job.Checkpoint())
+    return;
 
-    if (bMoreThanOneFile)
-    {
-      m_Recorder.m_bRecordedModifcations = true;
-    }
+  // using a transaction to update the DB in one go speeds this up by a huge factor
+  BeginTransaction();
 
-    bMoreThanOneFile = true;
+  {
+    std::lock_guard<std::mutex> lock(m_RecorderMutex);
+    ApplyJournal();
   }
 
-  // using a transaction to update the DB in one go speeds this up by a huge factor
-  SqlExec("BEGIN IMMEDIATE TRANSACTION", nullptr, nullptr);
-
-  std::lock_guard<std::mutex> lock(m_RecorderMutex);
-  m_Recorder.ApplyAll(this);
+  EndTransaction();
+}
 
-  SqlExec("END TRANSACTION", nullptr, nullptr);
+QString MusicLibrary::GetCheckpointFile() const
+{
+  return AppConfig::GetSingleton()->GetProfileDirectory() + "/library/checkpoint-" + AppConfig::GetSingleton()->GetDeviceId() + ".f1c";
 }
 
-void MusicLibrary::LoadLibraryFile(const QString& sPath)
+void MusicLibrary::LoadCheckpoint()
 {
-  QFile file(sPath);
-  if (!file.open(QIODevice::OpenModeFlag::ReadOnly))
-    return;
+  const QString sOwnFile = GetCheckpointFile();
+  const QDir dir(AppConfig::GetSingleton()->GetProfileDirectory() + "/library/");
 
   std::lock_guard<std::mutex> lock(m_RecorderMutex);
 
-  m_LibFilesToDeleteOnSave.push_back(sPath);
-
-  QDataStream stream(&file);
-
-  m_Recorder.LoadAdditional(stream);
-}
+  m_pOwnCheckpoint->Load(sOwnFile);
+  *m_pCheckpoint = *m_pOwnCheckpoint;
 
-void MusicLibrary::onBusyWorkChanged(bool active)
-{
-  if (active == false)
-  {
-    m_bWorkersActive = true;
-    m_WorkerTask = QtConcurrent::run(this, &MusicLibrary::CleanupThread);
-  }
-  else
+  // the checkpoints of the other computers only contain their own modifications, so adding them up doesn't count anything twice
+  for (const QString& sName : dir.entryList(QStringList() << "checkpoint*.f1c", QDir::Files))
   {
-    m_bWorkersActive = false;
+    const QString sFile = dir.absoluteFilePath(sName);
+
+    if (QFileInfo(sFile) == QFileInfo(sOwnFile))
+      continue;
 
-    if (m_WorkerTask.isRunning())
+    LibraryCheckpoint other;
+    if (other.Load(sFile))
     {
-      m_WorkerTask.waitForFinished();
+      m_pCheckpoint->Merge(other);
     }
   }
-}
-
-void MusicLibrary::onProfileDirectoryChanged()
-{
-  {
-    std::lock_guard<std::mutex> lock(m_RecorderMutex);
-
-    // do not delete the files in the previous directory
-    m_LibFilesToDeleteOnSave.clear();
 
-    // save the state to the new directory now
-    m_Recorder.m_bRecordedModifcations = true;
-  }
+  // the checkpoints may have been written before some songs got a new GUID
+  auto resolve = [this](const QString& sGuid) { return ResolveSongGuid(sGuid); };
+  m_pOwnCheckpoint->ResolveSongGuids(resolve);
+  m_pCheckpoint->ResolveSongGuids(resolve);
 
-  SaveUserState();
+  // another computer may have folded modifications that were merged from its journal before
+  m_Recorder.RemoveModifications(m_pCheckpoint->GetFoldedModifications());
+  m_Recorder.AddKnownModifications(m_pCheckpoint->GetFoldedModifications());
 }
 
-void MusicLibrary::SqlExec(const QString& stmt, int (*callback)(void*, int, char**, char**), void* userData) const
+void MusicLibrary::FindJournalFiles(std::vector<QString>& out_Files) const
 {
-  char* szErrMsg = nullptr;
-  auto ret = sqlite3_exec(m_pSongDatabase, stmt.toUtf8().data(), callback, userData, &szErrMsg);
-
-  if (ret != SQLITE_OK && ret != SQLITE_ABORT)
-  {
-    char msg[512];
-    sprintf_s(msg, 512, "SQL error: %s\n", szErrMsg);
-    sqlite3_free(szErrMsg);
+  const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/library/";
 
-    OutputDebugStringA(msg);
-  }
-}
+  QDirIterator dirIt(sDir, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
 
-void MusicLibrary::CleanupThread()
-{
-  LoadUserState();
+  while (dirIt.hasNext())
+  {
+    dirIt.next();
 
-  // terminate the thread function as early as possible if m_bWorkersActive is set to false
+    const QFileInfo fileInfo = dirIt.fileInfo();
 
-  if (m_bWorkersActive)
-  {
-    UpdateSongPlayCount();
-  }
+    if (fileInfo.isDir())
+      continue;
 
-  if (m_bWorkersActive)
-  {
-    RestoreFromDatabase();
-  }
+    const QString sLibraryFile = fileInfo.absoluteFilePath();
 
-  if (m_bWorkersActive)
-  {
-    CleanUpLocations();
-  }
+    if (!JournalFile::IsLibraryJournal(sLibraryFile))
+      continue;
 
-  if (m_bWorkersActive)
-  {
-    CleanUpSongs();
+    out_Files.push_back(sLibraryFile);
   }
-
-  m_bWorkersActive = false;
 }
 
-void MusicLibrary::SetSearchText(const QString& text)
+bool MusicLibrary::IsOwnJournalFile(const QString& sPath) const
 {
-  if (m_sSearchText == text)
-    return;
-
-  m_sSearchText = text;
+  if (!sPath.endsWith(JournalFile::GetLibraryExtension(), Qt::CaseInsensitive))
+    return true;
 
-  emit SearchTextChanged(m_sSearchText);
+  return QFileInfo(sPath).completeBaseName().endsWith("-" + AppConfig::GetSingleton()->GetDeviceId(), Qt::CaseInsensitive);
 }
 
-void MusicLibrary::AddSupportedFileExtension(const char* szExtension)
+void MusicLibrary::ApplyJournal(const QSet<QString>* pSongs /*= nullptr*/)
 {
-  QString sExt = szExtension;
-  sExt = sExt.toLower();
-
-  auto it = std::find(m_MusicFileExtensions.begin(), m_MusicFileExtensions.end(), sExt);
+  // the recorder mutex is locked by the caller
 
-  if (it == m_MusicFileExtensions.end())
+  struct FinalValues
   {
-    m_MusicFileExtensions.push_back(sExt);
-  }
-}
-
-bool MusicLibrary::IsSupportedFileExtension(const char* szExtension) const
-{
-  QString sExt = szExtension;
-  sExt = sExt.toLower();
-
-  auto it = std::find(m_MusicFileExtensions.begin(), m_MusicFileExtensions.end(), sExt);
+    int m_iValues[s_iNumJournalColumns] = {};
+    bool m_bSet[s_iNumJournalColumns] = {};
+    ModificationId m_Ids[s_iNumJournalColumns];
+  };
 
-  return it != m_MusicFileExtensions.end();
-}
+  QElapsedTimer timer;
+  timer.start();
 
-inline static bool IsNull(const char* sz)
-{
-  return sz == nullptr;
-}
+  // collapse the whole history to the final value of every property, keyed by the current song GUID
+  QHash<QString, FinalValues> finalValues;
+  int iNumEntries = 0;
 
-static void RetrieveSongData(SongInfo& s, char** values)
-{
-  s.m_sSongGuid = values[0];
-  s.m_sTitle = IsNull(values[1]) ? "<invalid>" : values[1];
-  s.m_sArtist = IsNull(values[2]) ? "" : values[2];
-  s.m_sAlbum = IsNull(values[3]) ? "" : values[3];
-  s.m_iDiscNumber = IsNull(values[4]) ? 0 : QString(values[4]).toInt();
-  s.m_iTrackNumber = IsNull(values[5]) ? 0 : QString(values[5]).toInt();
-  s.m_iYear = IsNull(values[6]) ? 0 : QString(values[6]).toInt();
-  s.m_iLengthInMS = IsNull(values[7]) ? 0 : QString(values[7]).toInt();
-  s.m_iRating = QString(values[8]).toInt();
-  s.m_iVolume = QString(values[9]).toInt();
-  s.m_iStartOffset = QString(values[10]).toInt();
-  s.m_iEndOffset = QString(values[11]).toInt();
-  s.m_iLastPlayed = IsNull(values[12]) ? -1 : QString(values[12]).toInt();
-  s.m_iDateAdded = IsNull(values[13]) ? -1 : QString(values[13]).toInt();
-  s.m_iPlayCount = QString(values[14]).toInt();
+  auto setValue = [&](const QString& sGuid, LibraryModification::Type type, int value, const ModificationId& id) {
+    const int idx = GetJournalColumnIndex(type);
 
-  if (values[15] != nullptr)
-    s.m_sLastPlayed = values[15];
+    if (idx < 0)
+      return;
 
-  if (values[16] != nullptr)
-    s.m_sDateAdded = values[16];
-}
+    const QString sSongGuid = ResolveSongGuid(sGuid);
 
-static int RetrieveSongArray(void* result, int numColumns, char** values, char** columnNames)
-{
-  SongInfo s;
-  RetrieveSongData(s, values);
+    if (pSongs != nullptr && !pSongs->contains(sSongGuid))
+      return;
 
-  std::deque<SongInfo>* allSongs = (std::deque<SongInfo>*)result;
-  allSongs->push_back(s);
-  return 0;
-}
+    FinalValues& values = finalValues[sSongGuid];
+    ++iNumEntries;
 
-static int RetrieveSongGuidArray(void* result, int numColumns, char** values, char** columnNames)
-{
-  std::deque<QString>* allSongs = (std::deque<QString>*)result;
-  allSongs->push_back(values[0]);
-  return 0;
-}
+    // after a GUID remap the same song can have entries under its old and its new GUID, the newest one wins
+    if (values.m_bSet[idx] && !(values.m_Ids[idx] < id))
+      return;
 
-static int RetrieveSong(void* result, int numColumns, char** values, char** columnNames)
-{
-  SongInfo& s = *(SongInfo*)result;
-  RetrieveSongData(s, values);
-  return 0;
-}
+    values.m_iValues[idx] = value;
+    values.m_bSet[idx] = true;
+    values.m_Ids[idx] = id;
+  };
 
-bool MusicLibrary::FindSong(const QString& songGuid, SongInfo& song) const
-{
-  std::lock_guard<std::mutex> lock(m_CacheMutex);
+  // the checkpoint holds the state of the whole history, only the journal entries written since have to be replayed
+  const QHash<QString, LibraryCheckpoint::SongState>& songs = m_pCheckpoint->GetSongs();
 
-  for (size_t i = 0; i < m_songInfoCache.size(); ++i)
+  for (auto it = songs.begin(); it != songs.end(); ++it)
   {
-    if (m_songInfoCache[i].m_sSongGuid == songGuid)
+    for (int type = 0; type < (int)LibraryModification::Type::ENUM_COUNT; ++type)
     {
-      song = m_songInfoCache[i];
-      return true;
+      const LibraryCheckpoint::Value& value = it.value().m_Values[type];
+
+      if (value.m_Id.IsValid())
+      {
+        setValue(it.key(), (LibraryModification::Type)type, value.m_iData, value.m_Id);
+      }
     }
   }
 
-  QString sql = QString("SELECT *" //id, title, artist, album, disc, track, year, length, rating, volume, start, end, lastplayed, dateadded, playcount"
-                        ", strftime('%Y-%m-%d %H:%M', lastplayed, 'unixepoch', 'localtime') AS playedstring"
-                        ", strftime('%Y-%m-%d %H:%M', dateadded, 'unixepoch', 'localtime') AS addedstring"
-                        " FROM music WHERE id = '%1'")
-                    .arg(songGuid);
+  m_Recorder.ForEach([&](const LibraryModification& mod) {
+    if (!m_pCheckpoint->IsOutdated(mod, ResolveSongGuid(mod.m_sSongGuid)))
+    {
+      setValue(mod.m_sSongGuid, mod.m_Type, mod.m_iData, mod.m_ModId);
+    }
+  });
 
-  song.m_sSongGuid = QString();
-  SqlExec(sql, RetrieveSong, &song);
+  // most values are in the database already, only write those that differ
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
 
-  const bool bFound = !song.m_sSongGuid.isEmpty();
-  song.m_sSongGuid = songGuid;
+    for (auto it = finalValues.begin(); it != finalValues.end();)
+    {
+      const int row = m_SongStore.FindRow(it.key());
+      bool bAnyChange = false;
 
-  if (bFound)
-  {
-    if (m_songInfoCache.size() > 31)
-      m_songInfoCache.pop_front();
+      for (int idx = 0; idx < s_iNumJournalColumns && row >= 0; ++idx)
+      {
+        FinalValues& values = it.value();
 
-    m_songInfoCache.push_back(song);
-  }
+        if (values.m_bSet[idx] && m_SongStore.GetInt(row, s_JournalColumns[idx].second) == values.m_iValues[idx])
+        {
+          values.m_bSet[idx] = false;
+        }
 
-  return bFound;
-}
+        bAnyChange |= values.m_bSet[idx];
+      }
 
-std::deque<SongInfo> MusicLibrary::GetAllSongs(bool bUseSearchString) const
-{
-  std::deque<SongInfo> allSongs;
+      if (bAnyChange)
+        ++it;
+      else
+        it = finalValues.erase(it);
+    }
+  }
 
-  if (m_pSongDatabase)
+  if (!finalValues.isEmpty())
   {
-    QString sql = "SELECT *"
-                  ", strftime('%Y-%m-%d %H:%M', lastplayed, 'unixepoch', 'localtime') AS playedstring"
-                  ", strftime('%Y-%m-%d %H:%M', dateadded, 'unixepoch', 'localtime') AS addedstring"
-                  " FROM music ORDER BY artist, album, disc, track";
+    // one prepared INSERT per song into the staging table, then a single UPDATE for all of them
+    SqlQuery(m_Statements, SqlStatement::ClearJournalStaging).Execute();
 
-    if (bUseSearchString && !m_sSearchText.isEmpty())
+    for (auto it = finalValues.begin(); it != finalValues.end(); ++it)
     {
-      char tmp[128];
+      SqlQuery query(m_Statements, SqlStatement::StageJournalValues);
+      query.Bind(1, it.key());
 
-      QStringList pieces = m_sSearchText.split(' ', QString::SkipEmptyParts);
-
-      QString condition;
-
-      for (const QString& piece : pieces)
+      for (int idx = 0; idx < s_iNumJournalColumns; ++idx)
       {
-        if (!condition.isEmpty())
-          condition.append(" AND ");
-
-        sqlite3_snprintf(127, tmp, "%q", piece.toUtf8().data());
-        condition.append(QString("(UPPER(title) LIKE UPPER('%%%1%%') OR UPPER(artist) LIKE UPPER('%%%1%%') OR UPPER(album) LIKE UPPER('%%%1%%'))").arg(tmp));
+        if (it.value().m_bSet[idx])
+          query.Bind(2 + idx, it.value().m_iValues[idx]);
+        else
+          query.BindNull(2 + idx);
       }
 
-      sql = QString("SELECT *"
-                    ", strftime('%Y-%m-%d %H:%M', lastplayed, 'unixepoch', 'localtime') AS playedstring"
-                    ", strftime('%Y-%m-%d %H:%M', dateadded, 'unixepoch', 'localtime') AS addedstring"
-                    " FROM music WHERE %1"
-                    " ORDER BY artist, album, disc, track")
-                .arg(condition);
+      query.Execute();
     }
 
-    SqlExec(sql, RetrieveSongArray, &allSongs);
+    SqlQuery(m_Statements, SqlStatement::ApplyJournalStaging).Execute();
+    SqlQuery(m_Statements, SqlStatement::ClearJournalStaging).Execute();
+
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+
+    for (auto it = finalValues.begin(); it != finalValues.end(); ++it)
+    {
+      for (int idx = 0; idx < s_iNumJournalColumns; ++idx)
+      {
+        if (it.value().m_bSet[idx])
+        {
+          m_SongStore.SetInt(it.key(), s_JournalColumns[idx].second, it.value().m_iValues[idx]);
+        }
+      }
+    }
   }
 
-  return std::move(allSongs);
+  char msg[512];
+  sprintf_s(msg, 512, "Applied %i journal values, %i songs changed, in %i ms.\n", iNumEntries, (int)finalValues.size(), (int)timer.elapsed());
+  OutputDebugStringA(msg);
 }
 
-std::deque<QString> MusicLibrary::GetAllSongGuids(bool bUseSearchString) const
+void MusicLibrary::WriteCheckpoint()
 {
-  std::deque<QString> allSongs;
+  const QString sFile = GetCheckpointFile();
+  const QDir dir(AppConfig::GetSingleton()->GetProfileDirectory() + "/library/");
+
+  LibraryCheckpoint checkpoint;
+  std::vector<LibraryModification> foldedMods;
+  QSet<ModificationId> folded;
 
-  if (m_pSongDatabase)
   {
-    QString sql = "SELECT id FROM music";
+    std::lock_guard<std::mutex> lock(m_RecorderMutex);
 
-    if (bUseSearchString && !m_sSearchText.isEmpty())
+    // only this computer's modifications are folded, the other computers fold theirs into their own checkpoints
+    for (const LibraryModification& mod : m_Recorder.GetAllModifications())
     {
-      char tmp[128];
+      if (!m_ForeignModifications.contains(mod.m_ModId))
+      {
+        foldedMods.push_back(mod);
+      }
+    }
 
-      QStringList pieces = m_sSearchText.split(' ', QString::SkipEmptyParts);
+    if ((int)foldedMods.size() < s_iCheckpointThreshold)
+      return;
 
-      QString condition;
+    checkpoint = *m_pOwnCheckpoint;
 
-      for (const QString& piece : pieces)
-      {
-        if (!condition.isEmpty())
-          condition.append(" AND ");
+    // the IDs of the previously folded modifications are only needed, as long as the journal files that contained them exist
+    // this keeps the set from growing with the whole history
+    const QStringList& previousFiles = checkpoint.GetFoldedJournalFiles();
+    if (std::none_of(previousFiles.begin(), previousFiles.end(), [&dir](const QString& sFile) { return dir.exists(sFile); }))
+    {
+      checkpoint.ForgetFoldedModifications();
+    }
 
-        sqlite3_snprintf(127, tmp, "%q", piece.toUtf8().data());
-        condition.append(QString("(UPPER(title) LIKE UPPER('%%%1%%') OR UPPER(artist) LIKE UPPER('%%%1%%') OR UPPER(album) LIKE UPPER('%%%1%%'))").arg(tmp));
-      }
+    for (const LibraryModification& mod : foldedMods)
+    {
+      checkpoint.Fold(mod, ResolveSongGuid(mod.m_sSongGuid));
+      folded.insert(mod.m_ModId);
+    }
 
-      sql = QString("SELECT id FROM music WHERE %1"
-                    " ORDER BY artist, album, disc, track")
-                .arg(condition);
+    // all of them are deleted on the next save
+    QStringList journalFiles;
+    for (const QString& sJournal : m_LibFilesToDeleteOnSave)
+    {
+      journalFiles.push_back(dir.relativeFilePath(sJournal));
     }
 
-    SqlExec(sql, RetrieveSongGuidArray, &allSongs);
+    checkpoint.SetFoldedJournalFiles(journalFiles);
   }
 
-  return std::move(allSongs);
-}
-
-std::deque<SongInfo> MusicLibrary::LookupSongs(const QString& where, const QString& orderBy) const
-{
-  std::deque<SongInfo> allSongs;
-
-  if (m_pSongDatabase)
+  // writing the file doesn't block recording new modifications
+  if (!checkpoint.Save(sFile))
   {
-    QString sql = QString("SELECT *"
-                          ", strftime('%Y-%m-%d %H:%M', lastplayed, 'unixepoch', 'localtime') AS playedstring"
-                          ", strftime('%Y-%m-%d %H:%M', dateadded, 'unixepoch', 'localtime') AS addedstring"
-                          " FROM music");
+    OutputDebugStringA("Writing the library checkpoint failed.\n");
+    return;
+  }
 
-    if (!where.isEmpty())
-      sql += QString(" WHERE %1").arg(where);
+  std::lock_guard<std::mutex> lock(m_RecorderMutex);
 
-    if (!orderBy.isEmpty())
-      sql += QString(" ORDER BY %1").arg(orderBy);
+  *m_pOwnCheckpoint = std::move(checkpoint);
 
-    SqlExec(sql, RetrieveSongArray, &allSongs);
+  for (const LibraryModification& mod : foldedMods)
+  {
+    m_pCheckpoint->Fold(mod, ResolveSongGuid(mod.m_sSongGuid));
   }
 
-  return std::move(allSongs);
+  // the journal is written without the folded entries on the next save, the old journal files are deleted then
+  m_Recorder.RemoveModifications(folded);
+  m_Recorder.m_bRecordedModifcations = true;
 }
 
-void MusicLibrary::CountSongPlayed(const QString& sGuid)
+void MusicLibrary::onBusyWorkChanged(bool active)
 {
-  // set last play date (and increment counter)
+  if (active)
   {
-    QString sql = QString("UPDATE music SET lastplayed = (strftime('%s','now')), playcount = playcount + 1 WHERE id = '%1'")
-                      .arg(sGuid);
-
-    SqlExec(sql, nullptr, nullptr);
+    // imports change the library, the clean up has to run again once they are finished
+    m_bMaintenanceNeeded = true;
   }
-
-  // read back current value
-  SongInfo song;
-
-  // record last play date
-  if (FindSong(sGuid, song))
+  else
   {
-    LibraryModification mod;
-    mod.m_sSongGuid = sGuid;
-    mod.m_Type = LibraryModification::Type::AddPlayDate;
-    mod.m_iData = song.m_iLastPlayed;
-
-    std::lock_guard<std::mutex> lock(m_RecorderMutex);
-
-    m_Recorder.AddModification(mod, this);
+    ScheduleMaintenance();
   }
 }
 
-static int RetrieveTableVersion(void* result, int numColumns, char** values, char** columnNames)
+void MusicLibrary::ScheduleMaintenance()
 {
-  int* pVersion = (int*)result;
-
-  *pVersion = QString(values[0]).toInt();
-  return 0;
-}
+  if (!m_bMaintenanceNeeded || m_pSongDatabase == nullptr || JobScheduler::GetSingleton()->IsBusy())
+    return;
 
-bool MusicLibrary::CreateTable()
-{
-  if (m_pSongDatabase == nullptr)
-    return true;
+  // called again by the restore job, once the running clean up is finished
+  if (m_pMaintenanceJob && !m_pMaintenanceJob->IsFinished())
+    return;
 
-  const int iCurrentVersion = 9;
+  m_bMaintenanceNeeded = false;
 
+  // the restore job starts from scratch after the clean up anyway
+  if (m_pRestoreJob)
   {
-    const char* sql = "CREATE TABLE IF NOT EXISTS details (version INTEGER NOT NULL)";
-
-    SqlExec(sql, nullptr, nullptr);
+    m_pRestoreJob->Cancel();
+  }
 
-    int iTableVersion = -1;
+  JobScheduler* pScheduler = JobScheduler::GetSingleton();
 
-    // check if there is a version number stored
-    SqlExec("SELECT version FROM details", RetrieveTableVersion, &iTableVersion);
+  // the user waits for the play counts and ratings, so the journal is applied even while music is playing
+  // the clean up doesn't start before this is finished, because jobs with a lower priority wait for it
+  m_pJournalMergeJob = pScheduler->Schedule("Apply library journal", JobPriority::JournalMerge, QString(), [this](Job& job) {
+    LoadUserState(job);
 
-    if (iTableVersion == -1) // nothing stored
+    if (job.Checkpoint())
     {
-      iTableVersion = iCurrentVersion;
+      UpdateSongPlayCount(job);
+    }
+  });
 
-      const QString qsql = QString("INSERT INTO details (version) VALUES('%1')").arg(iCurrentVersion);
+  m_pMaintenanceJob = pScheduler->Schedule("Library maintenance", JobPriority::Cleanup, QString(), [this](Job& job) { MaintenanceJob(job); });
 
-      SqlExec(qsql, nullptr, nullptr);
-    }
+  m_pRestoreJob = pScheduler->Schedule("Restore journal from database", JobPriority::JournalRestore, QString(), [this](Job& job) {
+    RestoreFromDatabase(job);
 
-    if (iTableVersion != iCurrentVersion)
-      return false;
-  }
+    // imports that happened in the meantime may need another clean up
+    QMetaObject::invokeMethod(this, "ScheduleMaintenance", Qt::QueuedConnection);
+  });
+}
 
+void MusicLibrary::onProfileDirectoryChanged()
+{
   {
-    const char* sql = "CREATE TABLE IF NOT EXISTS music "
+    std::lock_guard<std::mutex> lock(m_RecorderMutex);
+
+    // do not delete the files in the previous directory
+    m_LibFilesToDeleteOnSave.clear();
+    m_MergedJournalFiles.clear();
+
+    // save the state to the new directory now
+    m_Recorder.m_bRecordedModifcations = true;
+
+    // the files of the other computers stay in the previous directory, so this computer takes over their history
+    m_ForeignModifications.clear();
+    *m_pOwnCheckpoint = *m_pCheckpoint;
+    m_pOwnCheckpoint->SetFoldedJournalFiles(QStringList());
+
+    // the journal doesn't contain the history that has been folded into the checkpoint
+    const QString sCheckpointFile = GetCheckpointFile();
+    QDir().mkpath(QFileInfo(sCheckpointFile).path());
+
+    if (!m_pOwnCheckpoint->GetSongs().isEmpty())
+    {
+      m_pOwnCheckpoint->Save(sCheckpointFile);
+    }
+  }
+
+  SaveUserState();
+  StartJournalWatch();
+}
+
+void MusicLibrary::MergeJournalFiles(const std::vector<QString>& files, std::vector<LibraryModification>& out_Added)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  // the modification time is the high-water mark of every file, a file is only decoded again, if it has been rewritten since
+  std::vector<std::pair<QString, QDateTime>> newFiles;
+
+  {
+    std::lock_guard<std::mutex> lock(m_RecorderMutex);
+
+    for (const QString& sFile : files)
+    {
+      const QFileInfo fileInfo(sFile);
+
+      if (!fileInfo.exists())
+        continue;
+
+      const QString sPath = QDir::cleanPath(fileInfo.absoluteFilePath());
+      const QDateTime lastModified = fileInfo.lastModified();
+
+      auto it = m_MergedJournalFiles.find(sPath);
+      if (it != m_MergedJournalFiles.end() && it.value() == lastModified)
+        continue;
+
+      newFiles.push_back(std::make_pair(sPath, lastModified));
+    }
+  }
+
+  if (newFiles.empty())
+    return;
+
+  std::vector<std::unique_ptr<JournalFile>> journals;
+  std::vector<QDataStream*> ownStreams;
+  std::vector<QDataStream*> foreignStreams;
+  std::vector<std::pair<QString, QDateTime>> ownFiles;
+  std::vector<std::pair<QString, QDateTime>> foreignFiles;
+
+  for (const auto& file : newFiles)
+  {
+    std::unique_ptr<JournalFile> pFile = std::make_unique<JournalFile>();
+
+    // e.g. locked by a sync client, it is tried again when it changes or on the next start
+    if (!pFile->Open(file.first))
+      continue;
+
+    if (IsOwnJournalFile(file.first))
+    {
+      ownStreams.push_back(&pFile->GetStream());
+      ownFiles.push_back(file);
+    }
+    else
+    {
+      foreignStreams.push_back(&pFile->GetStream());
+      foreignFiles.push_back(file);
+    }
+
+    journals.push_back(std::move(pFile));
+  }
+
+  // decoding and merging the files takes a while, the journal is only locked to add the result
+  std::vector<LibraryModification> ownAdded;
+  std::vector<LibraryModification> foreignAdded;
+  std::vector<bool> ownComplete;
+  std::vector<bool> foreignComplete;
+  ModificationRecorder<LibraryModification, MusicLibrary*>::DecodeAndMerge(ownStreams, ownAdded, &ownComplete);
+  ModificationRecorder<LibraryModification, MusicLibrary*>::DecodeAndMerge(foreignStreams, foreignAdded, &foreignComplete);
+
+  // files that couldn't be read completely (still being written, or from a newer version) must not be deleted, and are merged again once they change
+  newFiles.clear();
+  for (size_t i = 0; i < ownFiles.size(); ++i)
+  {
+    if (ownComplete[i])
+      newFiles.push_back(ownFiles[i]);
+  }
+  for (size_t i = 0; i < foreignFiles.size(); ++i)
+  {
+    if (foreignComplete[i])
+      newFiles.push_back(foreignFiles[i]);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_RecorderMutex);
+
+    // checkpoints written before modification IDs existed only know the GUIDs of the folded modifications
+    if (m_pCheckpoint->HasLegacyModifications())
+    {
+      QSet<ModificationId> folded;
+
+      for (const std::vector<LibraryModification>* pAdded : {&ownAdded, &foreignAdded})
+      {
+        for (const LibraryModification& mod : *pAdded)
+        {
+          if (m_pCheckpoint->ResolveLegacyModification(mod.m_ModId))
+          {
+            folded.insert(mod.m_ModId);
+          }
+        }
+      }
+
+      m_Recorder.AddKnownModifications(folded);
+    }
+
+    // if a modification is in both, it stays with this computer
+    m_Recorder.Splice(ownAdded);
+    m_Recorder.Splice(foreignAdded);
+
+    for (const LibraryModification& mod : foreignAdded)
+    {
+      m_ForeignModifications.insert(mod.m_ModId);
+    }
+
+    out_Added.insert(out_Added.end(), ownAdded.begin(), ownAdded.end());
+    out_Added.insert(out_Added.end(), foreignAdded.begin(), foreignAdded.end());
+
+    for (const auto& file : newFiles)
+    {
+      m_MergedJournalFiles[file.first] = file.second;
+
+      // the other computers delete their files themselves, once they have rewritten or folded them
+      if (!IsOwnJournalFile(file.first))
+        continue;
+
+      if (std::find(m_LibFilesToDeleteOnSave.begin(), m_LibFilesToDeleteOnSave.end(), file.first) == m_LibFilesToDeleteOnSave.end())
+      {
+        m_LibFilesToDeleteOnSave.push_back(file.first);
+      }
+    }
+
+    // if there are two or more files, write them into one at the next save
+    if (m_LibFilesToDeleteOnSave.size() > 1)
+    {
+      m_Recorder.m_bRecordedModifcations = true;
+    }
+  }
+
+  char msg[256];
+  sprintf_s(msg, 256, "Merged %i library journal files (%i new entries) in %i ms.\n", (int)newFiles.size(), (int)out_Added.size(), (int)timer.elapsed());
+  OutputDebugStringA(msg);
+}
+
+void MusicLibrary::StartJournalWatch()
+{
+  m_JournalWatchTimer.stop();
+  m_JournalWatcher.CloseDirectory();
+  m_PendingJournalFiles.clear();
+
+  const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/library/";
+  QDir().mkpath(sDir);
+
+  if (m_JournalWatcher.OpenDirectory(sDir, ezDirectoryWatcher::Writes | ezDirectoryWatcher::Creates | ezDirectoryWatcher::Renames | ezDirectoryWatcher::Subdirectories))
+  {
+    m_JournalWatchTimer.start(1000);
+  }
+}
+
+void MusicLibrary::onJournalWatchTimer()
+{
+  const qint64 now = QDateTime::currentMSecsSinceEpoch();
+  const QString sDir = AppConfig::GetSingleton()->GetProfileDirectory() + "/library/";
+
+  bool bEventsLost = false;
+
+  m_JournalWatcher.EnumerateChanges([this, now, &sDir, &bEventsLost](const QString& filename, ezDirectoryWatcherAction action) {
+    if (action == ezDirectoryWatcherAction::EventsLost)
+      bEventsLost = true;
+
+    if (action == ezDirectoryWatcherAction::Removed || action == ezDirectoryWatcherAction::RenamedOldName || action == ezDirectoryWatcherAction::EventsLost)
+      return;
+
+    if (!JournalFile::IsLibraryJournal(filename))
+      return;
+
+    m_PendingJournalFiles[QDir::cleanPath(sDir + QDir::fromNativeSeparators(filename))] = now;
+  });
+
+  if (bEventsLost)
+  {
+    // any file may have changed, those that didn't are skipped by their modification time
+    std::vector<QString> files;
+    FindJournalFiles(files);
+
+    for (const QString& sFile : files)
+    {
+      m_PendingJournalFiles[QDir::cleanPath(sFile)] = now;
+    }
+  }
+
+  if (m_PendingJournalFiles.isEmpty() || (m_pJournalMergeJob && !m_pJournalMergeJob->IsFinished()))
+    return;
+
+  // sync clients often write a file in several steps, wait until it settles down
+  const qint64 settleTime = 2000;
+
+  std::vector<QString> files;
+
+  for (auto it = m_PendingJournalFiles.begin(); it != m_PendingJournalFiles.end();)
+  {
+    if (now - it.value() >= settleTime)
+    {
+      files.push_back(it.key());
+      it = m_PendingJournalFiles.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  if (!files.empty())
+  {
+    m_pJournalMergeJob = JobScheduler::GetSingleton()->Schedule("Merge synchronized journals", JobPriority::JournalMerge, JobScheduler::GetDeviceOfPath(sDir), [this, files](Job& job) { MergeSyncedJournals(job, files); });
+  }
+}
+
+void MusicLibrary::MergeSyncedJournals(Job& job, const std::vector<QString>& files)
+{
+  if (!m_pSongDatabase)
+    return;
+
+  std::vector<LibraryModification> added;
+  MergeJournalFiles(files, added);
+
+  if (added.empty() || !job.Checkpoint())
+    return;
+
+  // only the songs that the new modifications refer to can change
+  QSet<QString> songs;
+  bool bNewPlays = false;
+
+  for (const LibraryModification& mod : added)
+  {
+    songs.insert(ResolveSongGuid(mod.m_sSongGuid));
+    bNewPlays |= (mod.m_Type == LibraryModification::Type::AddPlayDate);
+  }
+
+  job.AddProcessed((qint64)added.size(), 0);
+
+  BeginTransaction();
+
+  {
+    std::lock_guard<std::mutex> lock(m_RecorderMutex);
+    ApplyJournal(&songs);
+  }
+
+  EndTransaction();
+
+  if (bNewPlays && job.Checkpoint())
+  {
+    UpdateSongPlayCount(job);
+  }
+}
+
+void MusicLibrary::MaintenanceJob(Job& job)
+{
+  // every step is stopped as early as possible when the job gets canceled, and yields to imports in between
+  // the journal has been applied by a job with a higher priority before
+
+  if (job.Checkpoint())
+  {
+    WriteCheckpoint();
+  }
+
+  if (job.Checkpoint())
+  {
+    CleanUpLocations(job);
+  }
+
+  if (job.Checkpoint())
+  {
+    CleanUpSongs();
+  }
+
+  if (job.Checkpoint())
+  {
+    MigrateSongGuids(job);
+  }
+}
+
+void MusicLibrary::SetSearchText(const QString& text)
+{
+  if (m_sSearchText == text)
+    return;
+
+  m_sSearchText = text;
+
+  emit SearchTextChanged(m_sSearchText);
+}
+
+void MusicLibrary::AddSupportedFileExtension(const char* szExtension)
+{
+  QString sExt = szExtension;
+  sExt = sExt.toLower();
+
+  auto it = std::find(m_MusicFileExtensions.begin(), m_MusicFileExtensions.end(), sExt);
+
+  if (it == m_MusicFileExtensions.end())
+  {
+    m_MusicFileExtensions.push_back(sExt);
+  }
+}
+
+bool MusicLibrary::IsSupportedFileExtension(const char* szExtension) const
+{
+  QString sExt = szExtension;
+  sExt = sExt.toLower();
+
+  auto it = std::find(m_MusicFileExtensions.begin(), m_MusicFileExtensions.end(), sExt);
+
+  return it != m_MusicFileExtensions.end();
+}
+
+/// \brief Returns QString() for NULL and a non-null string for all text, even if it is empty.
+static QString GetNullableText(const SqlQuery& query, int column)
+{
+  if (query.IsNull(column))
+    return QString();
+
+  const QString sText = query.GetText(column);
+  return sText.isNull() ? QString("") : sText;
+}
+
+/// \brief With \a bKeepNullStrings the title, artist and album are read with GetNullableText(), which is what SongStore needs
+/// to evaluate smart playlist queries the same way as the database.
+static void RetrieveSongData(SongInfo& s, const SqlQuery& query, bool bKeepNullStrings = false)
+{
+  // column indices follow SQL_SONG_COLUMNS
+  s.m_sSongGuid = query.GetText(0);
+  s.m_sTitle = (query.IsNull(1) && !bKeepNullStrings) ? QString("<invalid>") : GetNullableText(query, 1);
+  s.m_sArtist = GetNullableText(query, 2);
+  s.m_sAlbum = GetNullableText(query, 3);
+  s.m_iDiscNumber = query.GetInt(4);
+  s.m_iTrackNumber = query.GetInt(5);
+  s.m_iYear = query.GetInt(6);
+  s.m_iLengthInMS = query.GetInt(7);
+  s.m_iRating = query.GetInt(8);
+  s.m_iVolume = query.GetInt(9);
+  s.m_iStartOffset = query.GetInt(10);
+  s.m_iEndOffset = query.GetInt(11);
+  s.m_iLastPlayed = query.IsNull(12) ? -1 : query.GetInt(12);
+  s.m_iDateAdded = query.IsNull(13) ? -1 : query.GetInt(13);
+  s.m_iPlayCount = query.GetInt(14);
+  s.m_sLastPlayed = query.GetText(15);
+  s.m_sDateAdded = query.GetText(16);
+}
+
+bool MusicLibrary::FindSong(const QString& songGuid, SongInfo& song) const
+{
+  // playlists may still refer to a song by an outdated GUID
+  const QString sCurrentGuid = ResolveSongGuid(songGuid);
+
+  std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+
+  const bool bFound = m_SongStore.GetSong(sCurrentGuid, song);
+  song.m_sSongGuid = songGuid;
+
+  return bFound;
+}
+
+quint64 MusicLibrary::FindSongs(const std::vector<QString>& songGuids, std::vector<SongInfo>& out_Songs, std::vector<bool>& out_Found) const
+{
+  std::vector<QString> currentGuids;
+  currentGuids.reserve(songGuids.size());
+
+  for (const QString& sGuid : songGuids)
+  {
+    currentGuids.push_back(ResolveSongGuid(sGuid));
+  }
+
+  out_Songs.resize(songGuids.size());
+  out_Found.resize(songGuids.size());
+
+  std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+
+  for (size_t i = 0; i < songGuids.size(); ++i)
+  {
+    out_Found[i] = m_SongStore.GetSong(currentGuids[i], out_Songs[i]);
+    out_Songs[i].m_sSongGuid = songGuids[i];
+  }
+
+  return SongStore::GetRevision();
+}
+
+void MusicLibrary::LoadSongStore()
+{
+  SongStore store;
+  store.Reserve(GetNumSongsInDatabase());
+
+  {
+    SqlQuery query(m_Statements, "SELECT " SQL_SONG_COLUMNS " FROM music");
+
+    SongInfo si;
+    while (query.Step())
+    {
+      RetrieveSongData(si, query, true);
+      store.SetSong(si);
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+
+  // clearing first increases the revision, so that cached song data is fetched again
+  m_SongStore.Clear();
+  m_SongStore = std::move(store);
+  m_uiReloadRevision = SongStore::GetRevision();
+
+  // every song would be reported as added, but all playlists are refreshed after a reload anyway
+  QHash<QString, unsigned int> changes;
+  m_SongStore.TakeChanges(changes);
+}
+
+void MusicLibrary::ReloadSongFromDatabase(const QString& sGuid)
+{
+  SongInfo si;
+  bool bFound = false;
+
+  {
+    SqlQuery query(m_Statements, SqlStatement::FindSong);
+    query.Bind(1, sGuid);
+
+    if (query.Step())
+    {
+      RetrieveSongData(si, query, true);
+      bFound = true;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+
+    if (bFound)
+      m_SongStore.SetSong(si);
+    else
+      m_SongStore.RemoveSong(sGuid);
+  }
+
+  FlushSongChanges();
+}
+
+/// \brief Builds a WHERE condition that requires every search word to appear in the title, artist or album.
+///
+/// Words with at least three characters are found through the trigram index of the music_search table.
+/// Shorter words can't use the index and fall back to LIKE on the same table. LIKE only folds ASCII characters,
+/// so both sides go through the Unicode aware UPPER function that Startup() registers.
+static QString BuildSearchCondition(const QStringList& pieces)
+{
+  QString condition;
+  int iParam = 1;
+
+  for (const QString& piece : pieces)
+  {
+    if (piece.length() >= 3)
+    {
+      condition = "music_search MATCH ?1";
+      iParam = 2;
+      break;
+    }
+  }
+
+  for (const QString& piece : pieces)
+  {
+    if (piece.length() >= 3)
+      continue;
+
+    if (!condition.isEmpty())
+      condition.append(" AND ");
+
+    condition.append(QString("(UPPER(title) LIKE UPPER(?%1) OR UPPER(artist) LIKE UPPER(?%1) OR UPPER(album) LIKE UPPER(?%1))").arg(iParam));
+    ++iParam;
+  }
+
+  return QString("rowid IN (SELECT rowid FROM music_search WHERE %1)").arg(condition);
+}
+
+/// \brief Binds the parameters for the condition that BuildSearchCondition() returned.
+static void BindSearchPieces(SqlQuery& query, const QStringList& pieces)
+{
+  QString match;
+
+  for (QString piece : pieces)
+  {
+    if (piece.length() < 3)
+      continue;
+
+    if (!match.isEmpty())
+      match.append(" ");
+
+    // each word is a quoted FTS5 string, so that no character in it is interpreted as an operator
+    piece.replace("\"", "\"\"");
+    match.append("\"" + piece + "\"");
+  }
+
+  int iParam = 1;
+
+  if (!match.isEmpty())
+  {
+    query.Bind(iParam, match);
+    ++iParam;
+  }
+
+  for (const QString& piece : pieces)
+  {
+    if (piece.length() >= 3)
+      continue;
+
+    query.Bind(iParam, "%" + piece + "%");
+    ++iParam;
+  }
+}
+
+int MusicLibrary::GetNumSongs() const
+{
+  std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+  return m_SongStore.GetNumSongs();
+}
+
+int MusicLibrary::GetNumSongsInDatabase() const
+{
+  SqlQuery query(m_Statements, SqlStatement::CountSongs);
+
+  if (!query.Step())
+    return 0;
+
+  return query.GetInt(0);
+}
+
+std::vector<SongInfo> MusicLibrary::GetAllSongs(bool bUseSearchString) const
+{
+  std::vector<SongInfo> allSongs;
+
+  if (m_pSongDatabase)
+  {
+    QStringList pieces;
+
+    if (bUseSearchString && !m_sSearchText.isEmpty())
+    {
+      pieces = m_sSearchText.split(' ', QString::SkipEmptyParts);
+    }
+    else
+    {
+      allSongs.reserve(GetNumSongs());
+    }
+
+    QString sql = "SELECT " SQL_SONG_COLUMNS " FROM music";
+
+    if (!pieces.isEmpty())
+    {
+      sql += QString(" WHERE %1").arg(BuildSearchCondition(pieces));
+    }
+
+    sql += " ORDER BY artist, album, disc, track";
+
+    SqlQuery query(m_Statements, sql);
+    BindSearchPieces(query, pieces);
+
+    while (query.Step())
+    {
+      allSongs.emplace_back();
+      RetrieveSongData(allSongs.back(), query);
+    }
+  }
+
+  return allSongs;
+}
+
+std::deque<QString> MusicLibrary::GetAllSongGuids(bool bUseSearchString) const
+{
+  std::deque<QString> allSongs;
+
+  if (m_pSongDatabase)
+  {
+    if (!bUseSearchString || m_sSearchText.isEmpty())
+    {
+      SqlQuery query(m_Statements, SqlStatement::GetAllSongGuids);
+
+      while (query.Step())
+      {
+        allSongs.push_back(query.GetText(0));
+      }
+    }
+    else
+    {
+      const QStringList pieces = m_sSearchText.split(' ', QString::SkipEmptyParts);
+
+      SqlQuery query(m_Statements, QString("SELECT id FROM music WHERE %1 ORDER BY artist, album, disc, track").arg(BuildSearchCondition(pieces)));
+      BindSearchPieces(query, pieces);
+
+      while (query.Step())
+      {
+        allSongs.push_back(query.GetText(0));
+      }
+    }
+  }
+
+  return std::move(allSongs);
+}
+
+std::vector<SongInfo> MusicLibrary::LookupSongs(const QString& where, const QString& orderBy) const
+{
+  std::vector<SongInfo> allSongs;
+
+  if (m_pSongDatabase)
+  {
+    QString sql = "SELECT " SQL_SONG_COLUMNS " FROM music";
+
+    if (!where.isEmpty())
+      sql += QString(" WHERE %1").arg(where);
+    else
+      allSongs.reserve(GetNumSongs());
+
+    if (!orderBy.isEmpty())
+      sql += QString(" ORDER BY %1").arg(orderBy);
+
+    SqlQuery query(m_Statements, sql);
+
+    while (query.Step())
+    {
+      allSongs.emplace_back();
+      RetrieveSongData(allSongs.back(), query);
+    }
+  }
+
+  return allSongs;
+}
+
+std::deque<QString> MusicLibrary::LookupSongGuids(const SmartPlaylistProgram& program) const
+{
+  std::deque<QString> songGuids;
+  std::vector<int> rows;
+
+  std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+
+  program.Evaluate(m_SongStore, rows);
+
+  for (int row : rows)
+  {
+    songGuids.push_back(m_SongStore.GetGuid(row));
+  }
+
+  return songGuids;
+}
+
+int MusicLibrary::UpdateSongGuids(const SmartPlaylistProgram& program, const QStringList& changedSongs, unsigned int uiChangedParts, std::deque<QString>& inout_SongGuids) const
+{
+  std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+
+  return program.Update(m_SongStore, changedSongs, uiChangedParts, inout_SongGuids);
+}
+
+void MusicLibrary::CountSongPlayed(const QString& sGuid)
+{
+  BeginTransaction();
+
+  // set last play date (and increment counter)
+  {
+    SqlQuery query(m_Statements, SqlStatement::CountSongPlayed);
+    query.Bind(1, ResolveSongGuid(sGuid));
+    query.Execute();
+  }
+
+  ReloadSongFromDatabase(ResolveSongGuid(sGuid));
+
+  // read back current value
+  SongInfo song;
+
+  // record last play date
+  if (FindSong(sGuid, song))
+  {
+    LibraryModification mod;
+    mod.m_sSongGuid = sGuid;
+    mod.m_Type = LibraryModification::Type::AddPlayDate;
+    mod.m_iData = song.m_iLastPlayed;
+
+    RecordModification(mod);
+  }
+
+  EndTransaction();
+}
+
+/// \brief One step that upgrades the database schema from the previous version to m_iVersion.
+struct SchemaMigration
+{
+  int m_iVersion;
+  const char* m_szStatements[5]; // terminated by nullptr
+};
+
+/// \brief All schema upgrades, in ascending order.
+///
+/// Never modify a step that has been released, add a new one instead.
+/// Databases older than s_iBaseSchemaVersion can't be upgraded and are recreated from scratch.
+static const int s_iBaseSchemaVersion = 9;
+static const SchemaMigration s_SchemaMigrations[] = {
+  {10,
+   {"CREATE VIRTUAL TABLE IF NOT EXISTS music_search USING fts5(title, artist, album, tokenize = 'trigram')",
+    "DELETE FROM music_search",
+    "INSERT INTO music_search (rowid, title, artist, album) SELECT rowid, title, artist, album FROM music",
+    nullptr}},
+  {11,
+   {"CREATE INDEX IF NOT EXISTS locations_id ON locations (id)",
+    nullptr}},
+  {12,
+   {"CREATE TABLE IF NOT EXISTS directories (path TEXT NOT NULL, modified TEXT, children INTEGER DEFAULT 0, PRIMARY KEY(path))",
+    nullptr}},
+  {13,
+   {"ALTER TABLE locations ADD COLUMN guidversion INTEGER DEFAULT 1", // all existing GUIDs were computed with MD5
+    "CREATE TABLE IF NOT EXISTS guidremap (old TEXT NOT NULL, new TEXT NOT NULL, PRIMARY KEY(old))",
+    nullptr}},
+  {14,
+   // music_search is keyed on the rowid of music, which VACUUM may renumber, unless it is an INTEGER PRIMARY KEY.
+   // The table is rebuilt with such a key and keeps the current rowids, so the search index stays valid.
+   {"CREATE TABLE music_rebuild "
+    "(searchkey INTEGER PRIMARY KEY"
+    ", id TEXT NOT NULL UNIQUE"
+    ", title TEXT"
+    ", artist TEXT"
+    ", album TEXT"
+    ", disc INTEGER DEFAULT 0"
+    ", track INTEGER DEFAULT 0"
+    ", year INTEGER DEFAULT 0"
+    ", length INTEGER DEFAULT 0"
+    ", rating INTEGER DEFAULT 0"
+    ", volume INTEGER DEFAULT 0"
+    ", start INTEGER DEFAULT 0"
+    ", end INTEGER DEFAULT 0"
+    ", lastplayed INTEGER DEFAULT NULL"
+    ", dateadded INTEGER DEFAULT (strftime('%s','now'))"
+    ", playcount INTEGER DEFAULT 0)",
+    "INSERT INTO music_rebuild (searchkey, id, title, artist, album, disc, track, year, length, rating, volume, start, end, lastplayed, dateadded, playcount) "
+    "SELECT rowid, id, title, artist, album, disc, track, year, length, rating, volume, start, end, lastplayed, dateadded, playcount FROM music",
+    "DROP TABLE music",
+    "ALTER TABLE music_rebuild RENAME TO music",
+    nullptr}},
+};
+
+MusicLibrary::SchemaResult MusicLibrary::CreateTable()
+{
+  if (m_pSongDatabase == nullptr)
+    return SchemaResult::Ready;
+
+  const int iCurrentVersion = s_SchemaMigrations[sizeof(s_SchemaMigrations) / sizeof(s_SchemaMigrations[0]) - 1].m_iVersion;
+
+  int iTableVersion = -1;
+
+  {
+    const char* sql = "CREATE TABLE IF NOT EXISTS details (version INTEGER NOT NULL)";
+
+    SqlQuery(m_Statements, sql).Execute();
+
+    // check if there is a version number stored
+    {
+      SqlQuery query(m_Statements, "SELECT version FROM details");
+
+      if (query.Step())
+      {
+        iTableVersion = query.GetInt(0);
+      }
+    }
+
+    if (iTableVersion == -1) // nothing stored
+    {
+      // create the base schema below and then upgrade it like any other database
+      iTableVersion = s_iBaseSchemaVersion;
+
+      SqlQuery query(m_Statements, "INSERT INTO details (version) VALUES(?1)");
+      query.Bind(1, iTableVersion);
+      query.Execute();
+    }
+
+    if (iTableVersion < s_iBaseSchemaVersion || iTableVersion > iCurrentVersion)
+      return SchemaResult::Incompatible;
+  }
+
+  {
+    const char* sql = "CREATE TABLE IF NOT EXISTS music "
                       "(id TEXT NOT NULL"
                       ", title TEXT"
                       ", artist TEXT"
@@ -567,237 +1409,490 @@ bool MusicLibrary::CreateTable()
                       ", playcount INTEGER DEFAULT 0"
                       ", PRIMARY KEY(id))";
 
-    SqlExec(sql, nullptr, nullptr);
-  }
+    SqlQuery(m_Statements, sql).Execute();
+  }
+
+  {
+    const char* sql = "CREATE TABLE IF NOT EXISTS locations (path TEXT NOT NULL, id TEXT NOT NULL, modified TEXT, PRIMARY KEY(path))";
+
+    SqlQuery(m_Statements, sql).Execute();
+  }
+
+  if (iTableVersion == iCurrentVersion)
+    return SchemaResult::Ready;
+
+  return MigrateSchema(iTableVersion) ? SchemaResult::Ready : SchemaResult::UpgradeFailed;
+}
+
+bool MusicLibrary::MigrateSchema(int iFromVersion)
+{
+  // all steps run in one transaction, so a failed upgrade leaves the database untouched
+  SqlQuery(m_Statements, SqlStatement::BeginTransaction).Execute();
+
+  int iVersion = iFromVersion;
+
+  for (const SchemaMigration& migration : s_SchemaMigrations)
+  {
+    if (migration.m_iVersion <= iVersion)
+      continue;
+
+    for (int i = 0; migration.m_szStatements[i] != nullptr; ++i)
+    {
+      if (!SqlQuery(m_Statements, migration.m_szStatements[i]).Execute())
+      {
+        char msg[512];
+        sprintf_s(msg, 512, "Upgrading the library database to version %i failed.\n", migration.m_iVersion);
+        OutputDebugStringA(msg);
+
+        SqlQuery(m_Statements, "ROLLBACK TRANSACTION").Execute();
+        return false;
+      }
+    }
+
+    iVersion = migration.m_iVersion;
+  }
+
+  {
+    SqlQuery query(m_Statements, "UPDATE details SET version = ?1");
+    query.Bind(1, iVersion);
+    query.Execute();
+  }
+
+  SqlQuery(m_Statements, SqlStatement::EndTransaction).Execute();
+  return true;
+}
+
+void MusicLibrary::BeginTransaction()
+{
+  ++s_iThreadTransactionDepth;
+
+  std::lock_guard<std::mutex> lock(m_TransactionMutex);
+
+  if (m_iTransactionDepth++ == 0)
+  {
+    SqlQuery(m_Statements, SqlStatement::BeginTransaction).Execute();
+  }
+}
+
+void MusicLibrary::EndTransaction()
+{
+  --s_iThreadTransactionDepth;
+
+  {
+    std::lock_guard<std::mutex> lock(m_TransactionMutex);
+
+    if (--m_iTransactionDepth == 0)
+    {
+      SqlQuery(m_Statements, SqlStatement::EndTransaction).Execute();
+    }
+  }
+
+  FlushSongChanges();
+}
+
+void MusicLibrary::FlushSongChanges()
+{
+  // everything that changes within a transaction is sent at once, when the outermost transaction of this thread ends
+  // the database transaction is shared by all threads, but a long import must not hold back the changes of the UI thread
+  // changes of transactions that are still open on other threads are sent along, the SongStore has them already
+  if (s_iThreadTransactionDepth > 0)
+    return;
+
+  QHash<QString, unsigned int> changes;
+
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+    m_SongStore.TakeChanges(changes);
+  }
+
+  if (changes.isEmpty())
+    return;
+
+  // one signal per combination of changed parts, usually all songs of a transaction changed the same way
+  QHash<unsigned int, QStringList> songsByParts;
+
+  for (auto it = changes.begin(); it != changes.end(); ++it)
+  {
+    songsByParts[it.value()].push_back(it.key());
+  }
+
+  for (auto it = songsByParts.begin(); it != songsByParts.end(); ++it)
+  {
+    emit SongsChanged(it.value(), it.key());
+  }
+}
+
+void MusicLibrary::RecordModification(const LibraryModification& mod)
+{
+  // applying the modification changes the song, the change is only sent once the recorder isn't locked anymore
+  BeginTransaction();
+
+  {
+    std::lock_guard<std::mutex> lock(m_RecorderMutex);
+    m_Recorder.AddModification(mod, this);
+  }
+
+  EndTransaction();
+}
+
+void MusicLibrary::AddSongToLibrary(const QString& sGuid, const SongInfo& info)
+{
+  // the search index is rebuilt from the updated row below
+  RemoveFromSearchIndex(sGuid);
+
+  {
+    SqlQuery query(m_Statements, SqlStatement::AddSong);
+    query.Bind(1, sGuid);
+    query.BindOrNull(2, info.m_sTitle);
+    query.BindOrNull(3, info.m_sArtist);
+    query.BindOrNull(4, info.m_sAlbum);
+    query.Bind(5, info.m_iDiscNumber);
+    query.Bind(6, info.m_iTrackNumber);
+    query.Bind(7, info.m_iYear);
+    query.Bind(8, info.m_iLengthInMS);
+    query.Execute();
+  }
+
+  AddToSearchIndex(sGuid);
+
+  // the database fills in the default values for all other columns of new songs
+  ReloadSongFromDatabase(sGuid);
+}
+
+void MusicLibrary::RemoveSongFromLibrary(const QString& sGuid)
+{
+  RemoveFromSearchIndex(sGuid);
+
+  {
+    SqlQuery query(m_Statements, SqlStatement::RemoveSong);
+    query.Bind(1, sGuid);
+    query.Execute();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+    m_SongStore.RemoveSong(sGuid);
+  }
+
+  FlushSongChanges();
+}
+
+void MusicLibrary::AddSongLocation(const QString& sGuid, const QString& sLocation, const QString& sLastModified, int iGuidVersion)
+{
+  SqlQuery query(m_Statements, SqlStatement::AddSongLocation);
+  query.Bind(1, sLocation);
+  query.Bind(2, sGuid);
+  query.Bind(3, sLastModified);
+  query.Bind(4, iGuidVersion);
+  query.Execute();
+}
+
+void MusicLibrary::RemoveSongLocation(const QString& sLocation)
+{
+  SqlQuery query(m_Statements, SqlStatement::RemoveSongLocation);
+  query.Bind(1, sLocation);
+  query.Execute();
+}
+
+bool MusicLibrary::GetLocationGuid(const QString& sLocation, QString& out_sGuid, int& out_iGuidVersion) const
+{
+  SqlQuery query(m_Statements, SqlStatement::GetLocationGuid);
+  query.Bind(1, sLocation);
+
+  if (!query.Step())
+    return false;
+
+  out_sGuid = query.GetText(0);
+  out_iGuidVersion = query.GetInt(1);
+  return true;
+}
+
+void MusicLibrary::LoadGuidRemaps()
+{
+  QHash<QString, QString> remaps;
 
   {
-    const char* sql = "CREATE TABLE IF NOT EXISTS locations (path TEXT NOT NULL, id TEXT NOT NULL, modified TEXT, PRIMARY KEY(path))";
+    SqlQuery query(m_Statements, SqlStatement::GetAllGuidRemaps);
 
-    SqlExec(sql, nullptr, nullptr);
+    while (query.Step())
+    {
+      remaps.insert(query.GetText(0), query.GetText(1));
+    }
   }
 
-  return true;
+  std::lock_guard<std::mutex> lock(m_GuidRemapMutex);
+  m_GuidRemap = std::move(remaps);
 }
 
-void MusicLibrary::AddSongToLibrary(const QString& sGuid, const SongInfo& info)
+QString MusicLibrary::ResolveSongGuid(const QString& sGuid) const
 {
-  QString sql = QString("INSERT OR REPLACE INTO music (id, title, artist, album, disc, track, year, length) VALUES('%1'").arg(sGuid);
+  std::lock_guard<std::mutex> lock(m_GuidRemapMutex);
 
-  char tmp[128];
+  QString sResult = sGuid;
 
-  if (!info.m_sTitle.isEmpty())
+  // a GUID may have been remapped more than once, if there were several algorithm changes
+  for (int i = 0; i < 8; ++i)
   {
-    sqlite3_snprintf(127, tmp, ", %Q", info.m_sTitle.toUtf8().data());
-    sql += tmp;
-  }
-  else
-    sql += ", NULL";
+    auto it = m_GuidRemap.find(sResult);
 
-  if (!info.m_sArtist.isEmpty())
-  {
-    sqlite3_snprintf(127, tmp, ", %Q", info.m_sArtist.toUtf8().data());
-    sql += tmp;
-  }
-  else
-    sql += ", NULL";
+    if (it == m_GuidRemap.end())
+      break;
 
-  if (!info.m_sAlbum.isEmpty())
-  {
-    sqlite3_snprintf(127, tmp, ", %Q", info.m_sAlbum.toUtf8().data());
-    sql += tmp;
+    sResult = it.value();
   }
-  else
-    sql += ", NULL";
-
-  sql += QString(", %1, %2, %3, %4)")
-             .arg(info.m_iDiscNumber)
-             .arg(info.m_iTrackNumber)
-             .arg(info.m_iYear)
-             .arg(info.m_iLengthInMS);
 
-  SqlExec(sql, nullptr, nullptr);
+  return sResult;
 }
 
-void MusicLibrary::RemoveSongFromLibrary(const QString& sGuid)
+void MusicLibrary::RemapSongGuid(const QString& sOldGuid, const QString& sNewGuid)
 {
-  QString sql = QString("DELETE FROM music WHERE id = '%1'").arg(sGuid);
+  if (sOldGuid == sNewGuid)
+    return;
 
-  SqlExec(sql, nullptr, nullptr);
-}
+  bool bNewGuidExists = false;
 
-void MusicLibrary::AddSongLocation(const QString& sGuid, const QString& sLocation, const QString& sLastModified)
-{
-  char tmp[256];
-  sqlite3_snprintf(255, tmp, "%q", sLocation.toUtf8().data());
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+    bNewGuidExists = m_SongStore.FindRow(sNewGuid) >= 0;
+  }
 
-  QString sql = QString("INSERT OR REPLACE INTO locations (path, id, modified) VALUES('%1', '%2', '%3')")
-                    .arg(tmp)
-                    .arg(sGuid)
-                    .arg(sLastModified);
+  BeginTransaction();
 
-  SqlExec(sql, nullptr, nullptr);
-}
+  {
+    SqlQuery query(m_Statements, SqlStatement::AddGuidRemap);
+    query.Bind(1, sOldGuid);
+    query.Bind(2, sNewGuid);
+    query.Execute();
+  }
 
-void MusicLibrary::RemoveSongLocation(const QString& sLocation)
-{
-  char tmp[256];
-  sqlite3_snprintf(255, tmp, "%q", sLocation.toUtf8().data());
+  if (bNewGuidExists)
+  {
+    // the same audio data has already been imported with the new GUID
+    RemoveFromSearchIndex(sOldGuid);
+
+    SqlQuery query(m_Statements, SqlStatement::RemoveSong);
+    query.Bind(1, sOldGuid);
+    query.Execute();
+  }
+  else
+  {
+    // keeps the rowid, so the search index stays valid
+    SqlQuery query(m_Statements, SqlStatement::RenameSong);
+    query.Bind(1, sOldGuid);
+    query.Bind(2, sNewGuid);
+    query.Execute();
+  }
 
-  QString sql = QString("DELETE FROM locations WHERE path = '%1'").arg(tmp);
+  {
+    SqlQuery query(m_Statements, SqlStatement::RenameSongLocations);
+    query.Bind(1, sOldGuid);
+    query.Bind(2, sNewGuid);
+    query.Bind(3, (int)FileGuidVersion::Current);
+    query.Execute();
+  }
 
-  SqlExec(sql, nullptr, nullptr);
-}
+  EndTransaction();
 
-static int RetrieveSongLocation(void* result, int numColumns, char** values, char** columnNames)
-{
-  std::deque<QString>* locations = (std::deque<QString>*)result;
+  {
+    std::lock_guard<std::mutex> lock(m_RecorderMutex);
 
-  locations->push_back(values[0]);
-  return 0;
-}
+    {
+      std::lock_guard<std::mutex> remapLock(m_GuidRemapMutex);
+      m_GuidRemap.insert(sOldGuid, sNewGuid);
+    }
 
-static int RetrieveHasSongLocation(void* result, int numColumns, char** values, char** columnNames)
-{
-  bool* bHasLocations = (bool*)result;
+    // the checkpoints are keyed by the current GUID
+    m_pOwnCheckpoint->RemapSong(sOldGuid, sNewGuid);
+    m_pCheckpoint->RemapSong(sOldGuid, sNewGuid);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+    m_SongStore.RemoveSong(sOldGuid);
+  }
 
-  *bHasLocations = true;
-  return 1;
+  ReloadSongFromDatabase(sNewGuid);
 }
 
 void MusicLibrary::GetSongLocations(const QString& sGuid, std::deque<QString>& out_Locations) const
 {
   out_Locations.clear();
 
-  QString sql = QString("SELECT path FROM locations WHERE id = '%1'")
-                    .arg(sGuid);
+  SqlQuery query(m_Statements, SqlStatement::GetSongLocations);
+  query.Bind(1, ResolveSongGuid(sGuid));
 
-  SqlExec(sql, RetrieveSongLocation, &out_Locations);
+  while (query.Step())
+  {
+    out_Locations.push_back(query.GetText(0));
+  }
 }
 
 bool MusicLibrary::HasSongLocations(const QString& sGuid) const
 {
-  bool bHasLocations = false;
-
-  QString sql = QString("SELECT path FROM locations WHERE id = '%1'")
-                    .arg(sGuid);
+  SqlQuery query(m_Statements, SqlStatement::HasSongLocations);
+  query.Bind(1, sGuid);
 
-  SqlExec(sql, RetrieveHasSongLocation, &bHasLocations);
-
-  return bHasLocations;
+  return query.Step();
 }
 
 void MusicLibrary::GetAllKnownArtists(std::deque<QString>& out_Artists) const
 {
   out_Artists.clear();
 
-  QString sql = QString("SELECT DISTINCT artist FROM music");
+  SqlQuery query(m_Statements, SqlStatement::GetAllKnownArtists);
 
-  // can reuse the same function for this lookup
-  SqlExec(sql, RetrieveSongLocation, &out_Artists);
+  while (query.Step())
+  {
+    out_Artists.push_back(query.GetText(0));
+  }
 }
 
 void MusicLibrary::GetAllKnownAlbums(std::deque<QString>& out_Albums, const QString& sArtist) const
 {
   out_Albums.clear();
 
-  QString sql = QString("SELECT DISTINCT album FROM music");
+  SqlQuery query(m_Statements, sArtist.isEmpty() ? SqlStatement::GetAllKnownAlbums : SqlStatement::GetAllKnownAlbumsOfArtist);
 
   if (!sArtist.isEmpty())
   {
-    char tmp[128];
-    sqlite3_snprintf(127, tmp, "%q", sArtist.toUtf8().data());
-
-    sql.append(" where artist = '");
-    sql.append(tmp);
-    sql.append("'");
+    query.Bind(1, sArtist);
   }
 
-  // can reuse the same function for this lookup
-  SqlExec(sql, RetrieveSongLocation, &out_Albums);
+  while (query.Step())
+  {
+    out_Albums.push_back(query.GetText(0));
+  }
 }
 
 bool MusicLibrary::IsLocationModified(const QString& sLocation, const QString& sLastModified) const
 {
-  char tmp[256];
-  sqlite3_snprintf(255, tmp, "%q", sLocation.toUtf8().data());
-
-  std::deque<QString> locations;
-
-  QString sql = QString("SELECT path FROM locations WHERE path = '%1' AND modified = '%2'")
-                    .arg(tmp)
-                    .arg(sLastModified);
+  SqlQuery query(m_Statements, SqlStatement::IsLocationModified);
+  query.Bind(1, sLocation);
+  query.Bind(2, sLastModified);
 
-  SqlExec(sql, RetrieveSongLocation, &locations);
-
-  return locations.empty();
+  return !query.Step();
 }
 
-void MusicLibrary::UpdateSongDuration(const QString& sGuid, int duration)
+static SqlStatement GetUpdateStatement(SongColumn column)
 {
-  QString sql = QString("UPDATE music SET length = %1 WHERE id = '%2'")
-                    .arg(duration)
-                    .arg(sGuid);
+  switch (column)
+  {
+  case SongColumn::Title:
+    return SqlStatement::UpdateSongTitle;
+  case SongColumn::Artist:
+    return SqlStatement::UpdateSongArtist;
+  case SongColumn::Album:
+    return SqlStatement::UpdateSongAlbum;
+  case SongColumn::DiscNumber:
+    return SqlStatement::UpdateSongDiscNumber;
+  case SongColumn::TrackNumber:
+    return SqlStatement::UpdateSongTrackNumber;
+  case SongColumn::Year:
+    return SqlStatement::UpdateSongYear;
+  case SongColumn::Length:
+    return SqlStatement::UpdateSongDuration;
+  case SongColumn::Rating:
+    return SqlStatement::UpdateSongRating;
+  case SongColumn::Volume:
+    return SqlStatement::UpdateSongVolume;
+  case SongColumn::StartOffset:
+    return SqlStatement::UpdateSongStartOffset;
+  case SongColumn::EndOffset:
+    return SqlStatement::UpdateSongEndOffset;
+  case SongColumn::LastPlayed:
+    return SqlStatement::UpdateSongPlayDate;
+  case SongColumn::PlayCount:
+    return SqlStatement::UpdateSongPlayCount;
 
-  SqlExec(sql, nullptr, nullptr);
+  default:
+    assert(false && "Column can't be updated");
+  }
 
-  m_songInfoCache.clear();
+  return SqlStatement::ENUM_COUNT;
 }
 
-void MusicLibrary::UpdateSongTitle(const QString& sGuid, const QString& value)
+void MusicLibrary::UpdateSongValue(SongColumn column, const QString& sRequestedGuid, int value)
 {
-  char tmp[128];
-  sqlite3_snprintf(127, tmp, "%q", value.toUtf8().data());
+  // journal entries may refer to a song by an outdated GUID
+  const QString sGuid = ResolveSongGuid(sRequestedGuid);
 
-  QString sql = QString("UPDATE music SET title = '%1' WHERE id = '%2'")
-                    .arg(tmp)
-                    .arg(sGuid);
+  {
+    SqlQuery query(m_Statements, GetUpdateStatement(column));
+    query.Bind(1, sGuid);
+    query.Bind(2, value);
+    query.Execute();
+  }
 
-  SqlExec(sql, nullptr, nullptr);
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+    m_SongStore.SetInt(sGuid, column, value);
+  }
 
-  std::lock_guard<std::mutex> lock(m_CacheMutex);
-  m_songInfoCache.clear();
+  FlushSongChanges();
 }
 
-void MusicLibrary::UpdateSongArtist(const QString& sGuid, const QString& value)
+void MusicLibrary::UpdateSongValue(SongColumn column, const QString& sRequestedGuid, const QString& value)
 {
-  char tmp[128];
-  sqlite3_snprintf(127, tmp, "%q", value.toUtf8().data());
+  const QString sGuid = ResolveSongGuid(sRequestedGuid);
+
+  {
+    SqlQuery query(m_Statements, GetUpdateStatement(column));
+    query.Bind(1, sGuid);
+    query.Bind(2, value);
+    query.Execute();
+  }
 
-  QString sql = QString("UPDATE music SET artist = '%1' WHERE id = '%2'")
-                    .arg(tmp)
-                    .arg(sGuid);
+  // all string columns are part of the search index
+  RemoveFromSearchIndex(sGuid);
+  AddToSearchIndex(sGuid);
+
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
 
-  SqlExec(sql, nullptr, nullptr);
+    // Bind() writes empty text, not NULL
+    m_SongStore.SetString(sGuid, column, value.isNull() ? QString("") : value);
+  }
 
-  std::lock_guard<std::mutex> lock(m_CacheMutex);
-  m_songInfoCache.clear();
+  FlushSongChanges();
 }
 
-void MusicLibrary::UpdateSongAlbum(const QString& sGuid, const QString& value)
+void MusicLibrary::AddToSearchIndex(const QString& sGuid)
 {
-  char tmp[128];
-  sqlite3_snprintf(127, tmp, "%q", value.toUtf8().data());
+  SqlQuery query(m_Statements, SqlStatement::AddSearchEntry);
+  query.Bind(1, sGuid);
+  query.Execute();
+}
 
-  QString sql = QString("UPDATE music SET album = '%1' WHERE id = '%2'")
-                    .arg(tmp)
-                    .arg(sGuid);
+void MusicLibrary::RemoveFromSearchIndex(const QString& sGuid)
+{
+  SqlQuery query(m_Statements, SqlStatement::RemoveSearchEntry);
+  query.Bind(1, sGuid);
+  query.Execute();
+}
 
-  SqlExec(sql, nullptr, nullptr);
+void MusicLibrary::UpdateSongDuration(const QString& sGuid, int duration)
+{
+  UpdateSongValue(SongColumn::Length, sGuid, duration);
+}
 
-  std::lock_guard<std::mutex> lock(m_CacheMutex);
-  m_songInfoCache.clear();
+void MusicLibrary::UpdateSongTitle(const QString& sGuid, const QString& value)
+{
+  UpdateSongValue(SongColumn::Title, sGuid, value);
 }
 
-void MusicLibrary::UpdateSongTrackNumber(const QString& sGuid, int value)
+void MusicLibrary::UpdateSongArtist(const QString& sGuid, const QString& value)
 {
-  QString sql = QString("UPDATE music SET track = %1 WHERE id = '%2'")
-                    .arg(value)
-                    .arg(sGuid);
+  UpdateSongValue(SongColumn::Artist, sGuid, value);
+}
 
-  SqlExec(sql, nullptr, nullptr);
+void MusicLibrary::UpdateSongAlbum(const QString& sGuid, const QString& value)
+{
+  UpdateSongValue(SongColumn::Album, sGuid, value);
+}
 
-  std::lock_guard<std::mutex> lock(m_CacheMutex);
-  m_songInfoCache.clear();
+void MusicLibrary::UpdateSongTrackNumber(const QString& sGuid, int value)
+{
+  UpdateSongValue(SongColumn::TrackNumber, sGuid, value);
 }
 
 void MusicLibrary::UpdateSongDiscNumber(const QString& sGuid, int value, bool bRecord)
@@ -809,33 +1904,17 @@ void MusicLibrary::UpdateSongDiscNumber(const QString& sGuid, int value, bool bR
     mod.m_Type = LibraryModification::Type::SetDiscNumber;
     mod.m_iData = value;
 
-    std::lock_guard<std::mutex> lock(m_RecorderMutex);
-
-    m_Recorder.AddModification(mod, this);
+    RecordModification(mod);
   }
   else
   {
-    QString sql = QString("UPDATE music SET disc = %1 WHERE id = '%2'")
-                      .arg(value)
-                      .arg(sGuid);
-
-    SqlExec(sql, nullptr, nullptr);
-
-    std::lock_guard<std::mutex> lock(m_CacheMutex);
-    m_songInfoCache.clear();
+    UpdateSongValue(SongColumn::DiscNumber, sGuid, value);
   }
 }
 
 void MusicLibrary::UpdateSongYear(const QString& sGuid, int value)
 {
-  QString sql = QString("UPDATE music SET year = %1 WHERE id = '%2'")
-                    .arg(value)
-                    .arg(sGuid);
-
-  SqlExec(sql, nullptr, nullptr);
-
-  std::lock_guard<std::mutex> lock(m_CacheMutex);
-  m_songInfoCache.clear();
+  UpdateSongValue(SongColumn::Year, sGuid, value);
 }
 
 void MusicLibrary::UpdateSongRating(const QString& sGuid, int value, bool bRecord)
@@ -847,11 +1926,7 @@ void MusicLibrary::UpdateSongRating(const QString& sGuid, int value, bool bRecor
     mod.m_Type = LibraryModification::Type::SetRating;
     mod.m_iData = value;
 
-    {
-      std::lock_guard<std::mutex> lock(m_RecorderMutex);
-
-      m_Recorder.AddModification(mod, this);
-    }
+    RecordModification(mod);
 
     if (AppState::GetSingleton()->GetActiveSongGuid() == sGuid)
     {
@@ -860,14 +1935,7 @@ void MusicLibrary::UpdateSongRating(const QString& sGuid, int value, bool bRecor
   }
   else
   {
-    QString sql = QString("UPDATE music SET rating = %1 WHERE id = '%2'")
-                      .arg(value)
-                      .arg(sGuid);
-
-    SqlExec(sql, nullptr, nullptr);
-
-    std::lock_guard<std::mutex> lock(m_CacheMutex);
-    m_songInfoCache.clear();
+    UpdateSongValue(SongColumn::Rating, sGuid, value);
   }
 }
 
@@ -880,20 +1948,11 @@ void MusicLibrary::UpdateSongVolume(const QString& sGuid, int value, bool bRecor
     mod.m_Type = LibraryModification::Type::SetVolume;
     mod.m_iData = value;
 
-    std::lock_guard<std::mutex> lock(m_RecorderMutex);
-
-    m_Recorder.AddModification(mod, this);
+    RecordModification(mod);
   }
   else
   {
-    QString sql = QString("UPDATE music SET volume = %1 WHERE id = '%2'")
-                      .arg(value)
-                      .arg(sGuid);
-
-    SqlExec(sql, nullptr, nullptr);
-
-    std::lock_guard<std::mutex> lock(m_CacheMutex);
-    m_songInfoCache.clear();
+    UpdateSongValue(SongColumn::Volume, sGuid, value);
   }
 }
 
@@ -906,20 +1965,11 @@ void MusicLibrary::UpdateSongStartOffset(const QString& sGuid, int value, bool b
     mod.m_Type = LibraryModification::Type::SetStartOffset;
     mod.m_iData = value;
 
-    std::lock_guard<std::mutex> lock(m_RecorderMutex);
-
-    m_Recorder.AddModification(mod, this);
+    RecordModification(mod);
   }
   else
   {
-    QString sql = QString("UPDATE music SET start = %1 WHERE id = '%2'")
-                      .arg(value)
-                      .arg(sGuid);
-
-    SqlExec(sql, nullptr, nullptr);
-
-    std::lock_guard<std::mutex> lock(m_CacheMutex);
-    m_songInfoCache.clear();
+    UpdateSongValue(SongColumn::StartOffset, sGuid, value);
   }
 }
 
@@ -932,61 +1982,143 @@ void MusicLibrary::UpdateSongEndOffset(const QString& sGuid, int value, bool bRe
     mod.m_Type = LibraryModification::Type::SetEndOffset;
     mod.m_iData = value;
 
-    std::lock_guard<std::mutex> lock(m_RecorderMutex);
-
-    m_Recorder.AddModification(mod, this);
+    RecordModification(mod);
   }
   else
   {
-    QString sql = QString("UPDATE music SET end = %1 WHERE id = '%2'")
-                      .arg(value)
-                      .arg(sGuid);
+    UpdateSongValue(SongColumn::EndOffset, sGuid, value);
+  }
+}
+
+void MusicLibrary::UpdateSongPlayDate(const QString& sGuid, int value)
+{
+  UpdateSongValue(SongColumn::LastPlayed, sGuid, value);
+}
+
+void MusicLibrary::FindSongsInLocation(const QString& sFolder, std::deque<QString>& out_Guids) const
+{
+  if (!m_pSongDatabase)
+    return;
+
+  // LIKE would also match sibling folders with the same prefix, and ignore the case of ASCII letters
+  // all paths that start with "folder/" sort between "folder/" and "folder0", and the range can use the index
+  const QString sPath = sFolder.endsWith('/') ? sFolder.left(sFolder.length() - 1) : sFolder;
+
+  SqlQuery query(m_Statements, SqlStatement::FindSongsInLocation);
+  query.Bind(1, sPath + "/");
+  query.Bind(2, sPath + QChar('/' + 1));
+
+  while (query.Step())
+  {
+    out_Guids.push_back(query.GetText(0));
+  }
+}
 
-    SqlExec(sql, nullptr, nullptr);
+void MusicLibrary::RemoveFolder(const QString& sFolder)
+{
+  // all paths that start with "folder/" sort between "folder/" and "folder0"
+  const QString sFirst = sFolder + "/";
+  const QString sLast = sFolder + QChar('/' + 1);
+
+  BeginTransaction();
+
+  {
+    SqlQuery query(m_Statements, SqlStatement::RemoveSongLocationsInFolder);
+    query.Bind(1, sFirst);
+    query.Bind(2, sLast);
+    query.Execute();
+  }
 
-    std::lock_guard<std::mutex> lock(m_CacheMutex);
-    m_songInfoCache.clear();
+  {
+    SqlQuery query(m_Statements, SqlStatement::RemoveDirectoriesInFolder);
+    query.Bind(1, sFolder);
+    query.Bind(2, sFirst);
+    query.Bind(3, sLast);
+    query.Execute();
   }
+
+  EndTransaction();
 }
 
-void MusicLibrary::UpdateSongPlayDate(const QString& sGuid, int value)
+void MusicLibrary::GetLocationsInFolder(const QString& sFolder, QHash<QString, QString>& out_Locations) const
 {
-  QString sql = QString("UPDATE music SET lastplayed = %1 WHERE id = '%2'")
-                    .arg(value)
-                    .arg(sGuid);
+  out_Locations.clear();
 
-  SqlExec(sql, nullptr, nullptr);
+  SqlQuery query(m_Statements, SqlStatement::GetLocationsInFolder);
+  query.Bind(1, sFolder + "/");
+  query.Bind(2, sFolder + QChar('/' + 1));
 
-  std::lock_guard<std::mutex> lock(m_CacheMutex);
-  m_songInfoCache.clear();
+  while (query.Step())
+  {
+    out_Locations.insert(query.GetText(0), query.GetText(1));
+  }
 }
 
-void MusicLibrary::FindSongsInLocation(const QString& sLocationPrefix, std::deque<QString>& out_Guids) const
+void MusicLibrary::FindDirectoriesInLocation(const QString& sFolder, std::vector<KnownDirectory>& out_Directories) const
 {
-  if (!m_pSongDatabase)
-    return;
+  // the folder itself, and everything between "folder/" and "folder0", see FindSongsInLocation()
+  SqlQuery query(m_Statements, SqlStatement::GetDirectoriesInLocation);
+  query.Bind(1, sFolder);
+  query.Bind(2, sFolder + "/");
+  query.Bind(3, sFolder + QChar('/' + 1));
+
+  while (query.Step())
+  {
+    KnownDirectory dir;
+    dir.m_sPath = query.GetText(0);
+    dir.m_sLastModified = query.GetText(1);
+    dir.m_iNumChildren = query.GetInt(2);
+
+    out_Directories.push_back(dir);
+  }
+}
 
-  QString sql = QString("SELECT id FROM locations WHERE path LIKE '%1%%'")
-                    .arg(sLocationPrefix);
+void MusicLibrary::AddDirectory(const KnownDirectory& dir)
+{
+  SqlQuery query(m_Statements, SqlStatement::AddDirectory);
+  query.Bind(1, dir.m_sPath);
+  query.Bind(2, dir.m_sLastModified);
+  query.Bind(3, dir.m_iNumChildren);
+  query.Execute();
+}
 
-  SqlExec(sql, RetrieveSongLocation, &out_Guids);
+void MusicLibrary::RemoveDirectory(const QString& sPath)
+{
+  SqlQuery query(m_Statements, SqlStatement::RemoveDirectory);
+  query.Bind(1, sPath);
+  query.Execute();
 }
 
-void MusicLibrary::RestoreFromDatabase()
+void MusicLibrary::RestoreFromDatabase(Job& job)
 {
   if (m_pSongDatabase == nullptr)
     return;
 
-  const std::deque<SongInfo> allSongs = GetAllSongs(false);
+  const std::vector<SongInfo> allSongs = GetAllSongs(false);
+
+  BackgroundThrottle throttle;
+
+  qint64 iNumDone = 0;
 
   for (const SongInfo& si : allSongs)
   {
-    if (!m_bWorkersActive)
+    if (!job.Checkpoint())
       return;
 
+    job.SetProgress(iNumDone++, (qint64)allSongs.size());
+    job.AddProcessed(1, 0);
+
     {
       std::lock_guard<std::mutex> lock(m_RecorderMutex);
 
+      // values that have been folded into the checkpoint are persistent already
+      auto ensureExists = [this](const LibraryModification& mod) {
+        if (!m_pCheckpoint->HasValue(ResolveSongGuid(mod.m_sSongGuid), mod.m_Type))
+        {
+          m_Recorder.EnsureModificationExists(mod, this);
+        }
+      };
+
       LibraryModification mod;
       mod.m_sSongGuid = si.m_sSongGuid;
 
@@ -994,74 +2126,133 @@ void MusicLibrary::RestoreFromDatabase()
       {
         mod.m_Type = LibraryModification::Type::SetRating;
         mod.m_iData = si.m_iRating;
-        m_Recorder.EnsureModificationExists(mod, this);
+        ensureExists(mod);
       }
 
       if (si.m_iDiscNumber != 0)
       {
         mod.m_Type = LibraryModification::Type::SetDiscNumber;
         mod.m_iData = si.m_iDiscNumber;
-        m_Recorder.EnsureModificationExists(mod, this);
+        ensureExists(mod);
       }
 
       if (si.m_iVolume != 0)
       {
         mod.m_Type = LibraryModification::Type::SetVolume;
         mod.m_iData = si.m_iVolume;
-        m_Recorder.EnsureModificationExists(mod, this);
+        ensureExists(mod);
       }
 
       if (si.m_iStartOffset != 0)
       {
         mod.m_Type = LibraryModification::Type::SetStartOffset;
         mod.m_iData = si.m_iStartOffset;
-        m_Recorder.EnsureModificationExists(mod, this);
+        ensureExists(mod);
       }
 
       if (si.m_iEndOffset != 0)
       {
         mod.m_Type = LibraryModification::Type::SetEndOffset;
         mod.m_iData = si.m_iEndOffset;
-        m_Recorder.EnsureModificationExists(mod, this);
+        ensureExists(mod);
       }
     }
 
     // don't hog the CPU with this too much, leave it running in the background
-    Sleep(1);
+    throttle.Step();
   }
 }
 
-void MusicLibrary::CleanUpLocations()
+void MusicLibrary::CleanUpLocations(Job& job)
 {
   if (!m_pSongDatabase)
     return;
 
-  std::deque<QString> allLocations;
-  std::deque<QString> toRemove;
+  // deleted files inside the music folders are already detected while scanning them,
+  // only locations outside of them (e.g. of a folder that was removed from the settings) need to be checked here
+  std::vector<QString> sourceFolders;
+  for (const QString& sFolder : AppConfig::GetSingleton()->GetAllMusicSources())
+  {
+    sourceFolders.push_back(QFileInfo(sFolder).absoluteFilePath() + "/");
+  }
+
+  struct DirectoryCheck
+  {
+    QString m_sPath;
+    std::vector<QString> m_Files;
+    std::vector<QString> m_MissingFiles;
+  };
 
-  SqlExec("SELECT path FROM locations", RetrieveSongLocation, &allLocations);
+  std::vector<DirectoryCheck> directories;
 
-  for (const QString& loc : allLocations)
   {
-    if (!m_bWorkersActive)
-      return;
+    QHash<QString, int> dirToIndex;
 
-    if (!QFile::exists(loc))
+    SqlQuery query(m_Statements, SqlStatement::GetAllLocations);
+
+    while (query.Step())
     {
-      toRemove.push_back(loc);
+      const QString sLocation = query.GetText(0);
+
+      const bool bInSourceFolder = std::any_of(sourceFolders.begin(), sourceFolders.end(), [&sLocation](const QString& sFolder) { return sLocation.startsWith(sFolder); });
+
+      if (bInSourceFolder)
+        continue;
+
+      const QString sDir = QFileInfo(sLocation).path();
+
+      auto it = dirToIndex.find(sDir);
+      if (it == dirToIndex.end())
+      {
+        it = dirToIndex.insert(sDir, (int)directories.size());
+        directories.emplace_back();
+        directories.back().m_sPath = sDir;
+      }
+
+      directories[it.value()].m_Files.push_back(sLocation);
     }
   }
 
+  // one directory listing instead of one file system query per file, and the directories are checked in parallel,
+  // which hides the latency of network drives
+  QtConcurrent::blockingMap(directories, [&job](DirectoryCheck& dir) {
+    if (job.IsCanceled())
+      return;
+
+    job.AddProcessed((qint64)dir.m_Files.size(), 0);
+
+    const QStringList entries = QDir(dir.m_sPath).entryList(QDir::Files | QDir::Hidden | QDir::System);
+    const QSet<QString> existing = QSet<QString>::fromList(entries);
+
+    for (const QString& sFile : dir.m_Files)
+    {
+      if (existing.contains(QFileInfo(sFile).fileName()))
+        continue;
+
+      // file names are case insensitive on Windows, and the listing fails for directories that can't be read,
+      // so only the file system can tell whether the file is really gone; this is rare enough to be checked one by one
+      if (!QFileInfo::exists(sFile))
+      {
+        dir.m_MissingFiles.push_back(sFile);
+      }
+    }
+  });
+
+  if (!job.Checkpoint())
+    return;
+
   // now remove all locations in one transaction
-  if (!toRemove.empty())
+  BeginTransaction();
+
+  for (const DirectoryCheck& dir : directories)
   {
-    SqlExec("BEGIN IMMEDIATE TRANSACTION", nullptr, nullptr);
-    for (const QString& loc : toRemove)
+    for (const QString& sFile : dir.m_MissingFiles)
     {
-      RemoveSongLocation(loc);
+      RemoveSongLocation(sFile);
     }
-    SqlExec("END TRANSACTION", nullptr, nullptr);
   }
+
+  EndTransaction();
 }
 
 void MusicLibrary::CleanUpSongs()
@@ -1069,83 +2260,159 @@ void MusicLibrary::CleanUpSongs()
   if (!m_pSongDatabase)
     return;
 
-  std::deque<QString> allSongs;
-  std::deque<QString> toRemove;
+  std::vector<QString> removedSongs;
+
+  // all songs without any location are deleted at once, the search index entries have to go first, while the songs still exist
+  BeginTransaction();
 
-  SqlExec("SELECT id FROM music", RetrieveSongGuidArray, &allSongs);
+  SqlQuery(m_Statements, SqlStatement::RemoveSearchEntriesWithoutLocations).Execute();
 
-  for (const QString& song : allSongs)
   {
-    if (!m_bWorkersActive)
-      return;
+    SqlQuery query(m_Statements, SqlStatement::RemoveSongsWithoutLocations);
 
-    if (!HasSongLocations(song))
+    while (query.Step())
     {
-      toRemove.push_back(song);
+      removedSongs.push_back(query.GetText(0));
     }
-
-    // don't hog the CPU with this too much, leave it running in the background
-    Sleep(1);
   }
 
-  if (!toRemove.empty())
+  EndTransaction();
+
   {
-    SqlExec("BEGIN IMMEDIATE TRANSACTION", nullptr, nullptr);
-    for (const QString& song : toRemove)
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
+
+    for (const QString& sGuid : removedSongs)
     {
-      RemoveSongFromLibrary(song);
+      m_SongStore.RemoveSong(sGuid);
     }
-    SqlExec("END TRANSACTION", nullptr, nullptr);
   }
+
+  FlushSongChanges();
 }
 
-void MusicLibrary::UpdateSongPlayCount()
+void MusicLibrary::UpdateSongPlayCount(Job& job)
 {
   if (!m_pSongDatabase)
     return;
 
-  ModificationRecorder<LibraryModification, MusicLibrary*> recorder;
+  std::map<QString, int> infos;
 
-  // make a copy
+  // only counting in memory, so the journal can stay locked
   {
     std::lock_guard<std::mutex> lock(m_RecorderMutex);
-    recorder = m_Recorder;
-  }
 
-  std::map<QString, int> infos;
-  std::set<QString> entryCounted;
+    QSet<ModificationId> entryCounted;
 
-  for (const auto& rec : recorder.GetAllModifications())
-  {
-    if (!m_bWorkersActive)
-      return;
+    for (const auto& rec : m_Recorder.GetAllModifications())
+    {
+      if (job.IsCanceled())
+        return;
 
-    if (rec.m_Type != LibraryModification::Type::AddPlayDate)
-      continue;
+      if (rec.m_Type != LibraryModification::Type::AddPlayDate)
+        continue;
 
-    // at this point, entries are not coalesced, so we must filter out duplicate play date information
-    if (entryCounted.find(rec.m_sModGuid) != entryCounted.end())
-      continue;
+      // at this point, entries are not coalesced, so we must filter out duplicate play date information
+      if (entryCounted.contains(rec.m_ModId))
+        continue;
+
+      entryCounted.insert(rec.m_ModId);
+
+      // entries from before and after a GUID change count for the same song
+      infos[ResolveSongGuid(rec.m_sSongGuid)]++;
+    }
+
+    // plus all plays from before the journal
+    const QHash<QString, LibraryCheckpoint::SongState>& songs = m_pCheckpoint->GetSongs();
 
-    entryCounted.insert(rec.m_sModGuid);
+    for (auto it = songs.begin(); it != songs.end(); ++it)
+    {
+      if (it.value().m_iPlayCount > 0)
+      {
+        infos[ResolveSongGuid(it.key())] += it.value().m_iPlayCount;
+      }
+    }
+  }
+
+  std::vector<std::pair<QString, int>> changed;
+
+  {
+    std::lock_guard<std::mutex> lock(m_SongStoreMutex);
 
-    infos[rec.m_sSongGuid]++;
+    for (const auto& itInfo : infos)
+    {
+      const int row = m_SongStore.FindRow(itInfo.first);
+
+      if (row >= 0 && m_SongStore.GetInt(row, SongColumn::PlayCount) != itInfo.second)
+      {
+        changed.push_back(itInfo);
+      }
+    }
   }
 
   // update database
   {
-    SqlExec("BEGIN IMMEDIATE TRANSACTION", nullptr, nullptr);
-    for (const auto itInfo : infos)
+    BeginTransaction();
+    for (const auto& itInfo : changed)
     {
       // no need to update lastplayed, that is already done during startup
-      QString sql = QString("UPDATE music SET playcount = %1 WHERE id = '%2'")
-                        .arg(itInfo.second)
-                        .arg(itInfo.first);
+      UpdateSongValue(SongColumn::PlayCount, itInfo.first, itInfo.second);
+    }
+    EndTransaction();
+  }
+}
 
-      SqlExec(sql, nullptr, nullptr);
+void MusicLibrary::MigrateSongGuids(Job& job)
+{
+  if (!m_pSongDatabase)
+    return;
+
+  std::vector<std::pair<QString, QString>> outdated; // location, GUID
+
+  {
+    SqlQuery query(m_Statements, SqlStatement::GetOutdatedLocations);
+    query.Bind(1, (int)FileGuidVersion::Current);
+
+    while (query.Step())
+    {
+      outdated.push_back(std::make_pair(query.GetText(0), query.GetText(1)));
     }
-    SqlExec("END TRANSACTION", nullptr, nullptr);
   }
+
+  if (outdated.empty())
+    return;
+
+  const std::vector<FileGuidVersion> versions = {FileGuidVersion::Md5, FileGuidVersion::Current};
+  std::vector<QString> guids;
+  int iNumRemapped = 0;
+
+  BackgroundThrottle throttle;
+
+  for (const auto& loc : outdated)
+  {
+    if (!job.Checkpoint())
+      break;
+
+    throttle.Step();
+    job.AddProcessed(1, 0);
+
+    // all locations of a song are updated together, when the first one is remapped
+    if (ResolveSongGuid(loc.second) != loc.second)
+      continue;
+
+    if (!ComputeFileGuids(loc.first, versions, guids))
+      continue;
+
+    // if the audio data changed, the file will be imported again with the current algorithm anyway
+    if (guids[0] != loc.second)
+      continue;
+
+    RemapSongGuid(loc.second, guids[1]);
+    ++iNumRemapped;
+  }
+
+  char msg[512];
+  sprintf_s(msg, 512, "Updated the GUIDs of %i of %i outdated song locations.\n", iNumRemapped, (int)outdated.size());
+  OutputDebugStringA(msg);
 }
 
 void LibraryModification::Apply(MusicLibrary* pContext) const
@@ -1176,23 +2443,23 @@ void LibraryModification::Apply(MusicLibrary* pContext) const
   }
 }
 
-void LibraryModification::Save(QDataStream& stream) const
+void LibraryModification::Save(QDataStream& stream, JournalStringTable& strings) const
 {
   stream << (int)m_Type;
-  stream << m_sSongGuid;
+  strings.Write(stream, m_sSongGuid);
   stream << m_iData;
 }
 
-void LibraryModification::Load(QDataStream& stream)
+void LibraryModification::Load(QDataStream& stream, const JournalStringTable& strings)
 {
   int type;
   stream >> type;
   m_Type = (Type)type;
-  stream >> m_sSongGuid;
+  m_sSongGuid = strings.Read(stream);
   stream >> m_iData;
 }
 
-void LibraryModification::Coalesce(ModificationRecorder<LibraryModification, MusicLibrary*>& recorder, size_t passThroughIndex)
+QString LibraryModification::GetCoalescingKey() const
 {
   switch (m_Type)
   {
@@ -1201,21 +2468,11 @@ void LibraryModification::Coalesce(ModificationRecorder<LibraryModification, Mus
   case Type::SetStartOffset:
   case Type::SetEndOffset:
   case Type::SetDiscNumber:
-  {
-    // remove previous changes to the same song and same property
-
-    recorder.InvalidatePrevious(passThroughIndex, [this](const LibraryModification& mod) -> bool {
-      if (mod.m_sSongGuid == this->m_sSongGuid)
-      {
-        return mod.m_Type == this->m_Type;
-      }
-
-      return false;
-    });
-  }
-  break;
+    // only the latest change to the same property of the same song is kept
+    return QString::number((int)m_Type) + ":" + m_sSongGuid;
 
   case Type::AddPlayDate:
-    break;
+  default:
+    return QString();
   }
 }
@@ -1,16 +1,32 @@
 #pragma once
 
 #include "Misc/Common.h"
+#include "Misc/FileSystemWatcher.h"
+#include "Misc/JobScheduler.h"
 #include "Misc/ModificationRecorder.h"
 #include "Misc/Song.h"
+#include "MusicLibrary/SongStore.h"
+#include "MusicLibrary/SqlStatementCache.h"
 #include "Playlists/Playlist.h"
-#include <QFuture>
+#include <QDateTime>
 #include <QHash>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <atomic>
 #include <deque>
 #include <map>
 #include <mutex>
 #include <sqlite3.h>
 
+/// \brief The state of a directory on disk at the time it was last scanned.
+struct KnownDirectory
+{
+  QString m_sPath;
+  QString m_sLastModified;
+  int m_iNumChildren = 0;
+};
+
 struct LibraryModification : public Modification
 {
   enum class Type
@@ -22,6 +38,8 @@ struct LibraryModification : public Modification
     SetEndOffset,
     AddPlayDate,
     SetDiscNumber,
+
+    ENUM_COUNT
   };
 
   Type m_Type = Type::None;
@@ -29,9 +47,10 @@ struct LibraryModification : public Modification
   int m_iData = 0;
 
   void Apply(MusicLibrary* pContext) const;
-  void Save(QDataStream& stream) const;
-  void Load(QDataStream& stream);
-  void Coalesce(ModificationRecorder<LibraryModification, MusicLibrary*>& recorder, size_t passThroughIndex);
+  void Save(QDataStream& stream, JournalStringTable& strings) const;
+  void Load(QDataStream& stream, const JournalStringTable& strings);
+  bool IsRelevant() const { return true; }
+  QString GetCoalescingKey() const;
 
   bool HasModificationData(const LibraryModification& rhs) const
   {
@@ -40,6 +59,9 @@ struct LibraryModification : public Modification
   }
 };
 
+class LibraryCheckpoint;
+class SmartPlaylistProgram;
+
 class MusicLibrary : public QObject
 {
   Q_OBJECT
@@ -53,7 +75,7 @@ public:
   void Startup(const QString& sAppDir);
   void Shutdown();
   void SaveUserState();
-  void LoadUserState();
+  void LoadUserState(Job& job);
 
   void SetSearchText(const QString& text);
 
@@ -64,21 +86,66 @@ public:
   /// Returns false, if the GUID is for an unknown song. In that case \a song will remain empty (including the GUID).
   bool FindSong(const QString& songGuid, SongInfo& song) const;
 
+  /// \brief Looks up several songs at once, with a single lock. \a out_Songs[i] is only filled out, if \a out_Found[i] is true.
+  ///
+  /// Returns the SongStore revision of the returned data.
+  quint64 FindSongs(const std::vector<QString>& songGuids, std::vector<SongInfo>& out_Songs, std::vector<bool>& out_Found) const;
+
+  /// \brief The SongStore revision right after the library was last reloaded from the database.
+  ///
+  /// A reload doesn't send SongsChanged(), so data that was fetched at an older revision (see FindSongs()) has to be fetched again.
+  quint64 GetReloadRevision() const { return m_uiReloadRevision; }
+
+  /// \brief Returns the number of songs in the entire library.
+  int GetNumSongs() const;
+
   /// \brief Returns the SongInfo objects for all songs in the entire library. Uses the search string to filter the results.
-  std::deque<SongInfo> GetAllSongs(bool bUseSearchString) const;
+  std::vector<SongInfo> GetAllSongs(bool bUseSearchString) const;
 
   /// \brief Returns the GUIDs for all songs in the entire library. Uses the search string to filter the results.
   std::deque<QString> GetAllSongGuids(bool bUseSearchString) const;
 
-  std::deque<SongInfo> LookupSongs(const QString& where, const QString& orderBy = "artist, album, disc, track") const;
+  std::vector<SongInfo> LookupSongs(const QString& where, const QString& orderBy = "artist, album, disc, track") const;
+
+  /// \brief Returns the GUIDs of all songs that match the program, evaluated on the in-memory song data instead of the database.
+  std::deque<QString> LookupSongGuids(const SmartPlaylistProgram& program) const;
+
+  /// \brief Updates a previous result of LookupSongGuids() for the changed songs only, see SmartPlaylistProgram::Update().
+  int UpdateSongGuids(const SmartPlaylistProgram& program, const QStringList& changedSongs, unsigned int uiChangedParts, std::deque<QString>& inout_SongGuids) const;
 
   void CountSongPlayed(const QString& sGuid);
 
+  /// \brief Groups all following database changes into one transaction, until the matching EndTransaction().
+  ///
+  /// Calls may be nested, also across threads. The changes are committed once the outermost transaction ends.
+  /// SongsChanged() is sent when the outermost transaction of the calling thread ends, independent of the other threads.
+  void BeginTransaction();
+  void EndTransaction();
+
   void AddSongToLibrary(const QString& sGuid, const SongInfo& info);
   void RemoveSongFromLibrary(const QString& sGuid);
-  void AddSongLocation(const QString& sGuid, const QString& sLocation, const QString& sLastModified);
+  void AddSongLocation(const QString& sGuid, const QString& sLocation, const QString& sLastModified, int iGuidVersion);
   void RemoveSongLocation(const QString& sLocation);
 
+  /// \brief Returns the GUID that is stored for the given location on disk and the FileGuidVersion that it was computed with.
+  /// Returns false, if the location is unknown.
+  bool GetLocationGuid(const QString& sLocation, QString& out_sGuid, int& out_iGuidVersion) const;
+
+  /// \brief Replaces the GUID of a song, after it was recomputed with a newer FileGuidVersion.
+  ///
+  /// The song keeps all its data and locations. The old GUID is remembered, so that journal entries and playlists
+  /// that still refer to it, continue to work (see ResolveSongGuid()).
+  void RemapSongGuid(const QString& sOldGuid, const QString& sNewGuid);
+
+  /// \brief Returns the current GUID for a song GUID that may have been computed with an older FileGuidVersion.
+  QString ResolveSongGuid(const QString& sGuid) const;
+
+  /// \brief Removes all song locations and known directories inside the given folder, and the folder itself.
+  void RemoveFolder(const QString& sFolder);
+
+  /// \brief Returns the last modification date of all known song locations inside the given folder, keyed by path.
+  void GetLocationsInFolder(const QString& sFolder, QHash<QString, QString>& out_Locations) const;
+
   /// \brief Returns all the locations on disk that are known for the given song.
   void GetSongLocations(const QString& sGuid, std::deque<QString>& out_Locations) const;
   bool HasSongLocations(const QString& sGuid) const;
@@ -105,44 +172,127 @@ public:
   void UpdateSongPlayDate(const QString& sGuid, int value);
 
   /// \brief Finds all songs below a certain folder on disk
-  void FindSongsInLocation(const QString& sLocationPrefix, std::deque<QString>& out_Guids) const;
+  void FindSongsInLocation(const QString& sFolder, std::deque<QString>& out_Guids) const;
 
-  /// \brief Called in a background thread to synchronize modifications that are only stored in the local database back to the persistent storage
+  /// \brief Returns the last scanned state of all directories below a certain folder on disk (including the folder itself).
+  void FindDirectoriesInLocation(const QString& sFolder, std::vector<KnownDirectory>& out_Directories) const;
+  void AddDirectory(const KnownDirectory& dir);
+  void RemoveDirectory(const QString& sPath);
+
+  /// \brief Called in a low priority background job to synchronize modifications that are only stored in the local database back to the persistent storage
   ///
   /// If a local change is made and the application crashes or the data about the library state is somehow else lost,
   /// this will ensure the state inside the database is added to the library description (the journaling entries) again.
-  void RestoreFromDatabase();
+  void RestoreFromDatabase(Job& job);
 
 signals:
   void SearchTextChanged(const QString& newText);
 
+  /// \brief Sent when songs were added, removed or changed. \a partMask is a combination of SongInfo::Part values.
+  ///
+  /// All changes made within a transaction are collected and sent once it ends, one signal per combination of changed parts.
+  /// May be sent from any thread.
+  void SongsChanged(const QStringList& songGuids, unsigned int partMask);
+
 private slots:
   void onBusyWorkChanged(bool active);
+
+  /// \brief Queues the journal, clean up and restore jobs, if the library changed since they ran last and no import is in progress.
+  void ScheduleMaintenance();
   void onProfileDirectoryChanged();
+  void onJournalWatchTimer();
 
 private:
   static MusicLibrary* s_Singleton;
 
-  bool CreateTable();
-  void SqlExec(const QString& stmt, int (*callback)(void*, int, char**, char**), void* userData) const;
+  enum class SchemaResult
+  {
+    Ready,
+    Incompatible,  ///< The version is outside of what can be upgraded, the database has to be recreated.
+    UpgradeFailed, ///< A migration step failed. The database is left as it was.
+  };
 
-  void LoadLibraryFile(const QString& file);
-  void CleanupThread();
-  void CleanUpLocations();
+  SchemaResult CreateTable();
+  bool MigrateSchema(int iFromVersion);
+  int GetNumSongsInDatabase() const;
+  void LoadSongStore();
+  void LoadGuidRemaps();
+  void ReloadSongFromDatabase(const QString& sGuid);
+  void UpdateSongValue(SongColumn column, const QString& sGuid, int value);
+  void UpdateSongValue(SongColumn column, const QString& sGuid, const QString& value);
+  /// \brief Sends SongsChanged() for everything that changed in the SongStore, unless the calling thread still has a transaction open.
+  void FlushSongChanges();
+  /// \brief Adds the modification to the journal and applies it.
+  void RecordModification(const LibraryModification& mod);
+  void AddToSearchIndex(const QString& sGuid);
+  void RemoveFromSearchIndex(const QString& sGuid);
+
+  QString GetCheckpointFile() const;
+  void LoadCheckpoint();
+
+  /// \brief Appends all library journal files in the profile directory.
+  void FindJournalFiles(std::vector<QString>& out_Files) const;
+
+  /// \brief Whether the journal file was written by this computer. Files in the format of version 1 are taken over by whoever loads them.
+  bool IsOwnJournalFile(const QString& sPath) const;
+
+  /// \brief Adds the modifications from the given journal files to the journal. Files that have been merged before and didn't change since are skipped.
+  ///
+  /// The files are decoded in parallel, the journal is only locked to add the result.
+  /// \a out_Added receives the modifications that were not known before.
+  void MergeJournalFiles(const std::vector<QString>& files, std::vector<LibraryModification>& out_Added);
+
+  /// \brief Merges journal files that were written by other computers into the synchronized profile directory, while the application is running.
+  void MergeSyncedJournals(Job& job, const std::vector<QString>& files);
+  void StartJournalWatch();
+
+  /// \brief Applies the checkpoint and the journal to the database in bulk.
+  ///
+  /// All modifications are collapsed to the final value of each song property in memory first.
+  /// The changed values are written into a staging table and applied with a single set-based UPDATE.
+  /// If \a pSongs is given, only the values of those songs (resolved GUIDs) are applied.
+  void ApplyJournal(const QSet<QString>* pSongs = nullptr);
+  void WriteCheckpoint();
+  void MaintenanceJob(Job& job);
+  void CleanUpLocations(Job& job);
   void CleanUpSongs();
-  void UpdateSongPlayCount();
+  void UpdateSongPlayCount(Job& job);
+  void MigrateSongGuids(Job& job);
 
   QString m_sSearchText;
   std::vector<QString> m_MusicFileExtensions;
   sqlite3* m_pSongDatabase = nullptr;
+  mutable SqlStatementCache m_Statements;
+  std::mutex m_TransactionMutex;
+  int m_iTransactionDepth = 0;
 
-  QFuture<void> m_WorkerTask;
-  volatile bool m_bWorkersActive = false;
+  std::shared_ptr<Job> m_pMaintenanceJob;
+  std::shared_ptr<Job> m_pRestoreJob;
+  bool m_bMaintenanceNeeded = false;
 
   mutable std::mutex m_RecorderMutex;
   ModificationRecorder<LibraryModification, MusicLibrary*> m_Recorder;
-  std::vector<QString> m_LibFilesToDeleteOnSave;
+  std::vector<QString> m_LibFilesToDeleteOnSave; // only files of this computer, the other computers delete their own ones
+  QHash<QString, QDateTime> m_MergedJournalFiles; // path -> modification time when it was merged, protected by m_RecorderMutex
+
+  // modifications from other computers' journals are applied, but neither saved nor folded by this computer
+  QSet<ModificationId> m_ForeignModifications;
+
+  // journal files from other computers are picked up by the watcher and merged in the background
+  ezDirectoryWatcher m_JournalWatcher;
+  QTimer m_JournalWatchTimer;
+  std::shared_ptr<Job> m_pJournalMergeJob;
+  QHash<QString, qint64> m_PendingJournalFiles; // path -> time of the last change
+
+  // the journal history of all computers before the current journal files, protected by m_RecorderMutex as well
+  std::unique_ptr<LibraryCheckpoint> m_pCheckpoint;
+  // the part of it that this computer folded, the only checkpoint file that it writes
+  std::unique_ptr<LibraryCheckpoint> m_pOwnCheckpoint;
+
+  mutable std::mutex m_SongStoreMutex;
+  SongStore m_SongStore;
+  std::atomic<quint64> m_uiReloadRevision{0};
 
-  mutable std::mutex m_CacheMutex;
-  mutable std::deque<SongInfo> m_songInfoCache;
+  mutable std::mutex m_GuidRemapMutex;
+  QHash<QString, QString> m_GuidRemap; // old GUID -> new GUID
 };
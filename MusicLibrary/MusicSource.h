@@ -14,4 +14,7 @@ public:
   virtual void Startup() = 0;
   virtual void Shutdown() = 0;
   virtual void Sort(const QString& prefix) {}
+
+  /// \brief Rescans all files of the source, without relying on any cached state about unchanged directories.
+  virtual void Verify(const QString& prefix) {}
 };
@@ -1,20 +1,24 @@
 #include "MusicLibrary/MusicSourceFolder.h"
+#include "Config/AppConfig.h"
 #include "Config/AppState.h"
+#include "MusicLibrary/FileGuid.h"
+#include "MusicLibrary/ImportPipeline.h"
 #include "MusicLibrary/MusicLibrary.h"
 #include "MusicLibrary/SortLibraryDlg.h"
 
-#include <QCryptographicHash>
 #include <QDateTime>
 #include <QDirIterator>
 #include <QMessageBox>
 #include <QProgressDialog>
-#include <QtConcurrent/QtConcurrentRun>
+#include <set>
 #include <taglib/fileref.h>
 #include <taglib/tag.h>
 
 MusicSourceFolder::MusicSourceFolder(const QString& path)
 {
   m_sFolder = path;
+
+  connect(&m_WatchTimer, &QTimer::timeout, this, &MusicSourceFolder::onWatchTimer);
 }
 
 MusicSourceFolder::~MusicSourceFolder()
@@ -23,176 +27,161 @@ MusicSourceFolder::~MusicSourceFolder()
 
 void MusicSourceFolder::Startup()
 {
-  m_bShutdownWorker = false;
-  m_WorkerTask = QtConcurrent::run(this, &MusicSourceFolder::ParseFolder);
-}
+  m_sDevice = JobScheduler::GetDeviceOfPath(m_sFolder);
 
-void MusicSourceFolder::Shutdown()
-{
-  if (m_WorkerTask.isRunning())
+  // start watching before the scan, so that no change can slip through in between
+  if (m_Watcher.OpenDirectory(m_sFolder, ezDirectoryWatcher::Writes | ezDirectoryWatcher::Creates | ezDirectoryWatcher::Renames | ezDirectoryWatcher::Subdirectories))
   {
-    m_bShutdownWorker = true;
-    m_WorkerTask.waitForFinished();
+    m_WatchTimer.start(250);
   }
+
+  StartScan(false);
 }
 
-void MusicSourceFolder::ParseFolder()
+void MusicSourceFolder::Shutdown()
 {
-  AppState::GetSingleton()->BeginBusyWork();
-
-  QDirIterator dirIt(m_sFolder, QDirIterator::Subdirectories | QDirIterator::FollowSymlinks);
+  m_WatchTimer.stop();
+  m_Watcher.CloseDirectory();
+  m_PendingChanges.clear();
+  m_bRescanNeeded = false;
 
-  MusicLibrary* ml = MusicLibrary::GetSingleton();
+  CancelJobs();
+}
 
-  int imported = 0;
+void MusicSourceFolder::StartScan(bool bFullVerify)
+{
+  m_pScanJob = JobScheduler::GetSingleton()->Schedule("Scan " + m_sFolder, JobPriority::Import, m_sDevice, [this, bFullVerify](Job& job) { ParseFolder(job, bFullVerify); });
+}
 
-  while (!m_bShutdownWorker && dirIt.hasNext())
+void MusicSourceFolder::CancelJobs()
+{
+  for (std::shared_ptr<Job>* ppJob : {&m_pScanJob, &m_pWatchJob})
   {
-    dirIt.next();
-
-    if (UpdateFile(dirIt.fileInfo()))
+    if (*ppJob)
     {
-      ++imported;
-
-      if (imported > 50)
-      {
-        imported = 0;
-        AppState::GetSingleton()->SongsHaveBeenImported();
-      }
+      (*ppJob)->Cancel();
+      (*ppJob)->Wait();
+      ppJob->reset();
     }
   }
-
-  if (imported > 0)
-  {
-    AppState::GetSingleton()->SongsHaveBeenImported();
-  }
-
-  AppState::GetSingleton()->EndBusyWork();
 }
 
-bool MusicSourceFolder::UpdateFile(const QFileInfo& info)
+void MusicSourceFolder::onWatchTimer()
 {
-  if (info.isDir())
-    return false;
+  const qint64 now = QDateTime::currentMSecsSinceEpoch();
 
-  MusicLibrary* ml = MusicLibrary::GetSingleton();
+  m_Watcher.EnumerateChanges([this, now](const QString& filename, ezDirectoryWatcherAction action) {
+    if (action == ezDirectoryWatcherAction::EventsLost)
+    {
+      m_bRescanNeeded = true;
+      return;
+    }
 
-  if (!ml->IsSupportedFileExtension(info.suffix().toUtf8().data()))
-    return false;
+    const QString sPath = QFileInfo(m_sFolder + "/" + QDir::fromNativeSeparators(filename)).absoluteFilePath();
+    m_PendingChanges[sPath] = now;
+  });
 
-  const QString sLocation = info.absoluteFilePath();
-  const QString sModDate = info.lastModified().toString("yyyy-MM-dd-hh-mm-ss");
+  if (m_bRescanNeeded)
+  {
+    // the scan finds all changes, also those that are still pending
+    m_PendingChanges.clear();
 
-  if (!ml->IsLocationModified(sLocation, sModDate))
-    return false;
+    // a running scan may already have passed the changed directories, so a new one has to start once it is finished
+    if ((m_pScanJob && !m_pScanJob->IsFinished()) || (m_pWatchJob && !m_pWatchJob->IsFinished()))
+      return;
 
-  SongInfo songInfo;
-  songInfo.m_sSongGuid = ComputeFileGuid(sLocation);
+    m_bRescanNeeded = false;
 
-  if (songInfo.m_sSongGuid.isEmpty())
-    return false;
+    // files that were modified in place don't change the directory timestamps, so everything has to be checked
+    StartScan(true);
+    return;
+  }
+
+  if (m_PendingChanges.isEmpty() || (m_pWatchJob && !m_pWatchJob->IsFinished()))
+    return;
 
-  songInfo.ReadSongInfo(sLocation);
+  // files that are still being written to produce more events, wait until they settle down
+  const qint64 settleTime = 300;
 
-  ml->AddSongToLibrary(songInfo.m_sSongGuid, songInfo);
-  ml->AddSongLocation(songInfo.m_sSongGuid, sLocation, sModDate);
+  std::vector<QString> changedPaths;
 
-  if (songInfo.m_iDiscNumber != 0)
+  for (auto it = m_PendingChanges.begin(); it != m_PendingChanges.end();)
   {
-    // disc number is not stored in the file tag itself, but externally
-    ml->UpdateSongDiscNumber(songInfo.m_sSongGuid, songInfo.m_iDiscNumber, true);
+    if (now - it.value() >= settleTime)
+    {
+      changedPaths.push_back(it.key());
+      it = m_PendingChanges.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
   }
 
-  return true;
+  if (!changedPaths.empty())
+  {
+    m_pWatchJob = JobScheduler::GetSingleton()->Schedule("Apply changes in " + m_sFolder, JobPriority::Import, m_sDevice, [this, changedPaths](Job& job) { ApplyFileChanges(job, changedPaths); });
+  }
 }
 
-// Skips ID3 tags only, thus only works for mp3 files!
-static void AdjustRangeID3v2(QFile& file, qint64& rangeStart)
+void MusicSourceFolder::ApplyFileChanges(Job& job, const std::vector<QString>& changedPaths)
 {
-  char tag[3];
-  if (file.read(tag, 3) != 3)
-    return;
+  MusicLibrary* ml = MusicLibrary::GetSingleton();
 
-  if (tag[0] != 'I' || tag[1] != 'D' || tag[2] != '3')
-    return;
+  bool bAnyChange = false;
 
-  file.seek(3 + 2 + 1);
+  // the type of change doesn't matter, only the current state on disk
+  for (const QString& sPath : changedPaths)
+  {
+    if (job.IsCanceled())
+      break;
 
-  char data[4];
-  if (file.read(data, 4) != 4)
-    return;
+    const QFileInfo info(sPath);
+
+    if (!info.exists())
+    {
+      // could have been a file or a whole directory
+      ml->RemoveSongLocation(sPath);
+      ml->RemoveFolder(sPath);
+      bAnyChange = true;
+    }
+    else if (info.isDir())
+    {
+      // a directory that was added or moved here, its content is unknown
+      ImportPipeline pipeline(AppConfig::GetSingleton()->GetImportPipelineConfig(), &job);
+      pipeline.Run(sPath, false);
+      bAnyChange = true;
+    }
+    else
+    {
+      // new, modified or renamed file
+      bAnyChange |= ImportPipeline::ImportFile(sPath);
+    }
 
-  qint32 size = ((qint32)data[0] << (7 * 3)) |
-                ((qint32)data[1] << (7 * 2)) |
-                ((qint32)data[2] << 7) |
-                ((qint32)data[3]);
+    job.AddProcessed(1, 0);
+  }
 
-  rangeStart = 3 + 2 + 1 + 4 + size;
+  if (bAnyChange)
+  {
+    AppState::GetSingleton()->SongsHaveBeenImported();
+  }
 }
 
-static void AdjustRangeID3v1(QFile& file, qint64& rangeEnd)
+void MusicSourceFolder::Verify(const QString& prefix)
 {
-  if (!file.seek(file.size() - 128))
+  if (m_sFolder.compare(prefix) != 0)
     return;
 
-  char tag[3];
-  if (file.read(tag, 3) != 3)
-    return;
+  // stop the current scan, but keep watching for changes
+  CancelJobs();
 
-  if (tag[0] != 'T' || tag[1] != 'A' || tag[2] != 'G')
-    return;
-
-  rangeEnd = file.size() - 128;
+  StartScan(true);
 }
 
-QString MusicSourceFolder::ComputeFileGuid(const QString& sFilepath) const
+void MusicSourceFolder::ParseFolder(Job& job, bool bFullVerify)
 {
-  QFile file(sFilepath);
-
-  if (!file.open(QIODevice::ReadOnly))
-    return QString();
-
-  // MP3 files can have tags at the end OR the beginning,
-  // which really messes up the GUID computation when you modify metadata and the tag is changed
-  // from being at the end to being at the beginning
-  // therefore always skip the MP3 tag at the beginning, if we find it, because we know the file format for this
-
-  qint64 rangeStart = 0;
-  qint64 rangeEnd = file.size();
-  AdjustRangeID3v2(file, rangeStart);
-  AdjustRangeID3v1(file, rangeEnd);
-  file.seek(rangeStart);
-
-  const qint64 fileSize = rangeEnd - rangeStart;
-
-  // TODO: if has ID3 tag at end -> ignore last 128 bytes
-
-  const qint64 blockSize = 4096 * 4;
-  const qint64 readRangeEnd = fileSize - blockSize;               // ignore the last part of the file, depending on the format, this may contain metadata, which can change
-  const qint64 fullBlocks = ((readRangeEnd - 0) / blockSize) - 2; // how much of the file we want to read, -1 because we also want to skip the start of the file, which often contains metadata
-  const qint64 readRangeStart = readRangeEnd - (fullBlocks * blockSize);
-
-  // if the file is too small, we can't properly handle it
-  if (readRangeStart < 0 || readRangeEnd < 0 || fullBlocks <= 0)
-    return QString();
-
-  QCryptographicHash hash(QCryptographicHash::Algorithm::Md5); // 128 bit should be sufficient for identification
-  QDataStream in(&file);
-
-  char buffer[blockSize * 3];
-
-  // skip the first n bytes, which potentially contain the song description
-  in.readRawData(buffer, readRangeStart);
-
-  // now read and hash the number of full blocks that we computed before
-  for (qint64 i = 0; i < fullBlocks; ++i)
-  {
-    in.readRawData(buffer, blockSize);
-
-    hash.addData(buffer, blockSize);
-  }
-
-  return hash.result().toHex();
+  ImportPipeline pipeline(AppConfig::GetSingleton()->GetImportPipelineConfig(), &job);
+  pipeline.Run(m_sFolder, bFullVerify);
 }
 
 void RemoveBrackets(QString& sentence)
@@ -400,7 +389,12 @@ bool MusicSourceFolder::ExecuteFileSort(const CopyInfo& ci, QString& outError)
     const QFileInfo targetInfo(ci.m_sTargetFile);
     const QString sModDate = targetInfo.lastModified().toString("yyyy-MM-dd-hh-mm-ss");
 
-    MusicLibrary::GetSingleton()->AddSongLocation(ci.m_sGuid, ci.m_sTargetFile, sModDate);
+    // the file content is unchanged, so is the GUID
+    QString sGuid = ci.m_sGuid;
+    int iGuidVersion = (int)FileGuidVersion::Current;
+    MusicLibrary::GetSingleton()->GetLocationGuid(ci.m_sSource, sGuid, iGuidVersion);
+
+    MusicLibrary::GetSingleton()->AddSongLocation(sGuid, ci.m_sTargetFile, sModDate, iGuidVersion);
 
     if (!QFile::remove(ci.m_sSource))
     {
@@ -1,12 +1,13 @@
 #pragma once
 
+#include "Misc/FileSystemWatcher.h"
+#include "Misc/JobScheduler.h"
 #include "MusicLibrary/MusicSource.h"
 
-#include <QFuture>
+#include <QHash>
+#include <QTimer>
 #include <deque>
 
-class QFileInfo;
-
 struct CopyInfo
 {
   QString m_sGuid;
@@ -26,17 +27,29 @@ public:
   virtual void Startup() override;
   virtual void Shutdown() override;
   virtual void Sort(const QString& prefix) override;
+  virtual void Verify(const QString& prefix) override;
+
+private slots:
+  void onWatchTimer();
 
 private:
   static void GatherFilesToSort(const QString& prefix, std::deque<CopyInfo>& cis);
   static bool ExecuteFileSort(const CopyInfo& ci, QString& outError);
   static void DeleteEmptyFolders(const QString& folder);
 
-  void ParseFolder();
-  QString ComputeFileGuid(const QString& sFilepath) const;
-  bool UpdateFile(const QFileInfo& info);
+  void StartScan(bool bFullVerify);
+  void CancelJobs();
+  void ParseFolder(Job& job, bool bFullVerify);
+  void ApplyFileChanges(Job& job, const std::vector<QString>& changedPaths);
 
   QString m_sFolder;
-  QFuture<void> m_WorkerTask;
-  volatile bool m_bShutdownWorker = false;
+  QString m_sDevice;
+  std::shared_ptr<Job> m_pScanJob;
+
+  // live updates: file system changes are collected by the timer and then applied in the background
+  ezDirectoryWatcher m_Watcher;
+  QTimer m_WatchTimer;
+  std::shared_ptr<Job> m_pWatchJob;
+  QHash<QString, qint64> m_PendingChanges; // path -> time of the last change
+  bool m_bRescanNeeded = false;            // the watcher lost events
 };
@@ -0,0 +1,294 @@
+#include "MusicLibrary/SongStore.h"
+#include <QDateTime>
+#include <assert.h>
+
+static QString FormatDate(int secondsSinceEpoch)
+{
+  if (secondsSinceEpoch < 0)
+    return QString();
+
+  // same format as the strftime() columns in SQL_SONG_COLUMNS
+  return QDateTime::fromSecsSinceEpoch(secondsSinceEpoch).toString("yyyy-MM-dd hh:mm");
+}
+
+std::atomic<quint64> SongStore::s_uiRevision(0);
+
+SongStore::SongStore()
+{
+  Clear();
+}
+
+void SongStore::Clear()
+{
+  ++s_uiRevision;
+
+  m_Guids.clear();
+  m_GuidToRow.clear();
+
+  for (int c = 0; c < (int)SongColumn::ENUM_COUNT; ++c)
+  {
+    m_Columns[c].clear();
+  }
+
+  m_StringPool.clear();
+  m_FoldedStringPool.clear();
+  m_StringToPoolIndex.clear();
+  m_Changes.clear();
+
+  // QString() and "" are equal for QHash, so NULL is never looked up, it always has index 0
+  m_StringPool.push_back(QString());
+  m_FoldedStringPool.push_back(QString());
+  PoolString(QString(""));
+}
+
+void SongStore::Reserve(int numSongs)
+{
+  m_Guids.reserve(numSongs);
+  m_GuidToRow.reserve(numSongs);
+
+  for (int c = 0; c < (int)SongColumn::ENUM_COUNT; ++c)
+  {
+    m_Columns[c].reserve(numSongs);
+  }
+}
+
+int SongStore::PoolString(const QString& sString)
+{
+  if (sString.isNull())
+    return s_iNullString;
+
+  auto it = m_StringToPoolIndex.find(sString);
+  if (it != m_StringToPoolIndex.end())
+    return it.value();
+
+  const int idx = (int)m_StringPool.size();
+  m_StringPool.push_back(sString);
+  m_FoldedStringPool.push_back(FoldCase(sString));
+  m_StringToPoolIndex.insert(sString, idx);
+  return idx;
+}
+
+QString SongStore::FoldCase(const QString& sString)
+{
+  QString result = sString;
+
+  // only detaches, if there is anything to change
+  for (int i = 0; i < sString.size(); ++i)
+  {
+    const ushort c = sString[i].unicode();
+
+    if (c >= 'A' && c <= 'Z')
+      result[i] = QChar(c + ('a' - 'A'));
+  }
+
+  return result;
+}
+
+void SongStore::SetSong(const SongInfo& info)
+{
+  ++s_uiRevision;
+
+  int row = FindRow(info.m_sSongGuid);
+
+  if (row < 0)
+  {
+    row = (int)m_Guids.size();
+    m_Guids.push_back(info.m_sSongGuid);
+    m_GuidToRow.insert(info.m_sSongGuid, row);
+
+    for (int c = 0; c < (int)SongColumn::ENUM_COUNT; ++c)
+    {
+      m_Columns[c].push_back(0);
+    }
+
+    AddChange(info.m_sSongGuid, SongInfo::Part::Existence);
+  }
+
+  int values[(int)SongColumn::ENUM_COUNT];
+  values[(int)SongColumn::Title] = PoolString(info.m_sTitle);
+  values[(int)SongColumn::Artist] = PoolString(info.m_sArtist);
+  values[(int)SongColumn::Album] = PoolString(info.m_sAlbum);
+  values[(int)SongColumn::DiscNumber] = info.m_iDiscNumber;
+  values[(int)SongColumn::TrackNumber] = info.m_iTrackNumber;
+  values[(int)SongColumn::Year] = info.m_iYear;
+  values[(int)SongColumn::Length] = info.m_iLengthInMS;
+  values[(int)SongColumn::Rating] = info.m_iRating;
+  values[(int)SongColumn::Volume] = info.m_iVolume;
+  values[(int)SongColumn::StartOffset] = info.m_iStartOffset;
+  values[(int)SongColumn::EndOffset] = info.m_iEndOffset;
+  values[(int)SongColumn::LastPlayed] = info.m_iLastPlayed;
+  values[(int)SongColumn::DateAdded] = info.m_iDateAdded;
+  values[(int)SongColumn::PlayCount] = info.m_iPlayCount;
+
+  unsigned int uiChanged = 0;
+
+  for (int c = 0; c < (int)SongColumn::ENUM_COUNT; ++c)
+  {
+    if (m_Columns[c][row] != values[c])
+    {
+      m_Columns[c][row] = values[c];
+      uiChanged |= GetPart((SongColumn)c);
+    }
+  }
+
+  if (uiChanged != 0)
+    AddChange(info.m_sSongGuid, uiChanged);
+}
+
+void SongStore::RemoveSong(const QString& sGuid)
+{
+  ++s_uiRevision;
+
+  const int row = FindRow(sGuid);
+
+  if (row < 0)
+    return;
+
+  AddChange(sGuid, SongInfo::Part::Existence);
+
+  const int lastRow = (int)m_Guids.size() - 1;
+
+  m_GuidToRow.remove(sGuid);
+
+  if (row != lastRow)
+  {
+    // move the last row into the freed slot
+    m_Guids[row] = m_Guids[lastRow];
+    m_GuidToRow[m_Guids[row]] = row;
+
+    for (int c = 0; c < (int)SongColumn::ENUM_COUNT; ++c)
+    {
+      m_Columns[c][row] = m_Columns[c][lastRow];
+    }
+  }
+
+  m_Guids.pop_back();
+
+  for (int c = 0; c < (int)SongColumn::ENUM_COUNT; ++c)
+  {
+    m_Columns[c].pop_back();
+  }
+}
+
+int SongStore::FindRow(const QString& sGuid) const
+{
+  auto it = m_GuidToRow.find(sGuid);
+
+  if (it == m_GuidToRow.end())
+    return -1;
+
+  return it.value();
+}
+
+bool SongStore::GetSong(const QString& sGuid, SongInfo& out_Info) const
+{
+  const int row = FindRow(sGuid);
+
+  if (row < 0)
+    return false;
+
+  GetSong(row, out_Info);
+  return true;
+}
+
+void SongStore::GetSong(int row, SongInfo& out_Info) const
+{
+  out_Info.m_sSongGuid = m_Guids[row];
+  out_Info.m_sTitle = IsNull(row, SongColumn::Title) ? QString("<invalid>") : GetString(row, SongColumn::Title);
+  out_Info.m_sArtist = GetString(row, SongColumn::Artist);
+  out_Info.m_sAlbum = GetString(row, SongColumn::Album);
+  out_Info.m_iDiscNumber = GetInt(row, SongColumn::DiscNumber);
+  out_Info.m_iTrackNumber = GetInt(row, SongColumn::TrackNumber);
+  out_Info.m_iYear = GetInt(row, SongColumn::Year);
+  out_Info.m_iLengthInMS = GetInt(row, SongColumn::Length);
+  out_Info.m_iRating = GetInt(row, SongColumn::Rating);
+  out_Info.m_iVolume = GetInt(row, SongColumn::Volume);
+  out_Info.m_iStartOffset = GetInt(row, SongColumn::StartOffset);
+  out_Info.m_iEndOffset = GetInt(row, SongColumn::EndOffset);
+  out_Info.m_iLastPlayed = GetInt(row, SongColumn::LastPlayed);
+  out_Info.m_iDateAdded = GetInt(row, SongColumn::DateAdded);
+  out_Info.m_iPlayCount = GetInt(row, SongColumn::PlayCount);
+  out_Info.m_sLastPlayed = FormatDate(out_Info.m_iLastPlayed);
+  out_Info.m_sDateAdded = FormatDate(out_Info.m_iDateAdded);
+}
+
+void SongStore::SetInt(const QString& sGuid, SongColumn column, int value)
+{
+  assert(!IsStringColumn(column));
+
+  ++s_uiRevision;
+
+  const int row = FindRow(sGuid);
+
+  if (row < 0 || m_Columns[(int)column][row] == value)
+    return;
+
+  m_Columns[(int)column][row] = value;
+  AddChange(sGuid, GetPart(column));
+}
+
+void SongStore::SetString(const QString& sGuid, SongColumn column, const QString& value)
+{
+  assert(IsStringColumn(column));
+
+  ++s_uiRevision;
+
+  const int row = FindRow(sGuid);
+
+  if (row < 0)
+    return;
+
+  const int idx = PoolString(value);
+
+  if (m_Columns[(int)column][row] == idx)
+    return;
+
+  m_Columns[(int)column][row] = idx;
+  AddChange(sGuid, GetPart(column));
+}
+
+unsigned int SongStore::GetPart(SongColumn column)
+{
+  switch (column)
+  {
+  case SongColumn::Title:
+    return SongInfo::Part::Title;
+  case SongColumn::Artist:
+    return SongInfo::Part::Artist;
+  case SongColumn::Album:
+    return SongInfo::Part::Album;
+  case SongColumn::DiscNumber:
+    return SongInfo::Part::DiscNumber;
+  case SongColumn::TrackNumber:
+    return SongInfo::Part::Track;
+  case SongColumn::Year:
+    return SongInfo::Part::Year;
+  case SongColumn::Length:
+    return SongInfo::Part::Length;
+  case SongColumn::Rating:
+    return SongInfo::Part::Rating;
+  case SongColumn::Volume:
+    return SongInfo::Part::Volume;
+  case SongColumn::StartOffset:
+    return SongInfo::Part::StartOffset;
+  case SongColumn::EndOffset:
+    return SongInfo::Part::EndOffset;
+  case SongColumn::LastPlayed:
+    return SongInfo::Part::LastPlayed;
+  case SongColumn::DateAdded:
+    return SongInfo::Part::DateAdded;
+  case SongColumn::PlayCount:
+    return SongInfo::Part::PlayCount;
+
+  default:
+    assert(false && "unknown column");
+  }
+
+  return 0;
+}
+
+void SongStore::TakeChanges(QHash<QString, unsigned int>& out_Changes)
+{
+  out_Changes.clear();
+  out_Changes.swap(m_Changes);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Misc/Common.h"
+#include "Misc/Song.h"
+#include <QHash>
+#include <atomic>
+#include <vector>
+
+/// \brief The columns of the music table that SongStore keeps in memory.
+enum class SongColumn
+{
+  // string columns
+  Title,
+  Artist,
+  Album,
+
+  // integer columns
+  DiscNumber,
+  TrackNumber,
+  Year,
+  Length,
+  Rating,
+  Volume,
+  StartOffset,
+  EndOffset,
+  LastPlayed,
+  DateAdded,
+  PlayCount,
+
+  ENUM_COUNT
+};
+
+/// \brief An in-memory copy of the music table, stored column by column.
+///
+/// Every column is an array with one entry per row. String columns store indices into a pool of deduplicated strings,
+/// since many songs share the same artist and album. NULL strings of the database have their own pool index (s_iNullString),
+/// so that they can be told apart from empty strings. A hash map from song GUID to row allows O(1) lookups.
+/// Removing a song moves the last row into the freed slot, so row indices are not stable across removals.
+///
+/// SongStore does not do any locking, the owner has to synchronize access.
+class SongStore
+{
+public:
+  SongStore();
+
+  void Clear();
+  void Reserve(int numSongs);
+
+  int GetNumSongs() const { return (int)m_Guids.size(); }
+
+  /// \brief Adds the song, or overwrites all its values if it is already known.
+  void SetSong(const SongInfo& info);
+  void RemoveSong(const QString& sGuid);
+
+  /// \brief Fills out \a out_Info with all the values of the given song. Returns false, if the song is unknown.
+  bool GetSong(const QString& sGuid, SongInfo& out_Info) const;
+
+  /// \brief Updates a single value. Does nothing, if the song is unknown.
+  void SetInt(const QString& sGuid, SongColumn column, int value);
+  void SetString(const QString& sGuid, SongColumn column, const QString& value);
+
+  /// \brief Returns the row index of the given song or -1, if the song is unknown.
+  int FindRow(const QString& sGuid) const;
+
+  const QString& GetGuid(int row) const { return m_Guids[row]; }
+  int GetInt(int row, SongColumn column) const { return m_Columns[(int)column][row]; }
+  const QString& GetString(int row, SongColumn column) const { return m_StringPool[m_Columns[(int)column][row]]; }
+  bool IsNull(int row, SongColumn column) const { return IsStringColumn(column) ? m_Columns[(int)column][row] == s_iNullString : m_Columns[(int)column][row] == -1; }
+  void GetSong(int row, SongInfo& out_Info) const;
+
+  static bool IsStringColumn(SongColumn column) { return column <= SongColumn::Album; }
+
+  /// \brief Direct access to all values of a column. For string columns these are indices into the string pool.
+  const std::vector<int>& GetColumn(SongColumn column) const { return m_Columns[(int)column]; }
+
+  int GetNumPooledStrings() const { return (int)m_StringPool.size(); }
+  const QString& GetPooledString(int idx) const { return m_StringPool[idx]; }
+  /// \brief The pooled string with ASCII letters in lower case, see FoldCase().
+  const QString& GetFoldedPooledString(int idx) const { return m_FoldedStringPool[idx]; }
+
+  /// \brief Lower cases ASCII letters only. This is how SQLite's LIKE compares strings (without the ICU extension).
+  static QString FoldCase(const QString& sString);
+
+  /// \brief The pool index of NULL strings (of the database). All other strings, including empty ones, have other indices.
+  static const int s_iNullString = 0;
+
+  /// \brief Returns the SongInfo::Part that the column belongs to.
+  static unsigned int GetPart(SongColumn column);
+
+  /// \brief Moves the changes since the last call into \a out_Changes: for every song GUID, which SongInfo::Part values changed.
+  ///
+  /// Only values that are really different are reported. Adding or removing a song is reported as SongInfo::Part::Existence.
+  void TakeChanges(QHash<QString, unsigned int>& out_Changes);
+
+  /// \brief Increases with every change of any SongStore. Caches of song data compare it, to know when they are outdated.
+  ///
+  /// Can be read without locking. Read it while holding the lock that protects the store, to get the revision of the data read under that lock.
+  static quint64 GetRevision() { return s_uiRevision; }
+
+private:
+  int PoolString(const QString& sString);
+  void AddChange(const QString& sGuid, unsigned int uiParts) { m_Changes[sGuid] |= uiParts; }
+
+  static std::atomic<quint64> s_uiRevision;
+
+  std::vector<QString> m_Guids;
+  std::vector<int> m_Columns[(int)SongColumn::ENUM_COUNT];
+  QHash<QString, int> m_GuidToRow;
+
+  std::vector<QString> m_StringPool;
+  std::vector<QString> m_FoldedStringPool;
+  QHash<QString, int> m_StringToPoolIndex;
+
+  QHash<QString, unsigned int> m_Changes; // song GUID -> SongInfo::Part mask
+};
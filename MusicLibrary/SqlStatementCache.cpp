@@ -0,0 +1,331 @@
+#include "MusicLibrary/SqlStatementCache.h"
+#include <assert.h>
+#include <windows.h>
+
+static const char* GetStatementSql(SqlStatement kind)
+{
+  switch (kind)
+  {
+  case SqlStatement::BeginTransaction:
+    return "BEGIN IMMEDIATE TRANSACTION";
+  case SqlStatement::EndTransaction:
+    return "END TRANSACTION";
+
+  case SqlStatement::FindSong:
+    return "SELECT " SQL_SONG_COLUMNS " FROM music WHERE id = ?1";
+  case SqlStatement::GetAllSongGuids:
+    return "SELECT id FROM music";
+  case SqlStatement::CountSongs:
+    return "SELECT COUNT(*) FROM music";
+  case SqlStatement::AddSong:
+    return "INSERT INTO music (id, title, artist, album, disc, track, year, length) VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8)"
+           " ON CONFLICT(id) DO UPDATE SET title = excluded.title, artist = excluded.artist, album = excluded.album"
+           ", disc = excluded.disc, track = excluded.track, year = excluded.year, length = excluded.length";
+  case SqlStatement::RemoveSong:
+    return "DELETE FROM music WHERE id = ?1";
+  case SqlStatement::RemoveSongsWithoutLocations:
+    return "DELETE FROM music WHERE NOT EXISTS (SELECT 1 FROM locations WHERE locations.id = music.id) RETURNING id";
+  case SqlStatement::CountSongPlayed:
+    return "UPDATE music SET lastplayed = (strftime('%s','now')), playcount = playcount + 1 WHERE id = ?1";
+
+  case SqlStatement::AddSearchEntry:
+    return "INSERT INTO music_search (rowid, title, artist, album) SELECT rowid, title, artist, album FROM music WHERE id = ?1";
+  case SqlStatement::RemoveSearchEntry:
+    return "DELETE FROM music_search WHERE rowid = (SELECT rowid FROM music WHERE id = ?1)";
+
+  case SqlStatement::RemoveSearchEntriesWithoutLocations:
+    return "DELETE FROM music_search WHERE rowid IN (SELECT rowid FROM music WHERE NOT EXISTS (SELECT 1 FROM locations WHERE locations.id = music.id))";
+
+  case SqlStatement::AddSongLocation:
+    return "INSERT OR REPLACE INTO locations (path, id, modified, guidversion) VALUES(?1, ?2, ?3, ?4)";
+  case SqlStatement::RemoveSongLocation:
+    return "DELETE FROM locations WHERE path = ?1";
+  case SqlStatement::GetSongLocations:
+    return "SELECT path FROM locations WHERE id = ?1";
+  case SqlStatement::HasSongLocations:
+    return "SELECT 1 FROM locations WHERE id = ?1 LIMIT 1";
+  case SqlStatement::IsLocationModified:
+    return "SELECT 1 FROM locations WHERE path = ?1 AND modified = ?2 LIMIT 1";
+  case SqlStatement::GetAllLocations:
+    return "SELECT path FROM locations";
+  case SqlStatement::FindSongsInLocation:
+    return "SELECT id FROM locations WHERE path >= ?1 AND path < ?2";
+  case SqlStatement::RemoveSongLocationsInFolder:
+    return "DELETE FROM locations WHERE path >= ?1 AND path < ?2";
+  case SqlStatement::GetLocationGuid:
+    return "SELECT id, guidversion FROM locations WHERE path = ?1";
+  case SqlStatement::GetLocationsInFolder:
+    return "SELECT path, modified FROM locations WHERE path >= ?1 AND path < ?2";
+  case SqlStatement::GetOutdatedLocations:
+    return "SELECT path, id FROM locations WHERE guidversion < ?1";
+
+  case SqlStatement::RenameSong:
+    return "UPDATE music SET id = ?2 WHERE id = ?1";
+  case SqlStatement::RenameSongLocations:
+    return "UPDATE locations SET id = ?2, guidversion = ?3 WHERE id = ?1";
+  case SqlStatement::AddGuidRemap:
+    return "INSERT OR REPLACE INTO guidremap (old, new) VALUES(?1, ?2)";
+  case SqlStatement::GetAllGuidRemaps:
+    return "SELECT old, new FROM guidremap";
+
+  case SqlStatement::GetDirectoriesInLocation:
+    return "SELECT path, modified, children FROM directories WHERE path = ?1 OR (path >= ?2 AND path < ?3)";
+  case SqlStatement::AddDirectory:
+    return "INSERT OR REPLACE INTO directories (path, modified, children) VALUES(?1, ?2, ?3)";
+  case SqlStatement::RemoveDirectory:
+    return "DELETE FROM directories WHERE path = ?1";
+  case SqlStatement::RemoveDirectoriesInFolder:
+    return "DELETE FROM directories WHERE path = ?1 OR (path >= ?2 AND path < ?3)";
+
+  case SqlStatement::GetAllKnownArtists:
+    return "SELECT DISTINCT artist FROM music";
+  case SqlStatement::GetAllKnownAlbums:
+    return "SELECT DISTINCT album FROM music";
+  case SqlStatement::GetAllKnownAlbumsOfArtist:
+    return "SELECT DISTINCT album FROM music WHERE artist = ?1";
+
+  case SqlStatement::UpdateSongDuration:
+    return "UPDATE music SET length = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongTitle:
+    return "UPDATE music SET title = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongArtist:
+    return "UPDATE music SET artist = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongAlbum:
+    return "UPDATE music SET album = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongTrackNumber:
+    return "UPDATE music SET track = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongDiscNumber:
+    return "UPDATE music SET disc = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongYear:
+    return "UPDATE music SET year = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongRating:
+    return "UPDATE music SET rating = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongVolume:
+    return "UPDATE music SET volume = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongStartOffset:
+    return "UPDATE music SET start = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongEndOffset:
+    return "UPDATE music SET end = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongPlayDate:
+    return "UPDATE music SET lastplayed = ?2 WHERE id = ?1";
+  case SqlStatement::UpdateSongPlayCount:
+    return "UPDATE music SET playcount = ?2 WHERE id = ?1";
+
+  // NULL in the staging table means the value is unchanged
+  case SqlStatement::StageJournalValues:
+    return "INSERT INTO journal_staging (id, rating, volume, start, end, disc, lastplayed) VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7)";
+  case SqlStatement::ApplyJournalStaging:
+    return "UPDATE music SET rating = coalesce(s.rating, music.rating), volume = coalesce(s.volume, music.volume)"
+           ", start = coalesce(s.start, music.start), end = coalesce(s.end, music.end), disc = coalesce(s.disc, music.disc)"
+           ", lastplayed = coalesce(s.lastplayed, music.lastplayed) FROM journal_staging AS s WHERE music.id = s.id";
+  case SqlStatement::ClearJournalStaging:
+    return "DELETE FROM journal_staging";
+
+  default:
+    assert(false && "Missing case statement");
+  }
+
+  return nullptr;
+}
+
+SqlStatementCache::~SqlStatementCache()
+{
+  Shutdown();
+}
+
+void SqlStatementCache::Startup(sqlite3* pDatabase)
+{
+  Shutdown();
+
+  m_pDatabase = pDatabase;
+}
+
+void SqlStatementCache::Shutdown()
+{
+  std::lock_guard<std::recursive_mutex> lock(m_Mutex);
+
+  for (int i = 0; i < (int)SqlStatement::ENUM_COUNT; ++i)
+  {
+    assert(!m_bInUse[i] && "Statement is still in use");
+
+    sqlite3_finalize(m_Statements[i]);
+    m_Statements[i] = nullptr;
+  }
+
+  m_pDatabase = nullptr;
+}
+
+sqlite3_stmt* SqlStatementCache::Acquire(SqlStatement kind)
+{
+  const int idx = (int)kind;
+
+  assert(!m_bInUse[idx] && "The same cached statement can't be used recursively");
+
+  if (m_Statements[idx] == nullptr && m_pDatabase != nullptr)
+  {
+    if (sqlite3_prepare_v3(m_pDatabase, GetStatementSql(kind), -1, SQLITE_PREPARE_PERSISTENT, &m_Statements[idx], nullptr) != SQLITE_OK)
+    {
+      char msg[512];
+      sprintf_s(msg, 512, "SQL error: %s\n", sqlite3_errmsg(m_pDatabase));
+      OutputDebugStringA(msg);
+
+      m_Statements[idx] = nullptr;
+    }
+  }
+
+  m_bInUse[idx] = m_Statements[idx] != nullptr;
+  return m_Statements[idx];
+}
+
+void SqlStatementCache::Release(SqlStatement kind)
+{
+  const int idx = (int)kind;
+
+  sqlite3_reset(m_Statements[idx]);
+  sqlite3_clear_bindings(m_Statements[idx]);
+  m_bInUse[idx] = false;
+}
+
+SqlQuery::SqlQuery(SqlStatementCache& cache, SqlStatement kind)
+    : m_Lock(cache.m_Mutex)
+{
+  m_pCache = &cache;
+  m_pStatement = cache.Acquire(kind);
+
+  if (m_pStatement != nullptr)
+  {
+    m_Kind = kind;
+  }
+}
+
+SqlQuery::SqlQuery(SqlStatementCache& cache, const QString& sql)
+    : m_Lock(cache.m_Mutex)
+{
+  m_pCache = &cache;
+
+  if (cache.m_pDatabase == nullptr)
+    return;
+
+  if (sqlite3_prepare_v2(cache.m_pDatabase, sql.toUtf8().data(), -1, &m_pStatement, nullptr) != SQLITE_OK)
+  {
+    ReportError(SQLITE_ERROR);
+
+    sqlite3_finalize(m_pStatement);
+    m_pStatement = nullptr;
+  }
+}
+
+SqlQuery::~SqlQuery()
+{
+  if (m_pStatement == nullptr)
+    return;
+
+  if (m_Kind != SqlStatement::ENUM_COUNT)
+  {
+    m_pCache->Release(m_Kind);
+  }
+  else
+  {
+    sqlite3_finalize(m_pStatement);
+  }
+}
+
+void SqlQuery::Bind(int param, int value)
+{
+  if (m_pStatement == nullptr)
+    return;
+
+  sqlite3_bind_int(m_pStatement, param, value);
+}
+
+void SqlQuery::Bind(int param, const QString& value)
+{
+  if (m_pStatement == nullptr)
+    return;
+
+  const QByteArray utf8 = value.toUtf8();
+  sqlite3_bind_text(m_pStatement, param, utf8.constData(), utf8.size(), SQLITE_TRANSIENT);
+}
+
+void SqlQuery::BindNull(int param)
+{
+  if (m_pStatement == nullptr)
+    return;
+
+  sqlite3_bind_null(m_pStatement, param);
+}
+
+void SqlQuery::BindOrNull(int param, const QString& value)
+{
+  if (m_pStatement == nullptr)
+    return;
+
+  if (value.isEmpty())
+  {
+    sqlite3_bind_null(m_pStatement, param);
+  }
+  else
+  {
+    Bind(param, value);
+  }
+}
+
+bool SqlQuery::Step()
+{
+  if (m_pStatement == nullptr)
+    return false;
+
+  const int ret = sqlite3_step(m_pStatement);
+
+  if (ret == SQLITE_ROW)
+    return true;
+
+  if (ret != SQLITE_DONE)
+  {
+    ReportError(ret);
+  }
+
+  return false;
+}
+
+bool SqlQuery::Execute()
+{
+  while (Step())
+  {
+  }
+
+  return m_pStatement != nullptr && !m_bFailed;
+}
+
+bool SqlQuery::IsNull(int column) const
+{
+  return sqlite3_column_type(m_pStatement, column) == SQLITE_NULL;
+}
+
+int SqlQuery::GetInt(int column) const
+{
+  return sqlite3_column_int(m_pStatement, column);
+}
+
+QString SqlQuery::GetText(int column) const
+{
+  const char* szText = reinterpret_cast<const char*>(sqlite3_column_text(m_pStatement, column));
+
+  if (szText == nullptr)
+    return QString();
+
+  return QString::fromUtf8(szText, sqlite3_column_bytes(m_pStatement, column));
+}
+
+void SqlQuery::ReportError(int result)
+{
+  m_bFailed = true;
+
+  if (result == SQLITE_ABORT)
+    return;
+
+  char msg[512];
+  sprintf_s(msg, 512, "SQL error: %s\n", sqlite3_errmsg(m_pCache->m_pDatabase));
+
+  OutputDebugStringA(msg);
+}
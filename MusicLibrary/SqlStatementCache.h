@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Misc/Common.h"
+#include <mutex>
+#include <sqlite3.h>
+
+/// \brief The columns of the music table, in the order in which SongInfo rows are read.
+#define SQL_SONG_COLUMNS                                                                     \
+  "id, title, artist, album, disc, track, year, length, rating, volume"                      \
+  ", start, end, lastplayed, dateadded, playcount"                                           \
+  ", strftime('%Y-%m-%d %H:%M', lastplayed, 'unixepoch', 'localtime') AS playedstring"       \
+  ", strftime('%Y-%m-%d %H:%M', dateadded, 'unixepoch', 'localtime') AS addedstring"
+
+/// \brief All the statements that MusicLibrary executes regularly.
+///
+/// Each kind is compiled only once per database connection and then reused with different bound parameters.
+enum class SqlStatement
+{
+  BeginTransaction,
+  EndTransaction,
+
+  FindSong,
+  GetAllSongGuids,
+  CountSongs,
+  AddSong,
+  RemoveSong,
+  RemoveSongsWithoutLocations,
+  CountSongPlayed,
+
+  AddSearchEntry,
+  RemoveSearchEntry,
+  RemoveSearchEntriesWithoutLocations,
+
+  AddSongLocation,
+  RemoveSongLocation,
+  GetSongLocations,
+  HasSongLocations,
+  IsLocationModified,
+  GetAllLocations,
+  FindSongsInLocation,
+  RemoveSongLocationsInFolder,
+  GetLocationGuid,
+  GetLocationsInFolder,
+  GetOutdatedLocations,
+
+  RenameSong,
+  RenameSongLocations,
+  AddGuidRemap,
+  GetAllGuidRemaps,
+
+  GetDirectoriesInLocation,
+  AddDirectory,
+  RemoveDirectory,
+  RemoveDirectoriesInFolder,
+
+  GetAllKnownArtists,
+  GetAllKnownAlbums,
+  GetAllKnownAlbumsOfArtist,
+
+  UpdateSongDuration,
+  UpdateSongTitle,
+  UpdateSongArtist,
+  UpdateSongAlbum,
+  UpdateSongTrackNumber,
+  UpdateSongDiscNumber,
+  UpdateSongYear,
+  UpdateSongRating,
+  UpdateSongVolume,
+  UpdateSongStartOffset,
+  UpdateSongEndOffset,
+  UpdateSongPlayDate,
+  UpdateSongPlayCount,
+
+  StageJournalValues,
+  ApplyJournalStaging,
+  ClearJournalStaging,
+
+  ENUM_COUNT
+};
+
+/// \brief Owns one prepared sqlite3_stmt per SqlStatement kind for a single database connection.
+///
+/// Statements are compiled lazily on first use and finalized on Shutdown().
+/// Use SqlQuery to execute them, it takes care of locking, binding and resetting.
+class SqlStatementCache
+{
+public:
+  ~SqlStatementCache();
+
+  void Startup(sqlite3* pDatabase);
+  void Shutdown();
+
+  sqlite3* GetDatabase() const { return m_pDatabase; }
+
+private:
+  friend class SqlQuery;
+
+  sqlite3_stmt* Acquire(SqlStatement kind);
+  void Release(SqlStatement kind);
+
+  sqlite3* m_pDatabase = nullptr;
+  std::recursive_mutex m_Mutex;
+  sqlite3_stmt* m_Statements[(int)SqlStatement::ENUM_COUNT] = {};
+  bool m_bInUse[(int)SqlStatement::ENUM_COUNT] = {};
+};
+
+/// \brief Executes a single SQL statement with bound parameters.
+///
+/// Either uses a cached statement (by kind) or compiles a one-off statement from a string (for dynamically built queries).
+/// The cache is locked for the lifetime of the SqlQuery object, so keep it short-lived.
+/// Parameter indices are 1-based, column indices are 0-based, just as in the sqlite3 API.
+class SqlQuery
+{
+public:
+  SqlQuery(SqlStatementCache& cache, SqlStatement kind);
+  SqlQuery(SqlStatementCache& cache, const QString& sql);
+  ~SqlQuery();
+
+  SqlQuery(const SqlQuery&) = delete;
+  void operator=(const SqlQuery&) = delete;
+
+  void Bind(int param, int value);
+  void Bind(int param, const QString& value);
+
+  /// \brief Binds NULL for empty strings, the string otherwise.
+  void BindOrNull(int param, const QString& value);
+  void BindNull(int param);
+
+  /// \brief Advances to the next result row. Returns false once there are no more rows, or if an error occurred.
+  bool Step();
+
+  /// \brief Runs the statement to completion, ignoring any result rows. Returns false, if an error occurred.
+  bool Execute();
+
+  bool IsNull(int column) const;
+  int GetInt(int column) const;
+  QString GetText(int column) const;
+
+private:
+  void ReportError(int result);
+
+  std::unique_lock<std::recursive_mutex> m_Lock;
+  SqlStatementCache* m_pCache = nullptr;
+  SqlStatement m_Kind = SqlStatement::ENUM_COUNT;
+  sqlite3_stmt* m_pStatement = nullptr;
+  bool m_bFailed = false;
+};
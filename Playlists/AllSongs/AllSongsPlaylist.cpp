@@ -17,11 +17,8 @@ void AllSongsPlaylist::Refresh(PlaylistRefreshReason reason)
   m_CachedTotalDuration = 0;
   m_NumCachedSongDurations = 0;
 
-  beginResetModel();
-
-  m_AllSongs = std::move(MusicLibrary::GetSingleton()->GetAllSongGuids(true));
-
-  endResetModel();
+  // usually only a few songs were imported or removed
+  ReplaceSongList(m_AllSongs, MusicLibrary::GetSingleton()->GetAllSongGuids(true));
 
   emit StatsChanged();
 }
@@ -96,7 +93,7 @@ void AllSongsPlaylist::Save(QDataStream& stream)
   throw std::logic_error("The method or operation is not implemented.");
 }
 
-void AllSongsPlaylist::Load(QDataStream& stream)
+void AllSongsPlaylist::Load(const std::vector<QDataStream*>& journals)
 {
   throw std::logic_error("The method or operation is not implemented.");
 }
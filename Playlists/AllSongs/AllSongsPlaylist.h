@@ -40,7 +40,7 @@ public:
 
   virtual bool CanSerialize() override;
   virtual void Save(QDataStream& stream) override;
-  virtual void Load(QDataStream& stream) override;
+  virtual void Load(const std::vector<QDataStream*>& journals) override;
 
   virtual bool LookupSongByIndex(int index, SongInfo& song) const override;
 
@@ -1,9 +1,13 @@
 #include "Config/AppConfig.h"
 #include "Config/AppState.h"
+#include "Misc/ListDiff.h"
+#include "MusicLibrary/SongStore.h"
 #include "Playlists/Playlist.h"
 #include <QFile>
 #include <QMimeData>
+#include <QSet>
 #include <algorithm>
+#include <deque>
 #include <random>
 #include <QColor>
 #include <QFont>
@@ -14,6 +18,20 @@ Playlist::Playlist(const QString& sTitle, const QString& guid)
   m_sGuid = guid;
 
   connect(AppState::GetSingleton(), &AppState::ActiveSongChanged, this, &Playlist::onActiveSongChanged);
+  connect(MusicLibrary::GetSingleton(), &MusicLibrary::SongsChanged, this, &Playlist::onSongsChanged);
+
+  // the cached rows may not match the songs anymore
+  connect(this, &QAbstractItemModel::modelReset, this, &Playlist::InvalidateRowCache);
+  connect(this, &QAbstractItemModel::layoutChanged, this, &Playlist::InvalidateRowCache);
+  connect(this, &QAbstractItemModel::rowsInserted, this, &Playlist::InvalidateRowCache);
+  connect(this, &QAbstractItemModel::rowsRemoved, this, &Playlist::InvalidateRowCache);
+  connect(this, &QAbstractItemModel::rowsMoved, this, &Playlist::InvalidateRowCache);
+  connect(this, &QAbstractItemModel::dataChanged, this, [this](const QModelIndex& topLeft, const QModelIndex& bottomRight, const QVector<int>& roles)
+  {
+    // a different font doesn't change the cached values
+    if (roles.size() != 1 || roles[0] != Qt::FontRole)
+      InvalidateCachedRows(topLeft.row(), bottomRight.row());
+  });
 }
 
 int Playlist::columnCount(const QModelIndex& parent /*= QModelIndex()*/) const
@@ -182,8 +200,106 @@ void Playlist::SetShuffle(bool shuffle)
 
 void Playlist::onActiveSongChanged()
 {
-  beginResetModel();
-  endResetModel();
+  // only the fonts of the previously and the newly playing song change, see commonData()
+  const QString sActiveGuid = AppState::GetSingleton()->GetActiveSongGuid();
+  const int iBoldRow = (AppState::GetSingleton()->GetActivePlaylist() == this && m_bActiveSongIndexValid) ? m_iActiveSong : -1;
+  const int iNumSongs = GetNumSongs();
+  const QVector<int> roles = {Qt::FontRole};
+
+  auto updateRow = [&](int row)
+  {
+    if (row >= 0 && row < iNumSongs)
+    {
+      emit dataChanged(index(row, 0), index(row, PlaylistColumn::ENUM_COUNT - 1), roles);
+    }
+  };
+
+  updateRow(m_iHighlightedRow);
+
+  if (iBoldRow != m_iHighlightedRow)
+    updateRow(iBoldRow);
+
+  if (sActiveGuid != m_sHighlightedSongGuid)
+  {
+    for (int row = 0; row < iNumSongs; ++row)
+    {
+      const QString guid = GetSongGuid(row);
+
+      if (guid == sActiveGuid || guid == m_sHighlightedSongGuid)
+        updateRow(row);
+    }
+  }
+
+  m_iHighlightedRow = iBoldRow;
+  m_sHighlightedSongGuid = sActiveGuid;
+}
+
+void Playlist::onSongsChanged(const QStringList& songGuids, unsigned int partMask)
+{
+  // the columns that show the changed parts, a song that was added or removed shows up as (not) missing in all columns
+  static const std::pair<unsigned int, PlaylistColumn> s_PartColumns[] = {
+    {SongInfo::Part::Rating, PlaylistColumn::Rating},
+    {SongInfo::Part::Title, PlaylistColumn::Title},
+    {SongInfo::Part::Length, PlaylistColumn::Length},
+    {SongInfo::Part::Artist, PlaylistColumn::Artist},
+    {SongInfo::Part::Album, PlaylistColumn::Album},
+    {SongInfo::Part::Track | SongInfo::Part::DiscNumber, PlaylistColumn::TrackNumber},
+    {SongInfo::Part::LastPlayed, PlaylistColumn::LastPlayed},
+    {SongInfo::Part::PlayCount, PlaylistColumn::PlayCount},
+    {SongInfo::Part::DateAdded, PlaylistColumn::DateAdded},
+  };
+
+  int iFirstColumn = PlaylistColumn::ENUM_COUNT;
+  int iLastColumn = -1;
+
+  if ((partMask & SongInfo::Part::Existence) != 0)
+  {
+    iFirstColumn = 0;
+    iLastColumn = PlaylistColumn::ENUM_COUNT - 1;
+  }
+
+  for (const auto& partColumn : s_PartColumns)
+  {
+    if ((partMask & partColumn.first) != 0)
+    {
+      iFirstColumn = Min(iFirstColumn, partColumn.second);
+      iLastColumn = Max(iLastColumn, partColumn.second);
+    }
+  }
+
+  // nothing that is displayed
+  if (iLastColumn < 0)
+    return;
+
+  QSet<QString> changed;
+  changed.reserve(songGuids.size());
+
+  for (const QString& guid : songGuids)
+    changed.insert(guid);
+
+  // the cache knows the current GUIDs, so this also catches rows that refer to a song by a remapped GUID
+  for (CachedRow& row : m_RowCache)
+  {
+    if (changed.contains(row.m_sCurrentGuid))
+      row.m_bOutdated = true;
+  }
+
+  const int iNumSongs = GetNumSongs();
+
+  // consecutive rows are updated together
+  for (int row = 0; row < iNumSongs; ++row)
+  {
+    if (!changed.contains(GetSongGuid(row)))
+      continue;
+
+    int iEndRow = row + 1;
+    while (iEndRow < iNumSongs && changed.contains(GetSongGuid(iEndRow)))
+      ++iEndRow;
+
+    emit dataChanged(index(row, iFirstColumn), index(iEndRow - 1, iLastColumn));
+
+    row = iEndRow;
+  }
 }
 
 void Playlist::ReachedEnd()
@@ -197,6 +313,10 @@ void Playlist::ReachedEnd()
   }
 }
 
+/// \brief How many rows are fetched before and after the requested rows, so that scrolling doesn't need a fetch for every new row.
+static const int s_iRowPrefetchBehind = 32;
+static const int s_iRowPrefetchAhead = 128;
+
 QVariant Playlist::commonData(const QModelIndex& index, int role, const QString& sSongGuid) const
 {
   if (role == Qt::UserRole + 1)
@@ -206,8 +326,7 @@ QVariant Playlist::commonData(const QModelIndex& index, int role, const QString&
 
   if (role == Qt::BackgroundColorRole)
   {
-    SongInfo song;
-    if (!LookupSongByIndex(index.row(), song))
+    if (!GetCachedRow(index.row()).m_bFound)
     {
       return QColor::fromRgb(255, 130, 130);
     }
@@ -215,8 +334,9 @@ QVariant Playlist::commonData(const QModelIndex& index, int role, const QString&
 
   if (role == Qt::DisplayRole)
   {
-    SongInfo song;
-    if (!LookupSongByIndex(index.row(), song))
+    const CachedRow& row = GetCachedRow(index.row());
+
+    if (!row.m_bFound)
     {
       if (index.column() == 1)
         return "<Missing Song>";
@@ -224,56 +344,352 @@ QVariant Playlist::commonData(const QModelIndex& index, int role, const QString&
         return QVariant();
     }
 
-    switch (index.column())
-    {
-    case PlaylistColumn::Rating:
-      return song.m_iRating;
-    case PlaylistColumn::Title:
-      return song.m_sTitle;
-    case PlaylistColumn::Length:
-      return ToTime(song.m_iLengthInMS);
-    case PlaylistColumn::Artist:
-      return song.m_sArtist;
-    case PlaylistColumn::Album:
-      return song.m_sAlbum;
-    case PlaylistColumn::TrackNumber:
-      if (song.m_iDiscNumber > 0)
-        return QString("%1 (%2)").arg(song.m_iTrackNumber).arg(song.m_iDiscNumber);
-      else
-        return QString("%1").arg(song.m_iTrackNumber);
-    case PlaylistColumn::LastPlayed:
-      return song.m_sLastPlayed;
-    case PlaylistColumn::PlayCount:
-      return song.m_iPlayCount;
-    case PlaylistColumn::DateAdded:
-      return song.m_sDateAdded;
-    case PlaylistColumn::Order:
+    if (index.column() == PlaylistColumn::Order)
       return index.row() + 1;
 
-    default:
-      return "";
-    }
+    if (index.column() >= 0 && index.column() < PlaylistColumn::ENUM_COUNT)
+      return row.m_Columns[index.column()];
+
+    return "";
   }
 
   if (role == Qt::FontRole)
   {
+    static const QFont s_BoldFont = []() { QFont font; font.setBold(true); return font; }();
+    static const QFont s_ItalicFont = []() { QFont font; font.setItalic(true); return font; }();
+
     if (AppState::GetSingleton()->GetActivePlaylist() == this && m_bActiveSongIndexValid && m_iActiveSong == index.row())
     {
-      QFont font;
-      font.setBold(true);
-      return font;
+      return s_BoldFont;
     }
     else if (AppState::GetSingleton()->GetActiveSongGuid() == sSongGuid)
     {
-      QFont font;
-      font.setItalic(true);
-      return font;
+      return s_ItalicFont;
     }
   }
 
   return QVariant();
 }
 
+void Playlist::PrefetchRows(int iFirstRow, int iLastRow) const
+{
+  const int iNumSongs = GetNumSongs();
+
+  iFirstRow = Max(iFirstRow, 0);
+  iLastRow = Min(iLastRow, iNumSongs - 1);
+
+  if (iFirstRow > iLastRow)
+    return;
+
+  MusicLibrary* pLibrary = MusicLibrary::GetSingleton();
+
+  // a reload doesn't report which songs changed
+  if (m_uiRowCacheRevision < pLibrary->GetReloadRevision())
+  {
+    m_RowCache.clear();
+  }
+
+  std::vector<QString> guids;
+  std::vector<SongInfo> songs;
+  std::vector<bool> found;
+
+  if (iFirstRow >= m_iRowCacheStart && iLastRow < m_iRowCacheStart + (int)m_RowCache.size())
+  {
+    // already cached, only fetch the rows of songs that changed since
+    std::vector<int> outdatedRows;
+
+    for (int row = iFirstRow; row <= iLastRow; ++row)
+    {
+      if (m_RowCache[row - m_iRowCacheStart].m_bOutdated)
+      {
+        outdatedRows.push_back(row);
+        guids.push_back(GetSongGuid(row));
+      }
+    }
+
+    if (outdatedRows.empty())
+      return;
+
+    pLibrary->FindSongs(guids, songs, found);
+
+    for (size_t i = 0; i < outdatedRows.size(); ++i)
+    {
+      FillCachedRow(m_RowCache[outdatedRows[i] - m_iRowCacheStart], pLibrary->ResolveSongGuid(guids[i]), songs[i], found[i]);
+    }
+
+    return;
+  }
+
+  const int iStart = Max(iFirstRow - s_iRowPrefetchBehind, 0);
+  const int iEnd = Min(iLastRow + s_iRowPrefetchAhead, iNumSongs - 1);
+
+  guids.reserve(iEnd - iStart + 1);
+
+  for (int row = iStart; row <= iEnd; ++row)
+  {
+    guids.push_back(GetSongGuid(row));
+  }
+
+  m_uiRowCacheRevision = pLibrary->FindSongs(guids, songs, found);
+
+  m_iRowCacheStart = iStart;
+  m_RowCache.clear();
+  m_RowCache.resize(guids.size());
+
+  for (size_t i = 0; i < songs.size(); ++i)
+  {
+    FillCachedRow(m_RowCache[i], pLibrary->ResolveSongGuid(guids[i]), songs[i], found[i]);
+  }
+}
+
+void Playlist::FillCachedRow(CachedRow& out_Row, const QString& sSongGuid, const SongInfo& song, bool bFound)
+{
+  out_Row.m_bFound = bFound;
+  out_Row.m_bOutdated = false;
+  out_Row.m_sCurrentGuid = sSongGuid;
+
+  if (!bFound)
+    return;
+
+  out_Row.m_Columns[PlaylistColumn::Rating] = song.m_iRating;
+  out_Row.m_Columns[PlaylistColumn::Title] = song.m_sTitle;
+  out_Row.m_Columns[PlaylistColumn::Length] = ToTime(song.m_iLengthInMS);
+  out_Row.m_Columns[PlaylistColumn::Artist] = song.m_sArtist;
+  out_Row.m_Columns[PlaylistColumn::Album] = song.m_sAlbum;
+
+  if (song.m_iDiscNumber > 0)
+    out_Row.m_Columns[PlaylistColumn::TrackNumber] = QString("%1 (%2)").arg(song.m_iTrackNumber).arg(song.m_iDiscNumber);
+  else
+    out_Row.m_Columns[PlaylistColumn::TrackNumber] = QString("%1").arg(song.m_iTrackNumber);
+
+  out_Row.m_Columns[PlaylistColumn::LastPlayed] = song.m_sLastPlayed;
+  out_Row.m_Columns[PlaylistColumn::PlayCount] = song.m_iPlayCount;
+  out_Row.m_Columns[PlaylistColumn::DateAdded] = song.m_sDateAdded;
+}
+
+const Playlist::CachedRow& Playlist::GetCachedRow(int row) const
+{
+  static const CachedRow s_MissingRow;
+
+  PrefetchRows(row, row);
+
+  const int idx = row - m_iRowCacheStart;
+
+  if (idx < 0 || idx >= (int)m_RowCache.size())
+    return s_MissingRow;
+
+  return m_RowCache[idx];
+}
+
+void Playlist::InvalidateRowCache()
+{
+  m_RowCache.clear();
+}
+
+void Playlist::InvalidateCachedRows(int iFirstRow, int iLastRow)
+{
+  iFirstRow = Max(iFirstRow, m_iRowCacheStart);
+  iLastRow = Min(iLastRow, m_iRowCacheStart + (int)m_RowCache.size() - 1);
+
+  for (int row = iFirstRow; row <= iLastRow; ++row)
+  {
+    m_RowCache[row - m_iRowCacheStart].m_bOutdated = true;
+  }
+}
+
+/// \brief If more songs than this change their position, the model is reset instead, because finding each moved row is linear.
+static const int s_iMaxRowMoves = 64;
+
+template <typename LIST>
+void Playlist::ReplaceSongList(LIST& songs, LIST&& newSongs)
+{
+  if (songs == newSongs)
+    return;
+
+  const LIST oldSongs = songs;
+  const auto matches = ListDiff<LIST>::FindMatches(songs, newSongs);
+
+  QSet<QString> inOld;
+  QSet<QString> inNew;
+  inOld.reserve((int)songs.size());
+  inNew.reserve((int)newSongs.size());
+
+  for (const QString& guid : songs)
+    inOld.insert(guid);
+  for (const QString& guid : newSongs)
+    inNew.insert(guid);
+
+  // songs that are in both lists, but not in the common sequence, are moved
+  std::vector<bool> liveKept(songs.size(), false);
+  std::vector<bool> newKept(newSongs.size(), false);
+
+  for (const auto& match : matches)
+  {
+    liveKept[match.m_iOldIndex] = true;
+    newKept[match.m_iNewIndex] = true;
+  }
+
+  int iNumMoves = 0;
+  for (size_t i = 0; i < newSongs.size(); ++i)
+  {
+    if (!newKept[i] && inOld.contains(newSongs[i]))
+      ++iNumMoves;
+  }
+
+  if (iNumMoves > s_iMaxRowMoves)
+  {
+    beginResetModel();
+    songs = std::move(newSongs);
+    endResetModel();
+  }
+  else
+  {
+    // remove the songs that are gone, back to front, consecutive rows at once
+    for (int end = (int)songs.size(); end > 0;)
+    {
+      if (inNew.contains(songs[end - 1]))
+      {
+        --end;
+        continue;
+      }
+
+      int start = end - 1;
+      while (start > 0 && !inNew.contains(songs[start - 1]))
+        --start;
+
+      beginRemoveRows(QModelIndex(), start, end - 1);
+      songs.erase(songs.begin() + start, songs.begin() + end);
+      liveKept.erase(liveKept.begin() + start, liveKept.begin() + end);
+      endRemoveRows();
+
+      end = start;
+    }
+
+    // now bring the rows into the new order, front to back, rows before 'row' are final
+    for (int row = 0; row < (int)newSongs.size(); ++row)
+    {
+      if (row < (int)songs.size() && songs[row] == newSongs[row])
+      {
+        if (newKept[row] && !liveKept[row])
+        {
+          // a duplicate took the place of the kept song, the kept one must not stay in the way of the following rows
+          auto it = std::find(liveKept.begin() + row + 1, liveKept.end(), true);
+
+          if (it != liveKept.end() && songs[it - liveKept.begin()] == songs[row])
+            *it = false;
+
+          liveKept[row] = true;
+        }
+
+        continue;
+      }
+
+      if (newKept[row])
+      {
+        // songs that move further down are in the way, park them at the end, they are picked up from there later
+        int kept = row;
+        while (kept < (int)songs.size() && !liveKept[kept])
+          ++kept;
+
+        if (kept > row && kept < (int)songs.size())
+        {
+          beginMoveRows(QModelIndex(), row, kept - 1, QModelIndex(), (int)songs.size());
+          std::rotate(songs.begin() + row, songs.begin() + kept, songs.end());
+          std::rotate(liveKept.begin() + row, liveKept.begin() + kept, liveKept.end());
+          endMoveRows();
+        }
+
+        if (row < (int)songs.size() && songs[row] == newSongs[row])
+          continue;
+      }
+
+      if (inOld.contains(newSongs[row]))
+      {
+        auto it = std::find(songs.begin() + row, songs.end(), newSongs[row]);
+
+        if (it != songs.end())
+        {
+          const int from = (int)(it - songs.begin());
+
+          beginMoveRows(QModelIndex(), from, from, QModelIndex(), row);
+          std::rotate(songs.begin() + row, it, it + 1);
+          std::rotate(liveKept.begin() + row, liveKept.begin() + from, liveKept.begin() + from + 1);
+          endMoveRows();
+          continue;
+        }
+      }
+
+      // insert all following songs that weren't in the list before at once
+      int end = row + 1;
+      while (end < (int)newSongs.size() && !inOld.contains(newSongs[end]))
+        ++end;
+
+      beginInsertRows(QModelIndex(), row, end - 1);
+      songs.insert(songs.begin() + row, newSongs.begin() + row, newSongs.begin() + end);
+      liveKept.insert(liveKept.begin() + row, end - row, false);
+      endInsertRows();
+
+      row = end - 1;
+    }
+
+    // only surplus duplicates can be left over
+    if (songs.size() > newSongs.size())
+    {
+      beginRemoveRows(QModelIndex(), (int)newSongs.size(), (int)songs.size() - 1);
+      songs.resize(newSongs.size());
+      endRemoveRows();
+    }
+  }
+
+  // the indices of the active song and the shuffle order refer to the old rows
+  if (m_iActiveSong < 0 && m_songShuffleOrder.empty())
+    return;
+
+  QHash<QString, int> newRow;
+  newRow.reserve((int)songs.size());
+
+  for (int row = (int)songs.size() - 1; row >= 0; --row)
+  {
+    newRow[songs[row]] = row;
+  }
+
+  if (m_iActiveSong >= 0 && m_iActiveSong < (int)oldSongs.size())
+  {
+    const int iOldActive = m_iActiveSong;
+    m_iActiveSong = newRow.value(oldSongs[iOldActive], -1);
+
+    if (m_iActiveSong < 0)
+    {
+      // like RemoveSong(), continue with the song after the one that came before the active one
+      m_bActiveSongIndexValid = false;
+
+      for (int i = iOldActive - 1; i >= 0 && m_iActiveSong < 0; --i)
+      {
+        m_iActiveSong = newRow.value(oldSongs[i], -1);
+      }
+    }
+  }
+
+  std::vector<int> shuffleOrder;
+  shuffleOrder.reserve(m_songShuffleOrder.size());
+
+  for (int oldIdx : m_songShuffleOrder)
+  {
+    if (oldIdx < 0 || oldIdx >= (int)oldSongs.size())
+      continue;
+
+    const int idx = newRow.value(oldSongs[oldIdx], -1);
+
+    if (idx >= 0)
+      shuffleOrder.push_back(idx);
+  }
+
+  m_songShuffleOrder = std::move(shuffleOrder);
+}
+
+template void Playlist::ReplaceSongList(std::vector<QString>& songs, std::vector<QString>&& newSongs);
+template void Playlist::ReplaceSongList(std::deque<QString>& songs, std::deque<QString>&& newSongs);
+
 double Playlist::GetSongDuration(const QString& guid)
 {
   SongInfo info;
@@ -75,7 +75,9 @@ public:
 
   virtual bool CanSerialize() = 0;
   virtual void Save(QDataStream& stream) = 0;
-  virtual void Load(QDataStream& stream) = 0;
+
+  /// \brief Replaces the content with the merged content of all given journals, e.g. the files written by different computers.
+  virtual void Load(const std::vector<QDataStream*>& journals) = 0;
 
   void AddFileToDeleteOnSave(const QString& file);
   void DeletePlaylistFiles();
@@ -109,6 +111,11 @@ public:
   /// \brief Returns the duration of all songs in this list combined
   virtual double GetTotalDuration() { return 0; }
 
+  /// \brief Fetches the song data of the given rows (plus some rows ahead) in one go, unless it is cached already.
+  ///
+  /// Called by the view with the rows that are about to be painted. Rows that are requested without a prefetch are fetched in blocks as well.
+  void PrefetchRows(int iFirstRow, int iLastRow) const;
+
 signals:
   void ActiveSongChanged(int index);
   void TitleChanged(const QString& newName);
@@ -117,12 +124,37 @@ signals:
 
 protected slots:
   virtual void onActiveSongChanged();
+  /// \brief Updates the rows of the changed songs, see MusicLibrary::SongsChanged().
+  virtual void onSongsChanged(const QStringList& songGuids, unsigned int partMask);
 
 protected:
   virtual void ReachedEnd();
 
   QVariant commonData(const QModelIndex& index, int role, const QString& sSongGuid) const;
 
+  /// \brief The preformatted values of one row, for all columns.
+  struct CachedRow
+  {
+    bool m_bFound = false;
+    bool m_bOutdated = false;
+    QString m_sCurrentGuid; // the GUID of the song data, which differs from the GUID in the playlist, if that was remapped
+    QVariant m_Columns[PlaylistColumn::ENUM_COUNT];
+  };
+
+  const CachedRow& GetCachedRow(int row) const;
+  static void FillCachedRow(CachedRow& out_Row, const QString& sSongGuid, const SongInfo& song, bool bFound);
+  void InvalidateRowCache();
+  /// \brief Marks the cached rows in the given range as outdated, they are fetched again the next time they are needed.
+  void InvalidateCachedRows(int iFirstRow, int iLastRow);
+
+  /// \brief Turns the song list that the model exposes into the new one, with row signals for only the songs that were removed, inserted or moved.
+  ///
+  /// This way views keep their selection and scroll position, and only query the rows that changed.
+  /// The active song and the shuffle order are adjusted to the new rows.
+  /// LIST is std::vector<QString> or std::deque<QString>.
+  template <typename LIST>
+  void ReplaceSongList(LIST& songs, LIST&& newSongs);
+
   static double GetSongDuration(const QString& guid);
 
   bool m_bWasModified = false;
@@ -135,4 +167,14 @@ protected:
   int m_iActiveSong = -1;
   std::vector<QString> m_FilesToDeleteOnSave;
   std::vector<int> m_songShuffleOrder;
+
+  // which rows were drawn highlighted, the next time the active song changes only those and the new ones are updated
+  int m_iHighlightedRow = -1;
+  QString m_sHighlightedSongGuid;
+
+  // a window of consecutive rows, valid as long as the rows don't change and the library isn't reloaded,
+  // single rows are marked outdated when their song changes
+  mutable int m_iRowCacheStart = 0;
+  mutable std::vector<CachedRow> m_RowCache;
+  mutable quint64 m_uiRowCacheRevision = 0;
 };
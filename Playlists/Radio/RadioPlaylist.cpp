@@ -116,13 +116,13 @@ void RadioPlaylist::Save(QDataStream& stream)
   m_Recorder.Save(stream);
 }
 
-void RadioPlaylist::Load(QDataStream& stream)
+void RadioPlaylist::Load(const std::vector<QDataStream*>& journals)
 {
   beginResetModel();
 
   m_Songs.clear();
 
-  m_Recorder.LoadAdditional(stream);
+  m_Recorder.LoadAdditional(journals);
   m_Recorder.ApplyAll(this);
 
   endResetModel();
@@ -317,14 +317,14 @@ void RadioPlaylistModification::Apply(RadioPlaylist* pContext) const
   }
 }
 
-void RadioPlaylistModification::Save(QDataStream& stream) const
+void RadioPlaylistModification::Save(QDataStream& stream, JournalStringTable& strings) const
 {
   stream << (int)m_Type;
-  stream << m_sIdentifier;
+  strings.Write(stream, m_sIdentifier);
 
   if (m_Type == Type::RenamePlaylist)
   {
-    stream << m_sIdentifier;
+    strings.Write(stream, m_sIdentifier);
   }
 
   if (m_Type == Type::ChangeSettings)
@@ -333,16 +333,16 @@ void RadioPlaylistModification::Save(QDataStream& stream) const
   }
 }
 
-void RadioPlaylistModification::Load(QDataStream& stream)
+void RadioPlaylistModification::Load(QDataStream& stream, const JournalStringTable& strings)
 {
   int type = 0;
   stream >> type;
   m_Type = (Type)type;
-  stream >> m_sIdentifier;
+  m_sIdentifier = strings.Read(stream);
 
   if (m_Type == Type::RenamePlaylist)
   {
-    stream >> m_sIdentifier;
+    m_sIdentifier = strings.Read(stream);
   }
 
   if (m_Type == Type::ChangeSettings)
@@ -351,34 +351,18 @@ void RadioPlaylistModification::Load(QDataStream& stream)
   }
 }
 
-void RadioPlaylistModification::Coalesce(ModificationRecorder<RadioPlaylistModification, RadioPlaylist*>& recorder, size_t passThroughIndex)
+QString RadioPlaylistModification::GetCoalescingKey() const
 {
   switch (m_Type)
   {
-  case Type::None:
-  {
-    recorder.InvalidateThis(passThroughIndex);
-    break;
-  }
-
   case Type::RenamePlaylist:
-  {
-    recorder.InvalidatePrevious(passThroughIndex, [](const RadioPlaylistModification& mod) -> bool {
-      // remove all previous renames
-      return mod.m_Type == Type::RenamePlaylist;
-    });
-
-    break;
-  }
+    return "rename";
 
   case Type::ChangeSettings:
-  {
-    recorder.InvalidatePrevious(passThroughIndex, [this](const RadioPlaylistModification& mod) -> bool {
-      // remove all other query changes
-      return mod.m_Type == Type::ChangeSettings;
-    });
-  }
-  break;
+    return "settings";
+
+  default:
+    return QString();
   }
 }
 
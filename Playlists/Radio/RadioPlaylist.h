@@ -36,9 +36,10 @@ struct RadioPlaylistModification : public Modification
   RadioPlaylistSettings m_Settings;
 
   void Apply(RadioPlaylist* pContext) const;
-  void Save(QDataStream& stream) const;
-  void Load(QDataStream& stream);
-  void Coalesce(ModificationRecorder<RadioPlaylistModification, RadioPlaylist*>& recorder, size_t passThroughIndex);
+  void Save(QDataStream& stream, JournalStringTable& strings) const;
+  void Load(QDataStream& stream, const JournalStringTable& strings);
+  bool IsRelevant() const { return m_Type != Type::None; }
+  QString GetCoalescingKey() const;
 };
 
 class RadioPlaylist : public Playlist
@@ -79,7 +80,7 @@ public:
 
   virtual bool CanSerialize() override;
   virtual void Save(QDataStream& stream) override;
-  virtual void Load(QDataStream& stream) override;
+  virtual void Load(const std::vector<QDataStream*>& journals) override;
 
   virtual bool LookupSongByIndex(int index, SongInfo& song) const override;
 
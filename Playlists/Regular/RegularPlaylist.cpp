@@ -65,11 +65,17 @@ void RegularPlaylist::AddSong(const QString& songGuid)
   mod.m_Type = RegularPlaylistModification::Type::AddSong;
   mod.m_sIdentifier = songGuid;
 
+  // the song is only appended, if it isn't in the list yet
+  const bool bInsert = !ContainsSong(songGuid);
+  const int row = (int)m_Songs.size();
+
+  if (bInsert)
+    beginInsertRows(QModelIndex(), row, row);
+
   m_Recorder.AddModification(mod, this);
 
-  // TODO: emit proper model signals
-  beginResetModel();
-  endResetModel();
+  if (bInsert)
+    endInsertRows();
 
   m_CachedTotalDuration = 0;
   emit StatsChanged();
@@ -100,11 +106,9 @@ void RegularPlaylist::RemoveSong(int index)
   mod.m_Type = RegularPlaylistModification::Type::RemoveSong;
   mod.m_sIdentifier = m_Songs[index];
 
+  beginRemoveRows(QModelIndex(), index, index);
   m_Recorder.AddModification(mod, this);
-
-  // TODO: emit proper model signals
-  beginResetModel();
-  endResetModel();
+  endRemoveRows();
 
   m_CachedTotalDuration = 0;
   emit StatsChanged();
@@ -170,13 +174,13 @@ void RegularPlaylist::Save(QDataStream& stream)
   m_Recorder.Save(stream);
 }
 
-void RegularPlaylist::Load(QDataStream& stream)
+void RegularPlaylist::Load(const std::vector<QDataStream*>& journals)
 {
   beginResetModel();
 
   m_Songs.clear();
 
-  m_Recorder.LoadAdditional(stream);
+  m_Recorder.LoadAdditional(journals);
   m_Recorder.ApplyAll(this);
 
   endResetModel();
@@ -325,84 +329,62 @@ void RegularPlaylistModification::Apply(RegularPlaylist* pContext) const
   }
 }
 
-void RegularPlaylistModification::Save(QDataStream& stream) const
+void RegularPlaylistModification::Save(QDataStream& stream, JournalStringTable& strings) const
 {
   stream << (int)m_Type;
-  stream << m_sIdentifier;
+  strings.Write(stream, m_sIdentifier);
 
   if (m_Type == Type::SetSongDescription)
   {
-    stream << m_sMisc;
+    strings.Write(stream, m_sMisc);
   }
 }
 
-void RegularPlaylistModification::Load(QDataStream& stream)
+void RegularPlaylistModification::Load(QDataStream& stream, const JournalStringTable& strings)
 {
   int type = 0;
   stream >> type;
   m_Type = (Type)type;
-  stream >> m_sIdentifier;
+  m_sIdentifier = strings.Read(stream);
 
   if (m_Type == Type::SetSongDescription)
   {
-    stream >> m_sMisc;
+    m_sMisc = strings.Read(stream);
   }
 }
 
-void RegularPlaylistModification::Coalesce(ModificationRecorder<RegularPlaylistModification, RegularPlaylist*>& recorder, size_t passThroughIndex)
+bool RegularPlaylistModification::IsRelevant() const
 {
   switch (m_Type)
   {
   case Type::None:
-  {
-    recorder.InvalidateThis(passThroughIndex);
-    break;
-  }
+    return false;
 
   case Type::AddSong:
   case Type::RemoveSong:
-  {
-    if (m_sIdentifier.isEmpty())
-    {
-      recorder.InvalidateThis(passThroughIndex);
-      break;
-    }
-
-    recorder.InvalidatePrevious(passThroughIndex, [this](const RegularPlaylistModification& mod) -> bool {
-      // remove all previous adds/removes of the same song
-      if (mod.m_sIdentifier == this->m_sIdentifier)
-      {
-        return mod.m_Type == Type::AddSong || mod.m_Type == Type::RemoveSong;
-      }
-
-      return false;
-    });
+    return !m_sIdentifier.isEmpty();
 
-    break;
+  default:
+    return true;
   }
+}
 
-  case Type::SetSongDescription:
+QString RegularPlaylistModification::GetCoalescingKey() const
+{
+  switch (m_Type)
   {
-    recorder.InvalidatePrevious(passThroughIndex, [this](const RegularPlaylistModification& mod) -> bool {
-      if (mod.m_sModGuid == this->m_sModGuid)
-      {
-        return true;
-      }
-
-      return false;
-    });
+  case Type::AddSong:
+  case Type::RemoveSong:
+    // the last add or remove of the same song decides whether it is in the list
+    return "song:" + m_sIdentifier;
 
-    break;
-  }
+  case Type::SetSongDescription:
+    return "description:" + m_ModId.ToString();
 
   case Type::RenamePlaylist:
-  {
-    recorder.InvalidatePrevious(passThroughIndex, [](const RegularPlaylistModification& mod) -> bool {
-      // remove all previous renames
-      return mod.m_Type == Type::RenamePlaylist;
-    });
+    return "rename";
 
-    break;
-  }
+  default:
+    return QString();
   }
 }
@@ -21,9 +21,10 @@ struct RegularPlaylistModification : public Modification
   QString m_sMisc;
 
   void Apply(RegularPlaylist* pContext) const;
-  void Save(QDataStream& stream) const;
-  void Load(QDataStream& stream);
-  void Coalesce(ModificationRecorder<RegularPlaylistModification, RegularPlaylist*>& recorder, size_t passThroughIndex);
+  void Save(QDataStream& stream, JournalStringTable& strings) const;
+  void Load(QDataStream& stream, const JournalStringTable& strings);
+  bool IsRelevant() const;
+  QString GetCoalescingKey() const;
 };
 
 class RegularPlaylist : public Playlist
@@ -60,7 +61,7 @@ public:
 
   virtual bool CanSerialize() override;
   virtual void Save(QDataStream& stream) override;
-  virtual void Load(QDataStream& stream) override;
+  virtual void Load(const std::vector<QDataStream*>& journals) override;
 
   virtual bool LookupSongByIndex(int index, SongInfo& song) const override;
 
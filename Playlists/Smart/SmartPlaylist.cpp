@@ -2,16 +2,19 @@
 #include "Config/AppState.h"
 #include "Misc/Song.h"
 #include "MusicLibrary/MusicLibrary.h"
+#include "Playlists/Smart/SmartPlaylistProgram.h"
 #include "SmartPlaylistDlg.h"
 #include <QColor>
 #include <QFont>
 #include <QMenu>
 #include <QTimer>
-#include <random>
 
 SmartPlaylist::SmartPlaylist(const QString& sTitle, const QString& guid)
     : Playlist(sTitle, guid)
 {
+  std::random_device rd;
+  m_RNG.seed(rd());
+
   m_Query.m_MainGroup.m_Fulfil = SmartPlaylistQuery::Fulfil::Any;
 
   {
@@ -23,42 +26,113 @@ SmartPlaylist::SmartPlaylist(const QString& sTitle, const QString& guid)
   }
 }
 
-void SmartPlaylist::Refresh(PlaylistRefreshReason reason)
+static std::deque<QString> LookupSongsInDatabase(const SmartPlaylistQuery& query)
 {
-  beginResetModel();
+  std::deque<QString> songGuids;
+
+  const std::vector<SongInfo> songs = MusicLibrary::GetSingleton()->LookupSongs(query.GenerateSQL(), query.GenerateOrderBySQL());
+
+  for (const SongInfo& si : songs)
+  {
+    songGuids.push_back(si.m_sSongGuid);
+  }
 
+  return songGuids;
+}
+
+void SmartPlaylist::Refresh(PlaylistRefreshReason reason)
+{
   if (reason == PlaylistRefreshReason::PlaylistModified || reason == PlaylistRefreshReason::PlaylistLoaded)
   {
     m_CachedTotalDuration = 0;
     m_NumCachedSongDurations = 0;
 
-    QString sql = m_Query.GenerateSQL();
+    // a new song may match any query
+    m_uiQueryDependencies = m_Query.GetDependencies() | SongInfo::Part::Existence;
 
-    std::deque<SongInfo> songs = std::move(MusicLibrary::GetSingleton()->LookupSongs(sql, m_Query.GenerateOrderBySQL()));
+    // evaluating the query in memory is much faster than going through the database
+    m_bProgramCompiled = m_Program.Compile(m_Query);
 
-    m_Songs.clear();
-    for (const SongInfo& si : songs)
+    if (m_bProgramCompiled)
     {
-      m_Songs.push_back(si.m_sSongGuid);
+      m_AllSongs = MusicLibrary::GetSingleton()->LookupSongGuids(m_Program);
     }
+    else
+    {
+      m_AllSongs = LookupSongsInDatabase(m_Query);
+    }
+
+    if (m_Query.m_SortOrder == SmartPlaylistQuery::SortOrder::Random)
+    {
+      std::shuffle(m_AllSongs.begin(), m_AllSongs.end(), m_RNG);
+    }
+  }
+  else if (m_Query.m_SortOrder == SmartPlaylistQuery::SortOrder::Random)
+  {
+    // only the shown songs are shuffled again
+    std::shuffle(m_AllSongs.begin(), m_AllSongs.begin() + Min((int)m_Songs.size(), (int)m_AllSongs.size()), m_RNG);
   }
 
-  if (m_Query.m_SortOrder == SmartPlaylistQuery::SortOrder::Random)
+  ApplySongLimit();
+
+  emit StatsChanged();
+}
+
+bool SmartPlaylist::ApplySongLimit()
+{
+  size_t numSongs = m_AllSongs.size();
+
+  if (m_Query.m_iSongLimit > 0 && numSongs > (size_t)m_Query.m_iSongLimit)
   {
-    std::random_device rd;
-    std::mt19937 g(rd());
+    numSongs = m_Query.m_iSongLimit;
+  }
+
+  std::deque<QString> newSongs(m_AllSongs.begin(), m_AllSongs.begin() + numSongs);
+
+  if (newSongs == m_Songs)
+    return false;
 
-    std::shuffle(m_Songs.begin(), m_Songs.end(), g);
+  ReplaceSongList(m_Songs, std::move(newSongs));
+  return true;
+}
+
+void SmartPlaylist::onSongsChanged(const QStringList& songGuids, unsigned int partMask)
+{
+  Playlist::onSongsChanged(songGuids, partMask);
+
+  if ((partMask & m_uiQueryDependencies) == 0)
+    return;
+
+  if (!m_bProgramCompiled)
+  {
+    // only the database can execute the query
+    Refresh(PlaylistRefreshReason::PlaylistModified);
+    return;
   }
 
-  if (m_Query.m_iSongLimit > 0 && m_Songs.size() > m_Query.m_iSongLimit)
+  // only the changed songs are evaluated again, m_AllSongs keeps the order of all matches, also beyond the limit
+  const int iNumAppended = MusicLibrary::GetSingleton()->UpdateSongGuids(m_Program, songGuids, partMask, m_AllSongs);
+
+  if (m_Query.m_SortOrder == SmartPlaylistQuery::SortOrder::Random && iNumAppended > 0)
   {
-    m_Songs.resize(m_Query.m_iSongLimit);
+    // new songs are shuffled in, the other songs keep their positions
+    std::vector<QString> newSongs(m_AllSongs.end() - iNumAppended, m_AllSongs.end());
+    m_AllSongs.resize(m_AllSongs.size() - iNumAppended);
+
+    for (const QString& guid : newSongs)
+    {
+      std::uniform_int_distribution<size_t> position(0, m_AllSongs.size());
+      m_AllSongs.insert(m_AllSongs.begin() + position(m_RNG), guid);
+    }
   }
 
-  endResetModel();
+  if (ApplySongLimit())
+  {
+    m_CachedTotalDuration = 0;
+    m_NumCachedSongDurations = 0;
 
-  emit StatsChanged();
+    emit StatsChanged();
+  }
 }
 
 void SmartPlaylist::ExtendContextMenu(QMenu* pMenu)
@@ -148,13 +222,15 @@ void SmartPlaylist::Save(QDataStream& stream)
   m_Recorder.Save(stream);
 }
 
-void SmartPlaylist::Load(QDataStream& stream)
+void SmartPlaylist::Load(const std::vector<QDataStream*>& journals)
 {
   beginResetModel();
 
   m_Songs.clear();
+  m_AllSongs.clear();
+  m_uiQueryDependencies = 0;
 
-  m_Recorder.LoadAdditional(stream);
+  m_Recorder.LoadAdditional(journals);
   m_Recorder.ApplyAll(this);
 
   endResetModel();
@@ -268,13 +344,13 @@ void SmartPlaylistModification::Apply(SmartPlaylist* pContext) const
   }
 }
 
-void SmartPlaylistModification::Save(QDataStream& stream) const
+void SmartPlaylistModification::Save(QDataStream& stream, JournalStringTable& strings) const
 {
   stream << (int)m_Type;
 
   if (m_Type == Type::RenamePlaylist)
   {
-    stream << m_sIdentifier;
+    strings.Write(stream, m_sIdentifier);
   }
 
   if (m_Type == Type::ChangeQuery)
@@ -283,7 +359,7 @@ void SmartPlaylistModification::Save(QDataStream& stream) const
   }
 }
 
-void SmartPlaylistModification::Load(QDataStream& stream)
+void SmartPlaylistModification::Load(QDataStream& stream, const JournalStringTable& strings)
 {
   int type = 0;
   stream >> type;
@@ -291,7 +367,7 @@ void SmartPlaylistModification::Load(QDataStream& stream)
 
   if (m_Type == Type::RenamePlaylist)
   {
-    stream >> m_sIdentifier;
+    m_sIdentifier = strings.Read(stream);
   }
 
   if (m_Type == Type::ChangeQuery)
@@ -300,26 +376,17 @@ void SmartPlaylistModification::Load(QDataStream& stream)
   }
 }
 
-void SmartPlaylistModification::Coalesce(ModificationRecorder<SmartPlaylistModification, SmartPlaylist*>& recorder, size_t passThroughIndex)
+QString SmartPlaylistModification::GetCoalescingKey() const
 {
   switch (m_Type)
   {
   case Type::ChangeQuery:
-  {
-    recorder.InvalidatePrevious(passThroughIndex, [this](const SmartPlaylistModification& mod) -> bool {
-      // remove all other query changes
-      return mod.m_Type == Type::ChangeQuery;
-    });
-  }
-  break;
+    return "query";
 
   case Type::RenamePlaylist:
-  {
-    recorder.InvalidatePrevious(passThroughIndex, [](const SmartPlaylistModification& mod) -> bool {
-      // remove all previous renames
-      return mod.m_Type == Type::RenamePlaylist;
-    });
-  }
-  break;
+    return "rename";
+
+  default:
+    return QString();
   }
 }
@@ -3,7 +3,9 @@
 #include "Misc/Song.h"
 #include "Misc/ModificationRecorder.h"
 #include "Playlists/Playlist.h"
+#include "Playlists/Smart/SmartPlaylistProgram.h"
 #include "Playlists/Smart/SmartPlaylistQuery.h"
+#include <random>
 
 class SmartPlaylist;
 
@@ -21,9 +23,10 @@ struct SmartPlaylistModification : public Modification
   SmartPlaylistQuery m_Query;
 
   void Apply(SmartPlaylist* pContext) const;
-  void Save(QDataStream& stream) const;
-  void Load(QDataStream& stream);
-  void Coalesce(ModificationRecorder<SmartPlaylistModification, SmartPlaylist*>& recorder, size_t passThroughIndex);
+  void Save(QDataStream& stream, JournalStringTable& strings) const;
+  void Load(QDataStream& stream, const JournalStringTable& strings);
+  bool IsRelevant() const { return true; }
+  QString GetCoalescingKey() const;
 };
 
 class SmartPlaylist : public Playlist
@@ -60,7 +63,7 @@ public:
 
   virtual bool CanSerialize() override;
   virtual void Save(QDataStream& stream) override;
-  virtual void Load(QDataStream& stream) override;
+  virtual void Load(const std::vector<QDataStream*>& journals) override;
 
   virtual bool LookupSongByIndex(int index, SongInfo& song) const override;
 
@@ -70,6 +73,10 @@ public:
 
   virtual double GetTotalDuration() override;
 
+protected slots:
+  /// \brief Re-evaluates the changed songs, if the query depends on any of the changed parts.
+  virtual void onSongsChanged(const QStringList& songGuids, unsigned int partMask) override;
+
 private slots:
   void onShowEditDlg();
   void onRefreshPlaylist();
@@ -78,9 +85,17 @@ private:
   friend SmartPlaylistModification;
   friend class SmartPlaylistDlg;
 
+  /// \brief Shows the first m_iSongLimit songs of m_AllSongs. Returns false, if the shown songs didn't change.
+  bool ApplySongLimit();
+
   double m_CachedTotalDuration = 0;
   size_t m_NumCachedSongDurations = 0;
   SmartPlaylistQuery m_Query;
+  SmartPlaylistProgram m_Program;
+  bool m_bProgramCompiled = false;
+  unsigned int m_uiQueryDependencies = 0; // SongInfo::Part mask, 0 until the query was executed
+  std::deque<QString> m_AllSongs;         // all songs that match the query, m_Songs are the first ones of these
   std::deque<QString> m_Songs;
+  std::mt19937 m_RNG;
   ModificationRecorder<SmartPlaylistModification, SmartPlaylist*> m_Recorder;
 };
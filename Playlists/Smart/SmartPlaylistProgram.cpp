@@ -0,0 +1,849 @@
+#include "Playlists/Smart/SmartPlaylistProgram.h"
+#include <QSet>
+#include <QVector>
+#include <algorithm>
+#include <assert.h>
+#include <climits>
+#include <cmath>
+
+static SongColumn ToSongColumn(SmartPlaylistQuery::Criterium c)
+{
+  switch (c)
+  {
+  case SmartPlaylistQuery::Criterium::Artist:
+    return SongColumn::Artist;
+  case SmartPlaylistQuery::Criterium::Album:
+    return SongColumn::Album;
+  case SmartPlaylistQuery::Criterium::Title:
+    return SongColumn::Title;
+  case SmartPlaylistQuery::Criterium::Year:
+    return SongColumn::Year;
+  case SmartPlaylistQuery::Criterium::TrackNumber:
+    return SongColumn::TrackNumber;
+  case SmartPlaylistQuery::Criterium::Length:
+    return SongColumn::Length;
+  case SmartPlaylistQuery::Criterium::Rating:
+    return SongColumn::Rating;
+  case SmartPlaylistQuery::Criterium::LastPlayed:
+    return SongColumn::LastPlayed;
+  case SmartPlaylistQuery::Criterium::DateAdded:
+    return SongColumn::DateAdded;
+  case SmartPlaylistQuery::Criterium::PlayCount:
+    return SongColumn::PlayCount;
+  case SmartPlaylistQuery::Criterium::DiscNumber:
+    return SongColumn::DiscNumber;
+
+  default:
+    assert(false && "Missing case statement");
+  }
+
+  return SongColumn::Title;
+}
+
+static bool IsSqlSpace(QChar c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+/// \brief Only accepts values that SQLite reads as exactly the same number, when they are inserted into the query unquoted.
+static bool ParseNumber(const QString& sValue, double& out_fValue)
+{
+  int start = 0;
+  int end = sValue.size();
+
+  while (start < end && IsSqlSpace(sValue[start]))
+    ++start;
+  while (end > start && IsSqlSpace(sValue[end - 1]))
+    --end;
+
+  int i = start;
+  if (i < end && (sValue[i] == '+' || sValue[i] == '-'))
+    ++i;
+
+  int numDigits = 0;
+  bool bDecimalPoint = false;
+
+  for (; i < end; ++i)
+  {
+    const QChar c = sValue[i];
+
+    if (c >= '0' && c <= '9')
+      ++numDigits;
+    else if (c == '.' && !bDecimalPoint)
+      bDecimalPoint = true;
+    else
+      return false;
+  }
+
+  // longer numbers may not be represented exactly by a double, or overflow into a real in SQLite
+  if (numDigits == 0 || numDigits > 15)
+    return false;
+
+  bool bOk = false;
+  out_fValue = sValue.mid(start, end - start).toDouble(&bOk);
+  return bOk;
+}
+
+/// \brief UTF-16 code units sort surrogates before U+E000 to U+FFFF, but SQLite compares UTF-8, which is in code point order.
+static int ToCodePointOrder(ushort c)
+{
+  if (c >= 0xE000)
+    return c - 0x800;
+  if (c >= 0xD800)
+    return c + 0x2000;
+  return c;
+}
+
+/// \brief Sorts like SQLite's BINARY collation.
+static bool LessInCodePointOrder(const QString& lhs, const QString& rhs)
+{
+  const int len = std::min(lhs.size(), rhs.size());
+
+  for (int i = 0; i < len; ++i)
+  {
+    const ushort l = lhs[i].unicode();
+    const ushort r = rhs[i].unicode();
+
+    if (l != r)
+      return ToCodePointOrder(l) < ToCodePointOrder(r);
+  }
+
+  return lhs.size() < rhs.size();
+}
+
+bool SmartPlaylistProgram::Compile(const SmartPlaylistQuery& query)
+{
+  m_Program.clear();
+  m_SortKeys.clear();
+
+  bool bEmpty = true;
+  if (!CompileGroup(query.m_MainGroup, bEmpty))
+  {
+    m_Program.clear();
+    return false;
+  }
+
+  // without any conditions there is no WHERE clause
+  if (bEmpty)
+  {
+    Instruction instr;
+    instr.m_OpCode = OpCode::MatchAll;
+    m_Program.push_back(instr);
+  }
+
+  CompileSortOrder(query.m_SortOrder);
+  return true;
+}
+
+bool SmartPlaylistProgram::CompileGroup(const SmartPlaylistQuery::ConditionGroup& group, bool& out_bEmpty)
+{
+  // same order as ConditionGroup::GenerateSQL(), which also skips empty groups
+  int iNumOperands = 0;
+
+  for (const SmartPlaylistQuery::ConditionGroup& subGroup : group.m_SubGroups)
+  {
+    bool bSubEmpty = true;
+    if (!CompileGroup(subGroup, bSubEmpty))
+      return false;
+
+    if (!bSubEmpty)
+      ++iNumOperands;
+  }
+
+  for (const SmartPlaylistQuery::Statement& statement : group.m_Statements)
+  {
+    if (!CompileStatement(statement))
+      return false;
+
+    ++iNumOperands;
+  }
+
+  if (iNumOperands > 1)
+  {
+    Instruction instr;
+    instr.m_OpCode = group.m_Fulfil == SmartPlaylistQuery::Fulfil::All ? OpCode::And : OpCode::Or;
+    instr.m_iNumOperands = iNumOperands;
+    m_Program.push_back(instr);
+  }
+
+  out_bEmpty = (iNumOperands == 0);
+  return true;
+}
+
+bool SmartPlaylistProgram::CompileStatement(const SmartPlaylistQuery::Statement& statement)
+{
+  if ((int)statement.m_Criterium < 0 || statement.m_Criterium >= SmartPlaylistQuery::Criterium::ENUM_COUNT)
+    return false;
+
+  // the SQL of other combinations is valid, but follows SQLite's type conversion rules, which aren't replicated here
+  std::vector<SmartPlaylistQuery::Comparison> allowed;
+  SmartPlaylistQuery::GetAllowedComparisons(statement.m_Criterium, allowed);
+
+  if (std::find(allowed.begin(), allowed.end(), statement.m_Compare) == allowed.end())
+    return false;
+
+  Instruction instr;
+  instr.m_Column = ToSongColumn(statement.m_Criterium);
+
+  if (SongStore::IsStringColumn(instr.m_Column))
+  {
+    if (!CompileTextComparison(statement, instr))
+      return false;
+  }
+  else
+  {
+    if (!CompileIntComparison(statement, instr))
+      return false;
+  }
+
+  m_Program.push_back(instr);
+  return true;
+}
+
+bool SmartPlaylistProgram::CompileIntComparison(const SmartPlaylistQuery::Statement& statement, Instruction& inout_Instr)
+{
+  // SongStore stores NULL as -1 for these
+  inout_Instr.m_bNullable = (inout_Instr.m_Column == SongColumn::LastPlayed || inout_Instr.m_Column == SongColumn::DateAdded);
+
+  if (statement.m_Compare == SmartPlaylistQuery::Comparison::IsUnknown)
+  {
+    inout_Instr.m_OpCode = OpCode::IsNullInt;
+    return true;
+  }
+
+  inout_Instr.m_OpCode = OpCode::CompareInt;
+
+  double fValue = 0;
+  if (!ParseNumber(statement.m_Value, fValue))
+    return false;
+
+  // turn every comparison into an integer range, a fraction makes equality impossible
+  const qint64 iFloor = (qint64)std::floor(fValue);
+  const qint64 iCeil = (qint64)std::ceil(fValue);
+
+  qint64 iLow = INT_MIN;
+  qint64 iHigh = INT_MAX;
+
+  switch (statement.m_Compare)
+  {
+  case SmartPlaylistQuery::Comparison::Equal:
+    iLow = iCeil;
+    iHigh = iFloor;
+    break;
+
+  case SmartPlaylistQuery::Comparison::NotEqual:
+    iLow = iCeil;
+    iHigh = iFloor;
+    inout_Instr.m_bNegate = true;
+    break;
+
+  case SmartPlaylistQuery::Comparison::Less:
+    iHigh = iCeil - 1;
+    break;
+
+  case SmartPlaylistQuery::Comparison::LessEqual:
+    iHigh = iFloor;
+    break;
+
+  case SmartPlaylistQuery::Comparison::Greater:
+    iLow = iFloor + 1;
+    break;
+
+  case SmartPlaylistQuery::Comparison::GreaterEqual:
+    iLow = iCeil;
+    break;
+
+  default:
+    assert(false && "Missing case statement");
+    return false;
+  }
+
+  iLow = std::max<qint64>(iLow, INT_MIN);
+  iHigh = std::min<qint64>(iHigh, INT_MAX);
+
+  inout_Instr.m_bEmptyRange = (iLow > iHigh);
+  inout_Instr.m_iLow = (int)iLow;
+  inout_Instr.m_iHigh = (int)iHigh;
+  return true;
+}
+
+bool SmartPlaylistProgram::CompileTextComparison(const SmartPlaylistQuery::Statement& statement, Instruction& inout_Instr)
+{
+  inout_Instr.m_OpCode = OpCode::MatchText;
+
+  if (statement.m_Compare == SmartPlaylistQuery::Comparison::IsUnknown)
+  {
+    inout_Instr.m_TextMatch = TextMatch::IsNull;
+    return true;
+  }
+
+  const QString sValue = statement.m_Value.isNull() ? QString("") : statement.m_Value;
+
+  // ToDbString() cuts off the escaped value to fit its buffer, and the string ends at a zero character
+  const QByteArray utf8 = sValue.toUtf8();
+  if (utf8.contains('\0') || utf8.size() + utf8.count('\'') >= 254 || QString::fromUtf8(utf8) != sValue)
+    return false;
+
+  switch (statement.m_Compare)
+  {
+  case SmartPlaylistQuery::Comparison::Is:
+  case SmartPlaylistQuery::Comparison::IsNot:
+    inout_Instr.m_TextMatch = TextMatch::Equal;
+    inout_Instr.m_sText = sValue;
+    inout_Instr.m_bNegate = (statement.m_Compare == SmartPlaylistQuery::Comparison::IsNot);
+    return true;
+
+  case SmartPlaylistQuery::Comparison::Contains:
+  case SmartPlaylistQuery::Comparison::ContainsNot:
+    inout_Instr.m_TextMatch = TextMatch::Contains;
+    inout_Instr.m_bNegate = (statement.m_Compare == SmartPlaylistQuery::Comparison::ContainsNot);
+    break;
+
+  case SmartPlaylistQuery::Comparison::StartsWith:
+    inout_Instr.m_TextMatch = TextMatch::StartsWith;
+    break;
+
+  case SmartPlaylistQuery::Comparison::EndsWith:
+    inout_Instr.m_TextMatch = TextMatch::EndsWith;
+    break;
+
+  default:
+    assert(false && "Missing case statement");
+    return false;
+  }
+
+  // LIKE only folds the case of ASCII letters
+  const QString sFolded = SongStore::FoldCase(sValue);
+
+  // the value is not escaped, so % and _ in it act as wildcards
+  if (sValue.isEmpty() || sValue.contains('%') || sValue.contains('_'))
+  {
+    QString sPattern = sFolded;
+
+    if (inout_Instr.m_TextMatch != TextMatch::StartsWith)
+      sPattern.prepend('%');
+    if (inout_Instr.m_TextMatch != TextMatch::EndsWith)
+      sPattern.append('%');
+
+    const QVector<uint> ucs4 = sPattern.toUcs4();
+    inout_Instr.m_LikePattern.assign(ucs4.begin(), ucs4.end());
+    inout_Instr.m_TextMatch = TextMatch::Like;
+    return true;
+  }
+
+  inout_Instr.m_sText = sFolded;
+  return true;
+}
+
+void SmartPlaylistProgram::CompileSortOrder(SmartPlaylistQuery::SortOrder order)
+{
+  // same as SmartPlaylistQuery::GenerateOrderBySQL()
+  switch (order)
+  {
+  case SmartPlaylistQuery::SortOrder::Random:
+    return;
+  case SmartPlaylistQuery::SortOrder::ArtistAtoZ:
+    break;
+  case SmartPlaylistQuery::SortOrder::AlbumAtoZ:
+    m_SortKeys.push_back({SongColumn::Album, false});
+    m_SortKeys.push_back({SongColumn::DiscNumber, false});
+    m_SortKeys.push_back({SongColumn::TrackNumber, false});
+    return;
+  case SmartPlaylistQuery::SortOrder::TitleAtoZ:
+    m_SortKeys.push_back({SongColumn::Title, false});
+    return;
+  case SmartPlaylistQuery::SortOrder::YearNewToOld:
+    m_SortKeys.push_back({SongColumn::Year, false});
+    break;
+  case SmartPlaylistQuery::SortOrder::YearOldToNew:
+    m_SortKeys.push_back({SongColumn::Year, true});
+    break;
+  case SmartPlaylistQuery::SortOrder::DurationShortToLong:
+    m_SortKeys.push_back({SongColumn::Length, false});
+    return;
+  case SmartPlaylistQuery::SortOrder::DurationLongToShort:
+    m_SortKeys.push_back({SongColumn::Length, true});
+    return;
+  case SmartPlaylistQuery::SortOrder::PlayDateOld:
+    m_SortKeys.push_back({SongColumn::LastPlayed, false});
+    return;
+  case SmartPlaylistQuery::SortOrder::PlayDataNew:
+    m_SortKeys.push_back({SongColumn::LastPlayed, true});
+    return;
+  case SmartPlaylistQuery::SortOrder::PlayCountLow:
+    m_SortKeys.push_back({SongColumn::PlayCount, false});
+    break;
+  case SmartPlaylistQuery::SortOrder::PlayCountHigh:
+    m_SortKeys.push_back({SongColumn::PlayCount, true});
+    break;
+  case SmartPlaylistQuery::SortOrder::RatingLow:
+    m_SortKeys.push_back({SongColumn::Rating, false});
+    break;
+  case SmartPlaylistQuery::SortOrder::RatingHigh:
+    m_SortKeys.push_back({SongColumn::Rating, true});
+    break;
+  case SmartPlaylistQuery::SortOrder::DateAddedOld:
+    m_SortKeys.push_back({SongColumn::DateAdded, false});
+    break;
+  case SmartPlaylistQuery::SortOrder::DateAddedNew:
+    m_SortKeys.push_back({SongColumn::DateAdded, true});
+    break;
+
+  default:
+    assert(false && "Missing case statement");
+    return;
+  }
+
+  // artist, album, disc, track
+  m_SortKeys.push_back({SongColumn::Artist, false});
+  m_SortKeys.push_back({SongColumn::Album, false});
+  m_SortKeys.push_back({SongColumn::DiscNumber, false});
+  m_SortKeys.push_back({SongColumn::TrackNumber, false});
+}
+
+void SmartPlaylistProgram::Evaluate(const SongStore& store, std::vector<int>& out_Rows) const
+{
+  const int iNumRows = store.GetNumSongs();
+
+  // one match mask per operand, the operators combine the masks at the top
+  std::vector<std::vector<quint8>> stack;
+
+  for (const Instruction& instr : m_Program)
+  {
+    switch (instr.m_OpCode)
+    {
+    case OpCode::MatchAll:
+      stack.emplace_back(iNumRows, 1);
+      break;
+
+    case OpCode::CompareInt:
+    case OpCode::IsNullInt:
+      stack.emplace_back();
+      ExecuteInt(instr, store, stack.back());
+      break;
+
+    case OpCode::MatchText:
+      stack.emplace_back();
+      ExecuteText(instr, store, stack.back());
+      break;
+
+    case OpCode::And:
+    case OpCode::Or:
+    {
+      const size_t first = stack.size() - instr.m_iNumOperands;
+      quint8* result = stack[first].data();
+
+      for (size_t op = first + 1; op < stack.size(); ++op)
+      {
+        const quint8* operand = stack[op].data();
+
+        if (instr.m_OpCode == OpCode::And)
+        {
+          for (int i = 0; i < iNumRows; ++i)
+            result[i] &= operand[i];
+        }
+        else
+        {
+          for (int i = 0; i < iNumRows; ++i)
+            result[i] |= operand[i];
+        }
+      }
+
+      stack.resize(first + 1);
+      break;
+    }
+
+    default:
+      assert(false && "Missing case statement");
+    }
+  }
+
+  assert(stack.size() == 1 && "Invalid smart playlist program");
+
+  out_Rows.clear();
+
+  const quint8* mask = stack.back().data();
+  for (int i = 0; i < iNumRows; ++i)
+  {
+    if (mask[i] != 0)
+      out_Rows.push_back(i);
+  }
+
+  Sort(store, out_Rows);
+}
+
+bool SmartPlaylistProgram::Matches(const SongStore& store, int row) const
+{
+  // same as Evaluate(), for a single row
+  std::vector<bool> stack;
+
+  for (const Instruction& instr : m_Program)
+  {
+    switch (instr.m_OpCode)
+    {
+    case OpCode::MatchAll:
+      stack.push_back(true);
+      break;
+
+    case OpCode::CompareInt:
+    case OpCode::IsNullInt:
+      stack.push_back(MatchesInt(instr, store.GetInt(row, instr.m_Column)));
+      break;
+
+    case OpCode::MatchText:
+      stack.push_back(MatchesPooledString(instr, store, store.GetColumn(instr.m_Column)[row]));
+      break;
+
+    case OpCode::And:
+    case OpCode::Or:
+    {
+      const size_t first = stack.size() - instr.m_iNumOperands;
+      bool bResult = stack[first];
+
+      for (size_t op = first + 1; op < stack.size(); ++op)
+      {
+        if (instr.m_OpCode == OpCode::And)
+          bResult = bResult && stack[op];
+        else
+          bResult = bResult || stack[op];
+      }
+
+      stack.resize(first);
+      stack.push_back(bResult);
+      break;
+    }
+
+    default:
+      assert(false && "Missing case statement");
+    }
+  }
+
+  assert(stack.size() == 1 && "Invalid smart playlist program");
+  return stack.back();
+}
+
+int SmartPlaylistProgram::Update(const SongStore& store, const QStringList& changedSongs, unsigned int uiChangedParts, std::deque<QString>& inout_Songs) const
+{
+  QSet<QString> changed;
+  changed.reserve(changedSongs.size());
+
+  for (const QString& guid : changedSongs)
+    changed.insert(guid);
+
+  unsigned int uiSortParts = 0;
+  for (const SortKey& sortKey : m_SortKeys)
+    uiSortParts |= SongStore::GetPart(sortKey.m_Column);
+
+  const bool bReorder = (uiChangedParts & uiSortParts) != 0;
+
+  // remove the changed songs, unless they still match and stay in place
+  QSet<QString> kept;
+  size_t numSongs = 0;
+
+  for (size_t i = 0; i < inout_Songs.size(); ++i)
+  {
+    if (changed.contains(inout_Songs[i]))
+    {
+      const int row = store.FindRow(inout_Songs[i]);
+
+      if (bReorder || row < 0 || !Matches(store, row))
+        continue;
+
+      kept.insert(inout_Songs[i]);
+    }
+
+    if (numSongs != i)
+      inout_Songs[numSongs] = std::move(inout_Songs[i]);
+
+    ++numSongs;
+  }
+
+  inout_Songs.resize(numSongs);
+
+  std::vector<int> addedRows;
+
+  for (const QString& guid : changedSongs)
+  {
+    if (kept.contains(guid))
+      continue;
+
+    const int row = store.FindRow(guid);
+
+    if (row >= 0 && Matches(store, row))
+      addedRows.push_back(row);
+  }
+
+  if (m_SortKeys.empty())
+  {
+    for (int row : addedRows)
+      inout_Songs.push_back(store.GetGuid(row));
+
+    return (int)addedRows.size();
+  }
+
+  for (int row : addedRows)
+  {
+    // behind all songs that are equal in the sort order, the list is still sorted without the changed songs
+    auto it = std::upper_bound(inout_Songs.begin(), inout_Songs.end(), row, [this, &store](int newRow, const QString& guid) {
+      const int otherRow = store.FindRow(guid);
+      return otherRow >= 0 && IsOrderedBefore(store, newRow, otherRow);
+    });
+
+    inout_Songs.insert(it, store.GetGuid(row));
+  }
+
+  return 0;
+}
+
+void SmartPlaylistProgram::ExecuteInt(const Instruction& instr, const SongStore& store, std::vector<quint8>& out_Mask)
+{
+  const std::vector<int>& column = store.GetColumn(instr.m_Column);
+  const int iNumRows = (int)column.size();
+  const int* values = column.data();
+
+  out_Mask.resize(iNumRows);
+  quint8* mask = out_Mask.data();
+
+  if (instr.m_OpCode == OpCode::IsNullInt)
+  {
+    for (int i = 0; i < iNumRows; ++i)
+      mask[i] = (quint8)(values[i] == -1);
+
+    return;
+  }
+
+  const quint8 negate = instr.m_bNegate ? 1 : 0;
+
+  if (instr.m_bEmptyRange)
+  {
+    std::fill(out_Mask.begin(), out_Mask.end(), negate);
+  }
+  else
+  {
+    // with unsigned wrap-around, low <= value <= high is a single comparison
+    const quint32 low = (quint32)instr.m_iLow;
+    const quint32 width = (quint32)instr.m_iHigh - low;
+
+    for (int i = 0; i < iNumRows; ++i)
+      mask[i] = (quint8)(((quint32)values[i] - low <= width) ^ negate);
+  }
+
+  // comparisons with NULL are never true, not even <>
+  if (instr.m_bNullable)
+  {
+    for (int i = 0; i < iNumRows; ++i)
+      mask[i] &= (quint8)(values[i] != -1);
+  }
+}
+
+void SmartPlaylistProgram::ExecuteText(const Instruction& instr, const SongStore& store, std::vector<quint8>& out_Mask)
+{
+  // many songs share a string, so evaluate each pooled string only once
+  const int iNumStrings = store.GetNumPooledStrings();
+  std::vector<quint8> pooledMatches(iNumStrings, 0);
+
+  for (int idx = 0; idx < iNumStrings; ++idx)
+  {
+    pooledMatches[idx] = MatchesPooledString(instr, store, idx) ? 1 : 0;
+  }
+
+  const std::vector<int>& column = store.GetColumn(instr.m_Column);
+  const int iNumRows = (int)column.size();
+  const int* values = column.data();
+  const quint8* matches = pooledMatches.data();
+
+  out_Mask.resize(iNumRows);
+  quint8* mask = out_Mask.data();
+
+  for (int i = 0; i < iNumRows; ++i)
+    mask[i] = matches[values[i]];
+}
+
+bool SmartPlaylistProgram::MatchesInt(const Instruction& instr, int value)
+{
+  // same as ExecuteInt(), for a single value
+  if (instr.m_OpCode == OpCode::IsNullInt)
+    return value == -1;
+
+  if (instr.m_bNullable && value == -1)
+    return false;
+
+  const bool bInRange = !instr.m_bEmptyRange && instr.m_iLow <= value && value <= instr.m_iHigh;
+  return bInRange != instr.m_bNegate;
+}
+
+bool SmartPlaylistProgram::MatchesPooledString(const Instruction& instr, const SongStore& store, int idx)
+{
+  if (instr.m_TextMatch == TextMatch::IsNull)
+    return idx == SongStore::s_iNullString;
+
+  // NULL never matches, also not when negated
+  if (idx == SongStore::s_iNullString)
+    return false;
+
+  return MatchesText(instr, store.GetPooledString(idx), store.GetFoldedPooledString(idx)) != instr.m_bNegate;
+}
+
+bool SmartPlaylistProgram::MatchesText(const Instruction& instr, const QString& sText, const QString& sFolded)
+{
+  switch (instr.m_TextMatch)
+  {
+  case TextMatch::Equal:
+    return sText == instr.m_sText;
+  case TextMatch::Contains:
+    return sFolded.contains(instr.m_sText, Qt::CaseSensitive);
+  case TextMatch::StartsWith:
+    return sFolded.startsWith(instr.m_sText, Qt::CaseSensitive);
+  case TextMatch::EndsWith:
+    return sFolded.endsWith(instr.m_sText, Qt::CaseSensitive);
+  case TextMatch::Like:
+    return MatchesLike(instr.m_LikePattern, sFolded);
+
+  default:
+    assert(false && "Missing case statement");
+  }
+
+  return false;
+}
+
+bool SmartPlaylistProgram::MatchesLike(const std::vector<uint>& pattern, const QString& sFolded)
+{
+  // like SQLite, _ matches one character (not one UTF-16 code unit)
+  const QVector<uint> text = sFolded.toUcs4();
+
+  const int iPatternLen = (int)pattern.size();
+  const int iTextLen = text.size();
+
+  int p = 0;
+  int t = 0;
+
+  // position of the last %, and the text position that it currently extends to
+  int iLastPercent = -1;
+  int iPercentEnd = 0;
+
+  while (t < iTextLen)
+  {
+    if (p < iPatternLen && pattern[p] == '%')
+    {
+      iLastPercent = p++;
+      iPercentEnd = t;
+    }
+    else if (p < iPatternLen && (pattern[p] == '_' || pattern[p] == text[t]))
+    {
+      ++p;
+      ++t;
+    }
+    else if (iLastPercent >= 0)
+    {
+      // let the last % swallow one more character
+      p = iLastPercent + 1;
+      t = ++iPercentEnd;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  while (p < iPatternLen && pattern[p] == '%')
+    ++p;
+
+  return p == iPatternLen;
+}
+
+void SmartPlaylistProgram::Sort(const SongStore& store, std::vector<int>& inout_Rows) const
+{
+  if (m_SortKeys.empty())
+    return;
+
+  struct Key
+  {
+    const int* m_pValues;
+    bool m_bDescending;
+  };
+
+  // strings are compared through their rank in the sorted pool, NULL (and -1 for NULL integers) comes first
+  std::vector<std::vector<int>> keyValues;
+  std::vector<int> pooledRanks;
+  std::vector<Key> keys;
+
+  keyValues.reserve(m_SortKeys.size());
+
+  for (const SortKey& sortKey : m_SortKeys)
+  {
+    const std::vector<int>& column = store.GetColumn(sortKey.m_Column);
+
+    if (!SongStore::IsStringColumn(sortKey.m_Column))
+    {
+      keys.push_back({column.data(), sortKey.m_bDescending});
+      continue;
+    }
+
+    if (pooledRanks.empty())
+    {
+      std::vector<int> pooledOrder(store.GetNumPooledStrings());
+      for (int idx = 0; idx < (int)pooledOrder.size(); ++idx)
+        pooledOrder[idx] = idx;
+
+      std::sort(pooledOrder.begin(), pooledOrder.end(), [&store](int lhs, int rhs) {
+        if (lhs == SongStore::s_iNullString || rhs == SongStore::s_iNullString)
+          return lhs == SongStore::s_iNullString && rhs != SongStore::s_iNullString;
+
+        return LessInCodePointOrder(store.GetPooledString(lhs), store.GetPooledString(rhs));
+      });
+
+      pooledRanks.resize(pooledOrder.size());
+      for (int rank = 0; rank < (int)pooledOrder.size(); ++rank)
+        pooledRanks[pooledOrder[rank]] = rank;
+    }
+
+    keyValues.emplace_back(column.size());
+    std::vector<int>& ranks = keyValues.back();
+
+    for (size_t row = 0; row < column.size(); ++row)
+      ranks[row] = pooledRanks[column[row]];
+
+    keys.push_back({ranks.data(), sortKey.m_bDescending});
+  }
+
+  std::stable_sort(inout_Rows.begin(), inout_Rows.end(), [&keys](int lhs, int rhs) {
+    for (const Key& key : keys)
+    {
+      const int l = key.m_pValues[lhs];
+      const int r = key.m_pValues[rhs];
+
+      if (l != r)
+        return key.m_bDescending ? l > r : l < r;
+    }
+
+    return false;
+  });
+}
+
+bool SmartPlaylistProgram::IsOrderedBefore(const SongStore& store, int lhsRow, int rhsRow) const
+{
+  // same order as Sort(), without the pooled string ranks
+  for (const SortKey& key : m_SortKeys)
+  {
+    const int l = store.GetColumn(key.m_Column)[lhsRow];
+    const int r = store.GetColumn(key.m_Column)[rhsRow];
+
+    if (l == r)
+      continue;
+
+    if (!SongStore::IsStringColumn(key.m_Column))
+      return key.m_bDescending ? l > r : l < r;
+
+    // pooled strings are unique, so different indices are different strings
+    bool bLess = false;
+
+    if (l == SongStore::s_iNullString)
+      bLess = true;
+    else if (r != SongStore::s_iNullString)
+      bLess = LessInCodePointOrder(store.GetPooledString(l), store.GetPooledString(r));
+
+    return key.m_bDescending ? !bLess : bLess;
+  }
+
+  return false;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Misc/Common.h"
+#include "MusicLibrary/SongStore.h"
+#include "Playlists/Smart/SmartPlaylistQuery.h"
+#include <QStringList>
+#include <deque>
+
+/// \brief A SmartPlaylistQuery compiled into a flat program, that is evaluated on the in-memory SongStore instead of the database.
+///
+/// The program is in postfix order. Every condition computes a match mask over all rows at once: numeric conditions
+/// are a single branch-free range check per row, which compilers vectorize. Text conditions are evaluated once per pooled string,
+/// on the case folded copies that SongStore keeps, and then looked up per row.
+///
+/// The results are the same as those of SmartPlaylistQuery::GenerateSQL() and GenerateOrderBySQL(), including SQLite's
+/// handling of NULL, LIKE wildcards and ASCII-only case folding. Songs that compare equal for the sort order may come out in a different order.
+/// Queries for which this can't be guaranteed, e.g. because a value is not a plain number, don't compile and have to go through the database.
+class SmartPlaylistProgram
+{
+public:
+  /// \brief Returns false, if the query has to be executed through SQL instead.
+  bool Compile(const SmartPlaylistQuery& query);
+
+  /// \brief Writes the rows of all matching songs into \a out_Rows, in the order that the query requests.
+  ///
+  /// The store must not change during the call.
+  void Evaluate(const SongStore& store, std::vector<int>& out_Rows) const;
+
+  /// \brief Whether the song in the given row fulfils the conditions.
+  bool Matches(const SongStore& store, int row) const;
+
+  /// \brief Re-evaluates only the changed songs and removes them from or inserts them into \a inout_Songs, which holds the result of a previous Evaluate().
+  ///
+  /// \a uiChangedParts is the SongInfo::Part mask of what changed. Songs that still match stay where they are,
+  /// unless the changed parts affect the sort order. Without a sort order new songs are appended, and the number
+  /// of appended songs is returned, so that the caller can move them elsewhere.
+  int Update(const SongStore& store, const QStringList& changedSongs, unsigned int uiChangedParts, std::deque<QString>& inout_Songs) const;
+
+private:
+  enum class OpCode
+  {
+    MatchAll,
+    CompareInt,
+    IsNullInt,
+    MatchText,
+    And,
+    Or,
+  };
+
+  enum class TextMatch
+  {
+    Equal,
+    Contains,
+    StartsWith,
+    EndsWith,
+    Like,
+    IsNull,
+  };
+
+  struct Instruction
+  {
+    OpCode m_OpCode = OpCode::MatchAll;
+    SongColumn m_Column = SongColumn::Title;
+
+    // CompareInt: the value is in [m_iLow; m_iHigh], or not if m_bNegate
+    int m_iLow = 0;
+    int m_iHigh = 0;
+    bool m_bEmptyRange = false;
+    bool m_bNullable = false;
+
+    // MatchText
+    TextMatch m_TextMatch = TextMatch::Equal;
+    QString m_sText; // case folded for everything but TextMatch::Equal
+    std::vector<uint> m_LikePattern;
+
+    bool m_bNegate = false;
+
+    // And, Or
+    int m_iNumOperands = 0;
+  };
+
+  struct SortKey
+  {
+    SongColumn m_Column;
+    bool m_bDescending;
+  };
+
+  bool CompileGroup(const SmartPlaylistQuery::ConditionGroup& group, bool& out_bEmpty);
+  bool CompileStatement(const SmartPlaylistQuery::Statement& statement);
+  bool CompileIntComparison(const SmartPlaylistQuery::Statement& statement, Instruction& inout_Instr);
+  bool CompileTextComparison(const SmartPlaylistQuery::Statement& statement, Instruction& inout_Instr);
+  void CompileSortOrder(SmartPlaylistQuery::SortOrder order);
+
+  static void ExecuteInt(const Instruction& instr, const SongStore& store, std::vector<quint8>& out_Mask);
+  static void ExecuteText(const Instruction& instr, const SongStore& store, std::vector<quint8>& out_Mask);
+  static bool MatchesInt(const Instruction& instr, int value);
+  static bool MatchesPooledString(const Instruction& instr, const SongStore& store, int idx);
+  static bool MatchesText(const Instruction& instr, const QString& sText, const QString& sFolded);
+  static bool MatchesLike(const std::vector<uint>& pattern, const QString& sFolded);
+
+  void Sort(const SongStore& store, std::vector<int>& inout_Rows) const;
+  bool IsOrderedBefore(const SongStore& store, int lhsRow, int rhsRow) const;
+
+  std::vector<Instruction> m_Program;
+  std::vector<SortKey> m_SortKeys;
+};
@@ -1,6 +1,8 @@
 #include "Playlists/Smart/SmartPlaylistQuery.h"
-#include "MusicLibrary/MusicLibrary.h"
+#include "Misc/Song.h"
+#include <QDataStream>
 #include <assert.h>
+#include <sqlite3.h>
 
 void SmartPlaylistQuery::GetAllowedComparisons(Criterium crit, std::vector<Comparison>& out_Comparisons)
 {
@@ -288,6 +290,40 @@ QString SmartPlaylistQuery::ToDbString(Comparison c, const QString& value)
   return QString();
 }
 
+unsigned int SmartPlaylistQuery::GetPart(Criterium c)
+{
+  switch (c)
+  {
+  case Criterium::Artist:
+    return SongInfo::Part::Artist;
+  case Criterium::Album:
+    return SongInfo::Part::Album;
+  case Criterium::Title:
+    return SongInfo::Part::Title;
+  case Criterium::Year:
+    return SongInfo::Part::Year;
+  case Criterium::TrackNumber:
+    return SongInfo::Part::Track;
+  case Criterium::Length:
+    return SongInfo::Part::Length;
+  case Criterium::Rating:
+    return SongInfo::Part::Rating;
+  case Criterium::LastPlayed:
+    return SongInfo::Part::LastPlayed;
+  case Criterium::DateAdded:
+    return SongInfo::Part::DateAdded;
+  case Criterium::PlayCount:
+    return SongInfo::Part::PlayCount;
+  case Criterium::DiscNumber:
+    return SongInfo::Part::DiscNumber;
+
+  default:
+    assert(false && "Missing case statement");
+  }
+
+  return 0;
+}
+
 QString SmartPlaylistQuery::GenerateSQL() const
 {
   return m_MainGroup.GenerateSQL();
@@ -337,6 +373,75 @@ QString SmartPlaylistQuery::GenerateOrderBySQL() const
   return QString();
 }
 
+unsigned int SmartPlaylistQuery::GetDependencies() const
+{
+  // same columns as in GenerateOrderBySQL()
+  const unsigned int uiArtistAlbumDiscTrack = SongInfo::Part::Artist | SongInfo::Part::Album | SongInfo::Part::DiscNumber | SongInfo::Part::Track;
+
+  unsigned int uiParts = m_MainGroup.GetDependencies();
+
+  switch (m_SortOrder)
+  {
+  case SmartPlaylistQuery::SortOrder::Random:
+    break;
+  case SmartPlaylistQuery::SortOrder::ArtistAtoZ:
+    uiParts |= uiArtistAlbumDiscTrack;
+    break;
+  case SmartPlaylistQuery::SortOrder::AlbumAtoZ:
+    uiParts |= SongInfo::Part::Album | SongInfo::Part::DiscNumber | SongInfo::Part::Track;
+    break;
+  case SmartPlaylistQuery::SortOrder::TitleAtoZ:
+    uiParts |= SongInfo::Part::Title;
+    break;
+  case SmartPlaylistQuery::SortOrder::YearNewToOld:
+  case SmartPlaylistQuery::SortOrder::YearOldToNew:
+    uiParts |= SongInfo::Part::Year | uiArtistAlbumDiscTrack;
+    break;
+  case SmartPlaylistQuery::SortOrder::DurationShortToLong:
+  case SmartPlaylistQuery::SortOrder::DurationLongToShort:
+    uiParts |= SongInfo::Part::Length;
+    break;
+  case SmartPlaylistQuery::SortOrder::PlayDateOld:
+  case SmartPlaylistQuery::SortOrder::PlayDataNew:
+    uiParts |= SongInfo::Part::LastPlayed;
+    break;
+  case SmartPlaylistQuery::SortOrder::PlayCountLow:
+  case SmartPlaylistQuery::SortOrder::PlayCountHigh:
+    uiParts |= SongInfo::Part::PlayCount | uiArtistAlbumDiscTrack;
+    break;
+  case SmartPlaylistQuery::SortOrder::RatingLow:
+  case SmartPlaylistQuery::SortOrder::RatingHigh:
+    uiParts |= SongInfo::Part::Rating | uiArtistAlbumDiscTrack;
+    break;
+  case SmartPlaylistQuery::SortOrder::DateAddedOld:
+  case SmartPlaylistQuery::SortOrder::DateAddedNew:
+    uiParts |= SongInfo::Part::DateAdded | uiArtistAlbumDiscTrack;
+    break;
+
+  default:
+    assert(false && "Missing case statement");
+  }
+
+  return uiParts;
+}
+
+unsigned int SmartPlaylistQuery::ConditionGroup::GetDependencies() const
+{
+  unsigned int uiParts = 0;
+
+  for (auto it = m_SubGroups.begin(); it != m_SubGroups.end(); ++it)
+  {
+    uiParts |= it->GetDependencies();
+  }
+
+  for (auto it = m_Statements.begin(); it != m_Statements.end(); ++it)
+  {
+    uiParts |= GetPart(it->m_Criterium);
+  }
+
+  return uiParts;
+}
+
 QString SmartPlaylistQuery::ConditionGroup::GenerateSQL() const
 {
   QString result;
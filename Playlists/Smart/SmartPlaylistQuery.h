@@ -88,6 +88,7 @@ public:
     std::list<ConditionGroup> m_SubGroups;
 
     QString GenerateSQL() const;
+    unsigned int GetDependencies() const;
   };
 
   static void GetAllowedComparisons(Criterium crit, std::vector<Comparison>& out_Comparisons);
@@ -99,9 +100,17 @@ public:
   static QString ToDbString(Criterium c);
   static QString ToDbString(Comparison c, const QString& value);
 
+  /// \brief Returns the SongInfo::Part that the criterium reads.
+  static unsigned int GetPart(Criterium c);
+
   QString GenerateSQL() const;
   QString GenerateOrderBySQL() const;
 
+  /// \brief Returns the SongInfo::Part values that the conditions and the sort order read.
+  ///
+  /// The result of the query can only change, if one of them changes, or if songs are added or removed.
+  unsigned int GetDependencies() const;
+
   void Save(QDataStream& stream) const;
   void Load(QDataStream& stream);
 
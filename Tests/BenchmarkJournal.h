@@ -0,0 +1,98 @@
+#pragma once
+
+#include "Misc/ModificationRecorder.h"
+#include "Tests/BenchmarkUtils.h"
+#include <vector>
+
+// The journal benchmarks need a modification type without the rest of MusicLibrary.
+// BenchmarkModification has the same data, serialization and coalescing keys as LibraryModification.
+
+struct BenchmarkModification : public Modification
+{
+  enum class Type
+  {
+    None,
+    SetRating,
+    SetVolume,
+    SetStartOffset,
+    SetEndOffset,
+    AddPlayDate,
+    SetDiscNumber,
+
+    ENUM_COUNT
+  };
+
+  Type m_Type = Type::None;
+  QString m_sSongGuid;
+  int m_iData = 0;
+
+  void Apply(int) const {}
+
+  void Save(QDataStream& stream, JournalStringTable& strings) const
+  {
+    stream << (int)m_Type;
+    strings.Write(stream, m_sSongGuid);
+    stream << m_iData;
+  }
+
+  void Load(QDataStream& stream, const JournalStringTable& strings)
+  {
+    int type;
+    stream >> type;
+    m_Type = (Type)type;
+    m_sSongGuid = strings.Read(stream);
+    stream >> m_iData;
+  }
+
+  bool IsRelevant() const { return true; }
+
+  QString GetCoalescingKey() const
+  {
+    if (m_Type == Type::AddPlayDate)
+      return QString();
+
+    return QString::number((int)m_Type) + ":" + m_sSongGuid;
+  }
+
+  bool HasModificationData(const BenchmarkModification& rhs) const { return m_Type == rhs.m_Type && m_sSongGuid == rhs.m_sSongGuid; }
+};
+
+/// \brief Creates \a iNumEntries modifications in chronological order, like years of recorded library changes.
+///
+/// Most entries are play dates, which are never coalesced, the others set a property of one of \a iNumSongs songs,
+/// so the same property of the same song is set several times in larger journals.
+inline void CreateBenchmarkModifications(int iNumEntries, int iNumSongs, std::vector<BenchmarkModification>& out_Modifications)
+{
+  static const BenchmarkModification::Type s_PropertyTypes[] = {BenchmarkModification::Type::SetRating, BenchmarkModification::Type::SetVolume, BenchmarkModification::Type::SetStartOffset, BenchmarkModification::Type::SetEndOffset, BenchmarkModification::Type::SetDiscNumber};
+
+  // 2020-09-13, one modification every ten minutes
+  const quint64 uiStartMS = 1600000000000ull;
+  quint64 uiHash = 0x9E3779B97F4A7C15ull;
+
+  out_Modifications.clear();
+  out_Modifications.reserve(iNumEntries);
+
+  for (int i = 0; i < iNumEntries; ++i)
+  {
+    uiHash = uiHash * 6364136223846793005ull + 1442695040888963407ull;
+    const quint32 uiRandom = (quint32)(uiHash >> 32);
+
+    BenchmarkModification mod;
+    mod.m_ModId.m_uiClock = (uiStartMS + (quint64)i * 600000) << 16;
+    mod.m_ModId.m_uiNode = 0x1234567890ABCDEFull;
+    mod.m_sSongGuid = GetBenchmarkSongGuid((int)(uiRandom % iNumSongs));
+
+    if (uiRandom % 10 < 7)
+    {
+      mod.m_Type = BenchmarkModification::Type::AddPlayDate;
+      mod.m_iData = (int)((uiStartMS / 1000) + (quint64)i * 600);
+    }
+    else
+    {
+      mod.m_Type = s_PropertyTypes[(uiRandom / 10) % 5];
+      mod.m_iData = (int)((uiRandom / 50) % 6);
+    }
+
+    out_Modifications.push_back(mod);
+  }
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QString>
+#include <sqlite3.h>
+#include <stdio.h>
+
+// Shared by the benchmarks in this directory. They only print timings, there is nothing to pass or fail,
+// so they are built with FORM1_BUILD_TESTS but not registered with CTest.
+
+/// \brief Runs \a func \a iRepetitions times and returns the fastest run in milliseconds, which is the least disturbed by other processes.
+template <typename FUNC>
+double MeasureMS(int iRepetitions, FUNC func)
+{
+  double fBestMS = -1.0;
+
+  for (int i = 0; i < iRepetitions; ++i)
+  {
+    QElapsedTimer timer;
+    timer.start();
+
+    func();
+
+    const double fMS = timer.nsecsElapsed() / 1000000.0;
+
+    if (fBestMS < 0.0 || fMS < fBestMS)
+      fBestMS = fMS;
+  }
+
+  return fBestMS;
+}
+
+/// \brief Prints one line with the time for \a iNumOps operations and the resulting throughput.
+inline void ReportTiming(const char* szName, double fMS, int iNumOps)
+{
+  const double fSeconds = fMS > 0.0 ? fMS / 1000.0 : 0.000001;
+  printf("  %-44s %10.2f ms %12.0f ops/sec\n", szName, fMS, iNumOps / fSeconds);
+}
+
+/// \brief Prints how much faster \a fNewMS is than \a fOldMS.
+inline void ReportSpeedup(const char* szName, double fOldMS, double fNewMS)
+{
+  printf("  %-44s %10.1fx\n", szName, fNewMS > 0.0 ? fOldMS / fNewMS : 0.0);
+}
+
+inline bool ExecuteSql(sqlite3* pDatabase, const char* szSql)
+{
+  char* szError = nullptr;
+
+  if (sqlite3_exec(pDatabase, szSql, nullptr, nullptr, &szError) != SQLITE_OK)
+  {
+    printf("SQL error: %s\n  in: %s\n", szError, szSql);
+    sqlite3_free(szError);
+    return false;
+  }
+
+  return true;
+}
+
+/// \brief The GUID of the benchmark song with the given index. 32 hex digits, like the GUIDs of FileGuid.
+inline QString GetBenchmarkSongGuid(int iSong)
+{
+  const quint64 uiHash = (quint64)(iSong + 1) * 0x9E3779B97F4A7C15ull;
+  return QString("%1%2").arg(uiHash, 16, 16, QChar('0')).arg(~uiHash, 16, 16, QChar('0'));
+}
+
+/// \brief A few words from a fixed list, so that searches for a word find some songs, but not most of them.
+inline QString GetBenchmarkText(int iSeed, int iNumWords)
+{
+  static const char* s_szWords[] = {"Midnight", "River", "Golden", "Shadow", "Summer", "Electric", "Heart", "Stone", "Blue", "Dream",
+                                    "Fire", "Ocean", "Silver", "Winter", "Road", "Night", "Light", "Wild", "Rain", "Mountain",
+                                    "City", "Ghost", "Velvet", "Thunder", "Echo", "Crystal", "Desert", "Morning", "Storm", "Paper",
+                                    "Garden", "Highway", "\xc3\x89toile", "Sch\xc3\xb6n", "Caf\xc3\xa9", "Na\xc3\xafve"};
+  static const int s_iNumWords = sizeof(s_szWords) / sizeof(s_szWords[0]);
+
+  QString sText;
+  quint64 uiHash = (quint64)(iSeed + 1) * 0x9E3779B97F4A7C15ull;
+
+  for (int i = 0; i < iNumWords; ++i)
+  {
+    if (i > 0)
+      sText += " ";
+
+    sText += QString::fromUtf8(s_szWords[(uiHash >> 32) % s_iNumWords]);
+    uiHash = uiHash * 6364136223846793005ull + 1442695040888963407ull;
+  }
+
+  return sText;
+}
+
+/// \brief The file path of the benchmark song with the given index, 12 songs per album directory.
+inline QString GetBenchmarkSongLocation(int iSong)
+{
+  return QString("C:/Music/Artist %1/Album %2/%3 Song %4.mp3").arg(iSong / 120).arg(iSong / 12).arg(iSong % 12 + 1, 2, 10, QChar('0')).arg(iSong);
+}
+
+/// \brief Creates the music and locations tables as in the current schema version and fills them with \a iNumSongs songs, one location each.
+inline bool CreateBenchmarkLibrary(sqlite3* pDatabase, int iNumSongs)
+{
+  if (!ExecuteSql(pDatabase, "CREATE TABLE music "
+                             "(searchkey INTEGER PRIMARY KEY"
+                             ", id TEXT NOT NULL UNIQUE"
+                             ", title TEXT"
+                             ", artist TEXT"
+                             ", album TEXT"
+                             ", disc INTEGER DEFAULT 0"
+                             ", track INTEGER DEFAULT 0"
+                             ", year INTEGER DEFAULT 0"
+                             ", length INTEGER DEFAULT 0"
+                             ", rating INTEGER DEFAULT 0"
+                             ", volume INTEGER DEFAULT 0"
+                             ", start INTEGER DEFAULT 0"
+                             ", end INTEGER DEFAULT 0"
+                             ", lastplayed INTEGER DEFAULT NULL"
+                             ", dateadded INTEGER DEFAULT (strftime('%s','now'))"
+                             ", playcount INTEGER DEFAULT 0)") ||
+      !ExecuteSql(pDatabase, "CREATE TABLE locations (path TEXT NOT NULL, id TEXT NOT NULL, modified TEXT, guidversion INTEGER DEFAULT 1, PRIMARY KEY(path))") ||
+      !ExecuteSql(pDatabase, "CREATE INDEX locations_id ON locations (id)"))
+  {
+    return false;
+  }
+
+  sqlite3_stmt* pSong = nullptr;
+  sqlite3_stmt* pLocation = nullptr;
+
+  sqlite3_prepare_v2(pDatabase, "INSERT INTO music (id, title, artist, album, disc, track, year, length, rating) VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9)", -1, &pSong, nullptr);
+  sqlite3_prepare_v2(pDatabase, "INSERT INTO locations (path, id, modified) VALUES(?1, ?2, ?3)", -1, &pLocation, nullptr);
+
+  bool bSuccess = pSong != nullptr && pLocation != nullptr && ExecuteSql(pDatabase, "BEGIN TRANSACTION");
+
+  for (int i = 0; i < iNumSongs && bSuccess; ++i)
+  {
+    const QByteArray guid = GetBenchmarkSongGuid(i).toUtf8();
+    const QByteArray title = GetBenchmarkText(i, 1 + i % 3).toUtf8();
+    const QByteArray artist = GetBenchmarkText(1000000 + i / 120, 2).toUtf8();
+    const QByteArray album = GetBenchmarkText(2000000 + i / 12, 2).toUtf8();
+    const QByteArray location = GetBenchmarkSongLocation(i).toUtf8();
+
+    sqlite3_reset(pSong);
+    sqlite3_bind_text(pSong, 1, guid.constData(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(pSong, 2, title.constData(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(pSong, 3, artist.constData(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(pSong, 4, album.constData(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(pSong, 5, 1);
+    sqlite3_bind_int(pSong, 6, i % 12 + 1);
+    sqlite3_bind_int(pSong, 7, 1970 + i % 50);
+    sqlite3_bind_int(pSong, 8, 180000 + (i % 120) * 1000);
+    sqlite3_bind_int(pSong, 9, i % 6);
+
+    sqlite3_reset(pLocation);
+    sqlite3_bind_text(pLocation, 1, location.constData(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(pLocation, 2, guid.constData(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(pLocation, 3, "2020-01-01-12-00-00", -1, SQLITE_STATIC);
+
+    bSuccess = sqlite3_step(pSong) == SQLITE_DONE && sqlite3_step(pLocation) == SQLITE_DONE;
+  }
+
+  sqlite3_finalize(pSong);
+  sqlite3_finalize(pLocation);
+
+  return bSuccess && ExecuteSql(pDatabase, "END TRANSACTION");
+}
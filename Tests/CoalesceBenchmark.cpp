@@ -0,0 +1,156 @@
+#include "Tests/BenchmarkJournal.h"
+#include <QElapsedTimer>
+#include <deque>
+
+// Compares how the journal used to be coalesced before it is saved, where every property change scanned all earlier entries
+// to invalidate those it replaces, with the one-pass ModificationRecorder::CoalesceEntries(), which keeps the latest entry per coalescing key.
+
+static const int s_iNumSongs = 5000;
+static const int s_iNumRepetitions = 3;
+
+static const int s_NumQuadraticEntries[] = {1000, 4000, 16000, 64000};
+static const int s_NumKeyedEntries[] = {250000, 1000000};
+
+/// \brief The coalescing as it was done before, each SetXYZ modification invalidated all earlier ones of the same song and type.
+static void CoalesceQuadratic(std::deque<BenchmarkModification>& modifications)
+{
+  std::sort(modifications.begin(), modifications.end(), [](const BenchmarkModification& lhs, const BenchmarkModification& rhs) -> bool {
+    return lhs.m_ModId < rhs.m_ModId;
+  });
+
+  for (size_t i = modifications.size(); i > 0; --i)
+  {
+    const BenchmarkModification& mod = modifications[i - 1];
+
+    if (!mod.m_ModId.IsValid() || mod.m_Type == BenchmarkModification::Type::AddPlayDate)
+      continue;
+
+    for (size_t prev = i - 1; prev > 0; --prev)
+    {
+      BenchmarkModification& prevMod = modifications[prev - 1];
+
+      if (prevMod.m_ModId.IsValid() && prevMod.m_sSongGuid == mod.m_sSongGuid && prevMod.m_Type == mod.m_Type)
+      {
+        prevMod.m_ModId = ModificationId();
+      }
+    }
+  }
+
+  modifications.erase(std::remove_if(modifications.begin(), modifications.end(), [](const BenchmarkModification& mod) { return !mod.m_ModId.IsValid(); }), modifications.end());
+}
+
+/// \brief Both ways must keep exactly the same entries.
+static bool IsSameResult(const std::deque<BenchmarkModification>& lhs, const std::deque<BenchmarkModification>& rhs)
+{
+  if (lhs.size() != rhs.size())
+    return false;
+
+  for (size_t i = 0; i < lhs.size(); ++i)
+  {
+    if (lhs[i].m_ModId != rhs[i].m_ModId)
+      return false;
+  }
+
+  return true;
+}
+
+/// \brief Times only the coalescing, filling a fresh recorder for every run is not measured.
+static double MeasureKeyedMS(const std::vector<BenchmarkModification>& entries, std::deque<BenchmarkModification>& out_Result)
+{
+  double fBestMS = -1.0;
+
+  for (int i = 0; i < s_iNumRepetitions; ++i)
+  {
+    ModificationRecorder<BenchmarkModification, int> recorder;
+    std::vector<BenchmarkModification> modifications = entries;
+    recorder.Splice(modifications);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    recorder.CoalesceEntries();
+
+    const double fMS = timer.nsecsElapsed() / 1000000.0;
+
+    if (fBestMS < 0.0 || fMS < fBestMS)
+      fBestMS = fMS;
+
+    out_Result = recorder.GetAllModifications();
+  }
+
+  return fBestMS;
+}
+
+static double MeasureQuadraticMS(const std::vector<BenchmarkModification>& entries, std::deque<BenchmarkModification>& out_Result)
+{
+  double fBestMS = -1.0;
+
+  for (int i = 0; i < s_iNumRepetitions; ++i)
+  {
+    std::deque<BenchmarkModification> modifications(entries.begin(), entries.end());
+
+    QElapsedTimer timer;
+    timer.start();
+
+    CoalesceQuadratic(modifications);
+
+    const double fMS = timer.nsecsElapsed() / 1000000.0;
+
+    if (fBestMS < 0.0 || fMS < fBestMS)
+      fBestMS = fMS;
+
+    out_Result.swap(modifications);
+  }
+
+  return fBestMS;
+}
+
+int main(int argc, char** argv)
+{
+  printf("%i songs, 70%% play dates, best of %i runs:\n", s_iNumSongs, s_iNumRepetitions);
+
+  std::vector<BenchmarkModification> entries;
+
+  for (int iNumEntries : s_NumQuadraticEntries)
+  {
+    CreateBenchmarkModifications(iNumEntries, s_iNumSongs, entries);
+
+    std::deque<BenchmarkModification> quadratic;
+    std::deque<BenchmarkModification> keyed;
+
+    const double fOldMS = MeasureQuadraticMS(entries, quadratic);
+    const double fNewMS = MeasureKeyedMS(entries, keyed);
+
+    if (!IsSameResult(quadratic, keyed))
+    {
+      printf("%i entries: the coalesced journals differ (%i vs. %i entries).\n", iNumEntries, (int)quadratic.size(), (int)keyed.size());
+      return 1;
+    }
+
+    char szName[64];
+    printf("  %i entries, %i after coalescing:\n", iNumEntries, (int)keyed.size());
+
+    sprintf(szName, "quadratic, %i entries", iNumEntries);
+    ReportTiming(szName, fOldMS, iNumEntries);
+    sprintf(szName, "coalescing keys, %i entries", iNumEntries);
+    ReportTiming(szName, fNewMS, iNumEntries);
+    ReportSpeedup("speedup", fOldMS, fNewMS);
+  }
+
+  // too slow for the old way, it would take minutes
+  for (int iNumEntries : s_NumKeyedEntries)
+  {
+    CreateBenchmarkModifications(iNumEntries, s_iNumSongs, entries);
+
+    std::deque<BenchmarkModification> keyed;
+    const double fNewMS = MeasureKeyedMS(entries, keyed);
+
+    char szName[64];
+    printf("  %i entries, %i after coalescing:\n", iNumEntries, (int)keyed.size());
+
+    sprintf(szName, "coalescing keys, %i entries", iNumEntries);
+    ReportTiming(szName, fNewMS, iNumEntries);
+  }
+
+  return 0;
+}
@@ -0,0 +1,181 @@
+#include "MusicLibrary/SqlStatementCache.h"
+#include "Tests/BenchmarkJournal.h"
+#include <QHash>
+#include <QTemporaryDir>
+
+// Compares how the library journal used to be replayed, one UPDATE per journal entry, with the way MusicLibrary::ApplyJournal() does it:
+// the entries are collapsed to the final value of every song property in memory, written into the journal_staging table
+// with one INSERT per song, and applied with a single UPDATE ... FROM.
+//
+// The database is a file, like the real library. In memory, the per-entry UPDATEs look much cheaper, since no pages have to be written.
+
+static const int s_iNumSongs = 50000;
+static const int s_iNumEntries = 20000;
+static const int s_iNumRepetitions = 3;
+
+/// \brief The journal columns in the order of the journal_staging table, as in MusicLibrary.cpp.
+static const BenchmarkModification::Type s_JournalColumns[] = {
+  BenchmarkModification::Type::SetRating,
+  BenchmarkModification::Type::SetVolume,
+  BenchmarkModification::Type::SetStartOffset,
+  BenchmarkModification::Type::SetEndOffset,
+  BenchmarkModification::Type::SetDiscNumber,
+  BenchmarkModification::Type::AddPlayDate,
+};
+
+static const int s_iNumJournalColumns = sizeof(s_JournalColumns) / sizeof(s_JournalColumns[0]);
+
+static int GetJournalColumnIndex(BenchmarkModification::Type type)
+{
+  for (int idx = 0; idx < s_iNumJournalColumns; ++idx)
+  {
+    if (s_JournalColumns[idx] == type)
+      return idx;
+  }
+
+  return -1;
+}
+
+static SqlStatement GetUpdateStatement(BenchmarkModification::Type type)
+{
+  switch (type)
+  {
+  case BenchmarkModification::Type::SetRating:
+    return SqlStatement::UpdateSongRating;
+  case BenchmarkModification::Type::SetVolume:
+    return SqlStatement::UpdateSongVolume;
+  case BenchmarkModification::Type::SetStartOffset:
+    return SqlStatement::UpdateSongStartOffset;
+  case BenchmarkModification::Type::SetEndOffset:
+    return SqlStatement::UpdateSongEndOffset;
+  case BenchmarkModification::Type::SetDiscNumber:
+    return SqlStatement::UpdateSongDiscNumber;
+  case BenchmarkModification::Type::AddPlayDate:
+  default:
+    return SqlStatement::UpdateSongPlayDate;
+  }
+}
+
+/// \brief One UPDATE per journal entry, in chronological order.
+static void ApplyPerEntry(SqlStatementCache& statements, const std::vector<BenchmarkModification>& modifications)
+{
+  SqlQuery(statements, SqlStatement::BeginTransaction).Execute();
+
+  for (const BenchmarkModification& mod : modifications)
+  {
+    SqlQuery query(statements, GetUpdateStatement(mod.m_Type));
+    query.Bind(1, mod.m_sSongGuid);
+    query.Bind(2, mod.m_iData);
+    query.Execute();
+  }
+
+  SqlQuery(statements, SqlStatement::EndTransaction).Execute();
+}
+
+/// \brief Collapses the entries to one row per song and applies all rows at once, like ApplyJournal().
+///
+/// ApplyJournal() also drops the values that the song store already has, there is no song store here, so every final value is written.
+static void ApplyStaged(SqlStatementCache& statements, const std::vector<BenchmarkModification>& modifications)
+{
+  struct FinalValues
+  {
+    int m_iValues[s_iNumJournalColumns] = {};
+    bool m_bSet[s_iNumJournalColumns] = {};
+  };
+
+  QHash<QString, FinalValues> finalValues;
+
+  for (const BenchmarkModification& mod : modifications)
+  {
+    const int idx = GetJournalColumnIndex(mod.m_Type);
+
+    if (idx < 0)
+      continue;
+
+    FinalValues& values = finalValues[mod.m_sSongGuid];
+    values.m_iValues[idx] = mod.m_iData;
+    values.m_bSet[idx] = true;
+  }
+
+  SqlQuery(statements, SqlStatement::BeginTransaction).Execute();
+  SqlQuery(statements, SqlStatement::ClearJournalStaging).Execute();
+
+  for (auto it = finalValues.begin(); it != finalValues.end(); ++it)
+  {
+    SqlQuery query(statements, SqlStatement::StageJournalValues);
+    query.Bind(1, it.key());
+
+    for (int idx = 0; idx < s_iNumJournalColumns; ++idx)
+    {
+      if (it.value().m_bSet[idx])
+        query.Bind(2 + idx, it.value().m_iValues[idx]);
+      else
+        query.BindNull(2 + idx);
+    }
+
+    query.Execute();
+  }
+
+  SqlQuery(statements, SqlStatement::ApplyJournalStaging).Execute();
+  SqlQuery(statements, SqlStatement::ClearJournalStaging).Execute();
+  SqlQuery(statements, SqlStatement::EndTransaction).Execute();
+}
+
+/// \brief Resets the journal columns of all songs, so that both ways start from the same state.
+static void ResetSongs(sqlite3* pDatabase)
+{
+  ExecuteSql(pDatabase, "UPDATE music SET rating = 0, volume = 0, start = 0, end = 0, disc = 1, lastplayed = NULL");
+}
+
+/// \brief A checksum over the journal columns of all songs, to check that both ways end up with the same values.
+static QString GetSongsChecksum(SqlStatementCache& statements)
+{
+  SqlQuery query(statements, QString("SELECT sum(searchkey * (rating + 7 * volume + 13 * start + 17 * end + 19 * disc) + coalesce(lastplayed, 0)) FROM music"));
+  return query.Step() ? query.GetText(0) : QString();
+}
+
+int main(int argc, char** argv)
+{
+  QTemporaryDir tempDir;
+  sqlite3* pDatabase = nullptr;
+
+  if (!tempDir.isValid() || sqlite3_open((tempDir.path() + "/library.db").toUtf8().data(), &pDatabase) != SQLITE_OK || !CreateBenchmarkLibrary(pDatabase, s_iNumSongs) ||
+      !ExecuteSql(pDatabase, "CREATE TEMP TABLE IF NOT EXISTS journal_staging (id TEXT NOT NULL, rating INTEGER, volume INTEGER, start INTEGER, end INTEGER, disc INTEGER, lastplayed INTEGER, PRIMARY KEY(id))"))
+  {
+    printf("Could not set up the database.\n");
+    return 1;
+  }
+
+  SqlStatementCache statements;
+  statements.Startup(pDatabase);
+
+  std::vector<BenchmarkModification> modifications;
+  CreateBenchmarkModifications(s_iNumEntries, s_iNumSongs, modifications);
+
+  ResetSongs(pDatabase);
+  ApplyPerEntry(statements, modifications);
+  const QString sPerEntryChecksum = GetSongsChecksum(statements);
+
+  ResetSongs(pDatabase);
+  ApplyStaged(statements, modifications);
+  const QString sStagedChecksum = GetSongsChecksum(statements);
+
+  if (sPerEntryChecksum != sStagedChecksum)
+  {
+    printf("The songs differ after applying the journal.\n");
+    return 1;
+  }
+
+  printf("%i songs, %i journal entries, best of %i runs:\n", s_iNumSongs, s_iNumEntries, s_iNumRepetitions);
+
+  const double fOldMS = MeasureMS(s_iNumRepetitions, [&]() { ApplyPerEntry(statements, modifications); });
+  const double fNewMS = MeasureMS(s_iNumRepetitions, [&]() { ApplyStaged(statements, modifications); });
+
+  ReportTiming("one UPDATE per entry", fOldMS, s_iNumEntries);
+  ReportTiming("staging table, one UPDATE ... FROM", fNewMS, s_iNumEntries);
+  ReportSpeedup("speedup", fOldMS, fNewMS);
+
+  statements.Shutdown();
+  sqlite3_close(pDatabase);
+  return 0;
+}
@@ -0,0 +1,157 @@
+#include "Tests/BenchmarkJournal.h"
+#include <QByteArray>
+#include <QDataStream>
+#include <QDateTime>
+#include <QUuid>
+#include <string.h>
+
+// Writes the same library modifications in all journal formats and compares the file sizes and how long ModificationRecorder::Decode() takes:
+// version 1 with a GUID string, a QDateTime and the song GUID inline in every entry, version 2 with a string table, a binary GUID
+// and a timestamp, and the current version 3 with a string table and two integers per modification ID.
+
+static const int s_iNumSongs = 20000;
+static const int s_iNumEntries = 200000;
+static const int s_iNumRepetitions = 3;
+
+/// \brief Versions 1 and 2 identified a modification by a random GUID, any unique one will do here.
+static QUuid GetLegacyGuid(const ModificationId& id)
+{
+  const quint64 uiHigh = id.m_uiClock * 0x9E3779B97F4A7C15ull;
+  const quint64 uiLow = ~id.m_uiClock * 6364136223846793005ull;
+
+  QByteArray data(16, 0);
+  memcpy(data.data(), &uiHigh, 8);
+  memcpy(data.data() + 8, &uiLow, 8);
+  return QUuid::fromRfc4122(data);
+}
+
+static QByteArray WriteJournalV1(const std::vector<BenchmarkModification>& modifications)
+{
+  QByteArray journal;
+  QDataStream stream(&journal, QIODevice::WriteOnly);
+
+  stream << (int)1;
+  stream << (int)modifications.size();
+
+  for (const BenchmarkModification& mod : modifications)
+  {
+    stream << GetLegacyGuid(mod.m_ModId).toString();
+    stream << QDateTime::fromMSecsSinceEpoch(mod.m_ModId.GetMilliseconds(), Qt::UTC);
+
+    // version 1 didn't have a string table
+    stream << (int)mod.m_Type;
+    stream << mod.m_sSongGuid;
+    stream << mod.m_iData;
+  }
+
+  return journal;
+}
+
+static QByteArray WriteJournalV2(const std::vector<BenchmarkModification>& modifications)
+{
+  QByteArray journal;
+  QDataStream stream(&journal, QIODevice::WriteOnly);
+
+  JournalStringTable strings;
+  QByteArray entries;
+
+  {
+    QDataStream entryStream(&entries, QIODevice::WriteOnly);
+
+    for (const BenchmarkModification& mod : modifications)
+    {
+      entryStream.writeRawData(GetLegacyGuid(mod.m_ModId).toRfc4122().constData(), 16);
+      entryStream << mod.m_ModId.GetMilliseconds();
+      mod.Save(entryStream, strings);
+    }
+  }
+
+  stream << (int)2;
+  strings.Save(stream);
+  stream << (int)modifications.size();
+  stream.writeRawData(entries.constData(), entries.size());
+
+  return journal;
+}
+
+static QByteArray WriteJournalV3(const std::vector<BenchmarkModification>& modifications)
+{
+  ModificationRecorder<BenchmarkModification, int> recorder;
+  std::vector<BenchmarkModification> copy = modifications;
+  recorder.Splice(copy);
+
+  QByteArray journal;
+  QDataStream stream(&journal, QIODevice::WriteOnly);
+  recorder.Save(stream);
+
+  return journal;
+}
+
+/// \brief Decodes the journal and checks that it contains the modifications it was written from.
+static bool IsDecodedCorrectly(const QByteArray& journal, const std::vector<BenchmarkModification>& modifications)
+{
+  QDataStream stream(journal);
+  std::vector<BenchmarkModification> decoded;
+
+  if (!ModificationRecorder<BenchmarkModification, int>::Decode(stream, decoded) || decoded.size() != modifications.size())
+    return false;
+
+  for (size_t i = 0; i < decoded.size(); ++i)
+  {
+    if (decoded[i].m_Type != modifications[i].m_Type || decoded[i].m_sSongGuid != modifications[i].m_sSongGuid || decoded[i].m_iData != modifications[i].m_iData ||
+        decoded[i].m_ModId.GetMilliseconds() != modifications[i].m_ModId.GetMilliseconds())
+      return false;
+  }
+
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  std::vector<BenchmarkModification> modifications;
+  CreateBenchmarkModifications(s_iNumEntries, s_iNumSongs, modifications);
+
+  struct Format
+  {
+    const char* m_szName;
+    QByteArray m_Journal;
+  };
+
+  Format formats[] = {
+    {"version 1", WriteJournalV1(modifications)},
+    {"version 2", WriteJournalV2(modifications)},
+    {"version 3", WriteJournalV3(modifications)},
+  };
+
+  printf("%i modifications of %i songs, best of %i runs:\n", s_iNumEntries, s_iNumSongs, s_iNumRepetitions);
+
+  double fVersion1MS = 0.0;
+
+  for (const Format& format : formats)
+  {
+    if (!IsDecodedCorrectly(format.m_Journal, modifications))
+    {
+      printf("The %s journal was not decoded correctly.\n", format.m_szName);
+      return 1;
+    }
+
+    const double fMS = MeasureMS(s_iNumRepetitions, [&]() {
+      QDataStream stream(format.m_Journal);
+      std::vector<BenchmarkModification> decoded;
+      ModificationRecorder<BenchmarkModification, int>::Decode(stream, decoded);
+    });
+
+    char szName[64];
+    printf("  %s: %.2f MB, %.1f bytes per entry\n", format.m_szName, format.m_Journal.size() / (1024.0 * 1024.0), (double)format.m_Journal.size() / s_iNumEntries);
+
+    sprintf(szName, "decode %s", format.m_szName);
+    ReportTiming(szName, fMS, s_iNumEntries);
+
+    if (fVersion1MS == 0.0)
+      fVersion1MS = fMS;
+    else
+      ReportSpeedup("speedup over version 1", fVersion1MS, fMS);
+  }
+
+  return 0;
+}
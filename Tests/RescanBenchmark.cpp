@@ -0,0 +1,194 @@
+#include "Tests/BenchmarkUtils.h"
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <vector>
+
+// Times the walk over an unchanged music folder, the way ImportPipeline::Walk() does it with and without bFullVerify:
+// either every directory is listed and every file's timestamp is compared with the known locations,
+// or only the timestamps of the known directories are checked, and unchanged directories are not listed at all.
+//
+// Pass a folder on the command line to measure a real library (e.g. on a network drive, where listing is expensive),
+// otherwise a temporary folder with empty files is created.
+
+static const int s_iNumArtists = 100;
+static const int s_iNumAlbumsPerArtist = 5;
+static const int s_iNumSongsPerAlbum = 12;
+static const int s_iNumRepetitions = 3;
+
+/// \brief What the database holds after the first import: the KnownDirectory rows and the locations with their timestamps.
+struct ScanState
+{
+  QHash<QString, QString> m_DirModified; // directory -> modification time in ms since the epoch
+  QHash<QString, QStringList> m_SubDirs;
+  QHash<QString, QString> m_Locations; // file -> modification time, as in the locations table
+};
+
+struct WalkResult
+{
+  int m_iNumListedDirs = 0;
+  int m_iNumCheckedFiles = 0;
+  int m_iNumSkippedDirs = 0;
+};
+
+static bool CreateMusicFolder(const QString& sRoot)
+{
+  for (int artist = 0; artist < s_iNumArtists; ++artist)
+  {
+    for (int album = 0; album < s_iNumAlbumsPerArtist; ++album)
+    {
+      const QString sDir = QString("%1/Artist %2/Album %3").arg(sRoot).arg(artist).arg(album);
+
+      if (!QDir().mkpath(sDir))
+        return false;
+
+      for (int song = 0; song < s_iNumSongsPerAlbum; ++song)
+      {
+        QFile file(QString("%1/%2 Song.mp3").arg(sDir).arg(song + 1, 2, 10, QChar('0')));
+
+        if (!file.open(QIODevice::WriteOnly))
+          return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/// \brief Lists all directories and compares every file with the known locations, like a walk with bFullVerify.
+static WalkResult ListEverything(const QString& sRoot, const ScanState& known, ScanState* out_pState)
+{
+  WalkResult result;
+  std::vector<QString> dirsToVisit;
+  dirsToVisit.push_back(sRoot);
+
+  while (!dirsToVisit.empty())
+  {
+    const QString sDir = dirsToVisit.back();
+    dirsToVisit.pop_back();
+
+    const QFileInfo dirInfo(sDir);
+    const QFileInfoList entries = QDir(sDir).entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+    ++result.m_iNumListedDirs;
+
+    if (out_pState != nullptr)
+    {
+      out_pState->m_DirModified.insert(sDir, QString::number(dirInfo.lastModified().toMSecsSinceEpoch()));
+    }
+
+    for (const QFileInfo& info : entries)
+    {
+      if (info.isDir())
+      {
+        dirsToVisit.push_back(info.absoluteFilePath());
+
+        if (out_pState != nullptr)
+          out_pState->m_SubDirs[sDir].push_back(info.absoluteFilePath());
+
+        continue;
+      }
+
+      const QString sModDate = info.lastModified().toString("yyyy-MM-dd-hh-mm-ss");
+
+      // the filter stage drops files whose timestamp matches the known location
+      if (known.m_Locations.value(info.absoluteFilePath()) != sModDate)
+      {
+        ++result.m_iNumCheckedFiles;
+      }
+
+      if (out_pState != nullptr)
+        out_pState->m_Locations.insert(info.absoluteFilePath(), sModDate);
+    }
+  }
+
+  return result;
+}
+
+/// \brief Only lists directories whose timestamp changed, like a walk without bFullVerify.
+static WalkResult SkipUnchanged(const QString& sRoot, const ScanState& known)
+{
+  WalkResult result;
+  std::vector<QString> dirsToVisit;
+  dirsToVisit.push_back(sRoot);
+
+  while (!dirsToVisit.empty())
+  {
+    const QString sDir = dirsToVisit.back();
+    dirsToVisit.pop_back();
+
+    const QFileInfo dirInfo(sDir);
+    const QString sModDate = QString::number(dirInfo.lastModified().toMSecsSinceEpoch());
+
+    auto itKnown = known.m_DirModified.find(sDir);
+    if (itKnown != known.m_DirModified.end() && itKnown.value() == sModDate)
+    {
+      ++result.m_iNumSkippedDirs;
+
+      for (const QString& sSubDir : known.m_SubDirs.value(sDir))
+      {
+        dirsToVisit.push_back(sSubDir);
+      }
+
+      continue;
+    }
+
+    // a changed directory is listed as a whole, it doesn't happen in this benchmark
+    const QFileInfoList entries = QDir(sDir).entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot);
+    ++result.m_iNumListedDirs;
+
+    for (const QFileInfo& info : entries)
+    {
+      if (info.isDir())
+        dirsToVisit.push_back(info.absoluteFilePath());
+      else
+        ++result.m_iNumCheckedFiles;
+    }
+  }
+
+  return result;
+}
+
+int main(int argc, char** argv)
+{
+  QTemporaryDir tempDir;
+  QString sRoot;
+
+  if (argc > 1)
+  {
+    sRoot = QFileInfo(QString::fromLocal8Bit(argv[1])).absoluteFilePath();
+  }
+  else
+  {
+    if (!tempDir.isValid() || !CreateMusicFolder(tempDir.path()))
+    {
+      printf("Could not create the music folder.\n");
+      return 1;
+    }
+
+    sRoot = QFileInfo(tempDir.path()).absoluteFilePath();
+  }
+
+  // the first import stores what the rescans compare against
+  ScanState known;
+  const WalkResult import = ListEverything(sRoot, known, &known);
+
+  printf("%i directories, %i files, best of %i runs:\n", import.m_iNumListedDirs, (int)known.m_Locations.size(), s_iNumRepetitions);
+
+  WalkResult full;
+  WalkResult skipped;
+
+  const double fFullMS = MeasureMS(s_iNumRepetitions, [&]() { full = ListEverything(sRoot, known, nullptr); });
+  const double fSkipMS = MeasureMS(s_iNumRepetitions, [&]() { skipped = SkipUnchanged(sRoot, known); });
+
+  ReportTiming("rescan, listing all directories", fFullMS, (int)known.m_Locations.size());
+  printf("  %-44s %i listed, %i files to check\n", "", full.m_iNumListedDirs, full.m_iNumCheckedFiles);
+  ReportTiming("rescan, skipping unchanged directories", fSkipMS, (int)known.m_Locations.size());
+  printf("  %-44s %i listed, %i skipped, %i files to check\n", "", skipped.m_iNumListedDirs, skipped.m_iNumSkippedDirs, skipped.m_iNumCheckedFiles);
+  ReportSpeedup("speedup", fFullMS, fSkipMS);
+
+  return 0;
+}
@@ -0,0 +1,137 @@
+#include "Tests/BenchmarkUtils.h"
+#include <QStringList>
+#include <vector>
+
+// Compares the library search as it used to be, a LIKE scan over the title, artist and album of every song,
+// with the lookup in the FTS5 trigram index music_search, which MusicLibrary uses for all words with at least three characters.
+
+static const int s_iNumSongs = 50000;
+static const int s_iNumRepetitions = 3;
+static const int s_iNumRounds = 10;
+
+static const char* s_szSearches[] = {"river", "gold", "night", "midnight river", "ston", "thunder echo", "light storm desert", "caf\xc3\xa9", "\xc3\xa9toile", "nothing like this"};
+static const int s_iNumSearches = sizeof(s_szSearches) / sizeof(s_szSearches[0]);
+
+/// \brief Creates the search index like schema migration 10 does.
+static bool CreateSearchIndex(sqlite3* pDatabase)
+{
+  return ExecuteSql(pDatabase, "CREATE VIRTUAL TABLE music_search USING fts5(title, artist, album, tokenize = 'trigram')") &&
+         ExecuteSql(pDatabase, "INSERT INTO music_search (rowid, title, artist, album) SELECT rowid, title, artist, album FROM music");
+}
+
+static sqlite3_stmt* Prepare(sqlite3* pDatabase, const QString& sql)
+{
+  sqlite3_stmt* pStatement = nullptr;
+
+  if (sqlite3_prepare_v2(pDatabase, sql.toUtf8().data(), -1, &pStatement, nullptr) != SQLITE_OK)
+  {
+    printf("SQL error: %s\n  in: %s\n", sqlite3_errmsg(pDatabase), sql.toUtf8().data());
+  }
+
+  return pStatement;
+}
+
+static int CountRows(sqlite3_stmt* pStatement)
+{
+  int iNumRows = 0;
+
+  while (sqlite3_step(pStatement) == SQLITE_ROW)
+  {
+    ++iNumRows;
+  }
+
+  sqlite3_reset(pStatement);
+  return iNumRows;
+}
+
+int main(int argc, char** argv)
+{
+  sqlite3* pDatabase = nullptr;
+  if (sqlite3_open(":memory:", &pDatabase) != SQLITE_OK || !CreateBenchmarkLibrary(pDatabase, s_iNumSongs) || !CreateSearchIndex(pDatabase))
+  {
+    printf("Could not set up the database.\n");
+    return 1;
+  }
+
+  std::vector<sqlite3_stmt*> likeQueries;
+  std::vector<sqlite3_stmt*> indexQueries;
+
+  for (int i = 0; i < s_iNumSearches; ++i)
+  {
+    const QStringList pieces = QString::fromUtf8(s_szSearches[i]).split(' ', QString::SkipEmptyParts);
+
+    // every word has to appear somewhere, the same conditions as the search used before the index existed
+    QString condition;
+    QString match;
+
+    for (int p = 0; p < pieces.size(); ++p)
+    {
+      if (!condition.isEmpty())
+        condition.append(" AND ");
+
+      condition.append(QString("(UPPER(title) LIKE UPPER(?%1) OR UPPER(artist) LIKE UPPER(?%1) OR UPPER(album) LIKE UPPER(?%1))").arg(p + 1));
+
+      if (!match.isEmpty())
+        match.append(" ");
+
+      match.append("\"" + pieces[p] + "\"");
+    }
+
+    sqlite3_stmt* pLike = Prepare(pDatabase, "SELECT id FROM music WHERE " + condition);
+    sqlite3_stmt* pIndex = Prepare(pDatabase, "SELECT id FROM music WHERE rowid IN (SELECT rowid FROM music_search WHERE music_search MATCH ?1)");
+
+    if (pLike == nullptr || pIndex == nullptr)
+      return 1;
+
+    for (int p = 0; p < pieces.size(); ++p)
+    {
+      sqlite3_bind_text(pLike, p + 1, ("%" + pieces[p] + "%").toUtf8().data(), -1, SQLITE_TRANSIENT);
+    }
+
+    sqlite3_bind_text(pIndex, 1, match.toUtf8().data(), -1, SQLITE_TRANSIENT);
+
+    likeQueries.push_back(pLike);
+    indexQueries.push_back(pIndex);
+  }
+
+  printf("%i songs, %i searches, best of %i runs:\n", s_iNumSongs, s_iNumSearches, s_iNumRepetitions);
+
+  // the number of results differ for non-ASCII words, LIKE only ignores the case of ASCII letters
+  for (int i = 0; i < s_iNumSearches; ++i)
+  {
+    printf("  '%s': %i songs with LIKE, %i with the index\n", s_szSearches[i], CountRows(likeQueries[i]), CountRows(indexQueries[i]));
+  }
+
+  int iNumFound = 0;
+
+  const double fLikeMS = MeasureMS(s_iNumRepetitions, [&]() {
+    for (int round = 0; round < s_iNumRounds; ++round)
+    {
+      for (sqlite3_stmt* pStatement : likeQueries)
+        iNumFound += CountRows(pStatement);
+    }
+  });
+
+  const double fIndexMS = MeasureMS(s_iNumRepetitions, [&]() {
+    for (int round = 0; round < s_iNumRounds; ++round)
+    {
+      for (sqlite3_stmt* pStatement : indexQueries)
+        iNumFound += CountRows(pStatement);
+    }
+  });
+
+  ReportTiming("LIKE scan", fLikeMS, s_iNumSearches * s_iNumRounds);
+  ReportTiming("FTS5 trigram index", fIndexMS, s_iNumSearches * s_iNumRounds);
+  ReportSpeedup("speedup", fLikeMS, fIndexMS);
+
+  for (int i = 0; i < s_iNumSearches; ++i)
+  {
+    sqlite3_finalize(likeQueries[i]);
+    sqlite3_finalize(indexQueries[i]);
+  }
+
+  sqlite3_close(pDatabase);
+
+  printf("(%i rows found)\n", iNumFound);
+  return 0;
+}
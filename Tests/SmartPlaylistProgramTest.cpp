@@ -0,0 +1,357 @@
+#include "Misc/Song.h"
+#include "MusicLibrary/SongStore.h"
+#include "Playlists/Smart/SmartPlaylistProgram.h"
+#include "Playlists/Smart/SmartPlaylistQuery.h"
+#include <QHash>
+#include <QStringList>
+#include <algorithm>
+#include <random>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Differential test: random songs are put into a SongStore and into an SQLite music table,
+// and random queries are evaluated through SmartPlaylistProgram and through the SQL that SmartPlaylistQuery generates.
+// Both have to find the same songs, in the same order where the sort order defines one.
+
+static const int s_iNumSongs = 300;
+static const int s_iNumQueries = 2000;
+
+/// \brief Few distinct pieces, so that strings repeat, share prefixes and exercise wildcards and case folding.
+static const char* s_szTextPieces[] = {"a", "A", "b", "B", "ab", " ", "%", "_", "'", "\xc3\xa9", "\xc3\x89", "x_y"};
+
+static const int s_iNumTextPieces = sizeof(s_szTextPieces) / sizeof(s_szTextPieces[0]);
+
+static int RandomInt(std::mt19937& rng, int iMin, int iMax)
+{
+  return std::uniform_int_distribution<int>(iMin, iMax)(rng);
+}
+
+static QString RandomText(std::mt19937& rng)
+{
+  const int iNumPieces = RandomInt(rng, 0, 3);
+  QString sText("");
+
+  for (int i = 0; i < iNumPieces; ++i)
+  {
+    sText += QString::fromUtf8(s_szTextPieces[RandomInt(rng, 0, s_iNumTextPieces - 1)]);
+  }
+
+  return sText;
+}
+
+static QString RandomNullableText(std::mt19937& rng)
+{
+  if (RandomInt(rng, 0, 9) == 0)
+    return QString();
+
+  return RandomText(rng);
+}
+
+static SongInfo RandomSong(std::mt19937& rng, int index)
+{
+  SongInfo si;
+  si.m_sSongGuid = QString("song%1").arg(index);
+  si.m_sTitle = RandomNullableText(rng);
+  si.m_sArtist = RandomNullableText(rng);
+  si.m_sAlbum = RandomNullableText(rng);
+  si.m_iDiscNumber = RandomInt(rng, 0, 2);
+  si.m_iTrackNumber = RandomInt(rng, 0, 12);
+  si.m_iYear = RandomInt(rng, 0, 3) == 0 ? 0 : RandomInt(rng, 1995, 2000);
+  si.m_iLengthInMS = RandomInt(rng, 0, 10) * 30000;
+  si.m_iRating = RandomInt(rng, 0, 5);
+  si.m_iLastPlayed = RandomInt(rng, 0, 2) == 0 ? -1 : RandomInt(rng, 1000, 1010);
+  si.m_iDateAdded = RandomInt(rng, 0, 4) == 0 ? -1 : RandomInt(rng, 1000, 1010);
+  si.m_iPlayCount = RandomInt(rng, 0, 4);
+  return si;
+}
+
+static QString RandomValue(std::mt19937& rng, SmartPlaylistQuery::Criterium crit)
+{
+  switch (crit)
+  {
+  case SmartPlaylistQuery::Criterium::Artist:
+  case SmartPlaylistQuery::Criterium::Album:
+  case SmartPlaylistQuery::Criterium::Title:
+    return RandomText(rng);
+
+  default:
+    break;
+  }
+
+  switch (RandomInt(rng, 0, 9))
+  {
+  case 0:
+    return QString("%1.5").arg(RandomInt(rng, -1, 5));
+  case 1:
+    return QString(" %1 ").arg(RandomInt(rng, -1, 5));
+  case 2:
+    return QString("abc"); // not a number, has to go through the database
+  case 3:
+    return QString("%1").arg(RandomInt(rng, 1000, 1010));
+  case 4:
+    return QString("%1").arg(RandomInt(rng, 1995, 2000));
+  case 5:
+    return QString("%1").arg(RandomInt(rng, 0, 10) * 30000);
+  default:
+    return QString("%1").arg(RandomInt(rng, -1, 12));
+  }
+}
+
+static void RandomGroup(std::mt19937& rng, SmartPlaylistQuery::ConditionGroup& group, int iDepth)
+{
+  group.m_Fulfil = RandomInt(rng, 0, 1) == 0 ? SmartPlaylistQuery::Fulfil::All : SmartPlaylistQuery::Fulfil::Any;
+
+  const int iNumSubGroups = iDepth < 2 ? RandomInt(rng, 0, 2) : 0;
+  for (int i = 0; i < iNumSubGroups; ++i)
+  {
+    group.m_SubGroups.emplace_back();
+    RandomGroup(rng, group.m_SubGroups.back(), iDepth + 1);
+  }
+
+  const int iNumStatements = RandomInt(rng, 0, 3);
+  for (int i = 0; i < iNumStatements; ++i)
+  {
+    SmartPlaylistQuery::Statement stmt;
+    stmt.m_Criterium = (SmartPlaylistQuery::Criterium)RandomInt(rng, 0, (int)SmartPlaylistQuery::Criterium::ENUM_COUNT - 1);
+
+    std::vector<SmartPlaylistQuery::Comparison> allowed;
+    SmartPlaylistQuery::GetAllowedComparisons(stmt.m_Criterium, allowed);
+    stmt.m_Compare = allowed[RandomInt(rng, 0, (int)allowed.size() - 1)];
+    stmt.m_Value = RandomValue(rng, stmt.m_Criterium);
+
+    group.m_Statements.push_back(stmt);
+  }
+}
+
+static bool Execute(sqlite3* pDatabase, const QString& sql)
+{
+  char* szError = nullptr;
+
+  if (sqlite3_exec(pDatabase, sql.toUtf8().data(), nullptr, nullptr, &szError) != SQLITE_OK)
+  {
+    printf("SQL error: %s\n  in: %s\n", szError, sql.toUtf8().data());
+    sqlite3_free(szError);
+    return false;
+  }
+
+  return true;
+}
+
+static void BindNullableText(sqlite3_stmt* pStatement, int iParam, const QString& sText)
+{
+  if (sText.isNull())
+    sqlite3_bind_null(pStatement, iParam);
+  else
+    sqlite3_bind_text(pStatement, iParam, sText.toUtf8().data(), -1, SQLITE_TRANSIENT);
+}
+
+static void BindNullableInt(sqlite3_stmt* pStatement, int iParam, int value)
+{
+  if (value == -1)
+    sqlite3_bind_null(pStatement, iParam);
+  else
+    sqlite3_bind_int(pStatement, iParam, value);
+}
+
+/// \brief Creates the music table like MusicLibrary does and fills it with the same songs as the SongStore.
+static bool FillDatabase(sqlite3* pDatabase, const std::vector<SongInfo>& songs)
+{
+  if (!Execute(pDatabase, "CREATE TABLE music "
+                          "(searchkey INTEGER PRIMARY KEY"
+                          ", id TEXT NOT NULL UNIQUE"
+                          ", title TEXT"
+                          ", artist TEXT"
+                          ", album TEXT"
+                          ", disc INTEGER DEFAULT 0"
+                          ", track INTEGER DEFAULT 0"
+                          ", year INTEGER DEFAULT 0"
+                          ", length INTEGER DEFAULT 0"
+                          ", rating INTEGER DEFAULT 0"
+                          ", volume INTEGER DEFAULT 0"
+                          ", start INTEGER DEFAULT 0"
+                          ", end INTEGER DEFAULT 0"
+                          ", lastplayed INTEGER DEFAULT NULL"
+                          ", dateadded INTEGER DEFAULT (strftime('%s','now'))"
+                          ", playcount INTEGER DEFAULT 0)"))
+  {
+    return false;
+  }
+
+  sqlite3_stmt* pStatement = nullptr;
+  const char* sql = "INSERT INTO music (id, title, artist, album, disc, track, year, length, rating, lastplayed, dateadded, playcount) "
+                    "VALUES(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12)";
+
+  if (sqlite3_prepare_v2(pDatabase, sql, -1, &pStatement, nullptr) != SQLITE_OK)
+    return false;
+
+  for (const SongInfo& si : songs)
+  {
+    sqlite3_reset(pStatement);
+    sqlite3_bind_text(pStatement, 1, si.m_sSongGuid.toUtf8().data(), -1, SQLITE_TRANSIENT);
+    BindNullableText(pStatement, 2, si.m_sTitle);
+    BindNullableText(pStatement, 3, si.m_sArtist);
+    BindNullableText(pStatement, 4, si.m_sAlbum);
+    sqlite3_bind_int(pStatement, 5, si.m_iDiscNumber);
+    sqlite3_bind_int(pStatement, 6, si.m_iTrackNumber);
+    sqlite3_bind_int(pStatement, 7, si.m_iYear);
+    sqlite3_bind_int(pStatement, 8, si.m_iLengthInMS);
+    sqlite3_bind_int(pStatement, 9, si.m_iRating);
+    BindNullableInt(pStatement, 10, si.m_iLastPlayed);
+    BindNullableInt(pStatement, 11, si.m_iDateAdded);
+    sqlite3_bind_int(pStatement, 12, si.m_iPlayCount);
+
+    if (sqlite3_step(pStatement) != SQLITE_DONE)
+    {
+      sqlite3_finalize(pStatement);
+      return false;
+    }
+  }
+
+  sqlite3_finalize(pStatement);
+  return true;
+}
+
+/// \brief Runs a query that returns the song GUID in the first column and optionally a sort key in the second.
+static bool SelectSongs(sqlite3* pDatabase, const QString& sql, QStringList& out_Guids, QStringList* out_pKeys = nullptr)
+{
+  sqlite3_stmt* pStatement = nullptr;
+
+  if (sqlite3_prepare_v2(pDatabase, sql.toUtf8().data(), -1, &pStatement, nullptr) != SQLITE_OK)
+  {
+    printf("SQL error: %s\n  in: %s\n", sqlite3_errmsg(pDatabase), sql.toUtf8().data());
+    return false;
+  }
+
+  while (sqlite3_step(pStatement) == SQLITE_ROW)
+  {
+    out_Guids.append(QString::fromUtf8(reinterpret_cast<const char*>(sqlite3_column_text(pStatement, 0))));
+
+    if (out_pKeys)
+      out_pKeys->append(QString::fromUtf8(reinterpret_cast<const char*>(sqlite3_column_text(pStatement, 1))));
+  }
+
+  sqlite3_finalize(pStatement);
+  return true;
+}
+
+/// \brief Turns an ORDER BY clause into an expression that concatenates the sorted columns, so that ties can be recognized.
+static QString GetSortKeyExpression(const QString& sOrderBy)
+{
+  QStringList columns = sOrderBy.split(", ");
+
+  for (QString& column : columns)
+  {
+    column = column.section(' ', 0, 0);
+    column = QString("quote(%1)").arg(column);
+  }
+
+  return columns.join(" || '|' || ");
+}
+
+static bool CheckQuery(sqlite3* pDatabase, const SongStore& store, const SmartPlaylistQuery& query, int iQuery)
+{
+  SmartPlaylistProgram program;
+  if (!program.Compile(query))
+    return true; // goes through the database in the app, nothing to compare
+
+  std::vector<int> rows;
+  program.Evaluate(store, rows);
+
+  QStringList memResult;
+  for (int row : rows)
+  {
+    memResult.append(store.GetGuid(row));
+  }
+
+  const QString sWhere = query.GenerateSQL();
+  const QString sOrderBy = query.GenerateOrderBySQL();
+
+  QString sql = "SELECT id FROM music";
+
+  if (!sWhere.isEmpty())
+    sql += QString(" WHERE %1").arg(sWhere);
+
+  QStringList sqlResult;
+  if (!SelectSongs(pDatabase, sql, sqlResult))
+    return false;
+
+  QStringList memSorted = memResult;
+  QStringList sqlSorted = sqlResult;
+  std::sort(memSorted.begin(), memSorted.end());
+  std::sort(sqlSorted.begin(), sqlSorted.end());
+
+  bool bOk = (memSorted == sqlSorted);
+
+  if (bOk && !sOrderBy.isEmpty())
+  {
+    // songs that are equal in the sort order may come out in a different order, so only the sequence of sort keys has to match
+    QStringList allGuids;
+    QStringList allKeys;
+    if (!SelectSongs(pDatabase, QString("SELECT id, %1 FROM music").arg(GetSortKeyExpression(sOrderBy)), allGuids, &allKeys))
+      return false;
+
+    QHash<QString, QString> guidToKey;
+    for (int i = 0; i < allGuids.size(); ++i)
+    {
+      guidToKey.insert(allGuids[i], allKeys[i]);
+    }
+
+    QStringList sqlOrdered;
+    if (!SelectSongs(pDatabase, sql + " ORDER BY " + sOrderBy, sqlOrdered))
+      return false;
+
+    for (int i = 0; i < sqlOrdered.size() && bOk; ++i)
+    {
+      bOk = (guidToKey[sqlOrdered[i]] == guidToKey[memResult[i]]);
+    }
+  }
+
+  if (!bOk)
+  {
+    printf("Query %i differs: in-memory found %i songs, database found %i.\n", iQuery, (int)memResult.size(), (int)sqlResult.size());
+    printf("  WHERE %s\n", sWhere.toUtf8().data());
+    printf("  ORDER BY %s\n", sOrderBy.toUtf8().data());
+  }
+
+  return bOk;
+}
+
+int main(int argc, char** argv)
+{
+  const unsigned int uiSeed = argc > 1 ? (unsigned int)strtoul(argv[1], nullptr, 10) : 1;
+  std::mt19937 rng(uiSeed);
+
+  std::vector<SongInfo> songs;
+  SongStore store;
+
+  for (int i = 0; i < s_iNumSongs; ++i)
+  {
+    songs.push_back(RandomSong(rng, i));
+    store.SetSong(songs.back());
+  }
+
+  sqlite3* pDatabase = nullptr;
+  if (sqlite3_open(":memory:", &pDatabase) != SQLITE_OK || !FillDatabase(pDatabase, songs))
+  {
+    printf("Could not set up the database.\n");
+    return 1;
+  }
+
+  int iNumFailed = 0;
+
+  for (int i = 0; i < s_iNumQueries; ++i)
+  {
+    SmartPlaylistQuery query;
+    RandomGroup(rng, query.m_MainGroup, 0);
+    query.m_SortOrder = (SmartPlaylistQuery::SortOrder)RandomInt(rng, 0, (int)SmartPlaylistQuery::SortOrder::ENUM_COUNT - 1);
+
+    if (!CheckQuery(pDatabase, store, query, i))
+      ++iNumFailed;
+  }
+
+  sqlite3_close(pDatabase);
+
+  printf("Seed %u: %i of %i queries differ.\n", uiSeed, iNumFailed, s_iNumQueries);
+  return iNumFailed == 0 ? 0 : 1;
+}
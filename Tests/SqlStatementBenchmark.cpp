@@ -0,0 +1,210 @@
+#include "MusicLibrary/SqlStatementCache.h"
+#include "Tests/BenchmarkUtils.h"
+#include <QStringList>
+
+// Compares the way MusicLibrary used to run its queries, formatting the values into the SQL text and running it through sqlite3_exec,
+// which parses and plans the statement on every call, with the prepared statements of SqlStatementCache and bound parameters.
+
+static const int s_iNumSongs = 20000;
+static const int s_iNumRepetitions = 3;
+
+/// \brief The songs are accessed in a scattered order, like the UI and the import do, not in the order of the table.
+static int GetSongIndex(int i)
+{
+  return (int)(((qint64)i * 7919) % s_iNumSongs);
+}
+
+static void SqlExec(sqlite3* pDatabase, const QString& stmt, int (*callback)(void*, int, char**, char**), void* userData)
+{
+  char* szErrMsg = nullptr;
+
+  const int ret = sqlite3_exec(pDatabase, stmt.toUtf8().data(), callback, userData, &szErrMsg);
+
+  // a callback returns non-zero to stop after the first row
+  if (ret != SQLITE_OK && ret != SQLITE_ABORT)
+  {
+    printf("SQL error: %s\n", szErrMsg);
+    sqlite3_free(szErrMsg);
+  }
+}
+
+static int RetrieveRow(void* result, int numColumns, char** values, char** columnNames)
+{
+  QStringList* pRow = (QStringList*)result;
+
+  for (int i = 0; i < numColumns; ++i)
+  {
+    pRow->push_back(QString::fromUtf8(values[i] != nullptr ? values[i] : ""));
+  }
+
+  return 0;
+}
+
+static int RetrieveExists(void* result, int numColumns, char** values, char** columnNames)
+{
+  *(bool*)result = true;
+  return 1;
+}
+
+int main(int argc, char** argv)
+{
+  sqlite3* pDatabase = nullptr;
+  if (sqlite3_open(":memory:", &pDatabase) != SQLITE_OK || !CreateBenchmarkLibrary(pDatabase, s_iNumSongs))
+  {
+    printf("Could not set up the database.\n");
+    return 1;
+  }
+
+  SqlStatementCache statements;
+  statements.Startup(pDatabase);
+
+  std::vector<QString> guids;
+  std::vector<QString> locations;
+
+  for (int i = 0; i < s_iNumSongs; ++i)
+  {
+    guids.push_back(GetBenchmarkSongGuid(GetSongIndex(i)));
+    locations.push_back(GetBenchmarkSongLocation(GetSongIndex(i)));
+  }
+
+  int iNumFound = 0;
+
+  printf("%i songs, best of %i runs:\n", s_iNumSongs, s_iNumRepetitions);
+
+  // FindSong
+  {
+    const double fOldMS = MeasureMS(s_iNumRepetitions, [&]() {
+      for (const QString& sGuid : guids)
+      {
+        QStringList row;
+        SqlExec(pDatabase, QString("SELECT " SQL_SONG_COLUMNS " FROM music WHERE id = '%1'").arg(sGuid), RetrieveRow, &row);
+        iNumFound += row.isEmpty() ? 0 : 1;
+      }
+    });
+
+    const double fNewMS = MeasureMS(s_iNumRepetitions, [&]() {
+      for (const QString& sGuid : guids)
+      {
+        SqlQuery query(statements, SqlStatement::FindSong);
+        query.Bind(1, sGuid);
+
+        if (query.Step())
+        {
+          QStringList row;
+          for (int column = 0; column < 4; ++column)
+            row.push_back(query.GetText(column));
+          for (int column = 4; column < 15; ++column)
+            row.push_back(QString::number(query.GetInt(column)));
+          row.push_back(query.GetText(15));
+          row.push_back(query.GetText(16));
+
+          iNumFound += 1;
+        }
+      }
+    });
+
+    ReportTiming("FindSong, formatted SQL", fOldMS, s_iNumSongs);
+    ReportTiming("FindSong, prepared statement", fNewMS, s_iNumSongs);
+    ReportSpeedup("FindSong speedup", fOldMS, fNewMS);
+  }
+
+  // GetSongLocations
+  {
+    const double fOldMS = MeasureMS(s_iNumRepetitions, [&]() {
+      for (const QString& sGuid : guids)
+      {
+        QStringList paths;
+        SqlExec(pDatabase, QString("SELECT path FROM locations WHERE id = '%1'").arg(sGuid), RetrieveRow, &paths);
+        iNumFound += paths.size();
+      }
+    });
+
+    const double fNewMS = MeasureMS(s_iNumRepetitions, [&]() {
+      for (const QString& sGuid : guids)
+      {
+        QStringList paths;
+        SqlQuery query(statements, SqlStatement::GetSongLocations);
+        query.Bind(1, sGuid);
+
+        while (query.Step())
+        {
+          paths.push_back(query.GetText(0));
+        }
+
+        iNumFound += paths.size();
+      }
+    });
+
+    ReportTiming("GetSongLocations, formatted SQL", fOldMS, s_iNumSongs);
+    ReportTiming("GetSongLocations, prepared statement", fNewMS, s_iNumSongs);
+    ReportSpeedup("GetSongLocations speedup", fOldMS, fNewMS);
+  }
+
+  // the modification check of every file during an import
+  {
+    const double fOldMS = MeasureMS(s_iNumRepetitions, [&]() {
+      for (const QString& sLocation : locations)
+      {
+        char tmp[256];
+        sqlite3_snprintf(255, tmp, "%q", sLocation.toUtf8().data());
+
+        bool bUnmodified = false;
+        SqlExec(pDatabase, QString("SELECT 1 FROM locations WHERE path = '%1' AND modified = '%2' LIMIT 1").arg(tmp).arg("2020-01-01-12-00-00"), RetrieveExists, &bUnmodified);
+        iNumFound += bUnmodified ? 1 : 0;
+      }
+    });
+
+    const double fNewMS = MeasureMS(s_iNumRepetitions, [&]() {
+      for (const QString& sLocation : locations)
+      {
+        SqlQuery query(statements, SqlStatement::IsLocationModified);
+        query.Bind(1, sLocation);
+        query.Bind(2, QString("2020-01-01-12-00-00"));
+        iNumFound += query.Step() ? 1 : 0;
+      }
+    });
+
+    ReportTiming("IsLocationModified, formatted SQL", fOldMS, s_iNumSongs);
+    ReportTiming("IsLocationModified, prepared statement", fNewMS, s_iNumSongs);
+    ReportSpeedup("IsLocationModified speedup", fOldMS, fNewMS);
+  }
+
+  // updates, all within one transaction, so that only the statement overhead is measured
+  {
+    const double fOldMS = MeasureMS(s_iNumRepetitions, [&]() {
+      SqlExec(pDatabase, "BEGIN IMMEDIATE TRANSACTION", nullptr, nullptr);
+
+      for (int i = 0; i < s_iNumSongs; ++i)
+      {
+        SqlExec(pDatabase, QString("UPDATE music SET rating = %2 WHERE id = '%1'").arg(guids[i]).arg(i % 6), nullptr, nullptr);
+      }
+
+      SqlExec(pDatabase, "END TRANSACTION", nullptr, nullptr);
+    });
+
+    const double fNewMS = MeasureMS(s_iNumRepetitions, [&]() {
+      SqlQuery(statements, SqlStatement::BeginTransaction).Execute();
+
+      for (int i = 0; i < s_iNumSongs; ++i)
+      {
+        SqlQuery query(statements, SqlStatement::UpdateSongRating);
+        query.Bind(1, guids[i]);
+        query.Bind(2, i % 6);
+        query.Execute();
+      }
+
+      SqlQuery(statements, SqlStatement::EndTransaction).Execute();
+    });
+
+    ReportTiming("UpdateSongRating, formatted SQL", fOldMS, s_iNumSongs);
+    ReportTiming("UpdateSongRating, prepared statement", fNewMS, s_iNumSongs);
+    ReportSpeedup("UpdateSongRating speedup", fOldMS, fNewMS);
+  }
+
+  statements.Shutdown();
+  sqlite3_close(pDatabase);
+
+  // keeps the compiler from dropping the lookups
+  printf("(%i rows found)\n", iNumFound);
+  return 0;
+}
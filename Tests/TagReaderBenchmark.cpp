@@ -0,0 +1,238 @@
+#include "Misc/TagReader.h"
+#include "Tests/BenchmarkUtils.h"
+#include <QDirIterator>
+#include <QFile>
+#include <QTemporaryDir>
+#include <vector>
+
+// Compares reading the tags and durations of MP3 and MP4 files with ReadFileTagsNative() and with TagLib.
+//
+// Pass a folder on the command line to read the files of a real library, otherwise a temporary folder
+// with generated files is used: MP3s with an ID3v2.3 tag, including a cover image, and iTunes style M4As.
+
+static const int s_iNumFilesPerFormat = 250;
+static const int s_iNumRepetitions = 3;
+
+static void AppendBE16(QByteArray& data, quint32 value)
+{
+  data.append((char)(value >> 8));
+  data.append((char)value);
+}
+
+static void AppendBE32(QByteArray& data, quint32 value)
+{
+  AppendBE16(data, value >> 16);
+  AppendBE16(data, value & 0xFFFF);
+}
+
+static QByteArray MakeId3v2Frame(const char* szId, const QByteArray& content)
+{
+  QByteArray frame(szId);
+  AppendBE32(frame, (quint32)content.size());
+  AppendBE16(frame, 0);
+  frame.append(content);
+  return frame;
+}
+
+static QByteArray MakeId3v2TextFrame(const char* szId, const QString& sText)
+{
+  // encoding 3 is UTF-8, officially only allowed in ID3v2.4, but widely used and read
+  return MakeId3v2Frame(szId, QByteArray(1, (char)3) + sText.toUtf8());
+}
+
+static QByteArray MakeMp4Box(const char* szType, const QByteArray& content)
+{
+  QByteArray box;
+  AppendBE32(box, (quint32)content.size() + 8);
+  box.append(szType, 4);
+  box.append(content);
+  return box;
+}
+
+static QByteArray MakeMp4Item(const char* szItem, quint32 type, const QByteArray& value)
+{
+  QByteArray data;
+  AppendBE32(data, type);
+  AppendBE32(data, 0); // locale
+  data.append(value);
+  return MakeMp4Box(szItem, MakeMp4Box("data", data));
+}
+
+static bool WriteFile(const QString& sFile, const QByteArray& data)
+{
+  QFile file(sFile);
+  return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+static bool WriteMp3(const QString& sFile, int iSong)
+{
+  QByteArray frames;
+  frames.append(MakeId3v2TextFrame("TIT2", GetBenchmarkText(iSong, 3)));
+  frames.append(MakeId3v2TextFrame("TPE1", GetBenchmarkText(iSong / 12, 2)));
+  frames.append(MakeId3v2TextFrame("TALB", GetBenchmarkText(iSong / 12 + 1000, 2)));
+  frames.append(MakeId3v2TextFrame("TRCK", QString("%1/12").arg(iSong % 12 + 1)));
+  frames.append(MakeId3v2TextFrame("TYER", QString::number(1970 + iSong % 50)));
+  // a cover image, the native reader skips it, TagLib reads it
+  frames.append(MakeId3v2Frame("APIC", QByteArray("\0image/jpeg\0\3\0", 14) + QByteArray(32 * 1024, (char)0x55)));
+  frames.append(QByteArray(1024, 0)); // padding
+
+  // the tag size is a sync-safe integer, 7 bits per byte
+  const quint32 size = (quint32)frames.size();
+  QByteArray data("ID3\3\0\0", 6);
+  data.append((char)((size >> 21) & 0x7F));
+  data.append((char)((size >> 14) & 0x7F));
+  data.append((char)((size >> 7) & 0x7F));
+  data.append((char)(size & 0x7F));
+  data.append(frames);
+
+  // 5 seconds of constant bit rate MPEG 1 layer III frames, 128 kbit/s at 44.1 kHz, 417 bytes each
+  QByteArray mpegFrame("\xFF\xFB\x90\x44", 4);
+  mpegFrame.append(QByteArray(417 - 4, 0));
+
+  for (int i = 0; i < 190; ++i)
+  {
+    data.append(mpegFrame);
+  }
+
+  return WriteFile(sFile, data);
+}
+
+static bool WriteMp4(const QString& sFile, int iSong)
+{
+  QByteArray ftyp("M4A ", 4);
+  AppendBE32(ftyp, 0);
+  ftyp.append("M4A isom", 8);
+
+  // version 0: flags, creation and modification time, time scale, duration, then rate, volume, matrix etc.
+  QByteArray mvhd;
+  AppendBE32(mvhd, 0);
+  AppendBE32(mvhd, 0);
+  AppendBE32(mvhd, 0);
+  AppendBE32(mvhd, 44100);
+  AppendBE32(mvhd, 44100 * (180 + iSong % 120));
+  mvhd.append(QByteArray(80, 0));
+
+  QByteArray hdlr;
+  AppendBE32(hdlr, 0);
+  AppendBE32(hdlr, 0);
+  hdlr.append("mdirappl", 8);
+  hdlr.append(QByteArray(9, 0));
+
+  QByteArray trkn;
+  AppendBE16(trkn, 0);
+  AppendBE16(trkn, iSong % 12 + 1);
+  AppendBE16(trkn, 12);
+  AppendBE16(trkn, 0);
+
+  QByteArray ilst;
+  ilst.append(MakeMp4Item("\251nam", 1, GetBenchmarkText(iSong, 3).toUtf8()));
+  ilst.append(MakeMp4Item("\251ART", 1, GetBenchmarkText(iSong / 12, 2).toUtf8()));
+  ilst.append(MakeMp4Item("\251alb", 1, GetBenchmarkText(iSong / 12 + 1000, 2).toUtf8()));
+  ilst.append(MakeMp4Item("\251day", 1, QString::number(1970 + iSong % 50).toUtf8()));
+  ilst.append(MakeMp4Item("trkn", 0, trkn));
+  ilst.append(MakeMp4Item("covr", 13, QByteArray(32 * 1024, (char)0x55)));
+
+  QByteArray meta;
+  AppendBE32(meta, 0);
+  meta.append(MakeMp4Box("hdlr", hdlr));
+  meta.append(MakeMp4Box("ilst", ilst));
+
+  const QByteArray moov = MakeMp4Box("mvhd", mvhd) + MakeMp4Box("udta", MakeMp4Box("meta", meta));
+
+  const QByteArray data = MakeMp4Box("ftyp", ftyp) + MakeMp4Box("moov", moov) + MakeMp4Box("mdat", QByteArray(64 * 1024, 0));
+  return WriteFile(sFile, data);
+}
+
+static bool IsSameTags(const FileTags& lhs, const FileTags& rhs)
+{
+  return lhs.m_sTitle == rhs.m_sTitle && lhs.m_sArtist == rhs.m_sArtist && lhs.m_sAlbum == rhs.m_sAlbum && lhs.m_iTrackNumber == rhs.m_iTrackNumber && lhs.m_iYear == rhs.m_iYear;
+}
+
+int main(int argc, char** argv)
+{
+  QTemporaryDir tempDir;
+  std::vector<QString> files;
+
+  if (argc > 1)
+  {
+    QDirIterator dirIt(QString::fromLocal8Bit(argv[1]), QDir::Files, QDirIterator::Subdirectories);
+
+    while (dirIt.hasNext())
+    {
+      const QString sFile = dirIt.next();
+
+      if (sFile.endsWith(".mp3", Qt::CaseInsensitive) || sFile.endsWith(".mp4", Qt::CaseInsensitive) || sFile.endsWith(".m4a", Qt::CaseInsensitive))
+        files.push_back(sFile);
+    }
+  }
+  else
+  {
+    if (!tempDir.isValid())
+      return 1;
+
+    for (int i = 0; i < s_iNumFilesPerFormat; ++i)
+    {
+      files.push_back(QString("%1/%2.mp3").arg(tempDir.path()).arg(i));
+      files.push_back(QString("%1/%2.m4a").arg(tempDir.path()).arg(i));
+
+      if (!WriteMp3(files[files.size() - 2], i) || !WriteMp4(files.back(), i))
+      {
+        printf("Could not write the music files.\n");
+        return 1;
+      }
+    }
+  }
+
+  // files that the native reader doesn't support are read with TagLib by SongInfo::ReadSongInfo()
+  int iNumNative = 0;
+  int iNumDifferent = 0;
+
+  for (const QString& sFile : files)
+  {
+    FileTags native;
+    FileTags tagLib;
+
+    if (!ReadFileTagsNative(sFile, QByteArray(), native))
+      continue;
+
+    ++iNumNative;
+
+    if (ReadFileTagsTagLib(sFile, tagLib) && !IsSameTags(native, tagLib))
+    {
+      if (iNumDifferent++ < 10)
+      {
+        printf("Different tags in '%s':\n", sFile.toUtf8().data());
+        printf("  native: '%s' / '%s' / '%s', track %i, %i\n", native.m_sTitle.toUtf8().data(), native.m_sArtist.toUtf8().data(), native.m_sAlbum.toUtf8().data(), native.m_iTrackNumber, native.m_iYear);
+        printf("  TagLib: '%s' / '%s' / '%s', track %i, %i\n", tagLib.m_sTitle.toUtf8().data(), tagLib.m_sArtist.toUtf8().data(), tagLib.m_sAlbum.toUtf8().data(), tagLib.m_iTrackNumber, tagLib.m_iYear);
+      }
+    }
+  }
+
+  printf("%i files, %i supported by the native reader, %i with different tags, best of %i runs:\n", (int)files.size(), iNumNative, iNumDifferent, s_iNumRepetitions);
+
+  // both read the files from the file system cache, after the pass above
+  int iNumRead = 0;
+
+  const double fTagLibMS = MeasureMS(s_iNumRepetitions, [&]() {
+    for (const QString& sFile : files)
+    {
+      FileTags tags;
+      iNumRead += ReadFileTagsTagLib(sFile, tags) ? 1 : 0;
+    }
+  });
+
+  const double fNativeMS = MeasureMS(s_iNumRepetitions, [&]() {
+    for (const QString& sFile : files)
+    {
+      FileTags tags;
+      iNumRead += ReadFileTagsNative(sFile, QByteArray(), tags) ? 1 : 0;
+    }
+  });
+
+  ReportTiming("TagLib", fTagLibMS, (int)files.size());
+  ReportTiming("native reader", fNativeMS, (int)files.size());
+  ReportSpeedup("speedup", fTagLibMS, fNativeMS);
+
+  printf("(%i files read)\n", iNumRead);
+  return 0;
+}